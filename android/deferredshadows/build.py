@@ -27,6 +27,10 @@ if subprocess.call("ndk-build", shell=True) == 0:
         os.makedirs("./assets/shaders/%s" % SHADER_DIR)
     for file in glob.glob("../../data/shaders/%s/*.spv" %SHADER_DIR):
         shutil.copy(file, "./assets/shaders/%s" % SHADER_DIR)    
+    # Clustered shading pass shared with the deferred example
+    if not os.path.exists("./assets/shaders/deferred"):
+        os.makedirs("./assets/shaders/deferred")
+    shutil.copy("../../data/shaders/deferred/deferred.frag.spv", "./assets/shaders/deferred")
     # Textures and model
     if not os.path.exists("./assets/models/armor/"):
         os.makedirs("./assets/models/armor/")           
@@ -0,0 +1,793 @@
+/*
+* Clustered light culling
+*
+* Splits the view frustum into a 3D grid of clusters (screen tiles x exponential depth slices) and assigns every point light
+* to the clusters its sphere of influence overlaps. The shading pass only loops over the lights of the fragment's cluster.
+*
+* The grid can be built on the CPU (multithreaded on the job system, SIMD where available) or with a compute shader
+* Both builders write the same layout, so the consuming shaders don't need to know which one was used:
+*   clusters[clusterIndex] = (offset, count) into the light index list
+*   lightIndices[offset .. offset + count - 1] = indices into the light list
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <vector>
+#include <array>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "simd.hpp"
+#include "jobsystem.hpp"
+#include "VulkanTimestampQueries.hpp"
+#include "VulkanTextOverlay.hpp"
+
+namespace vks
+{
+	class ClusteredLights
+	{
+	public:
+		/** @brief Point light, matches the Light struct of the shaders (std430) */
+		struct Light {
+			glm::vec4 position;
+			glm::vec3 color;
+			// Range of the light, its contribution falls off to zero at this distance
+			float radius;
+		};
+
+		enum Builder { BUILDER_CPU = 0, BUILDER_GPU = 1 };
+
+		struct Statistics {
+			uint32_t lightCount = 0;
+			// Number of light indices written by the CPU builder (the GPU builder's results stay on the GPU)
+			uint32_t lightIndexCount = 0;
+			uint32_t maxLightsInCluster = 0;
+			// Clusters that had more lights than maxLightsPerCluster (the additional lights are dropped)
+			uint32_t overflowingClusters = 0;
+			// CPU time of the last update (in ms)
+			double updateTime = 0.0;
+		};
+
+		/** @brief Lights to assign, can be changed between updates (up to the maximum light count) */
+		std::vector<Light> lights;
+
+		// Ambient and specular factors passed to the shading pass
+		float ambient = 0.0f;
+		float specular = 1.0f;
+
+		/** @brief Layout of the descriptor set with the cluster data (binding 0: parameters, 1: lights, 2: clusters, 3: light indices, 4: cluster bounds) */
+		VkDescriptorSetLayout descriptorSetLayout;
+		VkDescriptorSet descriptorSet;
+
+		/**
+		* Create the grid and its buffers
+		*
+		* @param device Vulkan device
+		* @param maxLights Maximum number of lights
+		* @param jobSystem Job system the CPU builder runs on
+		* @param tilesX Number of screen tiles in x direction
+		* @param tilesY Number of screen tiles in y direction
+		* @param slices Number of depth slices
+		* @param maxLightsPerCluster Maximum number of lights assigned to a single cluster
+		*/
+		ClusteredLights(vks::VulkanDevice *device, uint32_t maxLights, vks::JobSystem *jobSystem, uint32_t tilesX = 16, uint32_t tilesY = 8, uint32_t slices = 24, uint32_t maxLightsPerCluster = 128)
+		{
+			this->device = device;
+			this->maxLights = maxLights;
+			this->jobSystem = jobSystem;
+			this->tilesX = tilesX;
+			this->tilesY = tilesY;
+			this->slices = slices;
+			this->maxLightsPerCluster = maxLightsPerCluster;
+			clusterCount = tilesX * tilesY * slices;
+
+			// All buffers are host visible, the CPU builder writes them directly
+			const VkMemoryPropertyFlags memoryFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, memoryFlags, &buffers.params, sizeof(Params)));
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, memoryFlags, &buffers.lights, maxLights * sizeof(Light)));
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, memoryFlags, &buffers.clusters, clusterCount * sizeof(uint32_t) * 2));
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, memoryFlags, &buffers.lightIndices, clusterCount * maxLightsPerCluster * sizeof(uint32_t)));
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, memoryFlags, &buffers.clusterBounds, clusterCount * sizeof(glm::vec4) * 2));
+			VK_CHECK_RESULT(buffers.params.map());
+			VK_CHECK_RESULT(buffers.lights.map());
+			VK_CHECK_RESULT(buffers.clusters.map());
+			VK_CHECK_RESULT(buffers.lightIndices.map());
+			VK_CHECK_RESULT(buffers.clusterBounds.map());
+			memset(buffers.clusters.mapped, 0, buffers.clusters.size);
+
+			clusterLightCounts.resize(clusterCount);
+			clusterLights.resize(clusterCount * maxLightsPerCluster);
+			columnBounds.resize(slices * tilesX);
+			rowBounds.resize(slices * tilesY);
+			sliceBounds.resize(slices);
+
+			setupDescriptors();
+		}
+
+		~ClusteredLights()
+		{
+			buffers.params.destroy();
+			buffers.lights.destroy();
+			buffers.clusters.destroy();
+			buffers.lightIndices.destroy();
+			buffers.clusterBounds.destroy();
+			if (compute.pipeline != VK_NULL_HANDLE)
+			{
+				vkDestroyPipeline(device->logicalDevice, compute.pipeline, nullptr);
+				vkDestroyPipelineLayout(device->logicalDevice, compute.pipelineLayout, nullptr);
+			}
+			vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayout, nullptr);
+			vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
+		}
+
+		/**
+		* Create the compute pipeline of the GPU builder
+		*
+		* @param shaderStage Stage of the cluster assignment compute shader (shaders/base/clusteredlights.comp.spv)
+		*/
+		void prepareCompute(const VkPipelineShaderStageCreateInfo &shaderStage, VkPipelineCache pipelineCache)
+		{
+			VkPipelineLayoutCreateInfo pipelineLayoutInfo = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
+			VK_CHECK_RESULT(vkCreatePipelineLayout(device->logicalDevice, &pipelineLayoutInfo, nullptr, &compute.pipelineLayout));
+			VkComputePipelineCreateInfo pipelineInfo = vks::initializers::computePipelineCreateInfo(compute.pipelineLayout, 0);
+			pipelineInfo.stage = shaderStage;
+			VK_CHECK_RESULT(vkCreateComputePipelines(device->logicalDevice, pipelineCache, 1, &pipelineInfo, nullptr, &compute.pipeline));
+		}
+
+		/**
+		* Update the lights and the grid for the current view, with the CPU builder the lights are also assigned to the clusters
+		* The buffers are written directly, so the GPU must not be using them anymore (e.g. the previous frame has finished)
+		*
+		* @param view Matrix that transforms the light positions (and the G-Buffer positions) into view space
+		* @param projection Perspective projection matrix
+		* @param zNear Near plane distance
+		* @param zFar Far plane distance
+		* @param width Width of the render target in pixels
+		* @param height Height of the render target in pixels
+		* @param viewPos Viewer position passed to the shading pass (in the same space as the lights)
+		* @param builder Builder that assigns the lights to the clusters, with BUILDER_GPU cmdBuild must be recorded before shading
+		*/
+		void update(const glm::mat4 &view, const glm::mat4 &projection, float zNear, float zFar, uint32_t width, uint32_t height, const glm::vec4 &viewPos, Builder builder)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+
+			assert(lights.size() <= maxLights);
+			const uint32_t lightCount = std::min(static_cast<uint32_t>(lights.size()), maxLights);
+			memcpy(buffers.lights.mapped, lights.data(), lightCount * sizeof(Light));
+
+			// The cluster bounds only change with the projection and the render target size
+			if (projection != gridProjection || zNear != gridNear || zFar != gridFar || width != gridWidth || height != gridHeight)
+			{
+				updateClusterBounds(projection, zNear, zFar, width, height);
+			}
+
+			Params *params = reinterpret_cast<Params*>(buffers.params.mapped);
+			params->view = view;
+			params->viewPos = viewPos;
+			params->tileSize = glm::vec4(tileWidth, tileHeight, sliceScale, sliceBias);
+			params->grid = glm::uvec4(tilesX, tilesY, slices, lightCount);
+			params->shading = glm::vec4(ambient, specular, 0.0f, 0.0f);
+			params->limits = glm::uvec4(maxLightsPerCluster, clusterCount, 0, 0);
+
+			statistics = Statistics();
+			statistics.lightCount = lightCount;
+			if (builder == BUILDER_CPU)
+			{
+				buildClusters(view, lightCount);
+			}
+
+			statistics.updateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		}
+
+		/**
+		* Record the GPU builder, must be recorded outside of a render pass before the shading pass
+		* The shading pass has to bind the cluster descriptor set after this
+		*/
+		void cmdBuild(VkCommandBuffer commandBuffer)
+		{
+			assert(compute.pipeline != VK_NULL_HANDLE);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+			vkCmdDispatch(commandBuffer, (clusterCount + 63) / 64, 1, 1);
+
+			// Make the cluster lists visible to the shading pass
+			std::array<VkBufferMemoryBarrier, 2> barriers;
+			barriers[0] = vks::initializers::bufferMemoryBarrier();
+			barriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			barriers[0].buffer = buffers.clusters.buffer;
+			barriers[0].size = VK_WHOLE_SIZE;
+			barriers[1] = barriers[0];
+			barriers[1].buffer = buffers.lightIndices.buffer;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+		}
+
+		/** @brief Returns the light assignment statistics of the last update */
+		/** @brief Returns the name of a builder for display ("CPU" or "GPU") */
+		static const char *getBuilderName(Builder builder)
+		{
+			return (builder == BUILDER_GPU) ? "GPU" : "CPU";
+		}
+
+		const Statistics &getStatistics() const
+		{
+			return statistics;
+		}
+
+		uint32_t getMaxLights() const
+		{
+			return maxLights;
+		}
+
+		/**
+		* Fill the light list with randomly placed lights
+		*
+		* @param count Number of lights
+		* @param min Minimum corner of the box the lights are placed in
+		* @param max Maximum corner of the box the lights are placed in
+		* @param minRadius Minimum light range
+		* @param maxRadius Maximum light range
+		* @param seed Seed of the random generator, the same seed always results in the same lights
+		*/
+		void generateRandomLights(uint32_t count, glm::vec3 min, glm::vec3 max, float minRadius, float maxRadius, uint32_t seed = 0)
+		{
+			std::mt19937 rndGen(seed);
+			std::uniform_real_distribution<float> rndDist(0.0f, 1.0f);
+			lights.resize(std::min(count, maxLights));
+			for (auto &light : lights)
+			{
+				light.position = glm::vec4(glm::mix(min, max, glm::vec3(rndDist(rndGen), rndDist(rndGen), rndDist(rndGen))), 1.0f);
+				// Saturated colors, so overlapping lights don't just add up to white
+				glm::vec3 color = glm::vec3(rndDist(rndGen), rndDist(rndGen), rndDist(rndGen));
+				light.color = color / std::max(color.r, std::max(color.g, color.b));
+				light.radius = minRadius + (maxRadius - minRadius) * rndDist(rndGen);
+			}
+		}
+
+	private:
+		// Uniform block shared by the shading pass and the GPU builder (std140)
+		struct Params {
+			glm::mat4 view;
+			glm::vec4 viewPos;
+			// x, y = tile size in pixels, z, w = scale and bias to get the depth slice from the log of the view space depth
+			glm::vec4 tileSize;
+			// x, y, z = number of tiles and slices, w = number of lights
+			glm::uvec4 grid;
+			// x = ambient, y = specular
+			glm::vec4 shading;
+			// x = max. lights per cluster, y = number of clusters
+			glm::uvec4 limits;
+		};
+
+		vks::VulkanDevice *device;
+		vks::JobSystem *jobSystem;
+		uint32_t maxLights;
+		uint32_t tilesX, tilesY, slices;
+		uint32_t maxLightsPerCluster;
+		uint32_t clusterCount;
+
+		struct {
+			vks::Buffer params;
+			vks::Buffer lights;
+			vks::Buffer clusters;
+			vks::Buffer lightIndices;
+			vks::Buffer clusterBounds;
+		} buffers;
+
+		VkDescriptorPool descriptorPool;
+
+		struct {
+			VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+			VkPipeline pipeline = VK_NULL_HANDLE;
+		} compute;
+
+		// Grid the cluster bounds have been calculated for
+		glm::mat4 gridProjection = glm::mat4(0.0f);
+		float gridNear = 0.0f, gridFar = 0.0f;
+		uint32_t gridWidth = 0, gridHeight = 0;
+		float tileWidth, tileHeight;
+		float sliceScale, sliceBias;
+
+		// View space bounds of the clusters
+		// A cluster's box is separable: its x range only depends on the tile column and slice, its y range on the tile row and slice
+		struct Range {
+			float min, max;
+		};
+		std::vector<Range> columnBounds;
+		std::vector<Range> rowBounds;
+		std::vector<Range> sliceBounds;
+
+		// View space light spheres (structure of arrays) for the CPU builder
+		struct {
+			std::vector<float> x, y, z, radius;
+		} viewLights;
+
+		// Per cluster light lists of the CPU builder, each list has room for maxLightsPerCluster lights
+		std::vector<uint32_t> clusterLightCounts;
+		std::vector<uint32_t> clusterLights;
+
+		Statistics statistics;
+
+		void setupDescriptors()
+		{
+			const VkShaderStageFlags stages = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+				// Binding 0: Grid parameters
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, stages, 0),
+				// Binding 1: Lights
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, stages, 1),
+				// Binding 2: Cluster offsets and light counts
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, stages, 2),
+				// Binding 3: Light indices
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, stages, 3),
+				// Binding 4: View space cluster bounds (only used by the GPU builder)
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4),
+			};
+			VkDescriptorSetLayoutCreateInfo descriptorLayout = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayout, nullptr, &descriptorSetLayout));
+
+			std::vector<VkDescriptorPoolSize> poolSizes = {
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1),
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4),
+			};
+			VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(static_cast<uint32_t>(poolSizes.size()), poolSizes.data(), 1);
+			VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolInfo, nullptr, &descriptorPool));
+
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &descriptorSet));
+
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &buffers.params.descriptor),
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &buffers.lights.descriptor),
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &buffers.clusters.descriptor),
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &buffers.lightIndices.descriptor),
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &buffers.clusterBounds.descriptor),
+			};
+			vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+		}
+
+		/** @brief Calculate the view space bounds of all clusters */
+		void updateClusterBounds(const glm::mat4 &projection, float zNear, float zFar, uint32_t width, uint32_t height)
+		{
+			gridProjection = projection;
+			gridNear = zNear;
+			gridFar = zFar;
+			gridWidth = width;
+			gridHeight = height;
+
+			tileWidth = ceilf((float)width / (float)tilesX);
+			tileHeight = ceilf((float)height / (float)tilesY);
+			// slice = log(depth / zNear) / log(zFar / zNear) * slices
+			sliceScale = (float)slices / logf(zFar / zNear);
+			sliceBias = -logf(zNear) * sliceScale;
+
+			for (uint32_t s = 0; s < slices; s++)
+			{
+				// View space depths of the slice, the view direction is -z
+				const float depthNear = zNear * powf(zFar / zNear, (float)s / (float)slices);
+				const float depthFar = zNear * powf(zFar / zNear, (float)(s + 1) / (float)slices);
+				sliceBounds[s] = { -depthFar, -depthNear };
+
+				// Tile corners in normalized device coordinates, scaled to view space at the slice's near and far depth
+				for (uint32_t x = 0; x < tilesX; x++)
+				{
+					const float ndcMin = std::min((float)x * tileWidth / (float)width, 1.0f) * 2.0f - 1.0f;
+					const float ndcMax = std::min((float)(x + 1) * tileWidth / (float)width, 1.0f) * 2.0f - 1.0f;
+					columnBounds[s * tilesX + x] = getTileRange(ndcMin, ndcMax, depthNear, depthFar, projection[0][0], projection[2][0]);
+				}
+				for (uint32_t y = 0; y < tilesY; y++)
+				{
+					const float ndcMin = std::min((float)y * tileHeight / (float)height, 1.0f) * 2.0f - 1.0f;
+					const float ndcMax = std::min((float)(y + 1) * tileHeight / (float)height, 1.0f) * 2.0f - 1.0f;
+					rowBounds[s * tilesY + y] = getTileRange(ndcMin, ndcMax, depthNear, depthFar, projection[1][1], projection[2][1]);
+				}
+			}
+
+			// Full boxes for the GPU builder
+			glm::vec4 *bounds = reinterpret_cast<glm::vec4*>(buffers.clusterBounds.mapped);
+			for (uint32_t s = 0; s < slices; s++)
+			{
+				for (uint32_t y = 0; y < tilesY; y++)
+				{
+					for (uint32_t x = 0; x < tilesX; x++)
+					{
+						const uint32_t cluster = x + tilesX * (y + tilesY * s);
+						const Range &column = columnBounds[s * tilesX + x];
+						const Range &row = rowBounds[s * tilesY + y];
+						bounds[cluster * 2] = glm::vec4(column.min, row.min, sliceBounds[s].min, 0.0f);
+						bounds[cluster * 2 + 1] = glm::vec4(column.max, row.max, sliceBounds[s].max, 0.0f);
+					}
+				}
+			}
+		}
+
+		/** @brief View space range of a tile along one axis between two depths (ndc = (scale * v + offset * z) / -z) */
+		static Range getTileRange(float ndcMin, float ndcMax, float depthNear, float depthFar, float scale, float offset)
+		{
+			// v = (ndc + offset) * depth / scale, with z = -depth
+			const float values[4] = {
+				(ndcMin + offset) * depthNear / scale,
+				(ndcMin + offset) * depthFar / scale,
+				(ndcMax + offset) * depthNear / scale,
+				(ndcMax + offset) * depthFar / scale,
+			};
+			return { std::min(std::min(values[0], values[1]), std::min(values[2], values[3])), std::max(std::max(values[0], values[1]), std::max(values[2], values[3])) };
+		}
+
+		/** @brief CPU builder: transform the lights into view space, bin them per depth slice in parallel and compact the lists into the GPU buffers */
+		void buildClusters(const glm::mat4 &view, uint32_t lightCount)
+		{
+			// Padded to a multiple of 4, so the SIMD loops don't need a scalar tail
+			const uint32_t paddedCount = (lightCount + 3) & ~3u;
+			viewLights.x.resize(paddedCount);
+			viewLights.y.resize(paddedCount);
+			viewLights.z.resize(paddedCount);
+			viewLights.radius.resize(paddedCount);
+			for (uint32_t i = lightCount; i < paddedCount; i++)
+			{
+				// Padding lights are behind the viewer and never touch a slice
+				viewLights.x[i] = viewLights.y[i] = 0.0f;
+				viewLights.z[i] = 1.0e30f;
+				viewLights.radius[i] = 0.0f;
+			}
+
+			jobSystem->parallelFor(lightCount, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++)
+				{
+					const glm::vec4 pos = view * glm::vec4(glm::vec3(lights[i].position), 1.0f);
+					viewLights.x[i] = pos.x;
+					viewLights.y[i] = pos.y;
+					viewLights.z[i] = pos.z;
+					viewLights.radius[i] = lights[i].radius;
+				}
+			}, 256);
+
+			// Every slice is binned by one job, so no two jobs ever write to the same cluster
+			jobSystem->parallelFor(slices, [&](uint32_t begin, uint32_t end) {
+				std::vector<float> columnDistances(tilesX);
+				for (uint32_t s = begin; s < end; s++)
+				{
+					binSlice(s, paddedCount, columnDistances.data());
+				}
+			});
+
+			// Offsets of the compacted lists
+			uint32_t *clusters = reinterpret_cast<uint32_t*>(buffers.clusters.mapped);
+			uint32_t offset = 0;
+			for (uint32_t c = 0; c < clusterCount; c++)
+			{
+				if (clusterLightCounts[c] > maxLightsPerCluster)
+				{
+					clusterLightCounts[c] = maxLightsPerCluster;
+					statistics.overflowingClusters++;
+				}
+				clusters[c * 2] = offset;
+				clusters[c * 2 + 1] = clusterLightCounts[c];
+				offset += clusterLightCounts[c];
+				statistics.maxLightsInCluster = std::max(statistics.maxLightsInCluster, clusterLightCounts[c]);
+			}
+			statistics.lightIndexCount = offset;
+
+			// Copy the lists, every cluster's list is written sequentially into the (write combined) mapped memory
+			uint32_t *lightIndices = reinterpret_cast<uint32_t*>(buffers.lightIndices.mapped);
+			jobSystem->parallelFor(clusterCount, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t c = begin; c < end; c++)
+				{
+					memcpy(&lightIndices[clusters[c * 2]], &clusterLights[c * maxLightsPerCluster], clusterLightCounts[c] * sizeof(uint32_t));
+				}
+			}, 64);
+		}
+
+		/** @brief Assign all lights overlapping a depth slice to the slice's clusters */
+		void binSlice(uint32_t slice, uint32_t paddedCount, float *columnDistances)
+		{
+			const uint32_t firstCluster = slice * tilesX * tilesY;
+			memset(&clusterLightCounts[firstCluster], 0, tilesX * tilesY * sizeof(uint32_t));
+
+			const Range depthRange = sliceBounds[slice];
+			const Range *columns = &columnBounds[slice * tilesX];
+			const Range *rows = &rowBounds[slice * tilesY];
+			const float *lx = viewLights.x.data();
+			const float *ly = viewLights.y.data();
+			const float *lz = viewLights.z.data();
+			const float *lr = viewLights.radius.data();
+
+			for (uint32_t i = 0; i < paddedCount; i += 4)
+			{
+				// Find the lights whose sphere overlaps the slice's depth range (4 at a time)
+				uint32_t mask;
+#if defined(VKS_SIMD_SSE2)
+				const __m128 z = _mm_loadu_ps(lz + i);
+				const __m128 r = _mm_loadu_ps(lr + i);
+				const __m128 inFront = _mm_cmplt_ps(_mm_sub_ps(z, r), _mm_set1_ps(depthRange.max));
+				const __m128 behind = _mm_cmpgt_ps(_mm_add_ps(z, r), _mm_set1_ps(depthRange.min));
+				mask = static_cast<uint32_t>(_mm_movemask_ps(_mm_and_ps(inFront, behind)));
+#elif defined(VKS_SIMD_NEON)
+				const float32x4_t z = vld1q_f32(lz + i);
+				const float32x4_t r = vld1q_f32(lr + i);
+				const uint32x4_t overlap = vandq_u32(vcltq_f32(vsubq_f32(z, r), vdupq_n_f32(depthRange.max)), vcgtq_f32(vaddq_f32(z, r), vdupq_n_f32(depthRange.min)));
+				static const uint32_t bits[4] = { 1, 2, 4, 8 };
+				const uint32x4_t masked = vandq_u32(overlap, vld1q_u32(bits));
+				const uint32x2_t sum = vpadd_u32(vget_low_u32(masked), vget_high_u32(masked));
+				mask = vget_lane_u32(vpadd_u32(sum, sum), 0);
+#else
+				mask = 0;
+				for (uint32_t j = 0; j < 4; j++)
+				{
+					mask |= ((lz[i + j] - lr[i + j] < depthRange.max) && (lz[i + j] + lr[i + j] > depthRange.min)) ? (1 << j) : 0;
+				}
+#endif
+				while (mask)
+				{
+					const uint32_t light = i + countTrailingZeros(mask);
+					mask &= mask - 1;
+					binLight(light, lx[light], ly[light], lz[light], lr[light], depthRange, columns, rows, firstCluster, columnDistances);
+				}
+			}
+		}
+
+		/** @brief Add a light to all clusters of a slice its sphere overlaps, using the separable cluster boxes */
+		void binLight(uint32_t light, float x, float y, float z, float radius, const Range &depthRange, const Range *columns, const Range *rows, uint32_t firstCluster, float *columnDistances)
+		{
+			const float dz = std::max(0.0f, std::max(depthRange.min - z, z - depthRange.max));
+			const float remaining = radius * radius - dz * dz;
+			if (remaining < 0.0f)
+			{
+				return;
+			}
+
+			// Squared distances of the sphere center to all tile columns
+			uint32_t column = 0;
+#if defined(VKS_SIMD_SSE2)
+			const __m128 cx = _mm_set1_ps(x);
+			const __m128 zero = _mm_setzero_ps();
+			for (; column + 4 <= tilesX; column += 4)
+			{
+				const __m128 columnMin = _mm_setr_ps(columns[column].min, columns[column + 1].min, columns[column + 2].min, columns[column + 3].min);
+				const __m128 columnMax = _mm_setr_ps(columns[column].max, columns[column + 1].max, columns[column + 2].max, columns[column + 3].max);
+				const __m128 d = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(columnMin, cx), _mm_sub_ps(cx, columnMax)));
+				_mm_storeu_ps(columnDistances + column, _mm_mul_ps(d, d));
+			}
+#elif defined(VKS_SIMD_NEON)
+			const float32x4_t cx = vdupq_n_f32(x);
+			const float32x4_t zero = vdupq_n_f32(0.0f);
+			for (; column + 4 <= tilesX; column += 4)
+			{
+				const float columnMinValues[4] = { columns[column].min, columns[column + 1].min, columns[column + 2].min, columns[column + 3].min };
+				const float columnMaxValues[4] = { columns[column].max, columns[column + 1].max, columns[column + 2].max, columns[column + 3].max };
+				const float32x4_t d = vmaxq_f32(zero, vmaxq_f32(vsubq_f32(vld1q_f32(columnMinValues), cx), vsubq_f32(cx, vld1q_f32(columnMaxValues))));
+				vst1q_f32(columnDistances + column, vmulq_f32(d, d));
+			}
+#endif
+			for (; column < tilesX; column++)
+			{
+				const float d = std::max(0.0f, std::max(columns[column].min - x, x - columns[column].max));
+				columnDistances[column] = d * d;
+			}
+
+			for (uint32_t row = 0; row < tilesY; row++)
+			{
+				const float dy = std::max(0.0f, std::max(rows[row].min - y, y - rows[row].max));
+				const float remainingRow = remaining - dy * dy;
+				if (remainingRow < 0.0f)
+				{
+					continue;
+				}
+				for (uint32_t col = 0; col < tilesX; col++)
+				{
+					if (columnDistances[col] > remainingRow)
+					{
+						continue;
+					}
+					const uint32_t cluster = firstCluster + row * tilesX + col;
+					uint32_t &count = clusterLightCounts[cluster];
+					if (count < maxLightsPerCluster)
+					{
+						clusterLights[cluster * maxLightsPerCluster + count] = light;
+						count++;
+					}
+					else if (count == maxLightsPerCluster)
+					{
+						// A count of maxLightsPerCluster + 1 marks the cluster as overflowing
+						count++;
+					}
+				}
+			}
+		}
+	};
+
+	/**
+	* Measures frame times over a range of light counts (e.g. to compare light culling methods)
+	* Each light count is rendered for a number of warm up frames and then measured for a number of frames
+	* The GPU time is read from the first two timestamps of a vks::TimestampQueries frame (see update)
+	*/
+	class LightCountSweep
+	{
+	public:
+		struct Result {
+			uint32_t lightCount;
+			// Averages over the measured frames (in ms)
+			double frameTime;
+			double cpuTime;
+			double gpuTime;
+		};
+
+		std::vector<uint32_t> lightCounts = { 64, 128, 256, 512, 1024, 2048, 4096, 8192, 10000 };
+		uint32_t warmUpFrames = 10;
+		uint32_t measuredFrames = 60;
+		/** @brief Name of the measured GPU time in the overlay text */
+		std::string gpuTimeName = "GPU";
+
+		/** @brief Start the sweep, lightCount is the light count to return to once the sweep has finished */
+		void start(uint32_t lightCount)
+		{
+			results.clear();
+			step = 0;
+			frame = 0;
+			active = !lightCounts.empty();
+			current = Result();
+			initialLightCount = lightCount;
+		}
+
+		bool isActive() const
+		{
+			return active;
+		}
+
+		/** @brief Light count the current frame should be rendered with (the count passed to start once the sweep has finished) */
+		uint32_t getLightCount() const
+		{
+			return active ? lightCounts[step] : initialLightCount;
+		}
+
+		/** @brief GPU time (in ms) of the last frame whose timestamps have been resolved */
+		double getGpuTime() const
+		{
+			return gpuTime;
+		}
+
+		/**
+		* Resolve the GPU time of the frame that has just been submitted and add the frame to the sweep (if running)
+		* The frame's command buffer has to write timestamps 0 and 1 around the measured work, and the queue needs to be idle
+		* The results are written to stdout once the sweep has finished
+		*
+		* @return True if the light count changed (see getLightCount)
+		*/
+		bool update(vks::TimestampQueries *timestamps, uint32_t frameIndex, double frameTime, const ClusteredLights *clusteredLights, ClusteredLights::Builder builder)
+		{
+			if (timestamps->resolve(frameIndex))
+			{
+				gpuTime = timestamps->getDuration(0, 1);
+			}
+			if (!addFrame(frameTime, clusteredLights->getStatistics().updateTime, gpuTime))
+			{
+				return false;
+			}
+			if (!active)
+			{
+				std::cout << "Clustered lighting with " << ClusteredLights::getBuilderName(builder) << " cluster assignment:" << std::endl << getReport();
+			}
+			return true;
+		}
+
+		/**
+		* Add the timings of a finished frame
+		*
+		* @return True if the light count changed (or the sweep finished)
+		*/
+		bool addFrame(double frameTime, double cpuTime, double gpuTime)
+		{
+			if (!active)
+			{
+				return false;
+			}
+			frame++;
+			if (frame <= warmUpFrames)
+			{
+				return false;
+			}
+			current.frameTime += frameTime;
+			current.cpuTime += cpuTime;
+			current.gpuTime += gpuTime;
+			if (frame < warmUpFrames + measuredFrames)
+			{
+				return false;
+			}
+			current.lightCount = getLightCount();
+			current.frameTime /= measuredFrames;
+			current.cpuTime /= measuredFrames;
+			current.gpuTime /= measuredFrames;
+			results.push_back(current);
+			current = Result();
+			frame = 0;
+			step++;
+			active = (step < lightCounts.size());
+			return true;
+		}
+
+		const std::vector<Result> &getResults() const
+		{
+			return results;
+		}
+
+		/**
+		* Add the light count, the cluster statistics and the progress or results of the sweep to the text overlay
+		*
+		* @return Vertical position below the added lines
+		*/
+		float addOverlayText(VulkanTextOverlay *textOverlay, float y, uint32_t lightCount, const ClusteredLights *clusteredLights, ClusteredLights::Builder builder) const
+		{
+			const ClusteredLights::Statistics &statistics = clusteredLights->getStatistics();
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2) << lightCount << " lights, " << ClusteredLights::getBuilderName(builder) << " cluster assignment";
+			ss << " (CPU " << statistics.updateTime << " ms, " << gpuTimeName << " " << gpuTime << " ms)";
+			textOverlay->addText(ss.str(), 5.0f, y, VulkanTextOverlay::alignLeft);
+			y += 15.0f;
+			if (builder == ClusteredLights::BUILDER_CPU)
+			{
+				ss.str("");
+				ss << "Max. " << statistics.maxLightsInCluster << " lights per cluster, " << statistics.overflowingClusters << " full clusters";
+				textOverlay->addText(ss.str(), 5.0f, y, VulkanTextOverlay::alignLeft);
+			}
+			y += 15.0f;
+			if (active)
+			{
+				textOverlay->addText("Measuring " + std::to_string(getLightCount()) + " lights...", 5.0f, y, VulkanTextOverlay::alignLeft);
+				y += 15.0f;
+			}
+			else if (!results.empty())
+			{
+				std::stringstream report(getReport());
+				std::string line;
+				while (std::getline(report, line))
+				{
+					textOverlay->addText(line, 5.0f, y, VulkanTextOverlay::alignLeft);
+					y += 15.0f;
+				}
+			}
+			return y;
+		}
+
+		/** @brief Returns the results as a table (one line per light count) */
+		std::string getReport() const
+		{
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(3);
+			ss << "lights    frame ms    cpu ms    gpu ms\n";
+			for (auto &result : results)
+			{
+				ss << std::setw(6) << result.lightCount << std::setw(12) << result.frameTime << std::setw(10) << result.cpuTime << std::setw(10) << result.gpuTime << "\n";
+			}
+			return ss.str();
+		}
+
+	private:
+		std::vector<Result> results;
+		Result current;
+		uint32_t step = 0;
+		uint32_t frame = 0;
+		bool active = false;
+		uint32_t initialLightCount = 0;
+		double gpuTime = 0.0;
+	};
+}
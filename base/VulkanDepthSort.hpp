@@ -0,0 +1,240 @@
+/*
+* GPU depth sorting with compute shaders
+*
+* Sorts the elements of a storage buffer (e.g. particles written by a compute shader) back to front without a round trip to the host
+* A first pass writes a 32 bit key (based on the view space distance) and the element index for every element, a bitonic sort
+* over the key/value pairs follows. The sorted values can be bound directly as an index buffer to draw the elements in order
+*
+* The bitonic sort needs a power of two number of elements, the arrays are padded with keys that sort behind all valid elements
+* It takes log2(n) * (log2(n) + 1) / 2 dispatches, each one doing a single compare and swap step over the whole array
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+
+namespace vks
+{
+	class DepthSort
+	{
+	public:
+		/** @brief Number of invocations per work group of both shaders */
+		static const uint32_t workGroupSize = 256;
+
+		struct {
+			// Sort keys, padding elements are set to the largest key
+			vks::Buffer keys;
+			// Element indices, sorted along with the keys (usable as an index buffer)
+			vks::Buffer values;
+		} buffers;
+
+		/**
+		* Create the key and value buffers
+		*
+		* @param device Vulkan device
+		* @param maxCount Maximum number of elements to sort
+		*/
+		DepthSort(vks::VulkanDevice *device, uint32_t maxCount)
+		{
+			this->device = device;
+			this->maxCount = maxCount;
+			const VkDeviceSize size = getPaddedCount(maxCount) * sizeof(uint32_t);
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &params, sizeof(glm::vec4)));
+			VK_CHECK_RESULT(params.map());
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffers.keys, size));
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffers.values, size));
+		}
+
+		~DepthSort()
+		{
+			params.destroy();
+			buffers.keys.destroy();
+			buffers.values.destroy();
+			if (pipelines.keys != VK_NULL_HANDLE)
+			{
+				vkDestroyPipeline(device->logicalDevice, pipelines.keys, nullptr);
+				vkDestroyPipeline(device->logicalDevice, pipelines.sort, nullptr);
+				vkDestroyPipelineLayout(device->logicalDevice, pipelineLayout, nullptr);
+				vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayout, nullptr);
+				vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
+			}
+		}
+
+		/**
+		* Create the compute pipelines and bind the buffer with the element positions
+		*
+		* @param keysStage Stage of the key generation shader (shaders/base/depthsortkeys.comp.spv)
+		* @param sortStage Stage of the bitonic sort shader (shaders/base/depthsortbitonic.comp.spv)
+		* @param positions Buffer with the elements to sort, the first vec4 of each element is used as its position
+		* @param stride Size of a single element in the positions buffer in bytes (multiple of 16)
+		*/
+		void prepare(const VkPipelineShaderStageCreateInfo &keysStage, const VkPipelineShaderStageCreateInfo &sortStage, VkPipelineCache pipelineCache, const VkDescriptorBufferInfo &positions, uint32_t stride)
+		{
+			assert(stride > 0 && stride % sizeof(glm::vec4) == 0);
+			this->stride = stride / sizeof(glm::vec4);
+
+			std::vector<VkDescriptorPoolSize> poolSizes = {
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1),
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3),
+			};
+			VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(static_cast<uint32_t>(poolSizes.size()), poolSizes.data(), 1);
+			VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolInfo, nullptr, &descriptorPool));
+
+			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+				// Binding 0: Depth plane
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+				// Binding 1: Element positions
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+				// Binding 2: Keys
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+				// Binding 3: Values
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+			};
+			VkDescriptorSetLayoutCreateInfo descriptorLayout = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayout, nullptr, &descriptorSetLayout));
+
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &descriptorSet));
+			VkDescriptorBufferInfo positionsDescriptor = positions;
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &params.descriptor),
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &positionsDescriptor),
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &buffers.keys.descriptor),
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &buffers.values.descriptor),
+			};
+			vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+			// Both shaders share the layout and the push constant block
+			VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(PushConsts), 0);
+			VkPipelineLayoutCreateInfo pipelineLayoutInfo = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
+			pipelineLayoutInfo.pushConstantRangeCount = 1;
+			pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+			VK_CHECK_RESULT(vkCreatePipelineLayout(device->logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout));
+
+			VkComputePipelineCreateInfo pipelineInfo = vks::initializers::computePipelineCreateInfo(pipelineLayout, 0);
+			pipelineInfo.stage = keysStage;
+			VK_CHECK_RESULT(vkCreateComputePipelines(device->logicalDevice, pipelineCache, 1, &pipelineInfo, nullptr, &pipelines.keys));
+			pipelineInfo.stage = sortStage;
+			VK_CHECK_RESULT(vkCreateComputePipelines(device->logicalDevice, pipelineCache, 1, &pipelineInfo, nullptr, &pipelines.sort));
+		}
+
+		/**
+		* Set the view used for the next sorts
+		* The buffer is written directly, so no sort using it must be in flight
+		*
+		* @param view Matrix transforming the element positions into view space (camera looking down -z)
+		*/
+		void update(const glm::mat4 &view)
+		{
+			// Distance along the view direction is the negated z row of the view matrix
+			const glm::vec4 depthPlane = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+			memcpy(params.mapped, &depthPlane, sizeof(depthPlane));
+		}
+
+		/**
+		* Record the key generation and the sort, must be recorded outside of a render pass
+		* Writes to the positions buffer must be made visible to compute shader reads before this,
+		* reads of the sorted values (e.g. as an index buffer) need to be synchronized by the caller after this
+		*
+		* @param count Number of elements to sort (up to the maximum count passed at creation)
+		*/
+		void cmdSort(VkCommandBuffer commandBuffer, uint32_t count)
+		{
+			assert(pipelines.keys != VK_NULL_HANDLE);
+			assert(count <= maxCount);
+			const uint32_t paddedCount = getPaddedCount(count);
+			const uint32_t groupCount = paddedCount / workGroupSize;
+
+			PushConsts pushConsts = { count, stride, 0, 0 };
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.keys);
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConsts), &pushConsts);
+			vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.sort);
+			for (uint32_t blockSize = 2; blockSize <= paddedCount; blockSize <<= 1)
+			{
+				for (uint32_t compareDistance = blockSize >> 1; compareDistance > 0; compareDistance >>= 1)
+				{
+					// Each step reads the results of the previous one
+					cmdStepBarrier(commandBuffer);
+					pushConsts.blockSize = blockSize;
+					pushConsts.compareDistance = compareDistance;
+					vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConsts), &pushConsts);
+					vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+				}
+			}
+		}
+
+		/** @brief Returns the number of dispatches recorded by cmdSort for the given number of elements */
+		static uint32_t getDispatchCount(uint32_t count)
+		{
+			uint32_t steps = 0;
+			for (uint32_t blockSize = 2; blockSize <= getPaddedCount(count); blockSize <<= 1)
+			{
+				for (uint32_t compareDistance = blockSize >> 1; compareDistance > 0; compareDistance >>= 1)
+				{
+					steps++;
+				}
+			}
+			return steps + 1;
+		}
+
+		/** @brief Returns the number of elements the arrays are padded to (power of two, at least one work group) */
+		static uint32_t getPaddedCount(uint32_t count)
+		{
+			uint32_t paddedCount = workGroupSize;
+			while (paddedCount < count)
+			{
+				paddedCount <<= 1;
+			}
+			return paddedCount;
+		}
+
+	private:
+		struct PushConsts {
+			uint32_t count;
+			// Element stride in vec4s
+			uint32_t stride;
+			uint32_t blockSize;
+			uint32_t compareDistance;
+		};
+
+		vks::VulkanDevice *device;
+		uint32_t maxCount;
+		uint32_t stride = 1;
+		vks::Buffer params;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		struct {
+			VkPipeline keys = VK_NULL_HANDLE;
+			VkPipeline sort = VK_NULL_HANDLE;
+		} pipelines;
+
+		void cmdStepBarrier(VkCommandBuffer commandBuffer)
+		{
+			VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+			memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		}
+	};
+}
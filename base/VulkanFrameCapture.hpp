@@ -0,0 +1,516 @@
+/*
+* Asynchronous frame capture
+*
+* Copies rendered (swap chain) images into a ring of host visible readback buffers as part of the frame's submission
+* Finished copies are picked up without blocking a few frames later and encoded and written to disk on a worker thread,
+* so capturing image sequences doesn't stall rendering (frames are dropped instead if all slots are still busy)
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "threadpool.hpp"
+#include "simd.hpp"
+
+namespace vks
+{
+	class FrameCapture
+	{
+	public:
+		enum FileFormat {
+			// Binary RGB portable pixmap
+			FILE_FORMAT_PPM,
+			// RGB png with uncompressed (stored) deflate blocks, trades file size for encoding speed
+			FILE_FORMAT_PNG,
+			// Pixels as copied from the image (4 bytes per pixel in the image's channel order) without any header
+			FILE_FORMAT_RAW
+		};
+
+		struct {
+			// Frames written to disk
+			uint32_t writtenFrames = 0;
+			// Frames not captured because all slots were busy
+			uint32_t droppedFrames = 0;
+			// Frames copied or encoded but not yet written
+			uint32_t pendingFrames = 0;
+			// Worker thread time for converting, encoding and writing the last frame (ms)
+			double encodeTime = 0.0;
+			// Bytes written for the last frame
+			size_t fileSize = 0;
+		} statistics;
+
+		/**
+		* Create the readback slots and the worker thread
+		*
+		* @param device Vulkan device
+		* @param colorFormat Format of the captured images, must be one of the 8 bit RGBA / BGRA formats (see isFormatSupported)
+		* @param width Width of the captured images
+		* @param height Height of the captured images
+		* @param slotCount Number of captures that can be in flight (copied on the GPU or waiting for the worker)
+		*/
+		FrameCapture(vks::VulkanDevice *device, VkFormat colorFormat, uint32_t width, uint32_t height, uint32_t slotCount = 4)
+		{
+			assert(isFormatSupported(colorFormat));
+			this->device = device;
+			this->width = width;
+			this->height = height;
+			const VkFormat formatsBGR[] = { VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_B8G8R8A8_SNORM };
+			swizzle = std::find(std::begin(formatsBGR), std::end(formatsBGR), colorFormat) != std::end(formatsBGR);
+
+			// Host reads from uncached memory are very slow, so prefer cached memory (which may require explicit invalidation)
+			VkMemoryPropertyFlags memoryFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+			if (!hasMemoryType(memoryFlags))
+			{
+				memoryFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			}
+			coherent = (memoryFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+			VkCommandPoolCreateInfo cmdPoolInfo = vks::initializers::commandPoolCreateInfo();
+			cmdPoolInfo.queueFamilyIndex = device->queueFamilyIndices.graphics;
+			cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+			VK_CHECK_RESULT(vkCreateCommandPool(device->logicalDevice, &cmdPoolInfo, nullptr, &commandPool));
+
+			for (uint32_t i = 0; i < slotCount; i++)
+			{
+				std::unique_ptr<Slot> slot = make_unique<Slot>();
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					memoryFlags,
+					&slot->buffer,
+					(VkDeviceSize)width * height * 4));
+				VK_CHECK_RESULT(slot->buffer.map());
+
+				VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+				VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &cmdBufAllocateInfo, &slot->commandBuffer));
+
+				VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(0);
+				VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceCreateInfo, nullptr, &slot->fence));
+				slots.push_back(std::move(slot));
+			}
+		}
+
+		~FrameCapture()
+		{
+			flush();
+			for (auto &slot : slots)
+			{
+				slot->buffer.destroy();
+				vkDestroyFence(device->logicalDevice, slot->fence, nullptr);
+			}
+			vkDestroyCommandPool(device->logicalDevice, commandPool, nullptr);
+		}
+
+		/** @brief Returns true if images of the given format can be captured */
+		static bool isFormatSupported(VkFormat format)
+		{
+			const VkFormat formats[] = {
+				VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_R8G8B8A8_SNORM,
+				VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_B8G8R8A8_SNORM,
+				VK_FORMAT_A8B8G8R8_UNORM_PACK32, VK_FORMAT_A8B8G8R8_SRGB_PACK32, VK_FORMAT_A8B8G8R8_SNORM_PACK32
+			};
+			return std::find(std::begin(formats), std::end(formats), format) != std::end(formats);
+		}
+
+		/**
+		* Record the copy of a rendered image into the next free slot
+		*
+		* @param image Image to capture, must have been created with VK_IMAGE_USAGE_TRANSFER_SRC_BIT and be in the VK_IMAGE_LAYOUT_PRESENT_SRC_KHR layout
+		* @param filename File the image is written to once the copy has finished
+		* @param format File format
+		* @param commandBuffer Receives the command buffer with the copy, submit it after the commands rendering the image in the same batch (so presentation waits for the copy)
+		* @param fence Receives the fence that must be passed to the submission of the command buffer
+		*
+		* @return False if all slots are busy, the frame is dropped and nothing needs to be submitted
+		*/
+		bool record(VkImage image, const std::string &filename, FileFormat format, VkCommandBuffer *commandBuffer, VkFence *fence)
+		{
+			auto freeSlot = std::find_if(slots.begin(), slots.end(), [](const std::unique_ptr<Slot> &slot) { return slot->state == SLOT_FREE; });
+			if (freeSlot == slots.end())
+			{
+				statistics.droppedFrames++;
+				return false;
+			}
+			Slot *slot = freeSlot->get();
+			slot->filename = filename;
+			slot->format = format;
+
+			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+			cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			VK_CHECK_RESULT(vkBeginCommandBuffer(slot->commandBuffer, &cmdBufInfo));
+
+			const VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			vks::tools::insertImageMemoryBarrier(
+				slot->commandBuffer,
+				image,
+				VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				VK_ACCESS_TRANSFER_READ_BIT,
+				VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				subresourceRange);
+
+			// Rows are tightly packed in the buffer
+			VkBufferImageCopy copyRegion = {};
+			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copyRegion.imageSubresource.layerCount = 1;
+			copyRegion.imageExtent = { width, height, 1 };
+			vkCmdCopyImageToBuffer(slot->commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer.buffer, 1, &copyRegion);
+
+			vks::tools::insertImageMemoryBarrier(
+				slot->commandBuffer,
+				image,
+				VK_ACCESS_TRANSFER_READ_BIT,
+				0,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				subresourceRange);
+
+			// Make the copied data visible to the host once the fence has been signaled
+			VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+			bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.buffer = slot->buffer.buffer;
+			bufferBarrier.size = VK_WHOLE_SIZE;
+			vkCmdPipelineBarrier(slot->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+			VK_CHECK_RESULT(vkEndCommandBuffer(slot->commandBuffer));
+
+			VK_CHECK_RESULT(vkResetFences(device->logicalDevice, 1, &slot->fence));
+			slot->state = SLOT_SUBMITTED;
+			inFlight.push_back(slot);
+			statistics.pendingFrames++;
+
+			*commandBuffer = slot->commandBuffer;
+			*fence = slot->fence;
+			return true;
+		}
+
+		/**
+		* Hand finished copies over to the worker thread and pick up the results of written frames, never blocks
+		* Call this once per frame
+		*/
+		void update()
+		{
+			// Copies finish in submission order, so the files are also written in that order
+			while (!inFlight.empty() && (inFlight.front()->state == SLOT_SUBMITTED))
+			{
+				Slot *slot = inFlight.front();
+				if (vkGetFenceStatus(device->logicalDevice, slot->fence) != VK_SUCCESS)
+				{
+					break;
+				}
+				if (!coherent)
+				{
+					slot->buffer.invalidate();
+				}
+				slot->state = SLOT_ENCODING;
+				worker.addJob([this, slot] { encode(slot); });
+				inFlight.pop_front();
+				encoding.push_back(slot);
+			}
+
+			while (!encoding.empty() && (encoding.front()->state == SLOT_WRITTEN))
+			{
+				Slot *slot = encoding.front();
+				statistics.encodeTime = slot->encodeTime;
+				statistics.fileSize = slot->fileSize;
+				statistics.writtenFrames++;
+				statistics.pendingFrames--;
+				slot->state = SLOT_FREE;
+				encoding.pop_front();
+			}
+		}
+
+		/** @brief Wait until all recorded captures have been written to disk, the capture command buffers must have been submitted */
+		void flush()
+		{
+			for (auto &slot : inFlight)
+			{
+				VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &slot->fence, VK_TRUE, UINT64_MAX));
+			}
+			update();
+			worker.wait();
+			update();
+			assert(inFlight.empty() && encoding.empty());
+		}
+
+		/**
+		* Convert 4 byte pixels to tightly packed RGB
+		*
+		* @param swizzle Swap the first and third channel (BGRA source)
+		*/
+		static void convertToRGB(const uint8_t *src, uint8_t *dst, size_t pixelCount, bool swizzle)
+		{
+			size_t i = 0;
+#if defined(VKS_SIMD_SSE41)
+			// Four pixels per iteration, each store writes 4 bytes past the converted pixels which are overwritten by the next iteration
+			const __m128i shuffle = swizzle ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1) : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+			for (; i + 8 <= pixelCount; i += 4)
+			{
+				const __m128i pixels = _mm_loadu_si128((const __m128i*)(src + i * 4));
+				_mm_storeu_si128((__m128i*)(dst + i * 3), _mm_shuffle_epi8(pixels, shuffle));
+			}
+#elif defined(VKS_SIMD_NEON)
+			for (; i + 16 <= pixelCount; i += 16)
+			{
+				const uint8x16x4_t pixels = vld4q_u8(src + i * 4);
+				uint8x16x3_t rgb;
+				rgb.val[0] = swizzle ? pixels.val[2] : pixels.val[0];
+				rgb.val[1] = pixels.val[1];
+				rgb.val[2] = swizzle ? pixels.val[0] : pixels.val[2];
+				vst3q_u8(dst + i * 3, rgb);
+			}
+#endif
+			const uint32_t r = swizzle ? 2 : 0;
+			const uint32_t b = swizzle ? 0 : 2;
+			for (; i < pixelCount; i++)
+			{
+				dst[i * 3 + 0] = src[i * 4 + r];
+				dst[i * 3 + 1] = src[i * 4 + 1];
+				dst[i * 3 + 2] = src[i * 4 + b];
+			}
+		}
+
+	private:
+		enum SlotState {
+			SLOT_FREE,
+			// Copy recorded, waiting for the fence
+			SLOT_SUBMITTED,
+			// Owned by the worker thread
+			SLOT_ENCODING,
+			// Written by the worker thread, statistics not yet picked up
+			SLOT_WRITTEN
+		};
+
+		struct Slot {
+			vks::Buffer buffer;
+			VkCommandBuffer commandBuffer;
+			VkFence fence;
+			std::string filename;
+			FileFormat format;
+			// Changed by the worker thread
+			std::atomic<uint32_t> state{ SLOT_FREE };
+			// Only accessed by the worker thread while encoding, kept to avoid allocations for every frame
+			std::vector<uint8_t> fileData;
+			std::vector<uint8_t> scanlines;
+			double encodeTime = 0.0;
+			size_t fileSize = 0;
+		};
+
+		vks::VulkanDevice *device;
+		uint32_t width;
+		uint32_t height;
+		bool swizzle;
+		bool coherent;
+		VkCommandPool commandPool;
+		std::vector<std::unique_ptr<Slot>> slots;
+		// Slots in submission order
+		std::deque<Slot*> inFlight;
+		std::deque<Slot*> encoding;
+		// Declared last so it's destroyed (and joined) before the slots
+		vks::Thread worker;
+
+		bool hasMemoryType(VkMemoryPropertyFlags flags) const
+		{
+			for (uint32_t i = 0; i < device->memoryProperties.memoryTypeCount; i++)
+			{
+				if ((device->memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Runs on the worker thread
+		void encode(Slot *slot)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+			const uint8_t *src = (const uint8_t*)slot->buffer.mapped;
+			const size_t pixelCount = (size_t)width * height;
+			const char *data = (const char*)src;
+			size_t size = pixelCount * 4;
+
+			switch (slot->format)
+			{
+			case FILE_FORMAT_PPM:
+			{
+				const std::string header = "P6\n" + std::to_string(width) + "\n" + std::to_string(height) + "\n255\n";
+				slot->fileData.resize(header.size() + pixelCount * 3);
+				memcpy(slot->fileData.data(), header.data(), header.size());
+				convertToRGB(src, slot->fileData.data() + header.size(), pixelCount, swizzle);
+				data = (const char*)slot->fileData.data();
+				size = slot->fileData.size();
+				break;
+			}
+			case FILE_FORMAT_PNG:
+				encodePNG(slot, src);
+				data = (const char*)slot->fileData.data();
+				size = slot->fileData.size();
+				break;
+			case FILE_FORMAT_RAW:
+				// Written straight from the readback buffer
+				break;
+			}
+
+			// Everything is written with a single call
+			std::ofstream file(slot->filename, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (file.is_open())
+			{
+				file.write(data, size);
+			}
+			else
+			{
+				std::cerr << "Could not write captured frame to \"" << slot->filename << "\"" << std::endl;
+			}
+
+			slot->fileSize = size;
+			slot->encodeTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+			slot->state = SLOT_WRITTEN;
+		}
+
+		static void put32(std::vector<uint8_t> &data, uint32_t value)
+		{
+			const uint8_t bytes[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value };
+			data.insert(data.end(), bytes, bytes + 4);
+		}
+
+		static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0)
+		{
+			static const std::vector<uint32_t> table = [] {
+				std::vector<uint32_t> table(256);
+				for (uint32_t i = 0; i < 256; i++)
+				{
+					uint32_t c = i;
+					for (uint32_t k = 0; k < 8; k++)
+					{
+						c = (c & 1) ? 0xedb88320u ^ (c >> 1) : (c >> 1);
+					}
+					table[i] = c;
+				}
+				return table;
+			}();
+			crc = ~crc;
+			for (size_t i = 0; i < size; i++)
+			{
+				crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+			}
+			return ~crc;
+		}
+
+		static uint32_t adler32(const uint8_t *data, size_t size)
+		{
+			uint32_t a = 1, b = 0;
+			while (size > 0)
+			{
+				// Largest block for which the sums can't overflow before the modulo
+				const size_t blockSize = std::min(size, (size_t)5552);
+				for (size_t i = 0; i < blockSize; i++)
+				{
+					a += data[i];
+					b += a;
+				}
+				a %= 65521;
+				b %= 65521;
+				data += blockSize;
+				size -= blockSize;
+			}
+			return (b << 16) | a;
+		}
+
+		void endChunk(std::vector<uint8_t> &png, size_t start)
+		{
+			// Chunk data has already been appended after the (yet empty) length and the type
+			const uint32_t length = (uint32_t)(png.size() - start - 8);
+			png[start + 0] = (uint8_t)(length >> 24);
+			png[start + 1] = (uint8_t)(length >> 16);
+			png[start + 2] = (uint8_t)(length >> 8);
+			png[start + 3] = (uint8_t)length;
+			put32(png, crc32(png.data() + start + 4, length + 4));
+		}
+
+		void beginChunk(std::vector<uint8_t> &png, const char *type, size_t &start)
+		{
+			start = png.size();
+			put32(png, 0);
+			png.insert(png.end(), type, type + 4);
+		}
+
+		// See https://www.w3.org/TR/PNG/ for details, the zlib stream only uses stored blocks
+		void encodePNG(Slot *slot, const uint8_t *src)
+		{
+			// Each row starts with its filter type (0 = none)
+			const size_t rowSize = (size_t)width * 3 + 1;
+			std::vector<uint8_t> &scanlines = slot->scanlines;
+			scanlines.resize(rowSize * height);
+			for (uint32_t y = 0; y < height; y++)
+			{
+				scanlines[y * rowSize] = 0;
+				convertToRGB(src + (size_t)y * width * 4, scanlines.data() + y * rowSize + 1, width, swizzle);
+			}
+
+			const size_t maxBlockSize = 65535;
+			const size_t blockCount = std::max((scanlines.size() + maxBlockSize - 1) / maxBlockSize, (size_t)1);
+
+			std::vector<uint8_t> &png = slot->fileData;
+			png.clear();
+			png.reserve(64 + scanlines.size() + blockCount * 5);
+			const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+			png.insert(png.end(), signature, signature + 8);
+
+			size_t start;
+			beginChunk(png, "IHDR", start);
+			put32(png, width);
+			put32(png, height);
+			// 8 bit depth, RGB, deflate, no filtering, no interlacing
+			const uint8_t format[5] = { 8, 2, 0, 0, 0 };
+			png.insert(png.end(), format, format + 5);
+			endChunk(png, start);
+
+			beginChunk(png, "IDAT", start);
+			// zlib header: deflate with 32k window, no preset dictionary, fastest compression
+			png.push_back(0x78);
+			png.push_back(0x01);
+			for (size_t offset = 0; offset < scanlines.size(); offset += maxBlockSize)
+			{
+				const uint16_t blockSize = (uint16_t)std::min(maxBlockSize, scanlines.size() - offset);
+				const uint16_t inverseBlockSize = ~blockSize;
+				const bool last = (offset + blockSize) >= scanlines.size();
+				// Block type 0 (stored) followed by the length and its one's complement
+				const uint8_t blockHeader[5] = { (uint8_t)(last ? 1 : 0), (uint8_t)blockSize, (uint8_t)(blockSize >> 8), (uint8_t)inverseBlockSize, (uint8_t)(inverseBlockSize >> 8) };
+				png.insert(png.end(), blockHeader, blockHeader + 5);
+				png.insert(png.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+			}
+			put32(png, adler32(scanlines.data(), scanlines.size()));
+			endChunk(png, start);
+
+			beginChunk(png, "IEND", start);
+			endChunk(png, start);
+		}
+	};
+}
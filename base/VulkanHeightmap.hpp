@@ -1,18 +1,34 @@
 /*
 * Heightmap terrain generator
 *
+* Contains a single mesh heightmap and a quadtree based chunked terrain with distance based LOD and chunks streamed in from worker threads
+*
 * Copyright (C) 2016 by Sascha Willems - www.saschawillems.de
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
-#include <glm/glm.hpp>
+#pragma once
+
+#include <float.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <unordered_map>
+
 #include <glm/glm.hpp>
 #include <gli/gli.hpp>
 
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.hpp"
 #include "VulkanBuffer.hpp"
+#include "jobsystem.hpp"
+#include "frustum.hpp"
 
 namespace vks 
 {
@@ -251,4 +267,859 @@ namespace vks
 			vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
 		}
 	};
+
+	/** @brief Source of height samples for the chunked terrain, implementations must be thread safe as chunks are generated on worker threads */
+	class HeightSource
+	{
+	public:
+		virtual ~HeightSource() {}
+
+		/** @brief Returns the width and height of the (square) height field in samples */
+		virtual uint32_t getDim() = 0;
+
+		/**
+		* Read a grid of normalized [0..1] heights
+		* Coordinates outside of the height field are clamped to its border
+		*
+		* @param x0 X coordinate of the first sample (may be negative)
+		* @param y0 Y coordinate of the first sample (may be negative)
+		* @param stride Distance between two samples of the grid
+		* @param count Number of samples in x and y
+		* @param dst Destination for count * count heights
+		*/
+		virtual void getGrid(int32_t x0, int32_t y0, uint32_t stride, uint32_t count, float *dst) = 0;
+	};
+
+	/** @brief Height field that is completely kept in memory (loaded from a single channel 16 bit KTX file) */
+	class MemoryHeightSource : public HeightSource
+	{
+	private:
+		std::vector<uint16_t> heights;
+		uint32_t dim = 0;
+	public:
+#if defined(__ANDROID__)
+		void loadFromFile(const std::string filename, AAssetManager* assetManager)
+#else
+		void loadFromFile(const std::string filename)
+#endif
+		{
+#if defined(__ANDROID__)
+			AAsset* asset = AAssetManager_open(assetManager, filename.c_str(), AASSET_MODE_STREAMING);
+			assert(asset);
+			size_t size = AAsset_getLength(asset);
+			assert(size > 0);
+			void *textureData = malloc(size);
+			AAsset_read(asset, textureData, size);
+			AAsset_close(asset);
+			gli::texture2d heightTex(gli::load((const char*)textureData, size));
+			free(textureData);
+#else
+			gli::texture2d heightTex(gli::load(filename));
+#endif
+			assert(heightTex.extent().x == heightTex.extent().y);
+			dim = static_cast<uint32_t>(heightTex.extent().x);
+			heights.resize(dim * dim);
+			memcpy(heights.data(), heightTex.data(), heights.size() * sizeof(uint16_t));
+		}
+
+		/** @brief Returns the raw 16 bit heights (e.g. for writing them to tiles) */
+		const uint16_t *data()
+		{
+			return heights.data();
+		}
+
+		uint32_t getDim()
+		{
+			return dim;
+		}
+
+		void getGrid(int32_t x0, int32_t y0, uint32_t stride, uint32_t count, float *dst)
+		{
+			const int32_t max = static_cast<int32_t>(dim) - 1;
+			for (uint32_t y = 0; y < count; y++)
+			{
+				const int32_t sy = std::max(0, std::min(y0 + static_cast<int32_t>(y * stride), max));
+				for (uint32_t x = 0; x < count; x++)
+				{
+					const int32_t sx = std::max(0, std::min(x0 + static_cast<int32_t>(x * stride), max));
+					dst[y * count + x] = heights[sy * dim + sx] / 65535.0f;
+				}
+			}
+		}
+	};
+
+	/**
+	* Height field that is split into square tiles stored as separate raw 16 bit files, which are loaded on demand
+	* Only the most recently used tiles are kept in memory, so the height field can be larger than the available system memory
+	* Tile sets are written with writeTiles, which also stores the dimensions of the height field in an info file (see readInfo)
+	*/
+	class TiledHeightSource : public HeightSource
+	{
+	private:
+		struct Tile {
+			// Shared with grid reads that are still sampling the tile after it has been evicted
+			std::shared_ptr<const std::vector<uint16_t>> heights;
+			uint64_t lastUsed;
+		};
+		std::string basePath;
+		uint32_t dim;
+		uint32_t tileSize;
+		uint32_t tilesPerRow;
+		uint32_t maxCachedTiles;
+		std::unordered_map<uint32_t, Tile> tiles;
+		uint64_t useCounter = 0;
+		std::mutex tileMutex;
+		std::atomic<uint32_t> loadedTiles{ 0 };
+
+		// Returns the heights of a tile from the cache or loads them (missing files are treated as flat)
+		// The file is read without holding the tile mutex, so other threads reading cached tiles aren't blocked by the I/O
+		std::shared_ptr<const std::vector<uint16_t>> getTile(uint32_t tx, uint32_t ty)
+		{
+			const uint32_t key = ty * tilesPerRow + tx;
+			{
+				std::lock_guard<std::mutex> lock(tileMutex);
+				auto it = tiles.find(key);
+				if (it != tiles.end())
+				{
+					it->second.lastUsed = ++useCounter;
+					return it->second.heights;
+				}
+			}
+
+			std::shared_ptr<std::vector<uint16_t>> heights = std::make_shared<std::vector<uint16_t>>(tileSize * tileSize, 0);
+			std::ifstream file(getTileFileName(basePath, tx, ty), std::ios::binary);
+			if (file.is_open())
+			{
+				file.read(reinterpret_cast<char*>(heights->data()), heights->size() * sizeof(uint16_t));
+			}
+			loadedTiles++;
+
+			std::lock_guard<std::mutex> lock(tileMutex);
+			// Another thread may have loaded the same tile in the meantime
+			auto it = tiles.find(key);
+			if (it == tiles.end())
+			{
+				if (tiles.size() >= maxCachedTiles)
+				{
+					// Evict the least recently used tile
+					auto lru = tiles.begin();
+					for (auto t = tiles.begin(); t != tiles.end(); t++)
+					{
+						if (t->second.lastUsed < lru->second.lastUsed)
+						{
+							lru = t;
+						}
+					}
+					tiles.erase(lru);
+				}
+				Tile tile;
+				tile.heights = heights;
+				it = tiles.insert(std::make_pair(key, std::move(tile))).first;
+			}
+			it->second.lastUsed = ++useCounter;
+			return it->second.heights;
+		}
+	public:
+		/**
+		* Create a tiled height source
+		*
+		* @param basePath Path and name prefix of the tile files (see getTileFileName)
+		* @param dim Width and height of the complete height field in samples
+		* @param tileSize Width and height of a single tile in samples
+		* @param maxCachedTiles Max. number of tiles kept in memory
+		*/
+		TiledHeightSource(const std::string &basePath, uint32_t dim, uint32_t tileSize, uint32_t maxCachedTiles = 64)
+		{
+			assert(tileSize > 0);
+			this->basePath = basePath;
+			this->dim = dim;
+			this->tileSize = tileSize;
+			this->tilesPerRow = (dim + tileSize - 1) / tileSize;
+			this->maxCachedTiles = std::max(maxCachedTiles, 1u);
+		}
+
+		/** @brief Returns the file name of a tile */
+		static std::string getTileFileName(const std::string &basePath, uint32_t tx, uint32_t ty)
+		{
+			return basePath + "_" + std::to_string(tx) + "_" + std::to_string(ty) + ".r16";
+		}
+
+		/** @brief Returns the file name of the info file that stores the dimensions of a tile set */
+		static std::string getInfoFileName(const std::string &basePath)
+		{
+			return basePath + ".tiles";
+		}
+
+		/**
+		* Read the dimensions of a tile set written by writeTiles
+		*
+		* @param basePath Path and name prefix of the tile files
+		* @param dim Receives the width and height of the height field in samples
+		* @param tileSize Receives the width and height of a single tile in samples
+		*
+		* @return False if there is no complete tile set at basePath
+		*/
+		static bool readInfo(const std::string &basePath, uint32_t &dim, uint32_t &tileSize)
+		{
+			std::ifstream file(getInfoFileName(basePath), std::ios::binary);
+			uint32_t info[2];
+			if (!file.is_open() || !file.read(reinterpret_cast<char*>(info), sizeof(info)) || (info[0] == 0) || (info[1] == 0))
+			{
+				return false;
+			}
+			dim = info[0];
+			tileSize = info[1];
+			return true;
+		}
+
+		/**
+		* Split a height field into tile files that can be used with this class
+		*
+		* @param heights Raw 16 bit heights of the height field
+		* @param dim Width and height of the height field in samples
+		* @param tileSize Width and height of a single tile in samples
+		* @param basePath Path and name prefix of the tile files
+		*
+		* @return True if all tiles have been written
+		*
+		* @note The info file is written last, so readInfo only succeeds for complete tile sets
+		*/
+		static bool writeTiles(const uint16_t *heights, uint32_t dim, uint32_t tileSize, const std::string &basePath)
+		{
+			const uint32_t tileCount = (dim + tileSize - 1) / tileSize;
+			std::vector<uint16_t> tile(tileSize * tileSize);
+			for (uint32_t ty = 0; ty < tileCount; ty++)
+			{
+				for (uint32_t tx = 0; tx < tileCount; tx++)
+				{
+					for (uint32_t y = 0; y < tileSize; y++)
+					{
+						for (uint32_t x = 0; x < tileSize; x++)
+						{
+							const uint32_t sx = std::min(tx * tileSize + x, dim - 1);
+							const uint32_t sy = std::min(ty * tileSize + y, dim - 1);
+							tile[y * tileSize + x] = heights[sy * dim + sx];
+						}
+					}
+					std::ofstream file(getTileFileName(basePath, tx, ty), std::ios::binary);
+					if (!file.is_open() || !file.write(reinterpret_cast<const char*>(tile.data()), tile.size() * sizeof(uint16_t)))
+					{
+						return false;
+					}
+				}
+			}
+			std::ofstream file(getInfoFileName(basePath), std::ios::binary);
+			const uint32_t info[2] = { dim, tileSize };
+			return file.is_open() && file.write(reinterpret_cast<const char*>(info), sizeof(info));
+		}
+
+		/** @brief Returns the number of tiles that are currently kept in memory */
+		uint32_t getCachedTileCount()
+		{
+			std::lock_guard<std::mutex> lock(tileMutex);
+			return static_cast<uint32_t>(tiles.size());
+		}
+
+		/** @brief Returns the number of tiles that have been read from disk (including reloads of evicted tiles) */
+		uint32_t getLoadedTileCount()
+		{
+			return loadedTiles.load();
+		}
+
+		/** @brief Returns the max. number of tiles kept in memory */
+		uint32_t getMaxCachedTiles()
+		{
+			return maxCachedTiles;
+		}
+
+		uint32_t getDim()
+		{
+			return dim;
+		}
+
+		void getGrid(int32_t x0, int32_t y0, uint32_t stride, uint32_t count, float *dst)
+		{
+			const int32_t max = static_cast<int32_t>(dim) - 1;
+			std::shared_ptr<const std::vector<uint16_t>> tile;
+			uint32_t currentTx = UINT32_MAX, currentTy = UINT32_MAX;
+			for (uint32_t y = 0; y < count; y++)
+			{
+				const uint32_t sy = static_cast<uint32_t>(std::max(0, std::min(y0 + static_cast<int32_t>(y * stride), max)));
+				for (uint32_t x = 0; x < count; x++)
+				{
+					const uint32_t sx = static_cast<uint32_t>(std::max(0, std::min(x0 + static_cast<int32_t>(x * stride), max)));
+					const uint32_t tx = sx / tileSize;
+					const uint32_t ty = sy / tileSize;
+					if ((tx != currentTx) || (ty != currentTy))
+					{
+						tile = getTile(tx, ty);
+						currentTx = tx;
+						currentTy = ty;
+					}
+					dst[y * count + x] = (*tile)[(sy % tileSize) * tileSize + (sx % tileSize)] / 65535.0f;
+				}
+			}
+		}
+	};
+
+	/**
+	* Quadtree based terrain made of fixed resolution chunks
+	*
+	* Each quadtree level halves the sample spacing of its parent, so all chunks have the same number of vertices and share one index buffer
+	* Chunks are selected by distance to the camera (and optionally culled against a frustum), missing chunks are generated on worker threads
+	* and streamed into a fixed size vertex pool, evicting the least recently used chunks once it's full
+	* Until the children of a chunk are resident, the chunk itself is drawn, and skirts along the chunk borders hide cracks between different levels
+	*/
+	class ChunkedTerrain
+	{
+	public:
+		struct Settings {
+			/** @brief Number of quads along each edge of a chunk */
+			uint32_t chunkResolution = 32;
+			/** @brief A chunk is split into its children if the camera is closer than this factor times the chunk's size */
+			float lodDistance = 2.0f;
+			/** @brief Max. number of chunks resident in the vertex pool */
+			uint32_t maxResidentChunks = 512;
+			/** @brief Max. number of generated chunks uploaded per update */
+			uint32_t maxUploadsPerUpdate = 16;
+			/** @brief Min. skirt depth in multiples of the sample spacing of a chunk */
+			float skirtDepth = 4.0f;
+		} settings;
+
+		struct Statistics {
+			uint32_t drawnChunks = 0;
+			uint32_t residentChunks = 0;
+			uint32_t pendingChunks = 0;
+			uint32_t uploadedChunks = 0;
+			uint32_t evictedChunks = 0;
+			uint32_t triangles = 0;
+		} stats;
+
+		uint32_t indexCount = 0;
+		uint32_t verticesPerChunk = 0;
+
+		/**
+		* Create a chunked terrain
+		*
+		* @param jobSystem (Optional) Job system whose worker threads generate the chunks (chunks are generated on the calling thread if not set)
+		*/
+		ChunkedTerrain(vks::VulkanDevice *device, VkQueue copyQueue, vks::JobSystem *jobSystem = nullptr)
+		{
+			this->device = device;
+			this->copyQueue = copyQueue;
+			this->jobSystem = jobSystem;
+		}
+
+		~ChunkedTerrain()
+		{
+			// Chunk jobs may still be reading from the height source
+			if (jobSystem)
+			{
+				jobSystem->wait(chunkCounter);
+			}
+			vertexBuffer.destroy();
+			indexBuffer.destroy();
+			stagingBuffer.destroy();
+		}
+
+		/**
+		* Setup the quadtree and GPU buffers, the root chunk is generated before this function returns
+		* Settings need to be changed before calling this
+		*
+		* @param source Height source, must stay valid for the lifetime of the terrain
+		* @param scale Size of one sample in world units (x and z) and height for a normalized height of one (y)
+		* @param uvScale Scale for the texture coordinates, which span [0..uvScale] over the whole height field
+		*/
+		void create(HeightSource *source, glm::vec3 scale, float uvScale = 1.0f)
+		{
+			assert(device);
+			assert(copyQueue != VK_NULL_HANDLE);
+			assert(source && (source->getDim() > 1));
+			this->source = source;
+			this->scale = scale;
+			this->uvScale = uvScale;
+
+			const uint32_t res = settings.chunkResolution;
+			// Number of levels required for the finest level to use every sample of the height field
+			maxLevel = 0;
+			while ((res << maxLevel) < source->getDim() - 1)
+			{
+				maxLevel++;
+			}
+			rootSize = res << maxLevel;
+
+			// Complete quadtree, node bounds are refined once a chunk has been generated
+			levelOffsets.resize(maxLevel + 1);
+			uint32_t nodeCount = 0;
+			for (uint32_t level = 0; level <= maxLevel; level++)
+			{
+				levelOffsets[level] = nodeCount;
+				nodeCount += (1 << level) * (1 << level);
+			}
+			nodes.resize(nodeCount);
+			for (uint32_t level = 0; level <= maxLevel; level++)
+			{
+				const uint32_t count = 1 << level;
+				const float size = getChunkSize(level);
+				for (uint32_t y = 0; y < count; y++)
+				{
+					for (uint32_t x = 0; x < count; x++)
+					{
+						Node &node = nodes[getNodeIndex(level, x, y)];
+						node.level = level;
+						node.x = x;
+						node.y = y;
+						node.min = glm::vec3(getWorldX(x * (res << (maxLevel - level))), -scale.y, getWorldZ(y * (res << (maxLevel - level))));
+						node.max = glm::vec3(node.min.x + size, scale.y, node.min.z + size);
+					}
+				}
+			}
+
+			// Shared index buffer
+			const uint32_t rowSize = res + 1;
+			verticesPerChunk = rowSize * rowSize + 4 * rowSize;
+			assert(verticesPerChunk <= 65536);
+			std::vector<uint16_t> indices;
+			for (uint32_t y = 0; y < res; y++)
+			{
+				for (uint32_t x = 0; x < res; x++)
+				{
+					const uint16_t a = static_cast<uint16_t>(x + y * rowSize);
+					const uint16_t b = static_cast<uint16_t>(a + rowSize);
+					indices.insert(indices.end(), { a, b, static_cast<uint16_t>(b + 1), static_cast<uint16_t>(b + 1), static_cast<uint16_t>(a + 1), a });
+				}
+			}
+			// Skirts are drawn with both windings as they may be seen from either side
+			for (uint32_t edge = 0; edge < 4; edge++)
+			{
+				for (uint32_t i = 0; i < res; i++)
+				{
+					const uint16_t t0 = static_cast<uint16_t>(getEdgeVertex(edge, i));
+					const uint16_t t1 = static_cast<uint16_t>(getEdgeVertex(edge, i + 1));
+					const uint16_t s0 = static_cast<uint16_t>(rowSize * rowSize + edge * rowSize + i);
+					const uint16_t s1 = static_cast<uint16_t>(s0 + 1);
+					indices.insert(indices.end(), { t0, s0, s1, s1, t1, t0, t0, s1, s0, s1, t0, t1 });
+				}
+			}
+			indexCount = static_cast<uint32_t>(indices.size());
+
+			const VkDeviceSize chunkBufferSize = verticesPerChunk * sizeof(HeightMap::Vertex);
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vertexBuffer,
+				chunkBufferSize * settings.maxResidentChunks));
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&indexBuffer,
+				indices.size() * sizeof(uint16_t)));
+			const VkDeviceSize indexBufferSize = indices.size() * sizeof(uint16_t);
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&stagingBuffer,
+				std::max(chunkBufferSize * settings.maxUploadsPerUpdate, indexBufferSize)));
+			VK_CHECK_RESULT(stagingBuffer.map());
+
+			memcpy(stagingBuffer.mapped, indices.data(), indexBufferSize);
+			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			VkBufferCopy copyRegion = {};
+			copyRegion.size = indexBufferSize;
+			vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, indexBuffer.buffer, 1, &copyRegion);
+			device->flushCommandBuffer(copyCmd, copyQueue, true);
+
+			slotNodes.resize(settings.maxResidentChunks, 0);
+			freeSlots.resize(settings.maxResidentChunks);
+			for (uint32_t i = 0; i < settings.maxResidentChunks; i++)
+			{
+				freeSlots[i] = settings.maxResidentChunks - 1 - i;
+			}
+
+			// The root chunk is always resident, so there's always something to draw
+			ChunkData root;
+			generateChunk(0, root);
+			std::vector<ChunkData> chunks;
+			chunks.push_back(std::move(root));
+			uploadChunks(chunks);
+			drawList.push_back(0);
+		}
+
+		/**
+		* Select the chunks to draw for the given camera position, upload chunks that have been generated and request missing ones
+		*
+		* @param cameraPos Camera position in world space
+		* @param frustum (Optional) Frustum used to cull chunks
+		*
+		* @return True if the list of drawn chunks has changed (command buffers containing draw calls need to be rebuilt)
+		*/
+		bool update(const glm::vec3 &cameraPos, vks::Frustum *frustum = nullptr)
+		{
+			frame++;
+			stats.uploadedChunks = 0;
+			stats.evictedChunks = 0;
+
+			// Upload finished chunks (coarsest first)
+			{
+				std::lock_guard<std::mutex> lock(chunkMutex);
+				for (auto &chunk : finishedChunks)
+				{
+					readyChunks.push_back(std::move(chunk));
+				}
+				finishedChunks.clear();
+			}
+			if (!readyChunks.empty())
+			{
+				std::sort(readyChunks.begin(), readyChunks.end(), [this](const ChunkData &a, const ChunkData &b) { return nodes[a.node].level < nodes[b.node].level; });
+				const size_t uploadCount = std::min(readyChunks.size(), static_cast<size_t>(settings.maxUploadsPerUpdate));
+				std::vector<ChunkData> chunks(std::make_move_iterator(readyChunks.begin()), std::make_move_iterator(readyChunks.begin() + uploadCount));
+				readyChunks.erase(readyChunks.begin(), readyChunks.begin() + uploadCount);
+				uploadChunks(chunks);
+			}
+
+			// Select chunks
+			std::vector<uint32_t> newDrawList;
+			std::vector<uint32_t> requests;
+			selectChunks(0, cameraPos, frustum, newDrawList, requests);
+
+			// Request missing chunks, coarser levels and closer chunks first
+			std::sort(requests.begin(), requests.end(), [&](uint32_t a, uint32_t b) {
+				if (nodes[a].level != nodes[b].level)
+				{
+					return nodes[a].level < nodes[b].level;
+				}
+				return getDistance(nodes[a], cameraPos) < getDistance(nodes[b], cameraPos);
+			});
+			const uint32_t maxPendingChunks = std::max(getThreadCount(), 1u) * 4;
+			for (auto index : requests)
+			{
+				if (pendingChunks >= maxPendingChunks)
+				{
+					break;
+				}
+				requestChunk(index);
+			}
+
+			const bool changed = (newDrawList != drawList);
+			drawList = std::move(newDrawList);
+
+			stats.drawnChunks = static_cast<uint32_t>(drawList.size());
+			stats.residentChunks = settings.maxResidentChunks - static_cast<uint32_t>(freeSlots.size());
+			stats.pendingChunks = pendingChunks;
+			stats.triangles = stats.drawnChunks * settings.chunkResolution * settings.chunkResolution * 2;
+			return changed;
+		}
+
+		/** @brief Draw the selected chunks, the terrain's vertex and index buffers are bound by this function */
+		void draw(VkCommandBuffer commandBuffer, uint32_t vertexBindingId = 0)
+		{
+			VkDeviceSize offsets[1] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffer, vertexBindingId, 1, &vertexBuffer.buffer, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+			for (auto index : drawList)
+			{
+				vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, nodes[index].slot * static_cast<int32_t>(verticesPerChunk), 0);
+			}
+		}
+
+		/** @brief Returns the number of worker threads used for chunk generation (0 = calling thread only) */
+		uint32_t getThreadCount()
+		{
+			// The thread that created the job system only executes jobs while waiting
+			return jobSystem ? jobSystem->getThreadCount() - 1 : 0;
+		}
+
+		/** @brief Returns the number of quadtree levels */
+		uint32_t getLevelCount()
+		{
+			return maxLevel + 1;
+		}
+
+	private:
+		vks::VulkanDevice *device = nullptr;
+		VkQueue copyQueue = VK_NULL_HANDLE;
+		HeightSource *source = nullptr;
+		glm::vec3 scale;
+		float uvScale;
+		uint32_t maxLevel;
+		uint32_t rootSize;
+
+		vks::Buffer vertexBuffer;
+		vks::Buffer indexBuffer;
+		vks::Buffer stagingBuffer;
+
+		struct Node {
+			uint32_t level;
+			// Position in chunks at the node's level
+			uint32_t x, y;
+			// World space bounds (conservative until the chunk has been generated)
+			glm::vec3 min, max;
+			// Slot in the vertex pool (-1 if not resident)
+			int32_t slot = -1;
+			bool pending = false;
+			uint64_t lastUsed = 0;
+			uint64_t lastRequested = 0;
+		};
+		std::vector<Node> nodes;
+		std::vector<uint32_t> levelOffsets;
+		std::vector<uint32_t> drawList;
+		std::vector<uint32_t> freeSlots;
+		// Node occupying each vertex pool slot (only valid for used slots)
+		std::vector<int32_t> slotNodes;
+		uint64_t frame = 0;
+
+		struct ChunkData {
+			uint32_t node;
+			std::vector<HeightMap::Vertex> vertices;
+			float minY, maxY;
+		};
+		vks::JobSystem *jobSystem;
+		vks::JobCounter chunkCounter;
+		std::mutex chunkMutex;
+		// Chunks finished by the worker threads
+		std::vector<ChunkData> finishedChunks;
+		// Chunks waiting for upload (only accessed by the updating thread)
+		std::vector<ChunkData> readyChunks;
+		uint32_t pendingChunks = 0;
+
+		uint32_t getNodeIndex(uint32_t level, uint32_t x, uint32_t y)
+		{
+			return levelOffsets[level] + y * (1 << level) + x;
+		}
+
+		float getWorldX(float sx)
+		{
+			return (sx - source->getDim() / 2.0f) * scale.x;
+		}
+
+		float getWorldZ(float sy)
+		{
+			return (sy - source->getDim() / 2.0f) * scale.z;
+		}
+
+		// Size of a chunk at the given level in world units
+		float getChunkSize(uint32_t level)
+		{
+			return (rootSize >> level) * scale.x;
+		}
+
+		// Vertex index of the i-th vertex along an edge (0 = top, 1 = bottom, 2 = left, 3 = right)
+		uint32_t getEdgeVertex(uint32_t edge, uint32_t i)
+		{
+			const uint32_t res = settings.chunkResolution;
+			switch (edge)
+			{
+			case 0: return i;
+			case 1: return res * (res + 1) + i;
+			case 2: return i * (res + 1);
+			default: return i * (res + 1) + res;
+			}
+		}
+
+		float getDistance(const Node &node, const glm::vec3 &pos)
+		{
+			return glm::length(glm::max(glm::max(node.min - pos, pos - node.max), glm::vec3(0.0f)));
+		}
+
+		// Generate the vertices of a chunk, called from the worker threads
+		void generateChunk(uint32_t index, ChunkData &chunk)
+		{
+			const Node &node = nodes[index];
+			const uint32_t res = settings.chunkResolution;
+			const uint32_t stride = 1 << (maxLevel - node.level);
+			const uint32_t rowSize = res + 1;
+			const int32_t x0 = static_cast<int32_t>(node.x * res * stride);
+			const int32_t y0 = static_cast<int32_t>(node.y * res * stride);
+
+			// Heights include a one sample border for calculating the normals without additional lookups
+			const uint32_t gridSize = res + 3;
+			std::vector<float> heights(gridSize * gridSize);
+			source->getGrid(x0 - static_cast<int32_t>(stride), y0 - static_cast<int32_t>(stride), stride, gridSize, heights.data());
+
+			chunk.node = index;
+			chunk.vertices.resize(verticesPerChunk);
+			chunk.minY = FLT_MAX;
+			chunk.maxY = -FLT_MAX;
+			const float dx = 2.0f * stride * scale.x;
+			const float dz = 2.0f * stride * scale.z;
+			for (uint32_t y = 0; y < rowSize; y++)
+			{
+				for (uint32_t x = 0; x < rowSize; x++)
+				{
+					const float *h = &heights[(y + 1) * gridSize + (x + 1)];
+					const float sx = static_cast<float>(x0 + x * stride);
+					const float sy = static_cast<float>(y0 + y * stride);
+					HeightMap::Vertex &vertex = chunk.vertices[y * rowSize + x];
+					vertex.pos = glm::vec3(getWorldX(sx), -h[0] * scale.y, getWorldZ(sy));
+					vertex.uv = glm::vec2(sx, sy) / static_cast<float>(source->getDim()) * uvScale;
+					// Central differences, normals are encoded the same way as for the HeightMap class
+					const float gx = (h[1] - h[-1]) * scale.y / dx;
+					const float gz = (h[gridSize] - h[-static_cast<int32_t>(gridSize)]) * scale.y / dz;
+					vertex.normal = (glm::normalize(glm::vec3(-gx, 1.0f, -gz)) + 1.0f) * 0.5f;
+					chunk.minY = std::min(chunk.minY, vertex.pos.y);
+					chunk.maxY = std::max(chunk.maxY, vertex.pos.y);
+				}
+			}
+
+			// Skirts hang down from the chunk borders (positive y is down), deep enough to cover the height differences to neighbouring levels
+			const float skirtDepth = std::max(settings.skirtDepth * stride * scale.x, (chunk.maxY - chunk.minY) * 0.25f);
+			for (uint32_t edge = 0; edge < 4; edge++)
+			{
+				for (uint32_t i = 0; i < rowSize; i++)
+				{
+					HeightMap::Vertex &vertex = chunk.vertices[rowSize * rowSize + edge * rowSize + i];
+					vertex = chunk.vertices[getEdgeVertex(edge, i)];
+					vertex.pos.y += skirtDepth;
+				}
+			}
+			chunk.maxY += skirtDepth;
+		}
+
+		void requestChunk(uint32_t index)
+		{
+			Node &node = nodes[index];
+			if (node.pending || (node.slot >= 0))
+			{
+				return;
+			}
+			node.pending = true;
+			pendingChunks++;
+			auto job = [this, index] {
+				ChunkData chunk;
+				generateChunk(index, chunk);
+				std::lock_guard<std::mutex> lock(chunkMutex);
+				finishedChunks.push_back(std::move(chunk));
+			};
+			if (getThreadCount() == 0)
+			{
+				job();
+			}
+			else
+			{
+				jobSystem->addJob(job, &chunkCounter);
+			}
+		}
+
+		// Returns a free vertex pool slot, evicting the least recently used chunk if required (-1 if all chunks are in use)
+		int32_t allocateSlot()
+		{
+			if (freeSlots.empty())
+			{
+				// Chunks used by the last selection and the root chunk are never evicted
+				int32_t lru = -1;
+				for (auto index : slotNodes)
+				{
+					const Node &node = nodes[index];
+					if ((index != 0) && (node.lastUsed + 1 < frame) && ((lru < 0) || (node.lastUsed < nodes[lru].lastUsed)))
+					{
+						lru = index;
+					}
+				}
+				if (lru < 0)
+				{
+					return -1;
+				}
+				freeSlots.push_back(nodes[lru].slot);
+				nodes[lru].slot = -1;
+				stats.evictedChunks++;
+			}
+			const int32_t slot = static_cast<int32_t>(freeSlots.back());
+			freeSlots.pop_back();
+			return slot;
+		}
+
+		// Copy generated chunks into the vertex pool
+		// Note: Evicted slots are overwritten right away, so this must only be called when the vertex buffer is not in use by the GPU
+		void uploadChunks(std::vector<ChunkData> &chunks)
+		{
+			const VkDeviceSize chunkBufferSize = verticesPerChunk * sizeof(HeightMap::Vertex);
+			std::vector<VkBufferCopy> copyRegions;
+			for (auto &chunk : chunks)
+			{
+				Node &node = nodes[chunk.node];
+				node.pending = false;
+				pendingChunks = (pendingChunks > 0) ? pendingChunks - 1 : 0;
+				// Skip chunks that are no longer needed
+				if ((chunk.node != 0) && (node.lastRequested + 1 < frame))
+				{
+					continue;
+				}
+				const int32_t slot = allocateSlot();
+				if (slot < 0)
+				{
+					continue;
+				}
+				node.slot = slot;
+				slotNodes[slot] = chunk.node;
+				node.min.y = chunk.minY;
+				node.max.y = chunk.maxY;
+
+				VkBufferCopy copyRegion = {};
+				copyRegion.srcOffset = copyRegions.size() * chunkBufferSize;
+				copyRegion.dstOffset = slot * chunkBufferSize;
+				copyRegion.size = chunkBufferSize;
+				memcpy(static_cast<uint8_t*>(stagingBuffer.mapped) + copyRegion.srcOffset, chunk.vertices.data(), chunkBufferSize);
+				copyRegions.push_back(copyRegion);
+				stats.uploadedChunks++;
+			}
+			if (!copyRegions.empty())
+			{
+				VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+				vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, vertexBuffer.buffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+				device->flushCommandBuffer(copyCmd, copyQueue, true);
+			}
+		}
+
+		void selectChunks(uint32_t index, const glm::vec3 &cameraPos, vks::Frustum *frustum, std::vector<uint32_t> &selected, std::vector<uint32_t> &requests)
+		{
+			Node &node = nodes[index];
+			if (frustum && !frustum->checkSphere((node.min + node.max) * 0.5f, glm::length(node.max - node.min) * 0.5f))
+			{
+				return;
+			}
+			node.lastUsed = frame;
+
+			const bool resident = (node.slot >= 0);
+			if (!resident)
+			{
+				node.lastRequested = frame;
+				requests.push_back(index);
+			}
+
+			const bool split = (node.level < maxLevel) && (getDistance(node, cameraPos) < settings.lodDistance * getChunkSize(node.level));
+			if ((node.level < maxLevel) && (split || !resident))
+			{
+				uint32_t children[4];
+				bool childrenResident = true;
+				for (uint32_t i = 0; i < 4; i++)
+				{
+					children[i] = getNodeIndex(node.level + 1, node.x * 2 + (i % 2), node.y * 2 + (i / 2));
+					Node &child = nodes[children[i]];
+					if (child.slot < 0)
+					{
+						childrenResident = false;
+						if (split)
+						{
+							child.lastRequested = frame;
+							requests.push_back(children[i]);
+						}
+					}
+				}
+				// Draw the children once all of them are available, otherwise fall back to this chunk
+				if (childrenResident)
+				{
+					for (uint32_t i = 0; i < 4; i++)
+					{
+						selectChunks(children[i], cameraPos, frustum, selected, requests);
+					}
+					return;
+				}
+			}
+
+			if (resident)
+			{
+				selected.push_back(index);
+			}
+		}
+	};
 }
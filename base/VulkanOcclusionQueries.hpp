@@ -0,0 +1,211 @@
+/*
+* Occlusion query manager
+*
+* Manages occlusion queries for a large number of objects without stalling the CPU on the results
+* Each frame in flight (e.g. each swap chain image) gets its own query pool, results are copied in one batch into a host visible buffer on the GPU
+* The host only reads results whose availability has been signaled, objects without a (recent) result are treated as visible
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+#include "vulkan/vulkan.h"
+#include "VulkanInitializers.hpp"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+
+namespace vks
+{
+	class OcclusionQueryManager
+	{
+	public:
+		/** @brief Results that haven't been refreshed for this number of resolves are discarded and the object is treated as visible again */
+		uint32_t maxResultAge = 8;
+
+		/**
+		* Create the query pools and the result buffer
+		*
+		* @param device Vulkan device
+		* @param queryCount Maximum number of queries (objects) per frame
+		* @param frameCount Number of frames that can be in flight, each one gets a separate query pool
+		*/
+		OcclusionQueryManager(vks::VulkanDevice *device, uint32_t queryCount, uint32_t frameCount)
+		{
+			this->device = device;
+			this->queryCount = queryCount;
+
+			frames.resize(frameCount);
+			for (auto &frame : frames)
+			{
+				VkQueryPoolCreateInfo queryPoolInfo = {};
+				queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				queryPoolInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
+				queryPoolInfo.queryCount = queryCount;
+				VK_CHECK_RESULT(vkCreateQueryPool(device->logicalDevice, &queryPoolInfo, nullptr, &frame.queryPool));
+			}
+
+			// Each query writes its sample count and an availability value (both 64 bit)
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&resultBuffer,
+				getFrameResultSize() * frameCount));
+			VK_CHECK_RESULT(resultBuffer.map());
+			memset(resultBuffer.mapped, 0, resultBuffer.size);
+
+			results.resize(queryCount);
+		}
+
+		~OcclusionQueryManager()
+		{
+			for (auto &frame : frames)
+			{
+				vkDestroyQueryPool(device->logicalDevice, frame.queryPool, nullptr);
+			}
+			resultBuffer.destroy();
+		}
+
+		/** @brief Reset the frame's queries, must be recorded outside of a render pass before any query of this frame */
+		void cmdReset(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+		{
+			vkCmdResetQueryPool(commandBuffer, frames[frameIndex].queryPool, 0, queryCount);
+			frames[frameIndex].usedQueries = 0;
+		}
+
+		/**
+		* Begin an occlusion query for an object
+		*
+		* @param query Index of the object's query (0 .. queryCount - 1)
+		* @param precise Request exact sample counts instead of a boolean result (requires the occlusionQueryPrecise feature)
+		*/
+		void cmdBeginQuery(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t query, bool precise = false)
+		{
+			assert(query < queryCount);
+			vkCmdBeginQuery(commandBuffer, frames[frameIndex].queryPool, query, precise ? VK_QUERY_CONTROL_PRECISE_BIT : 0);
+			frames[frameIndex].usedQueries = std::max(frames[frameIndex].usedQueries, query + 1);
+		}
+
+		void cmdEndQuery(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t query)
+		{
+			vkCmdEndQuery(commandBuffer, frames[frameIndex].queryPool, query);
+		}
+
+		/**
+		* Copy the results of all queries used in this frame into the host visible result buffer
+		* Must be recorded outside of a render pass after the last query of the frame has ended
+		* The copy waits on the GPU for the queries to finish, the CPU never waits for it
+		*/
+		void cmdCopyResults(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+		{
+			const Frame &frame = frames[frameIndex];
+			if (frame.usedQueries == 0)
+			{
+				return;
+			}
+			const VkDeviceSize offset = getFrameResultSize() * frameIndex;
+			vkCmdCopyQueryPoolResults(
+				commandBuffer,
+				frame.queryPool,
+				0,
+				frame.usedQueries,
+				resultBuffer.buffer,
+				offset,
+				sizeof(uint64_t) * 2,
+				VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+			// Make the results visible to the host
+			VkBufferMemoryBarrier barrier = vks::initializers::bufferMemoryBarrier();
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			barrier.buffer = resultBuffer.buffer;
+			barrier.offset = offset;
+			barrier.size = getFrameResultSize();
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		}
+
+		/**
+		* Pick up the results that the GPU has copied for a frame since the last call, never blocks
+		* Call this before the frame's command buffer is submitted again, the results are then from the frame's previous submission (frameCount frames ago)
+		*
+		* @return Number of queries that received a new result
+		*/
+		uint32_t resolve(uint32_t frameIndex)
+		{
+			resolveCount++;
+			uint64_t *data = reinterpret_cast<uint64_t*>(reinterpret_cast<uint8_t*>(resultBuffer.mapped) + getFrameResultSize() * frameIndex);
+			uint32_t resolved = 0;
+			for (uint32_t i = 0; i < frames[frameIndex].usedQueries; i++)
+			{
+				uint64_t *result = &data[i * 2];
+				if (result[1] != 0)
+				{
+					results[i].passedSamples = result[0];
+					results[i].resolvedAt = resolveCount;
+					results[i].valid = true;
+					// Clear the availability so results are only picked up once
+					result[1] = 0;
+					resolved++;
+				}
+			}
+			return resolved;
+		}
+
+		/** @brief Returns true if a recent result for the query exists */
+		bool hasResult(uint32_t query) const
+		{
+			return results[query].valid && (resolveCount - results[query].resolvedAt <= maxResultAge);
+		}
+
+		/** @brief Returns false only if the latest result for the query passed no samples (conservative for queries without a result) */
+		bool isVisible(uint32_t query) const
+		{
+			return !hasResult(query) || (results[query].passedSamples > 0);
+		}
+
+		/** @brief Returns the number of samples that passed in the latest result (0 if there is none) */
+		uint64_t getPassedSamples(uint32_t query) const
+		{
+			return hasResult(query) ? results[query].passedSamples : 0;
+		}
+
+		uint32_t getQueryCount() const
+		{
+			return queryCount;
+		}
+
+	private:
+		vks::VulkanDevice *device;
+		uint32_t queryCount;
+
+		struct Frame {
+			VkQueryPool queryPool;
+			// Number of queries recorded for this frame (highest index + 1)
+			uint32_t usedQueries = 0;
+		};
+		std::vector<Frame> frames;
+
+		vks::Buffer resultBuffer;
+
+		struct Result {
+			uint64_t passedSamples = 0;
+			uint32_t resolvedAt = 0;
+			bool valid = false;
+		};
+		std::vector<Result> results;
+		uint32_t resolveCount = 0;
+
+		VkDeviceSize getFrameResultSize() const
+		{
+			return sizeof(uint64_t) * 2 * queryCount;
+		}
+	};
+}
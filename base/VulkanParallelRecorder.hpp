@@ -0,0 +1,175 @@
+/*
+* Parallel secondary command buffer recording
+*
+* Splits the draws of a render pass into chunks that are recorded into secondary command buffers on the job system
+* Every thread has its own command pool per frame (and pass), so no pool is ever accessed concurrently and the
+* pools of a frame can be reset in one go when the frame is recorded again
+* The secondary command buffers are executed in item order from the primary command buffer
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+#include "jobsystem.hpp"
+
+namespace vks
+{
+	class ParallelRecorder
+	{
+	public:
+		/** @brief Records the items [firstItem, lastItem) into a secondary command buffer that has already been begun */
+		typedef std::function<void(VkCommandBuffer commandBuffer, uint32_t firstItem, uint32_t lastItem)> RecordFunction;
+
+		/** @brief Minimum number of items recorded into one secondary command buffer, smaller chunks cost more than they save */
+		uint32_t minItemsPerCommandBuffer = 32;
+
+		/**
+		* @param device Logical device
+		* @param queueFamilyIndex Queue family the primary command buffers are submitted to
+		* @param jobSystem Job system used for recording, one command pool per frame is created for each of its threads
+		*/
+		ParallelRecorder(VkDevice device, uint32_t queueFamilyIndex, vks::JobSystem *jobSystem)
+		{
+			this->device = device;
+			this->queueFamilyIndex = queueFamilyIndex;
+			this->jobSystem = jobSystem;
+		}
+
+		~ParallelRecorder()
+		{
+			for (auto &slot : slots)
+			{
+				for (auto &pool : slot.pools)
+				{
+					vkDestroyCommandPool(device, pool.commandPool, nullptr);
+				}
+			}
+		}
+
+		/**
+		* Record items into secondary command buffers in parallel and execute them from a primary command buffer
+		* The primary command buffer must be inside a render pass instance begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+		* Recording the same frame and pass again resets the secondary command buffers recorded for it before,
+		* so the previous contents must not be in use by the GPU anymore
+		*
+		* @param commandBuffer Primary command buffer the secondary command buffers are executed from
+		* @param frameIndex Index of the frame (e.g. the swap chain image) the primary command buffer belongs to
+		* @param inheritanceInfo Render pass, subpass and framebuffer the secondary command buffers are used with
+		* @param itemCount Number of items (e.g. draws) to record
+		* @param recordItems Function that records a range of items, called concurrently from different threads
+		* @param pass (Optional) Index used to keep several parallel recordings of the same frame apart (e.g. one per render pass)
+		*/
+		void record(VkCommandBuffer commandBuffer, uint32_t frameIndex, const VkCommandBufferInheritanceInfo &inheritanceInfo, uint32_t itemCount, const RecordFunction &recordItems, uint32_t pass = 0)
+		{
+			Slot &slot = getSlot(frameIndex, pass);
+			for (auto &pool : slot.pools)
+			{
+				VK_CHECK_RESULT(vkResetCommandPool(device, pool.commandPool, 0));
+				pool.usedCommandBuffers = 0;
+			}
+			if (itemCount == 0)
+			{
+				return;
+			}
+
+			// A few chunks per thread, so threads that finish early can steal the remaining ones
+			const uint32_t maxChunkCount = std::max(jobSystem->getThreadCount() * 4, 1u);
+			const uint32_t chunkCount = std::min((itemCount + minItemsPerCommandBuffer - 1) / std::max(minItemsPerCommandBuffer, 1u), maxChunkCount);
+			const uint32_t chunkSize = (itemCount + chunkCount - 1) / chunkCount;
+
+			slot.commandBuffers.resize(chunkCount);
+			Slot *recordSlot = &slot;
+			const VkCommandBufferInheritanceInfo *inheritance = &inheritanceInfo;
+			const RecordFunction *function = &recordItems;
+			vks::JobCounter counter;
+			for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+			{
+				const uint32_t firstItem = chunk * chunkSize;
+				const uint32_t lastItem = std::min(firstItem + chunkSize, itemCount);
+				jobSystem->addJob([this, recordSlot, inheritance, function, chunk, firstItem, lastItem] {
+					VkCommandBuffer secondary = getCommandBuffer(recordSlot->pools[jobSystem->getThreadIndex()]);
+					VkCommandBufferBeginInfo beginInfo = vks::initializers::commandBufferBeginInfo();
+					beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+					beginInfo.pInheritanceInfo = inheritance;
+					VK_CHECK_RESULT(vkBeginCommandBuffer(secondary, &beginInfo));
+					(*function)(secondary, firstItem, lastItem);
+					VK_CHECK_RESULT(vkEndCommandBuffer(secondary));
+					recordSlot->commandBuffers[chunk] = secondary;
+				}, &counter);
+			}
+			jobSystem->wait(counter);
+
+			// Chunks are stored in item order, no matter which thread recorded them
+			vkCmdExecuteCommands(commandBuffer, chunkCount, slot.commandBuffers.data());
+		}
+
+	private:
+		VkDevice device;
+		uint32_t queueFamilyIndex;
+		vks::JobSystem *jobSystem;
+
+		struct ThreadCommandPool {
+			VkCommandPool commandPool;
+			// Command buffers are kept across resets of the pool and reused
+			std::vector<VkCommandBuffer> commandBuffers;
+			uint32_t usedCommandBuffers = 0;
+		};
+
+		// Command pools of all threads for one frame and pass
+		struct Slot {
+			uint32_t frameIndex;
+			uint32_t pass;
+			std::vector<ThreadCommandPool> pools;
+			std::vector<VkCommandBuffer> commandBuffers;
+		};
+		std::vector<Slot> slots;
+
+		Slot &getSlot(uint32_t frameIndex, uint32_t pass)
+		{
+			for (auto &slot : slots)
+			{
+				if (slot.frameIndex == frameIndex && slot.pass == pass)
+				{
+					return slot;
+				}
+			}
+			Slot slot;
+			slot.frameIndex = frameIndex;
+			slot.pass = pass;
+			slot.pools.resize(jobSystem->getThreadCount());
+			for (auto &pool : slot.pools)
+			{
+				VkCommandPoolCreateInfo commandPoolInfo = vks::initializers::commandPoolCreateInfo();
+				commandPoolInfo.queueFamilyIndex = queueFamilyIndex;
+				commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+				VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolInfo, nullptr, &pool.commandPool));
+			}
+			slots.push_back(slot);
+			return slots.back();
+		}
+
+		/** @brief Returns the next unused secondary command buffer of a thread's pool, only called from the thread owning the pool */
+		VkCommandBuffer getCommandBuffer(ThreadCommandPool &pool)
+		{
+			if (pool.usedCommandBuffers == pool.commandBuffers.size())
+			{
+				VkCommandBufferAllocateInfo allocateInfo = vks::initializers::commandBufferAllocateInfo(pool.commandPool, VK_COMMAND_BUFFER_LEVEL_SECONDARY, 1);
+				VkCommandBuffer commandBuffer;
+				VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer));
+				pool.commandBuffers.push_back(commandBuffer);
+			}
+			return pool.commandBuffers[pool.usedCommandBuffers++];
+		}
+	};
+}
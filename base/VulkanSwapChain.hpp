@@ -72,6 +72,107 @@ private:
 	PFN_vkGetSwapchainImagesKHR fpGetSwapchainImagesKHR;
 	PFN_vkAcquireNextImageKHR fpAcquireNextImageKHR;
 	PFN_vkQueuePresentKHR fpQueuePresentKHR;
+	// Headless mode: Offscreen images replace the swap chain images, queue used to signal and wait on the acquire and present semaphores
+	bool headless = false;
+	VkQueue headlessQueue = VK_NULL_HANDLE;
+	std::vector<VkDeviceMemory> headlessMemory;
+	uint32_t currentHeadlessImage = 0;
+
+	void createHeadlessImages(uint32_t width, uint32_t height)
+	{
+		destroyHeadlessImages();
+
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+		// Two images, so the index still alternates between frames like with a real swap chain
+		imageCount = 2;
+		images.resize(imageCount);
+		buffers.resize(imageCount);
+		headlessMemory.resize(imageCount);
+		for (uint32_t i = 0; i < imageCount; i++)
+		{
+			VkImageCreateInfo imageCI = {};
+			imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageCI.imageType = VK_IMAGE_TYPE_2D;
+			imageCI.format = colorFormat;
+			imageCI.extent = { width, height, 1 };
+			imageCI.mipLevels = 1;
+			imageCI.arrayLayers = 1;
+			imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCI.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			imageCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &images[i]));
+
+			VkMemoryRequirements memReqs;
+			vkGetImageMemoryRequirements(device, images[i], &memReqs);
+			VkMemoryAllocateInfo memAlloc = {};
+			memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			memAlloc.allocationSize = memReqs.size;
+			memAlloc.memoryTypeIndex = UINT32_MAX;
+			for (uint32_t j = 0; j < memoryProperties.memoryTypeCount; j++)
+			{
+				if ((memReqs.memoryTypeBits & (1 << j)) && (memoryProperties.memoryTypes[j].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+				{
+					memAlloc.memoryTypeIndex = j;
+					break;
+				}
+			}
+			if (memAlloc.memoryTypeIndex == UINT32_MAX)
+			{
+				vks::tools::exitFatal("Could not find a device local memory type for the headless color images", "Fatal error");
+			}
+			VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &headlessMemory[i]));
+			VK_CHECK_RESULT(vkBindImageMemory(device, images[i], headlessMemory[i], 0));
+
+			VkImageViewCreateInfo colorAttachmentView = {};
+			colorAttachmentView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			colorAttachmentView.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			colorAttachmentView.format = colorFormat;
+			colorAttachmentView.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
+			colorAttachmentView.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			colorAttachmentView.image = images[i];
+			buffers[i].image = images[i];
+			VK_CHECK_RESULT(vkCreateImageView(device, &colorAttachmentView, nullptr, &buffers[i].view));
+		}
+		currentHeadlessImage = imageCount - 1;
+	}
+
+	void destroyHeadlessImages()
+	{
+		for (size_t i = 0; i < headlessMemory.size(); i++)
+		{
+			vkDestroyImageView(device, buffers[i].view, nullptr);
+			vkDestroyImage(device, images[i], nullptr);
+			vkFreeMemory(device, headlessMemory[i], nullptr);
+		}
+		headlessMemory.clear();
+		images.clear();
+		buffers.clear();
+		imageCount = 0;
+	}
+
+	// Submits an empty batch so semaphores are signaled and waited on like by a real swap chain's acquire and present
+	VkResult submitHeadless(VkSemaphore waitSemaphore, VkSemaphore signalSemaphore)
+	{
+		VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		if (waitSemaphore != VK_NULL_HANDLE)
+		{
+			submitInfo.waitSemaphoreCount = 1;
+			submitInfo.pWaitSemaphores = &waitSemaphore;
+			submitInfo.pWaitDstStageMask = &waitStageMask;
+		}
+		if (signalSemaphore != VK_NULL_HANDLE)
+		{
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &signalSemaphore;
+		}
+		return vkQueueSubmit(headlessQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	}
 public:
 	VkFormat colorFormat;
 	VkColorSpaceKHR colorSpace;
@@ -290,6 +391,44 @@ public:
 		GET_DEVICE_PROC_ADDR(device, QueuePresentKHR);
 	}
 
+	/**
+	* Use offscreen color images instead of a surface and swap chain, e.g. for capturing frames without a window system
+	* Replaces initSurface and connect, create, acquireNextImage, queuePresent and cleanup then operate on the offscreen images
+	*
+	* @param physicalDevice Physical device used to query format support and memory types
+	* @param device Logical device to create the images on
+	* @param queue Queue used to signal and wait on the acquire and present semaphores
+	* @param queueFamilyIndex Queue family index of the graphics queue
+	*/
+	void initHeadless(VkPhysicalDevice physicalDevice, VkDevice device, VkQueue queue, uint32_t queueFamilyIndex)
+	{
+		this->physicalDevice = physicalDevice;
+		this->device = device;
+		headless = true;
+		headlessQueue = queue;
+		queueNodeIndex = queueFamilyIndex;
+		surface = VK_NULL_HANDLE;
+
+		// Prefer the format swap chains usually offer, the images need to be renderable and copyable (same requirements as for capturing the swap chain)
+		colorFormat = VK_FORMAT_UNDEFINED;
+		colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+		const VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+		for (VkFormat format : { VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_R8G8B8A8_UNORM })
+		{
+			VkFormatProperties formatProps;
+			vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProps);
+			if ((formatProps.optimalTilingFeatures & requiredFeatures) == requiredFeatures)
+			{
+				colorFormat = format;
+				break;
+			}
+		}
+		if (colorFormat == VK_FORMAT_UNDEFINED)
+		{
+			vks::tools::exitFatal("Could not find a color format for headless rendering", "Fatal error");
+		}
+	}
+
 	/** 
 	* Create the swapchain and get it's images with given width and height
 	* 
@@ -299,6 +438,12 @@ public:
 	*/
 	void create(uint32_t *width, uint32_t *height, bool vsync = false)
 	{
+		if (headless)
+		{
+			createHeadlessImages(*width, *height);
+			return;
+		}
+
 		VkResult err;
 		VkSwapchainKHR oldSwapchain = swapChain;
 
@@ -487,6 +632,12 @@ public:
 	*/
 	VkResult acquireNextImage(VkSemaphore presentCompleteSemaphore, uint32_t *imageIndex)
 	{
+		if (headless)
+		{
+			currentHeadlessImage = (currentHeadlessImage + 1) % imageCount;
+			*imageIndex = currentHeadlessImage;
+			return submitHeadless(VK_NULL_HANDLE, presentCompleteSemaphore);
+		}
 		// By setting timeout to UINT64_MAX we will always wait until the next image has been acquired or an actual error is thrown
 		// With that we don't have to handle VK_NOT_READY
 		return fpAcquireNextImageKHR(device, swapChain, UINT64_MAX, presentCompleteSemaphore, (VkFence)nullptr, imageIndex);
@@ -503,6 +654,11 @@ public:
 	*/
 	VkResult queuePresent(VkQueue queue, uint32_t imageIndex, VkSemaphore waitSemaphore = VK_NULL_HANDLE)
 	{
+		if (headless)
+		{
+			// Nothing to present, but the semaphore still has to be waited on before it can be signaled again
+			return submitHeadless(waitSemaphore, VK_NULL_HANDLE);
+		}
 		VkPresentInfoKHR presentInfo = {};
 		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 		presentInfo.pNext = NULL;
@@ -524,6 +680,11 @@ public:
 	*/
 	void cleanup()
 	{
+		if (headless)
+		{
+			destroyHeadlessImages();
+			return;
+		}
 		if (swapChain != VK_NULL_HANDLE)
 		{
 			for (uint32_t i = 0; i < imageCount; i++)
@@ -0,0 +1,245 @@
+/*
+* Text batching for bitmap fonts
+*
+* Appends any number of texts with individual transforms into one persistently mapped vertex buffer per frame
+* All texts of a frame are drawn with a single indexed indirect draw, so changing the texts doesn't require recording command buffers again
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include <glm/glm.hpp>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "bitmapfont.hpp"
+
+namespace vks
+{
+	class TextBatch
+	{
+	public:
+		/** @brief Vertex layout of the batch (location 0 = position, location 1 = uv) */
+		struct Vertex {
+			glm::vec3 pos;
+			glm::vec2 uv;
+		};
+
+		/** @brief Set if the buffers used by draws recorded with cmdDraw have been recreated, these need to be recorded again */
+		bool drawCommandsInvalid = false;
+
+		struct {
+			// CPU time for building the last batch (ms)
+			double buildTime = 0.0;
+			uint32_t textCount = 0;
+			uint32_t glyphCount = 0;
+			uint32_t glyphCapacity = 0;
+		} statistics;
+
+		/**
+		* Create the batch buffers
+		*
+		* @param device Vulkan device
+		* @param font Font used to lay out the texts
+		* @param frameCount Number of frames that can be in flight (e.g. number of swap chain images), each one gets its own vertex buffer
+		* @param glyphCapacity Initial number of glyphs per frame, the buffers grow on demand
+		*/
+		TextBatch(vks::VulkanDevice *device, vks::BitmapFont *font, uint32_t frameCount, uint32_t glyphCapacity = 4096)
+		{
+			this->device = device;
+			this->font = font;
+			vertexBuffers.resize(frameCount);
+
+			VkDrawIndexedIndirectCommand drawCommand = {};
+			std::vector<VkDrawIndexedIndirectCommand> drawCommands(frameCount, drawCommand);
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&indirectBuffer,
+				drawCommands.size() * sizeof(VkDrawIndexedIndirectCommand),
+				drawCommands.data()));
+			VK_CHECK_RESULT(indirectBuffer.map());
+
+			createBuffers(glyphCapacity);
+		}
+
+		~TextBatch()
+		{
+			for (auto &vertexBuffer : vertexBuffers)
+			{
+				vertexBuffer.destroy();
+			}
+			indexBuffer.destroy();
+			indirectBuffer.destroy();
+		}
+
+		/**
+		* Start a new batch for the given frame
+		* @note The frame's previous batch must no longer be in use by the GPU
+		*/
+		void begin(uint32_t frameIndex)
+		{
+			assert(frameIndex < vertexBuffers.size());
+			tStart = std::chrono::high_resolution_clock::now();
+			currentFrame = frameIndex;
+			glyphCount = 0;
+			statistics.textCount = 0;
+		}
+
+		/**
+		* Append a text to the current batch
+		*
+		* @param text Text to add, '\n' starts a new line
+		* @param transform Transformation from font units (1.0 = distance from the top of a line to its baseline, y pointing down) to the space expected by the vertex shader
+		* @param anchor Point of the text placed at the origin (see BitmapFont::layout)
+		*/
+		void add(const std::string &text, const glm::mat4 &transform, const glm::vec2 &anchor = glm::vec2(0.0f))
+		{
+			quads.clear();
+			const uint32_t count = font->layout(text, anchor, quads);
+			if (glyphCount + count > capacity)
+			{
+				grow(glyphCount + count);
+			}
+
+			// Texts are flat, so each corner only needs the x and y axis of the transform
+			const glm::vec3 axisX = glm::vec3(transform[0]);
+			const glm::vec3 axisY = glm::vec3(transform[1]);
+			const glm::vec3 origin = glm::vec3(transform[3]);
+
+			Vertex *vertex = (Vertex*)vertexBuffers[currentFrame].mapped + glyphCount * 4;
+			for (auto &quad : quads)
+			{
+				const glm::vec3 left = origin + axisX * quad.pos.x;
+				const glm::vec3 right = origin + axisX * quad.pos.z;
+				const glm::vec3 top = axisY * quad.pos.y;
+				const glm::vec3 bottom = axisY * quad.pos.w;
+				*vertex++ = { right + bottom, glm::vec2(quad.uv.z, quad.uv.w) };
+				*vertex++ = { left + bottom, glm::vec2(quad.uv.x, quad.uv.w) };
+				*vertex++ = { left + top, glm::vec2(quad.uv.x, quad.uv.y) };
+				*vertex++ = { right + top, glm::vec2(quad.uv.z, quad.uv.y) };
+			}
+			glyphCount += count;
+			statistics.textCount++;
+		}
+
+		/**
+		* Finish the current batch and update the frame's draw parameters
+		*/
+		void end()
+		{
+			VkDrawIndexedIndirectCommand *drawCommand = (VkDrawIndexedIndirectCommand*)indirectBuffer.mapped + currentFrame;
+			drawCommand->indexCount = glyphCount * 6;
+			drawCommand->instanceCount = (glyphCount > 0) ? 1 : 0;
+
+			statistics.glyphCount = glyphCount;
+			statistics.glyphCapacity = capacity;
+			statistics.buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		}
+
+		/**
+		* Draw the last batch built for a frame, pipeline and descriptor sets must be bound by the caller
+		*
+		* @param binding Vertex input binding the batch's vertex buffer is bound to
+		*/
+		void cmdDraw(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t binding = 0)
+		{
+			VkDeviceSize offsets[1] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffer, binding, 1, &vertexBuffers[frameIndex].buffer, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+			vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer.buffer, frameIndex * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+			drawCommandsInvalid = false;
+		}
+
+	private:
+		vks::VulkanDevice *device;
+		vks::BitmapFont *font;
+
+		// Host visible and persistently mapped, one per frame
+		std::vector<vks::Buffer> vertexBuffers;
+		// Static indices for two triangles per glyph, shared by all frames
+		vks::Buffer indexBuffer;
+		// One set of draw parameters per frame
+		vks::Buffer indirectBuffer;
+
+		uint32_t capacity = 0;
+		uint32_t currentFrame = 0;
+		uint32_t glyphCount = 0;
+		std::vector<vks::BitmapFont::GlyphQuad> quads;
+		std::chrono::high_resolution_clock::time_point tStart;
+
+		void createBuffers(uint32_t glyphCapacity)
+		{
+			for (auto &vertexBuffer : vertexBuffers)
+			{
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					&vertexBuffer,
+					glyphCapacity * 4 * sizeof(Vertex)));
+				VK_CHECK_RESULT(vertexBuffer.map());
+			}
+
+			std::vector<uint32_t> indices(glyphCapacity * 6);
+			for (uint32_t i = 0; i < glyphCapacity; i++)
+			{
+				const uint32_t vertex = i * 4;
+				indices[i * 6 + 0] = vertex + 0;
+				indices[i * 6 + 1] = vertex + 1;
+				indices[i * 6 + 2] = vertex + 2;
+				indices[i * 6 + 3] = vertex + 2;
+				indices[i * 6 + 4] = vertex + 3;
+				indices[i * 6 + 5] = vertex + 0;
+			}
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&indexBuffer,
+				indices.size() * sizeof(uint32_t),
+				indices.data()));
+
+			capacity = glyphCapacity;
+			drawCommandsInvalid = true;
+		}
+
+		// Recreate the buffers of all frames with at least the required capacity, keeps the glyphs already added to the current batch
+		void grow(uint32_t requiredCapacity)
+		{
+			// Other frames may still be drawn from the current buffers
+			VK_CHECK_RESULT(vkDeviceWaitIdle(device->logicalDevice));
+
+			std::vector<Vertex> currentVertices((Vertex*)vertexBuffers[currentFrame].mapped, (Vertex*)vertexBuffers[currentFrame].mapped + glyphCount * 4);
+			for (auto &vertexBuffer : vertexBuffers)
+			{
+				vertexBuffer.destroy();
+			}
+			indexBuffer.destroy();
+			createBuffers(std::max(requiredCapacity, capacity * 2));
+			memcpy(vertexBuffers[currentFrame].mapped, currentVertices.data(), currentVertices.size() * sizeof(Vertex));
+
+			// Batches built before for other frames are gone with their buffers
+			for (uint32_t i = 0; i < vertexBuffers.size(); i++)
+			{
+				if (i != currentFrame)
+				{
+					VkDrawIndexedIndirectCommand *drawCommand = (VkDrawIndexedIndirectCommand*)indirectBuffer.mapped + i;
+					drawCommand->indexCount = 0;
+					drawCommand->instanceCount = 0;
+				}
+			}
+		}
+	};
+}
@@ -15,12 +15,15 @@
 #include <vector>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <chrono>
 
 #include <vulkan/vulkan.h>
 #include "VulkanTools.h"
 #include "VulkanDebug.h"
 #include "VulkanBuffer.hpp"
 #include "VulkanDevice.hpp"
+#include "VulkanTimestampQueries.hpp"
 
 #if defined(__ANDROID__)
 #include "vulkanandroid.h"
@@ -36,12 +39,15 @@
 #define STB_FIRST_CHAR STB_FONT_consolas_24_latin1_FIRST_CHAR
 #define STB_NUM_CHARS STB_FONT_consolas_24_latin1_NUM_CHARS
 
-// Max. number of chars the text overlay buffer can hold
+// Initial number of chars the text overlay buffers can hold, they grow on demand
 #define MAX_CHAR_COUNT 1024
 
 /**
 * @brief Mostly self-contained text overlay class
 * @note Will only work with compatible render passes
+* @note Texts are retained: only texts that changed are written to the vertex buffer and the command buffers draw all chars with a single indirect draw,
+* so they only need to be recorded again if the buffers grow or the framebuffers are recreated
+* @note The overlay can either be submitted with its own command buffers and render pass, or be recorded into the application's render pass using cmdDraw
 */ 
 class VulkanTextOverlay
 {
@@ -58,7 +64,12 @@ private:
 	VkSampler sampler;
 	VkImage image;
 	VkImageView view;
+	// Four vertices (position, uv) per char
 	vks::Buffer vertexBuffer;
+	// Static indices for two triangles per char
+	vks::Buffer indexBuffer;
+	// Draw parameters updated by the host, so the char count can change without recording the command buffers again
+	vks::Buffer indirectBuffer;
 	VkDeviceMemory imageMemory;
 	VkDescriptorPool descriptorPool;
 	VkDescriptorSetLayout descriptorSetLayout;
@@ -71,17 +82,80 @@ private:
 	std::vector<VkFramebuffer*> frameBuffers;
 	std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
 	VkFence fence;
-
-	// Used during text updates
-	glm::vec4 *mappedLocal = nullptr;
+	// GPU time of the overlay, one set of queries per framebuffer
+	vks::TimestampQueries *timestamps = nullptr;
 
 	stb_fontchar stbFontData[STB_NUM_CHARS];
-	uint32_t numLetters;
 
 public:
 
 	enum TextAlign { alignLeft, alignCenter, alignRight };
 
+	// Handle of a retained text
+	typedef uint32_t TextHandle;
+
+private:
+
+	struct Text {
+		std::string text;
+		float x, y;
+		TextAlign align;
+		// Cached glyph run of the text in font units relative to its origin, xy = position, zw = uv for each of the four vertices of a char
+		std::vector<glm::vec4> glyphs;
+		float width;
+		// Range of chars reserved in the vertex buffer
+		uint32_t offset;
+		uint32_t capacity;
+		// Number of chars currently written to the vertex buffer
+		uint32_t uploadedCount;
+		bool dirty;
+		bool active;
+	};
+	std::vector<Text> texts;
+	std::vector<TextHandle> freeHandles;
+
+	struct CharRange {
+		uint32_t offset;
+		uint32_t count;
+	};
+	// Unused ranges below charCount, sorted by offset, their chars are degenerate
+	std::vector<CharRange> freeRanges;
+	// Number of chars the buffers can hold
+	uint32_t charCapacity = 0;
+	// Number of chars drawn (including unused ranges)
+	uint32_t charCount = 0;
+
+	// Texts added via addText between beginTextUpdate and endTextUpdate, reused in the order they are added
+	std::vector<TextHandle> updateTexts;
+	uint32_t updateTextCount = 0;
+	std::chrono::high_resolution_clock::time_point updateStart;
+	bool updateStarted = false;
+
+	// Values used for the last upload, changing them requires all texts to be written again
+	uint32_t uploadedWidth = 0;
+	uint32_t uploadedHeight = 0;
+	float uploadedScale = 0.0f;
+
+	bool commandBuffersInvalid = true;
+
+	/**
+	* Bind the overlay pipeline and buffers and draw all chars, viewport and scissor must already be set
+	*/
+	void cmdDrawChars(VkCommandBuffer commandBuffer)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+
+		VkDeviceSize offsets = 0;
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer.buffer, &offsets);
+		vkCmdBindVertexBuffers(commandBuffer, 1, 1, &vertexBuffer.buffer, &offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+		// The char count is read from the indirect buffer, so text changes don't require recording the command buffers again
+		vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer.buffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+public:
+
 	bool visible = true;
 	bool invalidated = false;
 
@@ -89,6 +163,23 @@ public:
 
 	std::vector<VkCommandBuffer> cmdBuffers;
 
+	struct {
+		// CPU time of the last update (ms), includes adding the texts when done between beginTextUpdate and endTextUpdate
+		double updateTime = 0.0;
+		// Chars written to the vertex buffer by the last update
+		uint32_t uploadedChars = 0;
+		uint32_t charCount = 0;
+		uint32_t charCapacity = 0;
+		uint32_t commandBufferUpdates = 0;
+		// GPU time of the overlay (ms) in the last frame it was resolved for
+		double gpuTime = 0.0;
+		// CPU time for submitting the overlay and presenting the frame (ms), measured by the application
+		double submitTime = 0.0;
+	} statistics;
+
+	/** @brief Set if the buffers used by draws recorded with cmdDraw have been recreated, these need to be recorded again */
+	bool drawCommandsInvalid = false;
+
 	/**
 	* Default constructor
 	*
@@ -150,6 +241,8 @@ public:
 	{
 		// Free up all Vulkan resources requested by the text overlay
 		vertexBuffer.destroy();
+		indexBuffer.destroy();
+		indirectBuffer.destroy();
 		vkDestroySampler(vulkanDevice->logicalDevice, sampler, nullptr);
 		vkDestroyImage(vulkanDevice->logicalDevice, image, nullptr);
 		vkDestroyImageView(vulkanDevice->logicalDevice, view, nullptr);
@@ -163,6 +256,7 @@ public:
 		vkFreeCommandBuffers(vulkanDevice->logicalDevice, commandPool, static_cast<uint32_t>(cmdBuffers.size()), cmdBuffers.data());
 		vkDestroyCommandPool(vulkanDevice->logicalDevice, commandPool, nullptr);
 		vkDestroyFence(vulkanDevice->logicalDevice, fence, nullptr);
+		delete timestamps;
 	}
 
 	/**
@@ -191,15 +285,20 @@ public:
 
 		VK_CHECK_RESULT(vkAllocateCommandBuffers(vulkanDevice->logicalDevice, &cmdBufAllocateInfo, cmdBuffers.data()));
 
-		// Vertex buffer
+		timestamps = new vks::TimestampQueries(vulkanDevice, 2, static_cast<uint32_t>(cmdBuffers.size()), vulkanDevice->queueFamilyIndices.graphics);
+
+		// Vertex and index buffer
+		createCharBuffers(MAX_CHAR_COUNT);
+
+		// Indirect draw parameters
+		VkDrawIndexedIndirectCommand drawCommand = {};
 		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&vertexBuffer,
-			MAX_CHAR_COUNT * sizeof(glm::vec4)));
-
-		// Map persistent
-		vertexBuffer.map();
+			&indirectBuffer,
+			sizeof(VkDrawIndexedIndirectCommand),
+			&drawCommand));
+		indirectBuffer.map();
 
 		// Font texture
 		VkImageCreateInfo imageInfo = vks::initializers::imageCreateInfo();
@@ -383,7 +482,7 @@ public:
 	{
 		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
 			vks::initializers::pipelineInputAssemblyStateCreateInfo(
-				VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+				VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
 				0,
 				VK_FALSE);
 
@@ -554,105 +653,364 @@ public:
 	}
 
 	/**
-	* Maps the buffer, resets letter count
+	* Create host visible vertex and index buffers for the given number of chars
+	* The vertex buffer stays mapped, the index buffer is filled with two triangles per char
 	*/
-	void beginTextUpdate()
+	void createCharBuffers(uint32_t capacity)
 	{
-		mappedLocal = (glm::vec4*)vertexBuffer.mapped;
-		numLetters = 0;
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&vertexBuffer,
+			capacity * 4 * sizeof(glm::vec4)));
+		vertexBuffer.map();
+		// Unused chars are degenerate
+		memset(vertexBuffer.mapped, 0, capacity * 4 * sizeof(glm::vec4));
+
+		// Same winding as the four vertices of a char drawn as a triangle strip
+		std::vector<uint32_t> indices(capacity * 6);
+		for (uint32_t i = 0; i < capacity; i++)
+		{
+			const uint32_t vertex = i * 4;
+			indices[i * 6 + 0] = vertex + 0;
+			indices[i * 6 + 1] = vertex + 1;
+			indices[i * 6 + 2] = vertex + 2;
+			indices[i * 6 + 3] = vertex + 2;
+			indices[i * 6 + 4] = vertex + 1;
+			indices[i * 6 + 5] = vertex + 3;
+		}
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&indexBuffer,
+			indices.size() * sizeof(uint32_t),
+			indices.data()));
+
+		charCapacity = capacity;
+		commandBuffersInvalid = true;
+		drawCommandsInvalid = true;
 	}
 
 	/**
-	* Add text to the current buffer
-	*
-	* @param text Text to add
-	* @param x x position of the text to add in window coordinate space
-	* @param y y position of the text to add in window coordinate space
-	* @param align Alignment for the new text (left, right, center)
+	* Grow the vertex and index buffers to hold at least the given number of chars, keeps the current contents of the vertex buffer
 	*/
-	void addText(std::string text, float x, float y, TextAlign align)
+	void growCharBuffers(uint32_t requiredCapacity)
 	{
-		assert(vertexBuffer.mapped != nullptr);
+		// The overlay command buffers may still be executing with the current buffers
+		VK_CHECK_RESULT(vkQueueWaitIdle(queue));
 
-		if (align == alignLeft) {
-			x *= scale;
-		};
+		vks::Buffer previousVertexBuffer = vertexBuffer;
+		indexBuffer.destroy();
+		createCharBuffers(std::max(requiredCapacity, charCapacity * 2));
+		memcpy(vertexBuffer.mapped, previousVertexBuffer.mapped, charCount * 4 * sizeof(glm::vec4));
+		previousVertexBuffer.destroy();
+	}
 
-		y *= scale;
+	/**
+	* Reserve a range of chars in the vertex buffer, reuses unused ranges before appending
+	*
+	* @return Offset of the first char of the range
+	*/
+	uint32_t allocateChars(uint32_t count)
+	{
+		for (auto range = freeRanges.begin(); range != freeRanges.end(); range++)
+		{
+			if (range->count >= count)
+			{
+				const uint32_t offset = range->offset;
+				range->offset += count;
+				range->count -= count;
+				if (range->count == 0)
+				{
+					freeRanges.erase(range);
+				}
+				return offset;
+			}
+		}
+		if (charCount + count > charCapacity)
+		{
+			growCharBuffers(charCount + count);
+		}
+		const uint32_t offset = charCount;
+		charCount += count;
+		return offset;
+	}
 
-		const float charW = (1.5f * scale) / *frameBufferWidth;
-		const float charH = (1.5f * scale) / *frameBufferHeight;
+	/**
+	* Make a range of chars degenerate and return it to the unused ranges
+	*/
+	void releaseChars(uint32_t offset, uint32_t count)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		std::fill_n((glm::vec4*)vertexBuffer.mapped + offset * 4, count * 4, glm::vec4(0.0f));
 
-		float fbW = (float)*frameBufferWidth;
-		float fbH = (float)*frameBufferHeight;
-		x = (x / fbW * 2.0f) - 1.0f;
-		y = (y / fbH * 2.0f) - 1.0f;
+		auto next = std::find_if(freeRanges.begin(), freeRanges.end(), [offset](const CharRange &range) { return range.offset > offset; });
+		auto range = freeRanges.insert(next, { offset, count });
+		// Merge with the following and the preceding range
+		if ((range + 1 != freeRanges.end()) && (range->offset + range->count == (range + 1)->offset))
+		{
+			range->count += (range + 1)->count;
+			freeRanges.erase(range + 1);
+		}
+		if ((range != freeRanges.begin()) && ((range - 1)->offset + (range - 1)->count == range->offset))
+		{
+			(range - 1)->count += range->count;
+			range = freeRanges.erase(range) - 1;
+		}
+		// Don't draw unused chars at the end of the buffer
+		if (range->offset + range->count == charCount)
+		{
+			charCount = range->offset;
+			freeRanges.erase(range);
+		}
+	}
 
-		// Calculate text width
-		float textWidth = 0;
-		for (auto letter : text)
+	/**
+	* Generate the glyph run of a text (four vertices per char in font units)
+	*/
+	void layoutText(Text &entry)
+	{
+		entry.glyphs.resize(entry.text.size() * 4);
+		glm::vec4 *vertex = entry.glyphs.data();
+		float x = 0.0f;
+		for (auto letter : entry.text)
 		{
 			stb_fontchar *charData = &stbFontData[(uint32_t)letter - STB_FIRST_CHAR];
-			textWidth += charData->advance * charW;
+			*vertex++ = glm::vec4(x + (float)charData->x0, (float)charData->y0, charData->s0, charData->t0);
+			*vertex++ = glm::vec4(x + (float)charData->x1, (float)charData->y0, charData->s1, charData->t0);
+			*vertex++ = glm::vec4(x + (float)charData->x0, (float)charData->y1, charData->s0, charData->t1);
+			*vertex++ = glm::vec4(x + (float)charData->x1, (float)charData->y1, charData->s1, charData->t1);
+			x += charData->advance;
 		}
+		entry.width = x;
+	}
+
+	/**
+	* Write the glyph run of a text to its range of the vertex buffer in normalized device coordinates
+	*/
+	void uploadText(Text &entry)
+	{
+		const uint32_t count = static_cast<uint32_t>(entry.text.size());
+		if (count > entry.capacity)
+		{
+			releaseChars(entry.offset, entry.capacity);
+			// Leave some room so short texts (e.g. numbers) changing their length don't need to move
+			entry.capacity = (count + 15) & ~15u;
+			entry.offset = allocateChars(entry.capacity);
+			entry.uploadedCount = 0;
+		}
+
+		const float charW = (1.5f * scale) / *frameBufferWidth;
+		const float charH = (1.5f * scale) / *frameBufferHeight;
+
+		float x = (entry.align == alignLeft) ? entry.x * scale : entry.x;
+		float y = entry.y * scale;
+		x = (x / (float)*frameBufferWidth * 2.0f) - 1.0f;
+		y = (y / (float)*frameBufferHeight * 2.0f) - 1.0f;
 
-		switch (align)
+		switch (entry.align)
 		{
 		case alignRight:
-			x -= textWidth;
+			x -= entry.width * charW;
 			break;
 		case alignCenter:
-			x -= textWidth / 2.0f;
+			x -= entry.width * charW / 2.0f;
 			break;
 		case alignLeft:
 			break;
 		}
 
-		// Generate a uv mapped quad per char in the new text
-		for (auto letter : text)
+		glm::vec4 *mapped = (glm::vec4*)vertexBuffer.mapped + entry.offset * 4;
+		for (auto &glyph : entry.glyphs)
 		{
-			stb_fontchar *charData = &stbFontData[(uint32_t)letter - STB_FIRST_CHAR];
+			*mapped++ = glm::vec4(x + glyph.x * charW, y + glyph.y * charH, glyph.z, glyph.w);
+		}
+		// Chars left over from a longer previous text
+		if (entry.uploadedCount > count)
+		{
+			std::fill_n(mapped, (entry.uploadedCount - count) * 4, glm::vec4(0.0f));
+		}
+		entry.uploadedCount = count;
+		entry.dirty = false;
+
+		statistics.uploadedChars += count;
+	}
+
+	/**
+	* Add a retained text, it's displayed until it is destroyed
+	*
+	* @param text Text to add
+	* @param x x position of the text in window coordinate space
+	* @param y y position of the text in window coordinate space
+	* @param align Alignment for the text (left, right, center)
+	*
+	* @return Handle used to change or remove the text
+	* @note Changes are written to the vertex buffer with the next call to flushChanges (or endTextUpdate)
+	*/
+	TextHandle createText(const std::string &text, float x, float y, TextAlign align)
+	{
+		TextHandle handle;
+		if (!freeHandles.empty())
+		{
+			handle = freeHandles.back();
+			freeHandles.pop_back();
+		}
+		else
+		{
+			handle = static_cast<TextHandle>(texts.size());
+			texts.push_back(Text());
+		}
+		Text &entry = texts[handle];
+		entry.text = text;
+		entry.x = x;
+		entry.y = y;
+		entry.align = align;
+		entry.offset = 0;
+		entry.capacity = 0;
+		entry.uploadedCount = 0;
+		entry.dirty = true;
+		entry.active = true;
+		layoutText(entry);
+		return handle;
+	}
+
+	/**
+	* Change a retained text, unchanged texts are not written to the vertex buffer again
+	*/
+	void updateText(TextHandle handle, const std::string &text, float x, float y, TextAlign align)
+	{
+		assert(handle < texts.size() && texts[handle].active);
+		Text &entry = texts[handle];
+		if (entry.text != text)
+		{
+			entry.text = text;
+			layoutText(entry);
+			entry.dirty = true;
+		}
+		if ((entry.x != x) || (entry.y != y) || (entry.align != align))
+		{
+			entry.x = x;
+			entry.y = y;
+			entry.align = align;
+			entry.dirty = true;
+		}
+	}
+
+	void updateText(TextHandle handle, const std::string &text)
+	{
+		assert(handle < texts.size() && texts[handle].active);
+		updateText(handle, text, texts[handle].x, texts[handle].y, texts[handle].align);
+	}
+
+	/**
+	* Remove a retained text, its handle may be returned by a later call to createText
+	*/
+	void destroyText(TextHandle handle)
+	{
+		assert(handle < texts.size() && texts[handle].active);
+		Text &entry = texts[handle];
+		releaseChars(entry.offset, entry.capacity);
+		entry.active = false;
+		entry.glyphs.clear();
+		freeHandles.push_back(handle);
+	}
+
+	/**
+	* Write all changed texts to the vertex buffer and update the indirect draw parameters
+	* The command buffers are only recorded again if the buffers were reallocated or the framebuffers changed
+	* @note Like all updates of the text overlay, this must not be called while the overlay command buffers are executing
+	*/
+	void flushChanges()
+	{
+		const auto tStart = updateStarted ? updateStart : std::chrono::high_resolution_clock::now();
+		updateStarted = false;
+
+		statistics.uploadedChars = 0;
+		// The vertices are stored in normalized device coordinates
+		const bool uploadAll = (*frameBufferWidth != uploadedWidth) || (*frameBufferHeight != uploadedHeight) || (scale != uploadedScale);
+		uploadedWidth = *frameBufferWidth;
+		uploadedHeight = *frameBufferHeight;
+		uploadedScale = scale;
+		for (auto &entry : texts)
+		{
+			if (entry.active && (entry.dirty || uploadAll))
+			{
+				uploadText(entry);
+			}
+		}
 
-			mappedLocal->x = (x + (float)charData->x0 * charW);
-			mappedLocal->y = (y + (float)charData->y0 * charH);
-			mappedLocal->z = charData->s0;
-			mappedLocal->w = charData->t0;
-			mappedLocal++;
-
-			mappedLocal->x = (x + (float)charData->x1 * charW);
-			mappedLocal->y = (y + (float)charData->y0 * charH);
-			mappedLocal->z = charData->s1;
-			mappedLocal->w = charData->t0;
-			mappedLocal++;
-
-			mappedLocal->x = (x + (float)charData->x0 * charW);
-			mappedLocal->y = (y + (float)charData->y1 * charH);
-			mappedLocal->z = charData->s0;
-			mappedLocal->w = charData->t1;
-			mappedLocal++;
-
-			mappedLocal->x = (x + (float)charData->x1 * charW);
-			mappedLocal->y = (y + (float)charData->y1 * charH);
-			mappedLocal->z = charData->s1;
-			mappedLocal->w = charData->t1;
-			mappedLocal++;
-
-			x += charData->advance * charW;
-
-			numLetters++;
+		updateDrawCommand();
+
+		if (commandBuffersInvalid)
+		{
+			updateCommandBuffers();
 		}
+
+		statistics.charCount = charCount;
+		statistics.charCapacity = charCapacity;
+		statistics.updateTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
 	}
 
 	/**
-	* Unmap buffer and update command buffers
+	* Write the indirect draw parameters for the current char count and visibility
+	* Hiding the overlay this way doesn't require draws recorded with cmdDraw to be recorded again
+	*/
+	void updateDrawCommand()
+	{
+		VkDrawIndexedIndirectCommand *drawCommand = (VkDrawIndexedIndirectCommand*)indirectBuffer.mapped;
+		drawCommand->indexCount = charCount * 6;
+		drawCommand->instanceCount = (visible && (charCount > 0)) ? 1 : 0;
+	}
+
+	/**
+	* Start adding the texts of an update, texts are matched to those of the previous update by the order they are added in
+	*/
+	void beginTextUpdate()
+	{
+		updateTextCount = 0;
+		updateStart = std::chrono::high_resolution_clock::now();
+		updateStarted = true;
+	}
+
+	/**
+	* Add text to the current update
+	*
+	* @param text Text to add
+	* @param x x position of the text to add in window coordinate space
+	* @param y y position of the text to add in window coordinate space
+	* @param align Alignment for the new text (left, right, center)
+	*/
+	void addText(std::string text, float x, float y, TextAlign align)
+	{
+		if (updateTextCount < updateTexts.size())
+		{
+			updateText(updateTexts[updateTextCount], text, x, y, align);
+		}
+		else
+		{
+			updateTexts.push_back(createText(text, x, y, align));
+		}
+		updateTextCount++;
+	}
+
+	/**
+	* Remove texts that were not added again and write the changes to the vertex buffer
 	*/
 	void endTextUpdate()
 	{
-		updateCommandBuffers();
+		while (updateTexts.size() > updateTextCount)
+		{
+			destroyText(updateTexts.back());
+			updateTexts.pop_back();
+		}
+		flushChanges();
 	}
 
 	/**
-	* Update the command buffers to reflect text changes
+	* Record the command buffers drawing all chars of the vertex buffer
 	*/
 	void updateCommandBuffers()
 	{
@@ -677,6 +1035,9 @@ public:
 				vks::debugmarker::beginRegion(cmdBuffers[i], "Text overlay", glm::vec4(1.0f, 0.94f, 0.3f, 1.0f));
 			}
 
+			timestamps->cmdReset(cmdBuffers[i], i);
+			timestamps->cmdWriteTimestamp(cmdBuffers[i], i, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
 			vkCmdBeginRenderPass(cmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 			VkViewport viewport = vks::initializers::viewport((float)*frameBufferWidth, (float)*frameBufferHeight, 0.0f, 1.0f);
@@ -684,20 +1045,13 @@ public:
 
 			VkRect2D scissor = vks::initializers::rect2D(*frameBufferWidth, *frameBufferHeight, 0, 0);
 			vkCmdSetScissor(cmdBuffers[i], 0, 1, &scissor);
-			
-			vkCmdBindPipeline(cmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-			vkCmdBindDescriptorSets(cmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
-
-			VkDeviceSize offsets = 0;
-			vkCmdBindVertexBuffers(cmdBuffers[i], 0, 1, &vertexBuffer.buffer, &offsets);
-			vkCmdBindVertexBuffers(cmdBuffers[i], 1, 1, &vertexBuffer.buffer, &offsets);
-			for (uint32_t j = 0; j < numLetters; j++)
-			{
-				vkCmdDraw(cmdBuffers[i], 4, 1, j * 4, 0);
-			}
+
+			cmdDrawChars(cmdBuffers[i]);
 
 			vkCmdEndRenderPass(cmdBuffers[i]);
 
+			timestamps->cmdWriteTimestamp(cmdBuffers[i], i, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
 			if (vks::debugmarker::active)
 			{
 				vks::debugmarker::endRegion(cmdBuffers[i]);
@@ -705,6 +1059,51 @@ public:
 
 			VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffers[i]));
 		}
+
+		commandBuffersInvalid = false;
+		statistics.commandBufferUpdates++;
+	}
+
+	/**
+	* Reset the timestamp queries written by cmdDraw, must be recorded outside of a render pass before cmdDraw
+	*/
+	void cmdResetTimestamps(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+	{
+		timestamps->cmdReset(commandBuffer, frameIndex);
+	}
+
+	/**
+	* Record the overlay into a render pass of the application instead of submitting it with a separate render pass
+	* Saves a submission, a semaphore and loading and storing the framebuffer again
+	*
+	* @param commandBuffer Command buffer inside a render pass that is compatible with the overlay's render pass (same color and depth formats, single sample)
+	* @param frameIndex Index of the framebuffer (selects the timestamp queries)
+	* @note The recorded draw stays valid for text changes, it only needs to be recorded again if drawCommandsInvalid is set
+	*/
+	void cmdDraw(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+	{
+		timestamps->cmdWriteTimestamp(commandBuffer, frameIndex, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+		VkViewport viewport = vks::initializers::viewport((float)*frameBufferWidth, (float)*frameBufferHeight, 0.0f, 1.0f);
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		VkRect2D scissor = vks::initializers::rect2D(*frameBufferWidth, *frameBufferHeight, 0, 0);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		cmdDrawChars(commandBuffer);
+
+		timestamps->cmdWriteTimestamp(commandBuffer, frameIndex, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+		drawCommandsInvalid = false;
+	}
+
+	/**
+	* Pick up the GPU time of the overlay for a frame that has finished executing, never blocks
+	*/
+	void resolveTimestamps(uint32_t frameIndex)
+	{
+		if (timestamps->resolve(frameIndex))
+		{
+			statistics.gpuTime = timestamps->getDuration(0, 1);
+		}
 	}
 
 	/**
@@ -741,6 +1140,9 @@ public:
 				static_cast<uint32_t>(cmdBuffers.size()));
 
 		VK_CHECK_RESULT(vkAllocateCommandBuffers(vulkanDevice->logicalDevice, &cmdBufAllocateInfo, cmdBuffers.data()));
+
+		// The new command buffers (and framebuffers) are recorded with the next update
+		commandBuffersInvalid = true;
 	}
 
 };
\ No newline at end of file
@@ -20,6 +20,8 @@
 #include "VulkanTools.h"
 #include "VulkanDevice.hpp"
 #include "VulkanBuffer.hpp"
+#include "mipmapgenerator.hpp"
+#include "blockcompressor.hpp"
 
 #if defined(__ANDROID__)
 #include <android/asset_manager.h>
@@ -378,6 +380,9 @@ namespace vks
 		* @param (Optional) filter Texture filtering for the sampler (defaults to VK_FILTER_LINEAR)
 		* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
 		* @param (Optional) imageLayout Usage layout for the texture (defaults VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		* @param (Optional) generateMipmaps Generate a complete mip chain on the host from the buffer data (defaults to false, see vks::MipmapGenerator for supported formats)
+		* @param (Optional) compressedFormat Block compress all mip levels on the host into this format before uploading (defaults to VK_FORMAT_UNDEFINED = no compression, the buffer data must be RGBA8 (R8 for BC4) in the color space of the target format, see vks::BlockCompressor::sourceFormatSupported)
+		* @param (Optional) jobSystem Job system used for host side mip map generation and compression (defaults to nullptr = calling thread only)
 		*/
 		void fromBuffer(
 			void* buffer,
@@ -389,15 +394,66 @@ namespace vks
 			VkQueue copyQueue,
 			VkFilter filter = VK_FILTER_LINEAR,
 			VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
-			VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+			VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			bool generateMipmaps = false,
+			VkFormat compressedFormat = VK_FORMAT_UNDEFINED,
+			vks::JobSystem *jobSystem = nullptr)
 		{
 			assert(buffer);
 
 			this->device = device;
-			width = width;
-			height = height;
+			this->width = width;
+			this->height = height;
 			mipLevels = 1;
 
+			// The block compressor reads RGBA8 (or R8 for BC4) texels, data in any other format would be misinterpreted
+			if ((compressedFormat != VK_FORMAT_UNDEFINED) && !vks::BlockCompressor::sourceFormatSupported(format, compressedFormat))
+			{
+				vks::tools::exitFatal("Texture data in format " + std::to_string(format) + " can't be block compressed to format " + std::to_string(compressedFormat), "Error");
+			}
+
+			// The mip map generator only knows how to filter a fixed set of uncompressed formats
+			if (generateMipmaps && !vks::MipmapGenerator::formatSupported(format))
+			{
+				vks::tools::exitFatal("Can't generate mip maps for texture data in format " + std::to_string(format), "Error");
+			}
+
+			// Optionally build the full mip chain from the base level
+			std::vector<vks::MipmapGenerator::Level> levels = { { width, height, 0, bufferSize } };
+			std::vector<uint8_t> mipChain;
+			if (generateMipmaps)
+			{
+				vks::MipmapGenerator mipmapGenerator(jobSystem);
+				mipLevels = vks::MipmapGenerator::getMipLevelCount(width, height);
+				mipChain = mipmapGenerator.generate(buffer, format, width, height, mipLevels, levels);
+				buffer = mipChain.data();
+				bufferSize = mipChain.size();
+			}
+
+			// Optionally compress all levels into a block compressed format
+			std::vector<uint8_t> compressedData;
+			if (compressedFormat != VK_FORMAT_UNDEFINED)
+			{
+				vks::BlockCompressor blockCompressor(jobSystem);
+				VkDeviceSize offset = 0;
+				for (auto& level : levels)
+				{
+					offset += vks::BlockCompressor::getCompressedSize(compressedFormat, level.width, level.height);
+				}
+				compressedData.resize(static_cast<size_t>(offset));
+				offset = 0;
+				for (auto& level : levels)
+				{
+					blockCompressor.compress(static_cast<uint8_t*>(buffer) + level.offset, level.width, level.height, compressedFormat, compressedData.data() + offset);
+					level.offset = offset;
+					level.size = vks::BlockCompressor::getCompressedSize(compressedFormat, level.width, level.height);
+					offset += level.size;
+				}
+				buffer = compressedData.data();
+				bufferSize = compressedData.size();
+				format = compressedFormat;
+			}
+
 			VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
 			VkMemoryRequirements memReqs;
 
@@ -432,15 +488,21 @@ namespace vks
 			memcpy(data, buffer, bufferSize);
 			vkUnmapMemory(device->logicalDevice, stagingMemory);
 
-			VkBufferImageCopy bufferCopyRegion = {};
-			bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			bufferCopyRegion.imageSubresource.mipLevel = 0;
-			bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
-			bufferCopyRegion.imageSubresource.layerCount = 1;
-			bufferCopyRegion.imageExtent.width = width;
-			bufferCopyRegion.imageExtent.height = height;
-			bufferCopyRegion.imageExtent.depth = 1;
-			bufferCopyRegion.bufferOffset = 0;
+			// Setup buffer copy regions for each mip level
+			std::vector<VkBufferImageCopy> bufferCopyRegions;
+			for (uint32_t i = 0; i < mipLevels; i++)
+			{
+				VkBufferImageCopy bufferCopyRegion = {};
+				bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				bufferCopyRegion.imageSubresource.mipLevel = i;
+				bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
+				bufferCopyRegion.imageSubresource.layerCount = 1;
+				bufferCopyRegion.imageExtent.width = levels[i].width;
+				bufferCopyRegion.imageExtent.height = levels[i].height;
+				bufferCopyRegion.imageExtent.depth = 1;
+				bufferCopyRegion.bufferOffset = levels[i].offset;
+				bufferCopyRegions.push_back(bufferCopyRegion);
+			}
 
 			// Create optimal tiled target image
 			VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
@@ -491,8 +553,8 @@ namespace vks
 				stagingBuffer,
 				image,
 				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				1,
-				&bufferCopyRegion
+				static_cast<uint32_t>(bufferCopyRegions.size()),
+				bufferCopyRegions.data()
 			);
 
 			// Change texture image layout to shader read after all mip levels have been copied
@@ -523,7 +585,7 @@ namespace vks
 			samplerCreateInfo.mipLodBias = 0.0f;
 			samplerCreateInfo.compareOp = VK_COMPARE_OP_NEVER;
 			samplerCreateInfo.minLod = 0.0f;
-			samplerCreateInfo.maxLod = 0.0f;
+			samplerCreateInfo.maxLod = (float)mipLevels;
 			VK_CHECK_RESULT(vkCreateSampler(device->logicalDevice, &samplerCreateInfo, nullptr, &sampler));
 
 			// Create image view
@@ -534,7 +596,7 @@ namespace vks
 			viewCreateInfo.format = format;
 			viewCreateInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
 			viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-			viewCreateInfo.subresourceRange.levelCount = 1;
+			viewCreateInfo.subresourceRange.levelCount = mipLevels;
 			viewCreateInfo.image = image;
 			VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewCreateInfo, nullptr, &view));
 
@@ -0,0 +1,163 @@
+/*
+* GPU timestamp queries
+*
+* Measures the GPU time between points of a command buffer without stalling the CPU on the results
+* Each frame in flight (e.g. each swap chain image) gets its own query pool, results are only read once they are available
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+
+namespace vks
+{
+	class TimestampQueries
+	{
+	public:
+		/**
+		* Create the query pools
+		*
+		* @param device Vulkan device
+		* @param timestampCount Number of timestamps written per frame
+		* @param frameCount Number of frames that can be in flight, each one gets a separate query pool
+		* @param queueFamilyIndex Queue family the command buffers writing the timestamps are submitted to
+		*/
+		TimestampQueries(vks::VulkanDevice *device, uint32_t timestampCount, uint32_t frameCount, uint32_t queueFamilyIndex)
+		{
+			this->device = device;
+			this->timestampCount = timestampCount;
+			// Timestamps are only supported if the queue family has valid timestamp bits
+			validBits = device->queueFamilyProperties[queueFamilyIndex].timestampValidBits;
+			period = device->properties.limits.timestampPeriod;
+
+			frames.resize(frameCount);
+			for (auto &frame : frames)
+			{
+				VkQueryPoolCreateInfo queryPoolInfo = {};
+				queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+				queryPoolInfo.queryCount = timestampCount;
+				VK_CHECK_RESULT(vkCreateQueryPool(device->logicalDevice, &queryPoolInfo, nullptr, &frame.queryPool));
+				frame.timestamps.resize(timestampCount, 0);
+			}
+		}
+
+		~TimestampQueries()
+		{
+			for (auto &frame : frames)
+			{
+				vkDestroyQueryPool(device->logicalDevice, frame.queryPool, nullptr);
+			}
+		}
+
+		bool isSupported() const
+		{
+			return validBits > 0;
+		}
+
+		/** @brief Reset the frame's queries, must be recorded outside of a render pass before any timestamp of this frame */
+		void cmdReset(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+		{
+			vkCmdResetQueryPool(commandBuffer, frames[frameIndex].queryPool, 0, timestampCount);
+		}
+
+		/**
+		* Write a timestamp once all previous commands have reached the given pipeline stage
+		*
+		* @param index Index of the timestamp (0 .. timestampCount - 1)
+		*/
+		void cmdWriteTimestamp(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t index, VkPipelineStageFlagBits stage)
+		{
+			assert(index < timestampCount);
+			if (isSupported())
+			{
+				vkCmdWriteTimestamp(commandBuffer, stage, frames[frameIndex].queryPool, index);
+			}
+		}
+
+		/**
+		* Pick up the timestamps of the frame's last submission, never blocks
+		* Only call this for frames whose command buffer has been submitted at least once, and before it is submitted again
+		*
+		* @return True if all timestamps of the frame were available
+		*/
+		bool resolve(uint32_t frameIndex)
+		{
+			if (!isSupported())
+			{
+				return false;
+			}
+			Frame &frame = frames[frameIndex];
+			// Each query returns its value and an availability value (both 64 bit)
+			std::vector<uint64_t> data(timestampCount * 2);
+			const VkResult result = vkGetQueryPoolResults(device->logicalDevice, frame.queryPool, 0, timestampCount, data.size() * sizeof(uint64_t), data.data(), sizeof(uint64_t) * 2, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+			if (result != VK_SUCCESS && result != VK_NOT_READY)
+			{
+				VK_CHECK_RESULT(result);
+			}
+			bool complete = true;
+			for (uint32_t i = 0; i < timestampCount; i++)
+			{
+				if (data[i * 2 + 1] != 0)
+				{
+					frame.timestamps[i] = data[i * 2];
+				}
+				else
+				{
+					complete = false;
+				}
+			}
+			if (complete)
+			{
+				lastResolvedFrame = frameIndex;
+			}
+			return complete;
+		}
+
+		/** @brief Returns the GPU time between two timestamps of the last completely resolved frame (in ms) */
+		double getDuration(uint32_t begin, uint32_t end) const
+		{
+			assert(begin < timestampCount && end < timestampCount);
+			const std::vector<uint64_t> &timestamps = frames[lastResolvedFrame].timestamps;
+			// Only the lower validBits bits of a timestamp are valid
+			const uint64_t mask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+			const uint64_t ticks = (timestamps[end] - timestamps[begin]) & mask;
+			return (double)ticks * (double)period / 1000000.0;
+		}
+
+		/**
+		* Returns a timestamp of the last completely resolved frame (in ms)
+		* Only timestamps written on the same queue are guaranteed to be comparable, comparing them across queues relies on the implementation using the same clock
+		*/
+		double getTime(uint32_t index) const
+		{
+			assert(index < timestampCount);
+			const uint64_t mask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+			return (double)(frames[lastResolvedFrame].timestamps[index] & mask) * (double)period / 1000000.0;
+		}
+
+	private:
+		vks::VulkanDevice *device;
+		uint32_t timestampCount;
+		uint32_t validBits;
+		// Nanoseconds per timestamp tick
+		float period;
+
+		struct Frame {
+			VkQueryPool queryPool;
+			std::vector<uint64_t> timestamps;
+		};
+		std::vector<Frame> frames;
+		uint32_t lastResolvedFrame = 0;
+	};
+}
@@ -0,0 +1,801 @@
+/*
+* Dynamic AABB tree (bounding volume hierarchy) for culling and picking
+*
+* Each leaf stores the (slightly enlarged) bounding box of one object, so moving objects only need to be reinserted once they leave their enlarged box
+* Inserts pick their sibling using the surface area heuristic and keep the tree balanced with rotations
+* Static scenes can be built at once with a binned SAH build, optionally distributed across a job system
+* All nodes are stored in a single flat array and referenced by index
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+#include "jobsystem.hpp"
+
+namespace vks
+{
+	/** @brief Axis aligned bounding box */
+	struct AABB {
+		glm::vec3 min;
+		glm::vec3 max;
+
+		AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+		AABB(glm::vec3 min, glm::vec3 max) : min(min), max(max) {}
+
+		static AABB merge(const AABB &a, const AABB &b)
+		{
+			return AABB(glm::min(a.min, b.min), glm::max(a.max, b.max));
+		}
+
+		void extend(const AABB &other)
+		{
+			min = glm::min(min, other.min);
+			max = glm::max(max, other.max);
+		}
+
+		glm::vec3 center() const
+		{
+			return (min + max) * 0.5f;
+		}
+
+		float surfaceArea() const
+		{
+			const glm::vec3 d = max - min;
+			return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+		}
+
+		bool contains(const AABB &other) const
+		{
+			return glm::all(glm::lessThanEqual(min, other.min)) && glm::all(glm::greaterThanEqual(max, other.max));
+		}
+	};
+
+	class AABBTree
+	{
+	public:
+		static const int32_t nullNode = -1;
+
+		struct Node {
+			/** @brief Bounds of the subtree (enlarged by the margin for leaves) */
+			AABB bounds;
+			int32_t parent = nullNode;
+			int32_t children[2] = { nullNode, nullNode };
+			/** @brief Height of the subtree (0 = leaf, -1 = unused node) */
+			int32_t height = -1;
+			/** @brief Application defined object id (leaves only) */
+			uint32_t userData = 0;
+
+			bool isLeaf() const
+			{
+				return children[0] == nullNode;
+			}
+		};
+
+		/** @brief Amount by which leaf bounds are enlarged, objects moving less than this don't need to be reinserted */
+		float margin = 0.1f;
+
+		/** @brief Remove all nodes */
+		void clear()
+		{
+			nodes.clear();
+			root = nullNode;
+			freeList = nullNode;
+			leafCount = 0;
+		}
+
+		/**
+		* Insert a new object into the tree
+		*
+		* @param bounds Bounds of the object
+		* @param userData Application defined object id returned by the queries
+		*
+		* @return Proxy id used to update or remove the object
+		*/
+		int32_t insert(const AABB &bounds, uint32_t userData)
+		{
+			const int32_t leaf = allocateNode();
+			nodes[leaf].bounds = enlarge(bounds);
+			nodes[leaf].userData = userData;
+			nodes[leaf].height = 0;
+			insertLeaf(leaf);
+			leafCount++;
+			return leaf;
+		}
+
+		/** @brief Remove an object from the tree */
+		void remove(int32_t proxy)
+		{
+			assert(nodes[proxy].isLeaf());
+			removeLeaf(proxy);
+			freeNode(proxy);
+			leafCount--;
+		}
+
+		/**
+		* Update the bounds of a moving object
+		* The object is only reinserted if the new bounds are no longer contained in its enlarged bounds
+		*
+		* @return True if the object had to be reinserted
+		*/
+		bool update(int32_t proxy, const AABB &bounds)
+		{
+			assert(nodes[proxy].isLeaf());
+			if (nodes[proxy].bounds.contains(bounds))
+			{
+				return false;
+			}
+			removeLeaf(proxy);
+			nodes[proxy].bounds = enlarge(bounds);
+			insertLeaf(proxy);
+			return true;
+		}
+
+		/**
+		* Refit the bounds of an object in place without changing the tree structure
+		* Cheaper than update for small movements, but the tree quality degrades if objects move far from where they were inserted
+		*/
+		void refit(int32_t proxy, const AABB &bounds)
+		{
+			assert(nodes[proxy].isLeaf());
+			nodes[proxy].bounds = enlarge(bounds);
+			int32_t index = nodes[proxy].parent;
+			while (index != nullNode)
+			{
+				const AABB merged = AABB::merge(nodes[nodes[index].children[0]].bounds, nodes[nodes[index].children[1]].bounds);
+				if (nodes[index].bounds.contains(merged) && merged.contains(nodes[index].bounds))
+				{
+					break;
+				}
+				nodes[index].bounds = merged;
+				index = nodes[index].parent;
+			}
+		}
+
+		/**
+		* Build a new tree for a set of objects using a binned surface area heuristic, replacing the current contents
+		*
+		* @param bounds Bounds of the objects
+		* @param userData Object ids, one per bounding box (if empty, the index of the bounding box is used)
+		* @param proxies Receives the proxy id for each object
+		* @param jobSystem (Optional) Job system used to build the lower levels of the tree in parallel
+		*/
+		void build(const std::vector<AABB> &bounds, const std::vector<uint32_t> &userData, std::vector<int32_t> &proxies, vks::JobSystem *jobSystem = nullptr)
+		{
+			assert(userData.empty() || userData.size() == bounds.size());
+			clear();
+			const uint32_t count = static_cast<uint32_t>(bounds.size());
+			proxies.resize(count);
+			if (count == 0)
+			{
+				return;
+			}
+
+			// A binary tree with n leaves has 2n - 1 nodes, so every subtree knows its node range in advance
+			nodes.resize(2 * count - 1);
+			leafCount = count;
+			root = 0;
+
+			std::vector<BuildItem> items(count);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				items[i].bounds = enlarge(bounds[i]);
+				items[i].centroid = items[i].bounds.center();
+				items[i].index = i;
+			}
+
+			BuildContext context = { items.data(), &userData, &proxies };
+
+			const uint32_t threadCount = jobSystem ? jobSystem->getThreadCount() : 0;
+			if (threadCount < 2 || count < parallelBuildThreshold)
+			{
+				buildRecursive(context, 0, count, 0, nullNode);
+				return;
+			}
+
+			// Split the upper levels on the calling thread until there are enough subtrees to keep all threads busy
+			struct Task {
+				uint32_t first;
+				uint32_t count;
+				int32_t node;
+				int32_t parent;
+			};
+			std::vector<Task> tasks = { { 0, count, 0, nullNode } };
+			std::vector<int32_t> upperNodes;
+			while (tasks.size() < threadCount * 4)
+			{
+				auto largest = std::max_element(tasks.begin(), tasks.end(), [](const Task &a, const Task &b) { return a.count < b.count; });
+				if (largest->count < parallelBuildThreshold)
+				{
+					break;
+				}
+				const Task task = *largest;
+				tasks.erase(largest);
+				const uint32_t leftCount = split(context, task.first, task.count, task.node, task.parent);
+				upperNodes.push_back(task.node);
+				tasks.push_back({ task.first, leftCount, task.node + 1, task.node });
+				tasks.push_back({ task.first + leftCount, task.count - leftCount, task.node + 2 * (int32_t)leftCount, task.node });
+			}
+
+			vks::JobCounter counter;
+			for (const Task &task : tasks)
+			{
+				jobSystem->addJob([=] { buildRecursive(context, task.first, task.count, task.node, task.parent); }, &counter);
+			}
+			jobSystem->wait(counter);
+
+			// Upper nodes were split in order, so children always come after their parents
+			for (auto it = upperNodes.rbegin(); it != upperNodes.rend(); ++it)
+			{
+				Node &node = nodes[*it];
+				node.height = 1 + std::max(nodes[node.children[0]].height, nodes[node.children[1]].height);
+			}
+		}
+
+		/**
+		* Collect all objects whose bounds intersect the view frustum
+		* Planes that fully contain a node are not tested again for its children, subtrees fully inside the frustum are added without further tests
+		*
+		* @param frustum View frustum
+		* @param result Receives the ids of the visible objects (appended)
+		*/
+		void queryFrustum(const vks::Frustum &frustum, std::vector<uint32_t> &result) const
+		{
+			if (root == nullNode)
+			{
+				return;
+			}
+			struct Entry {
+				int32_t node;
+				uint32_t planeMask;
+			};
+			std::vector<Entry> stack;
+			stack.reserve(64);
+			stack.push_back({ root, 0x3F });
+			while (!stack.empty())
+			{
+				const Entry entry = stack.back();
+				stack.pop_back();
+				const Node &node = nodes[entry.node];
+				uint32_t planeMask = entry.planeMask;
+				bool outside = false;
+				if (planeMask != 0)
+				{
+					const glm::vec3 center = node.bounds.center();
+					const glm::vec3 extent = node.bounds.max - center;
+					for (uint32_t p = 0; p < 6; p++)
+					{
+						if ((planeMask & (1 << p)) == 0)
+						{
+							continue;
+						}
+						const glm::vec4 &plane = frustum.planes[p];
+						const float d = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+						const float r = fabsf(plane.x) * extent.x + fabsf(plane.y) * extent.y + fabsf(plane.z) * extent.z;
+						if (d <= -r)
+						{
+							outside = true;
+							break;
+						}
+						if (d >= r)
+						{
+							planeMask &= ~(1 << p);
+						}
+					}
+				}
+				if (outside)
+				{
+					continue;
+				}
+				if (node.isLeaf())
+				{
+					result.push_back(node.userData);
+				}
+				else
+				{
+					stack.push_back({ node.children[0], planeMask });
+					stack.push_back({ node.children[1], planeMask });
+				}
+			}
+		}
+
+		/**
+		* Collect all objects whose bounds overlap a sphere
+		*
+		* @param result Receives the ids of the overlapping objects (appended)
+		*/
+		void querySphere(glm::vec3 center, float radius, std::vector<uint32_t> &result) const
+		{
+			if (root == nullNode)
+			{
+				return;
+			}
+			std::vector<int32_t> stack;
+			stack.reserve(64);
+			stack.push_back(root);
+			while (!stack.empty())
+			{
+				const Node &node = nodes[stack.back()];
+				stack.pop_back();
+				// Squared distance from the sphere center to the closest point of the box
+				const glm::vec3 d = glm::max(glm::max(node.bounds.min - center, center - node.bounds.max), glm::vec3(0.0f));
+				if (glm::dot(d, d) > radius * radius)
+				{
+					continue;
+				}
+				if (node.isLeaf())
+				{
+					result.push_back(node.userData);
+				}
+				else
+				{
+					stack.push_back(node.children[0]);
+					stack.push_back(node.children[1]);
+				}
+			}
+		}
+
+		/**
+		* Find the closest object hit by a ray
+		* Children are visited front to back and skipped if they start behind the closest hit found so far
+		*
+		* @param origin Ray origin
+		* @param direction Normalized ray direction
+		* @param maxDistance Maximum distance along the ray
+		* @param userData Receives the id of the closest object hit
+		* @param distance Receives the distance to the closest hit
+		* @param hitTest (Optional) Exact intersection test for an object, returns false on a miss and the hit distance otherwise
+		* If not set, the distance to the object's bounds is used
+		*
+		* @return True if an object was hit
+		*/
+		bool raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, uint32_t &userData, float &distance, std::function<bool(uint32_t userData, float &distance)> hitTest = nullptr) const
+		{
+			if (root == nullNode)
+			{
+				return false;
+			}
+			const glm::vec3 invDir = 1.0f / direction;
+			float closest = maxDistance;
+			bool hit = false;
+			std::vector<int32_t> stack;
+			stack.reserve(64);
+			stack.push_back(root);
+			while (!stack.empty())
+			{
+				const Node &node = nodes[stack.back()];
+				stack.pop_back();
+				float tNear;
+				if (!intersectRay(node.bounds, origin, invDir, closest, tNear))
+				{
+					continue;
+				}
+				if (node.isLeaf())
+				{
+					float t = tNear;
+					if (hitTest && !hitTest(node.userData, t))
+					{
+						continue;
+					}
+					if (t <= closest)
+					{
+						closest = t;
+						userData = node.userData;
+						hit = true;
+					}
+				}
+				else
+				{
+					// Push the farther child first so the nearer one is visited first
+					float tLeft, tRight;
+					const bool hitLeft = intersectRay(nodes[node.children[0]].bounds, origin, invDir, closest, tLeft);
+					const bool hitRight = intersectRay(nodes[node.children[1]].bounds, origin, invDir, closest, tRight);
+					if (hitLeft && hitRight)
+					{
+						const bool leftFirst = tLeft <= tRight;
+						stack.push_back(node.children[leftFirst ? 1 : 0]);
+						stack.push_back(node.children[leftFirst ? 0 : 1]);
+					}
+					else if (hitLeft)
+					{
+						stack.push_back(node.children[0]);
+					}
+					else if (hitRight)
+					{
+						stack.push_back(node.children[1]);
+					}
+				}
+			}
+			distance = closest;
+			return hit;
+		}
+
+		/** @brief Returns the (enlarged) bounds stored for an object */
+		const AABB &getBounds(int32_t proxy) const
+		{
+			return nodes[proxy].bounds;
+		}
+
+		/** @brief Returns the height of the tree (0 for a single object, -1 if empty) */
+		int32_t getHeight() const
+		{
+			return (root == nullNode) ? -1 : nodes[root].height;
+		}
+
+		/** @brief Returns the number of objects stored in the tree */
+		uint32_t getObjectCount() const
+		{
+			return leafCount;
+		}
+
+		/** @brief Returns the sum of all internal node surface areas relative to the root's (lower is better) */
+		float getCost() const
+		{
+			if (root == nullNode)
+			{
+				return 0.0f;
+			}
+			float area = 0.0f;
+			for (auto &node : nodes)
+			{
+				if (node.height > 0)
+				{
+					area += node.bounds.surfaceArea();
+				}
+			}
+			return area / nodes[root].bounds.surfaceArea();
+		}
+
+		/** @brief Flat node array, e.g. for uploading the tree to the GPU */
+		const std::vector<Node> &getNodes() const
+		{
+			return nodes;
+		}
+
+		int32_t getRoot() const
+		{
+			return root;
+		}
+
+	private:
+		std::vector<Node> nodes;
+		int32_t root = nullNode;
+		// Unused nodes are linked through their parent index
+		int32_t freeList = nullNode;
+		uint32_t leafCount = 0;
+
+		// Subtrees with less objects are built on a single thread
+		static const uint32_t parallelBuildThreshold = 4096;
+		static const uint32_t sahBinCount = 16;
+
+		struct BuildItem {
+			AABB bounds;
+			glm::vec3 centroid;
+			uint32_t index;
+		};
+
+		struct BuildContext {
+			BuildItem *items;
+			const std::vector<uint32_t> *userData;
+			std::vector<int32_t> *proxies;
+		};
+
+		AABB enlarge(const AABB &bounds) const
+		{
+			return AABB(bounds.min - glm::vec3(margin), bounds.max + glm::vec3(margin));
+		}
+
+		static bool intersectRay(const AABB &bounds, const glm::vec3 &origin, const glm::vec3 &invDir, float maxDistance, float &tNear)
+		{
+			const glm::vec3 t0 = (bounds.min - origin) * invDir;
+			const glm::vec3 t1 = (bounds.max - origin) * invDir;
+			const glm::vec3 tMin = glm::min(t0, t1);
+			const glm::vec3 tMax = glm::max(t0, t1);
+			tNear = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+			const float tFar = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, maxDistance));
+			return tNear <= tFar;
+		}
+
+		int32_t allocateNode()
+		{
+			if (freeList == nullNode)
+			{
+				nodes.push_back(Node());
+				return static_cast<int32_t>(nodes.size() - 1);
+			}
+			const int32_t index = freeList;
+			freeList = nodes[index].parent;
+			nodes[index] = Node();
+			return index;
+		}
+
+		void freeNode(int32_t index)
+		{
+			nodes[index].height = -1;
+			nodes[index].parent = freeList;
+			freeList = index;
+		}
+
+		void insertLeaf(int32_t leaf)
+		{
+			if (root == nullNode)
+			{
+				root = leaf;
+				nodes[leaf].parent = nullNode;
+				return;
+			}
+
+			// Descend to the sibling that causes the smallest increase in surface area
+			const AABB leafBounds = nodes[leaf].bounds;
+			int32_t index = root;
+			while (!nodes[index].isLeaf())
+			{
+				const Node &node = nodes[index];
+				const float area = node.bounds.surfaceArea();
+				const float combinedArea = AABB::merge(node.bounds, leafBounds).surfaceArea();
+				// Cost of creating a new parent for this node and the new leaf
+				const float cost = 2.0f * combinedArea;
+				// Minimum cost of pushing the leaf further down the tree
+				const float inheritanceCost = 2.0f * (combinedArea - area);
+				float childCost[2];
+				for (uint32_t i = 0; i < 2; i++)
+				{
+					const Node &child = nodes[node.children[i]];
+					const float mergedArea = AABB::merge(child.bounds, leafBounds).surfaceArea();
+					childCost[i] = (child.isLeaf() ? mergedArea : mergedArea - child.bounds.surfaceArea()) + inheritanceCost;
+				}
+				if (cost < childCost[0] && cost < childCost[1])
+				{
+					break;
+				}
+				index = (childCost[0] < childCost[1]) ? node.children[0] : node.children[1];
+			}
+
+			const int32_t sibling = index;
+			const int32_t oldParent = nodes[sibling].parent;
+			const int32_t newParent = allocateNode();
+			nodes[newParent].parent = oldParent;
+			nodes[newParent].bounds = AABB::merge(leafBounds, nodes[sibling].bounds);
+			nodes[newParent].height = nodes[sibling].height + 1;
+			nodes[newParent].children[0] = sibling;
+			nodes[newParent].children[1] = leaf;
+			nodes[sibling].parent = newParent;
+			nodes[leaf].parent = newParent;
+			if (oldParent != nullNode)
+			{
+				replaceChild(oldParent, sibling, newParent);
+			}
+			else
+			{
+				root = newParent;
+			}
+
+			refitAncestors(newParent);
+		}
+
+		void removeLeaf(int32_t leaf)
+		{
+			if (leaf == root)
+			{
+				root = nullNode;
+				return;
+			}
+			const int32_t parent = nodes[leaf].parent;
+			const int32_t grandParent = nodes[parent].parent;
+			const int32_t sibling = (nodes[parent].children[0] == leaf) ? nodes[parent].children[1] : nodes[parent].children[0];
+			freeNode(parent);
+			nodes[sibling].parent = grandParent;
+			if (grandParent != nullNode)
+			{
+				replaceChild(grandParent, parent, sibling);
+				refitAncestors(grandParent);
+			}
+			else
+			{
+				root = sibling;
+			}
+		}
+
+		void replaceChild(int32_t parent, int32_t oldChild, int32_t newChild)
+		{
+			Node &node = nodes[parent];
+			node.children[(node.children[0] == oldChild) ? 0 : 1] = newChild;
+		}
+
+		// Walk up the tree, rebalancing and recalculating bounds and heights
+		void refitAncestors(int32_t index)
+		{
+			while (index != nullNode)
+			{
+				index = balance(index);
+				Node &node = nodes[index];
+				const Node &left = nodes[node.children[0]];
+				const Node &right = nodes[node.children[1]];
+				node.height = 1 + std::max(left.height, right.height);
+				node.bounds = AABB::merge(left.bounds, right.bounds);
+				index = node.parent;
+			}
+		}
+
+		/*
+			Rotates the taller child of node a up if the heights of its children differ by more than one
+			Returns the index of the node that now takes the place of a
+		*/
+		int32_t balance(int32_t a)
+		{
+			if (nodes[a].isLeaf() || nodes[a].height < 2)
+			{
+				return a;
+			}
+			const int32_t b = nodes[a].children[0];
+			const int32_t c = nodes[a].children[1];
+			const int32_t heightDiff = nodes[c].height - nodes[b].height;
+			if (heightDiff > 1)
+			{
+				return rotate(a, c, 1);
+			}
+			if (heightDiff < -1)
+			{
+				return rotate(a, b, 0);
+			}
+			return a;
+		}
+
+		// Rotate child (at slot childSlot of a) up, a becomes a child of it and takes over the child's shorter subtree
+		int32_t rotate(int32_t a, int32_t child, uint32_t childSlot)
+		{
+			const int32_t other = nodes[a].children[1 - childSlot];
+			const int32_t f = nodes[child].children[0];
+			const int32_t g = nodes[child].children[1];
+
+			nodes[child].children[0] = a;
+			nodes[child].parent = nodes[a].parent;
+			nodes[a].parent = child;
+			if (nodes[child].parent != nullNode)
+			{
+				replaceChild(nodes[child].parent, a, child);
+			}
+			else
+			{
+				root = child;
+			}
+
+			// Keep the taller grandchild below the rotated node, move the shorter one to a
+			const int32_t keep = (nodes[f].height > nodes[g].height) ? f : g;
+			const int32_t move = (keep == f) ? g : f;
+			nodes[child].children[1] = keep;
+			nodes[a].children[childSlot] = move;
+			nodes[move].parent = a;
+
+			nodes[a].bounds = AABB::merge(nodes[other].bounds, nodes[move].bounds);
+			nodes[a].height = 1 + std::max(nodes[other].height, nodes[move].height);
+			nodes[child].bounds = AABB::merge(nodes[a].bounds, nodes[keep].bounds);
+			nodes[child].height = 1 + std::max(nodes[a].height, nodes[keep].height);
+			return child;
+		}
+
+		/*
+			Partitions items [first, first + count) with a binned SAH split along the longest centroid axis
+			Writes the internal node at index and returns the number of items in the left subtree
+			The left subtree starts at index + 1, the right one at index + 2 * leftCount
+		*/
+		uint32_t split(const BuildContext &context, uint32_t first, uint32_t count, int32_t index, int32_t parent)
+		{
+			BuildItem *items = context.items + first;
+			AABB bounds;
+			AABB centroidBounds;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				bounds.extend(items[i].bounds);
+				centroidBounds.extend(AABB(items[i].centroid, items[i].centroid));
+			}
+
+			Node &node = nodes[index];
+			node.bounds = bounds;
+			node.parent = parent;
+
+			const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+			const uint32_t axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : ((extent.y > extent.z) ? 1 : 2);
+
+			uint32_t leftCount = count / 2;
+			if (extent[axis] > 0.0f)
+			{
+				struct Bin {
+					AABB bounds;
+					uint32_t count = 0;
+				} bins[sahBinCount];
+				const float binScale = sahBinCount * 0.9999f / extent[axis];
+				for (uint32_t i = 0; i < count; i++)
+				{
+					const uint32_t b = static_cast<uint32_t>((items[i].centroid[axis] - centroidBounds.min[axis]) * binScale);
+					bins[b].bounds.extend(items[i].bounds);
+					bins[b].count++;
+				}
+
+				// Sweep from the right to get the cost of all right hand partitions, then from the left to find the cheapest split
+				float rightArea[sahBinCount];
+				uint32_t rightCount[sahBinCount];
+				AABB accumulated;
+				uint32_t accumulatedCount = 0;
+				for (uint32_t b = sahBinCount - 1; b > 0; b--)
+				{
+					accumulated.extend(bins[b].bounds);
+					accumulatedCount += bins[b].count;
+					rightArea[b] = accumulated.surfaceArea();
+					rightCount[b] = accumulatedCount;
+				}
+				float bestCost = FLT_MAX;
+				uint32_t bestSplit = 0;
+				accumulated = AABB();
+				accumulatedCount = 0;
+				for (uint32_t b = 1; b < sahBinCount; b++)
+				{
+					accumulated.extend(bins[b - 1].bounds);
+					accumulatedCount += bins[b - 1].count;
+					if (accumulatedCount == 0 || rightCount[b] == 0)
+					{
+						continue;
+					}
+					const float cost = accumulated.surfaceArea() * accumulatedCount + rightArea[b] * rightCount[b];
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestSplit = b;
+					}
+				}
+
+				if (bestSplit > 0)
+				{
+					const float minCentroid = centroidBounds.min[axis];
+					BuildItem *mid = std::partition(items, items + count, [&](const BuildItem &item) {
+						return static_cast<uint32_t>((item.centroid[axis] - minCentroid) * binScale) < bestSplit;
+					});
+					leftCount = static_cast<uint32_t>(mid - items);
+				}
+			}
+			if (leftCount == 0 || leftCount == count || extent[axis] <= 0.0f)
+			{
+				// All centroids in one bin, fall back to a median split
+				leftCount = count / 2;
+				std::nth_element(items, items + leftCount, items + count, [axis](const BuildItem &a, const BuildItem &b) { return a.centroid[axis] < b.centroid[axis]; });
+			}
+
+			node.children[0] = index + 1;
+			node.children[1] = index + 2 * static_cast<int32_t>(leftCount);
+			return leftCount;
+		}
+
+		void buildRecursive(const BuildContext &context, uint32_t first, uint32_t count, int32_t index, int32_t parent)
+		{
+			if (count == 1)
+			{
+				const BuildItem &item = context.items[first];
+				Node &leaf = nodes[index];
+				leaf.bounds = item.bounds;
+				leaf.parent = parent;
+				leaf.children[0] = leaf.children[1] = nullNode;
+				leaf.height = 0;
+				leaf.userData = context.userData->empty() ? item.index : (*context.userData)[item.index];
+				(*context.proxies)[item.index] = index;
+				return;
+			}
+			const uint32_t leftCount = split(context, first, count, index, parent);
+			buildRecursive(context, first, leftCount, index + 1, index);
+			buildRecursive(context, first + leftCount, count - leftCount, index + 2 * leftCount, index);
+			Node &node = nodes[index];
+			node.height = 1 + std::max(nodes[node.children[0]].height, nodes[node.children[1]].height);
+		}
+	};
+}
@@ -0,0 +1,591 @@
+/*
+* Barnes-Hut N-body solver
+*
+* Bodies are sorted along a 30 bit morton code (10 bits per axis) of their position inside the bounding cube,
+* so every octree node covers a contiguous range of the sorted bodies and its mass and center of mass can be
+* taken from prefix sums over that range
+* Levels that don't split the bodies are skipped, so every internal node has at least two children
+*
+* Nodes are stored in depth first order without child pointers: The first child of an internal node directly follows
+* it and every node stores the index of the node following its subtree. This allows a stackless traversal on the CPU
+* as well as in shaders (the node layout matches std430)
+*
+* Force evaluation uses the same force law as the computenbody shaders:
+*   acceleration += gravity * d * mass / pow(dot(d, d) + soften, power)
+* Nodes with size / distance < theta are approximated by their center of mass (theta = 0 gives the exact all pairs result)
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "simd.hpp"
+#include "jobsystem.hpp"
+#include "radixsort.hpp"
+
+namespace vks
+{
+	class BarnesHut
+	{
+	public:
+		/** @brief Octree node, matches the std430 layout used by shaders (32 bytes) */
+		struct Node {
+			// xyz = center of mass, w = mass
+			glm::vec4 centerOfMass;
+			// Edge length of the node's cell
+			float size;
+			// Index of the first node after this node's subtree, children start at this node's index + 1
+			uint32_t next;
+			// Range of the node's bodies in the sorted body array
+			uint32_t firstBody;
+			// Number of bodies for leaves, 0 for internal nodes
+			uint32_t bodyCount;
+		};
+
+		struct Settings {
+			/** @brief Opening criterion, nodes with size / distance below this are approximated by their center of mass */
+			float theta = 0.5f;
+			float gravity = 0.002f;
+			float power = 0.75f;
+			float soften = 0.05f;
+			/** @brief Nodes with up to this many bodies are not split any further */
+			uint32_t leafSize = 8;
+			/** @brief Use SSE/NEON for the force evaluation (if available, only for a power of 0.75) */
+			bool simd = true;
+		} settings;
+
+		struct Statistics {
+			double buildTime = 0.0;
+			double forceTime = 0.0;
+			uint32_t nodeCount = 0;
+			/** @brief Average number of interactions (nodes and bodies) per body of the last computeAccelerations call */
+			float averageInteractions = 0.0f;
+		} statistics;
+
+		/** @param jobSystem (Optional) Job system used for the tree build and force evaluation of large body counts */
+		BarnesHut(JobSystem *jobSystem = nullptr)
+		{
+			this->jobSystem = jobSystem;
+		}
+
+		/**
+		* Build the octree
+		*
+		* @param positions Body positions (xyz) and masses (w)
+		* @param count Number of bodies
+		* @param stride Distance between two bodies in bytes (e.g. to read the positions of an array of particle structs)
+		*/
+		void build(const glm::vec4 *positions, uint32_t count, uint32_t stride = sizeof(glm::vec4))
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+
+			bodies.resize(count);
+			bodyIndices.resize(count);
+			codes.resize(count);
+			nodes.clear();
+
+			if (count > 0)
+			{
+				const bool parallel = jobSystem && (count >= parallelThreshold);
+				const uint32_t chunkCount = parallel ? std::max(jobSystem->getThreadCount(), 1u) : 1;
+				const uint8_t *source = reinterpret_cast<const uint8_t*>(positions);
+				auto position = [source, stride](uint32_t index) -> const glm::vec4& { return *reinterpret_cast<const glm::vec4*>(source + (size_t)index * stride); };
+
+				// Bounding cube
+				std::vector<glm::vec3> chunkMin(chunkCount, glm::vec3(position(0)));
+				std::vector<glm::vec3> chunkMax(chunkCount, glm::vec3(position(0)));
+				forEachRange(jobSystem, parallel, count, chunkCount, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+					for (uint32_t i = begin; i < end; i++)
+					{
+						chunkMin[chunk] = glm::min(chunkMin[chunk], glm::vec3(position(i)));
+						chunkMax[chunk] = glm::max(chunkMax[chunk], glm::vec3(position(i)));
+					}
+				});
+				glm::vec3 minPos = chunkMin[0];
+				glm::vec3 maxPos = chunkMax[0];
+				for (uint32_t chunk = 1; chunk < chunkCount; chunk++)
+				{
+					minPos = glm::min(minPos, chunkMin[chunk]);
+					maxPos = glm::max(maxPos, chunkMax[chunk]);
+				}
+				const glm::vec3 extent = maxPos - minPos;
+				// Slightly enlarged so that the bodies on the upper bounds still map to the last cell
+				rootSize = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) * 1.001f;
+				rootOrigin = minPos;
+
+				// Sort by morton code, the body index is kept in the lower 32 bits
+				entries.resize(count);
+				scratch.resize(count);
+				const float scale = (float)(1 << maxLevel) / rootSize;
+				forEachRange(jobSystem, parallel, count, chunkCount, [&](uint32_t, uint32_t begin, uint32_t end) {
+					for (uint32_t i = begin; i < end; i++)
+					{
+						const glm::vec3 cell = glm::clamp((glm::vec3(position(i)) - rootOrigin) * scale, glm::vec3(0.0f), glm::vec3((float)((1 << maxLevel) - 1)));
+						const uint64_t code = (expandBits((uint32_t)cell.x) << 2) | (expandBits((uint32_t)cell.y) << 1) | expandBits((uint32_t)cell.z);
+						entries[i] = (code << 32) | i;
+					}
+				});
+				radixSort.parallelThreshold = parallelThreshold;
+				radixSort.sort(entries.data(), scratch.data(), count, [](uint64_t entry) { return entry >> 32; }, 3 * maxLevel, jobSystem);
+
+				forEachRange(jobSystem, parallel, count, chunkCount, [&](uint32_t, uint32_t begin, uint32_t end) {
+					for (uint32_t i = begin; i < end; i++)
+					{
+						codes[i] = static_cast<uint32_t>(entries[i] >> 32);
+						bodyIndices[i] = static_cast<uint32_t>(entries[i]);
+						bodies[i] = position(bodyIndices[i]);
+					}
+				});
+
+				buildPrefixSums(parallel, chunkCount);
+				buildTree(parallel);
+			}
+
+			prepareBodyStreams();
+
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			statistics.buildTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+			statistics.nodeCount = static_cast<uint32_t>(nodes.size());
+		}
+
+		/**
+		* Calculate the accelerations of all bodies of the last build
+		*
+		* @param accelerations Receives the acceleration (xyz) of every body, in the order the bodies were passed to build
+		*/
+		void computeAccelerations(glm::vec4 *accelerations)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+
+			const uint32_t count = static_cast<uint32_t>(bodies.size());
+			std::atomic<uint64_t> interactionCount(0);
+			auto computeRange = [&](uint32_t begin, uint32_t end) {
+				InteractionList list;
+				uint64_t interactions = 0;
+				for (uint32_t i = begin; i < end; i++)
+				{
+					const glm::vec3 acceleration = traverse(glm::vec3(bodies[i]), list);
+					accelerations[bodyIndices[i]] = glm::vec4(acceleration, 0.0f);
+					interactions += list.size();
+				}
+				interactionCount += interactions;
+			};
+			// Bodies are processed in sorted order, so neighbouring bodies visit mostly the same nodes
+			if (jobSystem && (count >= parallelThreshold))
+			{
+				jobSystem->parallelFor(count, computeRange, 256);
+			}
+			else
+			{
+				computeRange(0, count);
+			}
+
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			statistics.forceTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+			statistics.averageInteractions = (count > 0) ? (float)((double)interactionCount / (double)count) : 0.0f;
+		}
+
+		/** @brief Returns the approximated acceleration at the given position */
+		glm::vec3 getAcceleration(const glm::vec3 &position) const
+		{
+			InteractionList list;
+			return traverse(position, list);
+		}
+
+		/** @brief Returns the exact (all pairs) acceleration at the given position, e.g. to measure the approximation error */
+		glm::vec3 getExactAcceleration(const glm::vec3 &position) const
+		{
+			return accumulate(position, bodyX.data(), bodyY.data(), bodyZ.data(), bodyMass.data(), static_cast<uint32_t>(bodies.size()));
+		}
+
+		/** @brief Returns the nodes of the last build (depth first order, root first) */
+		const std::vector<Node> &getNodes() const
+		{
+			return nodes;
+		}
+
+		/** @brief Returns the bodies of the last build (xyz = position, w = mass), sorted in the order referenced by the leaves */
+		const std::vector<glm::vec4> &getBodies() const
+		{
+			return bodies;
+		}
+
+		/** @brief Sets the number of bodies below which everything is done on the calling thread */
+		void setParallelThreshold(uint32_t threshold)
+		{
+			parallelThreshold = threshold;
+		}
+
+	private:
+		// Number of octree levels below the root that can be addressed by the morton codes
+		static const uint32_t maxLevel = 10;
+
+		// Interaction list of a single body, stored as structure of arrays for the force kernel
+		struct InteractionList {
+			std::vector<float> x, y, z, mass;
+			InteractionList()
+			{
+				x.reserve(4096); y.reserve(4096); z.reserve(4096); mass.reserve(4096);
+			}
+			void clear()
+			{
+				x.clear(); y.clear(); z.clear(); mass.clear();
+			}
+			void add(const glm::vec4 &body)
+			{
+				x.push_back(body.x); y.push_back(body.y); z.push_back(body.z); mass.push_back(body.w);
+			}
+			uint32_t size() const
+			{
+				return static_cast<uint32_t>(x.size());
+			}
+		};
+
+		// Part of the tree, either a single node of the top levels (built serially) or a subtree built by a job
+		struct Segment {
+			uint32_t begin;
+			uint32_t end;
+			bool subtree;
+			// Top level nodes: Index of the first segment after the node's subtree
+			uint32_t endSegment;
+		};
+
+		JobSystem *jobSystem;
+		uint32_t parallelThreshold = 16384;
+		RadixSort radixSort;
+		float rootSize = 1.0f;
+		glm::vec3 rootOrigin = glm::vec3(0.0f);
+
+		std::vector<uint64_t> entries;
+		std::vector<uint64_t> scratch;
+		std::vector<uint32_t> codes;
+		std::vector<uint32_t> bodyIndices;
+		std::vector<glm::vec4> bodies;
+		std::vector<float> bodyX, bodyY, bodyZ, bodyMass;
+		// Mass weighted positions (xyz) and masses (w) of the first n sorted bodies
+		std::vector<glm::dvec4> prefixSums;
+		std::vector<Node> nodes;
+		std::vector<Segment> segments;
+		std::vector<std::vector<Node>> subtrees;
+
+		/** @brief Spreads the lower 10 bits of v to every third bit */
+		static uint64_t expandBits(uint32_t v)
+		{
+			v = (v * 0x00010001u) & 0xFF0000FFu;
+			v = (v * 0x00000101u) & 0x0F00F00Fu;
+			v = (v * 0x00000011u) & 0xC30C30C3u;
+			v = (v * 0x00000005u) & 0x49249249u;
+			return v;
+		}
+
+		/** @brief Returns the deepest level whose cell contains both codes */
+		static uint32_t commonLevel(uint32_t codeA, uint32_t codeB)
+		{
+			uint32_t diff = codeA ^ codeB;
+			if (diff == 0)
+			{
+				return maxLevel;
+			}
+			uint32_t highestBit = 0;
+			while (diff >>= 1)
+			{
+				highestBit++;
+			}
+			return (3 * maxLevel - 1 - highestBit) / 3;
+		}
+
+		/** @brief Calls function(begin, end) for the body ranges of the occupied child cells of the cell at the given level */
+		template<typename F>
+		void forEachChild(uint32_t begin, uint32_t end, uint32_t level, const F &function) const
+		{
+			const uint32_t childMask = (1u << (3 * (maxLevel - level - 1))) - 1;
+			while (begin < end)
+			{
+				const uint32_t childEnd = static_cast<uint32_t>(std::upper_bound(codes.begin() + begin, codes.begin() + end, codes[begin] | childMask) - codes.begin());
+				function(begin, childEnd);
+				begin = childEnd;
+			}
+		}
+
+		Node makeNode(uint32_t begin, uint32_t end, uint32_t level) const
+		{
+			const glm::dvec4 sum = prefixSums[end] - prefixSums[begin];
+			Node node;
+			node.centerOfMass = (sum.w > 0.0) ? glm::vec4(glm::vec3(glm::dvec3(sum) / sum.w), (float)sum.w) : glm::vec4(glm::vec3(bodies[begin]), 0.0f);
+			node.size = rootSize / (float)(1 << level);
+			node.next = 0;
+			node.firstBody = begin;
+			node.bodyCount = end - begin;
+			return node;
+		}
+
+		bool isLeaf(uint32_t begin, uint32_t end, uint32_t level) const
+		{
+			return (end - begin <= settings.leafSize) || (level >= maxLevel);
+		}
+
+		void buildSubtree(std::vector<Node> &subtree, uint32_t begin, uint32_t end) const
+		{
+			const uint32_t level = commonLevel(codes[begin], codes[end - 1]);
+			const uint32_t index = static_cast<uint32_t>(subtree.size());
+			subtree.push_back(makeNode(begin, end, level));
+			if (!isLeaf(begin, end, level))
+			{
+				subtree[index].bodyCount = 0;
+				forEachChild(begin, end, level, [&](uint32_t childBegin, uint32_t childEnd) {
+					buildSubtree(subtree, childBegin, childEnd);
+				});
+			}
+			subtree[index].next = static_cast<uint32_t>(subtree.size());
+		}
+
+		void buildSegments(uint32_t begin, uint32_t end, uint32_t subtreeSize)
+		{
+			const uint32_t level = commonLevel(codes[begin], codes[end - 1]);
+			if ((end - begin <= subtreeSize) || isLeaf(begin, end, level))
+			{
+				segments.push_back({ begin, end, true, 0 });
+				return;
+			}
+			const uint32_t index = static_cast<uint32_t>(segments.size());
+			segments.push_back({ begin, end, false, 0 });
+			forEachChild(begin, end, level, [&](uint32_t childBegin, uint32_t childEnd) {
+				buildSegments(childBegin, childEnd, subtreeSize);
+			});
+			segments[index].endSegment = static_cast<uint32_t>(segments.size());
+		}
+
+		void buildTree(bool parallel)
+		{
+			const uint32_t count = static_cast<uint32_t>(bodies.size());
+			if (!parallel)
+			{
+				buildSubtree(nodes, 0, count);
+				return;
+			}
+
+			// The top levels are split serially into enough subtrees to keep all threads busy
+			segments.clear();
+			buildSegments(0, count, std::max(count / (jobSystem->getThreadCount() * 8), settings.leafSize * 64));
+			const uint32_t segmentCount = static_cast<uint32_t>(segments.size());
+			subtrees.resize(segmentCount);
+			jobSystem->parallelFor(segmentCount, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++)
+				{
+					subtrees[i].clear();
+					if (segments[i].subtree)
+					{
+						buildSubtree(subtrees[i], segments[i].begin, segments[i].end);
+					}
+				}
+			});
+
+			// Segments are in depth first order, so the subtrees only need to be offset
+			std::vector<uint32_t> offsets(segmentCount + 1);
+			offsets[0] = 0;
+			for (uint32_t i = 0; i < segmentCount; i++)
+			{
+				offsets[i + 1] = offsets[i] + (segments[i].subtree ? static_cast<uint32_t>(subtrees[i].size()) : 1);
+			}
+			nodes.resize(offsets[segmentCount]);
+			jobSystem->parallelFor(segmentCount, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++)
+				{
+					const Segment &segment = segments[i];
+					if (segment.subtree)
+					{
+						for (uint32_t j = 0; j < subtrees[i].size(); j++)
+						{
+							Node node = subtrees[i][j];
+							node.next += offsets[i];
+							nodes[offsets[i] + j] = node;
+						}
+					}
+					else
+					{
+						Node node = makeNode(segment.begin, segment.end, commonLevel(codes[segment.begin], codes[segment.end - 1]));
+						node.bodyCount = 0;
+						node.next = offsets[segment.endSegment];
+						nodes[offsets[i]] = node;
+					}
+				}
+			});
+		}
+
+		void buildPrefixSums(bool parallel, uint32_t chunkCount)
+		{
+			const uint32_t count = static_cast<uint32_t>(bodies.size());
+			prefixSums.resize(count + 1);
+			std::vector<glm::dvec4> chunkSums(chunkCount + 1, glm::dvec4(0.0));
+			forEachRange(jobSystem, parallel, count, chunkCount, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+				glm::dvec4 sum(0.0);
+				for (uint32_t i = begin; i < end; i++)
+				{
+					const glm::dvec4 body(bodies[i]);
+					sum += glm::dvec4(glm::dvec3(body) * body.w, body.w);
+				}
+				chunkSums[chunk + 1] = sum;
+			});
+			for (uint32_t chunk = 1; chunk <= chunkCount; chunk++)
+			{
+				chunkSums[chunk] += chunkSums[chunk - 1];
+			}
+			prefixSums[0] = glm::dvec4(0.0);
+			forEachRange(jobSystem, parallel, count, chunkCount, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+				glm::dvec4 sum = chunkSums[chunk];
+				for (uint32_t i = begin; i < end; i++)
+				{
+					const glm::dvec4 body(bodies[i]);
+					sum += glm::dvec4(glm::dvec3(body) * body.w, body.w);
+					prefixSums[i + 1] = sum;
+				}
+			});
+		}
+
+		void prepareBodyStreams()
+		{
+			const uint32_t count = static_cast<uint32_t>(bodies.size());
+			bodyX.resize(count);
+			bodyY.resize(count);
+			bodyZ.resize(count);
+			bodyMass.resize(count);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				bodyX[i] = bodies[i].x;
+				bodyY[i] = bodies[i].y;
+				bodyZ[i] = bodies[i].z;
+				bodyMass[i] = bodies[i].w;
+			}
+		}
+
+		/** @brief Collects the interactions of a position with a stackless traversal and evaluates them */
+		glm::vec3 traverse(const glm::vec3 &position, InteractionList &list) const
+		{
+			list.clear();
+			const float thetaSquared = settings.theta * settings.theta;
+			const uint32_t nodeCount = static_cast<uint32_t>(nodes.size());
+			uint32_t index = 0;
+			while (index < nodeCount)
+			{
+				const Node &node = nodes[index];
+				const glm::vec3 d = glm::vec3(node.centerOfMass) - position;
+				if (node.size * node.size < thetaSquared * glm::dot(d, d))
+				{
+					list.add(node.centerOfMass);
+					index = node.next;
+				}
+				else if (node.bodyCount > 0)
+				{
+					for (uint32_t i = node.firstBody; i < node.firstBody + node.bodyCount; i++)
+					{
+						list.add(bodies[i]);
+					}
+					index = node.next;
+				}
+				else
+				{
+					index++;
+				}
+			}
+			return accumulate(position, list.x.data(), list.y.data(), list.z.data(), list.mass.data(), list.size());
+		}
+
+		/** @brief Sums up the accelerations caused by the given bodies */
+		glm::vec3 accumulate(const glm::vec3 &position, const float *x, const float *y, const float *z, const float *mass, uint32_t count) const
+		{
+			glm::vec3 acceleration(0.0f);
+			uint32_t i = 0;
+#if defined(VKS_SIMD_SSE2)
+			if (settings.simd && settings.power == 0.75f)
+			{
+				const __m128 vPosX = _mm_set1_ps(position.x);
+				const __m128 vPosY = _mm_set1_ps(position.y);
+				const __m128 vPosZ = _mm_set1_ps(position.z);
+				const __m128 vSoften = _mm_set1_ps(settings.soften);
+				__m128 vAccX = _mm_setzero_ps();
+				__m128 vAccY = _mm_setzero_ps();
+				__m128 vAccZ = _mm_setzero_ps();
+				for (; i + 4 <= count; i += 4)
+				{
+					const __m128 dx = _mm_sub_ps(_mm_loadu_ps(&x[i]), vPosX);
+					const __m128 dy = _mm_sub_ps(_mm_loadu_ps(&y[i]), vPosY);
+					const __m128 dz = _mm_sub_ps(_mm_loadu_ps(&z[i]), vPosZ);
+					const __m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_add_ps(_mm_mul_ps(dz, dz), vSoften));
+					// s^0.75 = sqrt(s) * sqrt(sqrt(s))
+					const __m128 root = _mm_sqrt_ps(s);
+					const __m128 factor = _mm_div_ps(_mm_loadu_ps(&mass[i]), _mm_mul_ps(root, _mm_sqrt_ps(root)));
+					vAccX = _mm_add_ps(vAccX, _mm_mul_ps(dx, factor));
+					vAccY = _mm_add_ps(vAccY, _mm_mul_ps(dy, factor));
+					vAccZ = _mm_add_ps(vAccZ, _mm_mul_ps(dz, factor));
+				}
+				acceleration = glm::vec3(horizontalSum(vAccX), horizontalSum(vAccY), horizontalSum(vAccZ));
+			}
+#elif defined(VKS_SIMD_NEON)
+			if (settings.simd && settings.power == 0.75f)
+			{
+				const float32x4_t vPosX = vdupq_n_f32(position.x);
+				const float32x4_t vPosY = vdupq_n_f32(position.y);
+				const float32x4_t vPosZ = vdupq_n_f32(position.z);
+				const float32x4_t vSoften = vdupq_n_f32(settings.soften);
+				float32x4_t vAccX = vdupq_n_f32(0.0f);
+				float32x4_t vAccY = vdupq_n_f32(0.0f);
+				float32x4_t vAccZ = vdupq_n_f32(0.0f);
+				for (; i + 4 <= count; i += 4)
+				{
+					const float32x4_t dx = vsubq_f32(vld1q_f32(&x[i]), vPosX);
+					const float32x4_t dy = vsubq_f32(vld1q_f32(&y[i]), vPosY);
+					const float32x4_t dz = vsubq_f32(vld1q_f32(&z[i]), vPosZ);
+					const float32x4_t s = vmlaq_f32(vmlaq_f32(vmlaq_f32(vSoften, dx, dx), dy, dy), dz, dz);
+					// s^-0.75 = r * r * r^-0.5 with r = s^-0.5
+					const float32x4_t r = reciprocalSqrt(s);
+					const float32x4_t factor = vmulq_f32(vld1q_f32(&mass[i]), vmulq_f32(vmulq_f32(r, r), reciprocalSqrt(r)));
+					vAccX = vmlaq_f32(vAccX, dx, factor);
+					vAccY = vmlaq_f32(vAccY, dy, factor);
+					vAccZ = vmlaq_f32(vAccZ, dz, factor);
+				}
+				acceleration = glm::vec3(horizontalSum(vAccX), horizontalSum(vAccY), horizontalSum(vAccZ));
+			}
+#endif
+			for (; i < count; i++)
+			{
+				const glm::vec3 d = glm::vec3(x[i], y[i], z[i]) - position;
+				acceleration += d * mass[i] / powf(glm::dot(d, d) + settings.soften, settings.power);
+			}
+			return acceleration * settings.gravity;
+		}
+
+#if defined(VKS_SIMD_SSE2)
+		static float horizontalSum(__m128 v)
+		{
+			const __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+			return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+		}
+#elif defined(VKS_SIMD_NEON)
+		static float horizontalSum(float32x4_t v)
+		{
+			const float32x2_t pairs = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+			return vget_lane_f32(vpadd_f32(pairs, pairs), 0);
+		}
+
+		// Estimate refined with two Newton-Raphson steps (ARMv7 has no vector square root)
+		static float32x4_t reciprocalSqrt(float32x4_t v)
+		{
+			float32x4_t r = vrsqrteq_f32(v);
+			r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(v, r), r));
+			return vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(v, r), r));
+		}
+#endif
+	};
+}
@@ -0,0 +1,386 @@
+/*
+* AngelCode bitmap font (.fnt) glyph table with kerning
+*
+* The text file is only read and parsed if there is no matching binary cache next to it, the parsed table is then written to that cache
+* A cache matches if the size and modification time of the text file it was written for are unchanged
+* Glyphs are laid out in font units where 1.0 is the distance from the top of a line to its baseline
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <sys/stat.h>
+
+#include <glm/glm.hpp>
+
+#if defined(__ANDROID__)
+#include <android/asset_manager.h>
+#include "vulkanandroid.h"
+#endif
+
+namespace vks
+{
+	class BitmapFont
+	{
+	public:
+		struct Glyph {
+			// Position and size in the font texture (pixels)
+			uint16_t x, y;
+			uint16_t width, height;
+			int16_t xoffset, yoffset;
+			int16_t xadvance;
+			uint16_t page;
+		};
+
+		struct Metrics {
+			uint32_t lineHeight = 0;
+			uint32_t base = 0;
+			uint32_t scaleW = 0;
+			uint32_t scaleH = 0;
+		} metrics;
+
+		/** @brief Quad of a single glyph, xy = top left, zw = bottom right */
+		struct GlyphQuad {
+			glm::vec4 pos;
+			glm::vec4 uv;
+		};
+
+		struct {
+			// Time for loading the font (ms), including reading the file
+			double loadTime = 0.0;
+			bool loadedFromCache = false;
+		} statistics;
+
+		/**
+		* Load the glyph table from an AngelCode text format file
+		*
+		* @param filename Path of the .fnt file, the binary cache is stored at filename + ".cache"
+		*
+		* @return True if the font could be loaded, false if the file is missing or lacks the common metrics (base, scaleW, scaleH)
+		* @note The cache is only used on platforms that load assets from the file system (not on Android)
+		*/
+		bool loadFromFile(const std::string &filename)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+
+			statistics.loadedFromCache = false;
+#if !defined(__ANDROID__)
+			// The cache is checked against the size and modification time of the text file, so it's not read at all if the cache is valid
+			struct stat info;
+			if (stat(filename.c_str(), &info) != 0)
+			{
+				return false;
+			}
+			const uint64_t sourceSize = static_cast<uint64_t>(info.st_size);
+			const uint64_t sourceTime = static_cast<uint64_t>(info.st_mtime);
+			statistics.loadedFromCache = loadCache(filename + ".cache", sourceSize, sourceTime);
+#endif
+			if (!statistics.loadedFromCache)
+			{
+				std::string source;
+				if (!readFile(filename, source) || !parse(source))
+				{
+					return false;
+				}
+#if !defined(__ANDROID__)
+				writeCache(filename + ".cache", sourceSize, sourceTime);
+#endif
+			}
+			buildKerningMask();
+
+			statistics.loadTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+			return true;
+		}
+
+		/** @brief Returns the glyph for a char, chars not contained in the font use the glyph of char 0 */
+		const Glyph &getGlyph(uint8_t c) const
+		{
+			return present[c] ? glyphs[c] : glyphs[0];
+		}
+
+		/** @brief Returns the kerning (pixels) to apply between two chars */
+		int32_t getKerning(uint8_t first, uint8_t second) const
+		{
+			// Most chars don't start a kerning pair, so the search is skipped for them
+			if ((kerningMask[first >> 6] & (1ull << (first & 63))) == 0)
+			{
+				return 0;
+			}
+			const uint32_t key = ((uint32_t)first << 8) | second;
+			auto pair = std::lower_bound(kernings.begin(), kernings.end(), key, [](const KerningPair &pair, uint32_t key) { return pair.key < key; });
+			return ((pair != kernings.end()) && (pair->key == key)) ? pair->amount : 0;
+		}
+
+		/** @brief Returns the width of the widest line of a text in font units */
+		float measure(const std::string &text) const
+		{
+			const float unit = 1.0f / (float)metrics.base;
+			float width = 0.0f;
+			float x = 0.0f;
+			uint8_t previous = 0;
+			for (auto c : text)
+			{
+				if (c == '\n')
+				{
+					width = std::max(width, x);
+					x = 0.0f;
+					previous = 0;
+					continue;
+				}
+				x += (float)(getKerning(previous, (uint8_t)c) + getGlyph((uint8_t)c).xadvance) * unit;
+				previous = (uint8_t)c;
+			}
+			return std::max(width, x);
+		}
+
+		/**
+		* Generate the quads of all visible glyphs of a text
+		*
+		* @param text Text to lay out, '\n' starts a new line
+		* @param anchor Point of the text placed at the origin, relative to the width of the text and the baseline of the first line (0.5, 0.5 = centered on the first line)
+		* @param quads Receives one quad per visible glyph (in font units, y pointing down)
+		*
+		* @return Number of quads appended
+		*/
+		uint32_t layout(const std::string &text, const glm::vec2 &anchor, std::vector<GlyphQuad> &quads) const
+		{
+			const float unit = 1.0f / (float)metrics.base;
+			const glm::vec2 uvScale = glm::vec2(1.0f / (float)metrics.scaleW, 1.0f / (float)metrics.scaleH);
+
+			const float width = (anchor.x != 0.0f) ? measure(text) : 0.0f;
+			const float startX = -width * anchor.x;
+			float x = startX;
+			float y = -anchor.y;
+			uint8_t previous = 0;
+			uint32_t count = 0;
+			for (auto letter : text)
+			{
+				const uint8_t c = (uint8_t)letter;
+				if (c == '\n')
+				{
+					x = startX;
+					y += (float)metrics.lineHeight * unit;
+					previous = 0;
+					continue;
+				}
+				x += (float)getKerning(previous, c) * unit;
+				const Glyph &glyph = getGlyph(c);
+				// Whitespace only advances
+				if ((glyph.width > 0) && (glyph.height > 0))
+				{
+					GlyphQuad quad;
+					quad.pos.x = x + (float)glyph.xoffset * unit;
+					quad.pos.y = y + (float)glyph.yoffset * unit;
+					quad.pos.z = quad.pos.x + (float)glyph.width * unit;
+					quad.pos.w = quad.pos.y + (float)glyph.height * unit;
+					quad.uv = glm::vec4(glyph.x * uvScale.x, glyph.y * uvScale.y, (glyph.x + glyph.width) * uvScale.x, (glyph.y + glyph.height) * uvScale.y);
+					quads.push_back(quad);
+					count++;
+				}
+				x += (float)glyph.xadvance * unit;
+				previous = c;
+			}
+			return count;
+		}
+
+	private:
+		// Bump if the layout of the cached data changes
+		static const uint32_t cacheVersion = 2;
+
+		struct KerningPair {
+			// First char in the upper, second char in the lower 8 bits
+			uint32_t key;
+			int32_t amount;
+		};
+
+		struct CacheHeader {
+			uint32_t magic;
+			uint32_t version;
+			// Size and modification time of the text file the cache was written for
+			uint64_t sourceSize;
+			uint64_t sourceTime;
+			Metrics metrics;
+			uint32_t kerningCount;
+		};
+
+		std::array<Glyph, 256> glyphs = {};
+		std::array<uint8_t, 256> present = {};
+		// Sorted by key
+		std::vector<KerningPair> kernings;
+		// One bit per char that starts at least one kerning pair
+		uint64_t kerningMask[4] = {};
+
+		bool readFile(const std::string &filename, std::string &content)
+		{
+#if defined(__ANDROID__)
+			// Font description files are stored inside the apk, so they need to be loaded via the asset manager
+			AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_STREAMING);
+			if (!asset)
+			{
+				return false;
+			}
+			content.resize(AAsset_getLength(asset));
+			AAsset_read(asset, &content[0], content.size());
+			AAsset_close(asset);
+#else
+			std::ifstream file(filename, std::ios::in | std::ios::binary);
+			if (!file.is_open())
+			{
+				return false;
+			}
+			std::stringstream stream;
+			stream << file.rdbuf();
+			content = stream.str();
+#endif
+			return !content.empty();
+		}
+
+		// Returns the value of a key=value pair of a line
+		static int32_t getValue(const std::string &line, const char *key)
+		{
+			const std::string pattern = std::string(" ") + key + "=";
+			size_t pos = line.find(pattern);
+			return (pos != std::string::npos) ? atoi(line.c_str() + pos + pattern.size()) : 0;
+		}
+
+		// See http://www.angelcode.com/products/bmfont/doc/file_format.html for details
+		bool parse(const std::string &source)
+		{
+			glyphs = {};
+			present = {};
+			kernings.clear();
+			metrics = {};
+
+			std::istringstream stream(source);
+			std::string line;
+			while (std::getline(stream, line))
+			{
+				if (line.compare(0, 7, "common ") == 0)
+				{
+					metrics.lineHeight = getValue(line, "lineHeight");
+					metrics.base = getValue(line, "base");
+					metrics.scaleW = getValue(line, "scaleW");
+					metrics.scaleH = getValue(line, "scaleH");
+				}
+				else if (line.compare(0, 5, "char ") == 0)
+				{
+					const int32_t id = getValue(line, "id");
+					if ((id < 0) || (id > 255))
+					{
+						continue;
+					}
+					Glyph &glyph = glyphs[id];
+					glyph.x = (uint16_t)getValue(line, "x");
+					glyph.y = (uint16_t)getValue(line, "y");
+					glyph.width = (uint16_t)getValue(line, "width");
+					glyph.height = (uint16_t)getValue(line, "height");
+					glyph.xoffset = (int16_t)getValue(line, "xoffset");
+					glyph.yoffset = (int16_t)getValue(line, "yoffset");
+					glyph.xadvance = (int16_t)getValue(line, "xadvance");
+					glyph.page = (uint16_t)getValue(line, "page");
+					present[id] = 1;
+				}
+				else if (line.compare(0, 8, "kerning ") == 0)
+				{
+					const int32_t first = getValue(line, "first");
+					const int32_t second = getValue(line, "second");
+					if ((first >= 0) && (first <= 255) && (second >= 0) && (second <= 255))
+					{
+						kernings.push_back({ ((uint32_t)first << 8) | (uint32_t)second, getValue(line, "amount") });
+					}
+				}
+			}
+			std::sort(kernings.begin(), kernings.end(), [](const KerningPair &a, const KerningPair &b) { return a.key < b.key; });
+			return hasValidMetrics();
+		}
+
+		// Text layout divides by these, so fonts without them are rejected
+		bool hasValidMetrics() const
+		{
+			return (metrics.base > 0) && (metrics.scaleW > 0) && (metrics.scaleH > 0);
+		}
+
+		void buildKerningMask()
+		{
+			memset(kerningMask, 0, sizeof(kerningMask));
+			for (auto &pair : kernings)
+			{
+				const uint32_t first = pair.key >> 8;
+				kerningMask[first >> 6] |= 1ull << (first & 63);
+			}
+		}
+
+		bool loadCache(const std::string &filename, uint64_t sourceSize, uint64_t sourceTime)
+		{
+			std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+			if (!file.is_open())
+			{
+				return false;
+			}
+			const std::streamoff fileSize = file.tellg();
+			file.seekg(0, std::ios::beg);
+			CacheHeader header;
+			if (!file.read((char*)&header, sizeof(header)) || (header.magic != cacheMagic()) || (header.version != cacheVersion) || (header.sourceSize != sourceSize) || (header.sourceTime != sourceTime) || (header.metrics.base == 0) || (header.metrics.scaleW == 0) || (header.metrics.scaleH == 0))
+			{
+				return false;
+			}
+			// Reject kerning counts that can't be stored in the rest of the file before allocating them
+			const std::streamoff kerningDataSize = fileSize - (std::streamoff)(sizeof(header) + sizeof(Glyph) * glyphs.size() + present.size());
+			if ((kerningDataSize < 0) || ((uint64_t)header.kerningCount > (uint64_t)kerningDataSize / sizeof(KerningPair)))
+			{
+				return false;
+			}
+			std::vector<KerningPair> cachedKernings(header.kerningCount);
+			file.read((char*)glyphs.data(), sizeof(Glyph) * glyphs.size());
+			file.read((char*)present.data(), present.size());
+			file.read((char*)cachedKernings.data(), sizeof(KerningPair) * cachedKernings.size());
+			if (!file)
+			{
+				// Truncated cache, fall back to parsing
+				return false;
+			}
+			metrics = header.metrics;
+			kernings.swap(cachedKernings);
+			return true;
+		}
+
+		void writeCache(const std::string &filename, uint64_t sourceSize, uint64_t sourceTime)
+		{
+			// The cache is optional, so failing to write it (e.g. read-only asset directory) is not an error
+			std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+			{
+				return;
+			}
+			CacheHeader header = {};
+			header.magic = cacheMagic();
+			header.version = cacheVersion;
+			header.sourceSize = sourceSize;
+			header.sourceTime = sourceTime;
+			header.metrics = metrics;
+			header.kerningCount = static_cast<uint32_t>(kernings.size());
+			file.write((const char*)&header, sizeof(header));
+			file.write((const char*)glyphs.data(), sizeof(Glyph) * glyphs.size());
+			file.write((const char*)present.data(), present.size());
+			file.write((const char*)kernings.data(), sizeof(KerningPair) * kernings.size());
+		}
+
+		static uint32_t cacheMagic()
+		{
+			return ('B' << 24) | ('F' << 16) | ('N' << 8) | 'T';
+		}
+	};
+}
@@ -0,0 +1,931 @@
+/*
+* Host side block compressor for BC1, BC3, BC4 and BC7 textures
+*
+* Compresses uncompressed (e.g. procedurally generated) texture data at load time
+* Endpoints are fitted along the principal axis of each block and optionally refined with a least squares fit,
+* index selection is vectorized (SSE/NEON, if available) and block rows are distributed across a job system
+* BC7 blocks are encoded with mode 6 (single subset, combined RGBA endpoints with 4 bit indices)
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "vulkan/vulkan.h"
+
+#include "simd.hpp"
+#include "jobsystem.hpp"
+
+namespace vks
+{
+	class BlockCompressor
+	{
+	public:
+		struct Settings {
+			/** @brief Number of least squares endpoint refinement passes (0 = principal axis extents only) */
+			uint32_t refinementIterations = 1;
+			/** @brief Use vectorized code paths (set to false to force the scalar reference path) */
+			bool simd = true;
+			/** @brief Decode the compressed blocks after compression to calculate the PSNR */
+			bool computePSNR = false;
+		} settings;
+
+		struct Statistics {
+			/** @brief Time (in ms) taken for compression (excluding PSNR calculation) */
+			double time = 0.0;
+			/** @brief Compression throughput in megapixels per second */
+			double megaPixelsPerSecond = 0.0;
+			/** @brief Peak signal to noise ratio (in dB) of the compressed data (only if settings.computePSNR is set) */
+			double psnr = 0.0;
+			/** @brief Size of the uncompressed and compressed data in bytes */
+			VkDeviceSize sourceSize = 0;
+			VkDeviceSize compressedSize = 0;
+		} lastStatistics;
+
+		/** @param jobSystem (Optional) Job system the block rows of large images are distributed across, compresses on the calling thread if not set */
+		BlockCompressor(vks::JobSystem *jobSystem = nullptr)
+		{
+			this->jobSystem = jobSystem;
+		}
+
+		/** @brief Returns the number of threads used for compression */
+		uint32_t getThreadCount()
+		{
+			return jobSystem ? jobSystem->getThreadCount() : 1;
+		}
+
+		/** @brief Returns true if the block compressed format can be generated */
+		static bool formatSupported(VkFormat format)
+		{
+			return getBlockSize(format) > 0;
+		}
+
+		/** @brief Returns the size of a single 4x4 block in bytes (0 if the format is not supported) */
+		static uint32_t getBlockSize(VkFormat format)
+		{
+			switch (format)
+			{
+			case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+			case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+			case VK_FORMAT_BC4_UNORM_BLOCK:
+				return 8;
+			case VK_FORMAT_BC3_UNORM_BLOCK:
+			case VK_FORMAT_BC3_SRGB_BLOCK:
+			case VK_FORMAT_BC7_UNORM_BLOCK:
+			case VK_FORMAT_BC7_SRGB_BLOCK:
+				return 16;
+			default:
+				return 0;
+			}
+		}
+
+		/**
+		* Returns true if image data in the uncompressed source format can be compressed into the block compressed format
+		* BC4 is compressed from R8 data, all other formats from RGBA8 data with the same color space (sRGB or linear) as the target
+		*/
+		static bool sourceFormatSupported(VkFormat sourceFormat, VkFormat format)
+		{
+			switch (format)
+			{
+			case VK_FORMAT_BC4_UNORM_BLOCK:
+				return sourceFormat == VK_FORMAT_R8_UNORM;
+			case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+			case VK_FORMAT_BC3_UNORM_BLOCK:
+			case VK_FORMAT_BC7_UNORM_BLOCK:
+				return sourceFormat == VK_FORMAT_R8G8B8A8_UNORM;
+			case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+			case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+			case VK_FORMAT_BC3_SRGB_BLOCK:
+			case VK_FORMAT_BC7_SRGB_BLOCK:
+				return sourceFormat == VK_FORMAT_R8G8B8A8_SRGB;
+			default:
+				return false;
+			}
+		}
+
+		/** @brief Returns the number of 8 bit channels per pixel expected as the source for the given format (BC4 is compressed from single channel data, all other formats from RGBA) */
+		static uint32_t getSourceChannels(VkFormat format)
+		{
+			return (format == VK_FORMAT_BC4_UNORM_BLOCK) ? 1 : 4;
+		}
+
+		/** @brief Returns the size of the compressed data in bytes */
+		static VkDeviceSize getCompressedSize(VkFormat format, uint32_t width, uint32_t height)
+		{
+			return (VkDeviceSize)((width + 3) / 4) * ((height + 3) / 4) * getBlockSize(format);
+		}
+
+		/**
+		* Compress an image
+		*
+		* @param src Pointer to the tightly packed uncompressed image data (RGBA8, or R8 for BC4)
+		* @param width Width of the image
+		* @param height Height of the image
+		* @param format Block compressed target format (see formatSupported)
+		* @param dst Destination for the compressed blocks, must be at least the size returned by getCompressedSize
+		*/
+		void compress(const void *src, uint32_t width, uint32_t height, VkFormat format, void *dst)
+		{
+			assert(src && dst);
+			assert(formatSupported(format));
+
+			auto tStart = std::chrono::high_resolution_clock::now();
+
+			const uint32_t blocksX = (width + 3) / 4;
+			const uint32_t blocksY = (height + 3) / 4;
+			const uint8_t *srcData = static_cast<const uint8_t*>(src);
+			uint8_t *dstData = static_cast<uint8_t*>(dst);
+
+			parallelBlockRows(blocksY, blocksX, [&](uint32_t y0, uint32_t y1) {
+				compressBlockRows(srcData, width, height, format, dstData, y0, y1);
+			});
+
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			lastStatistics.time = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+			lastStatistics.megaPixelsPerSecond = (double)width * height / (lastStatistics.time * 1000.0);
+			lastStatistics.sourceSize = (VkDeviceSize)width * height * getSourceChannels(format);
+			lastStatistics.compressedSize = getCompressedSize(format, width, height);
+			lastStatistics.psnr = settings.computePSNR ? calculatePSNR(srcData, width, height, format, dstData) : 0.0;
+		}
+
+		/** @brief Compress an image into a new host buffer (see compress above) */
+		std::vector<uint8_t> compress(const void *src, uint32_t width, uint32_t height, VkFormat format)
+		{
+			std::vector<uint8_t> data(static_cast<size_t>(getCompressedSize(format, width, height)));
+			compress(src, width, height, format, data.data());
+			return data;
+		}
+
+		/**
+		* Decompress an image that has been compressed with this class
+		*
+		* @param src Compressed blocks
+		* @param width Width of the image
+		* @param height Height of the image
+		* @param format Block compressed format of the source data
+		* @param dst Destination for the uncompressed image (RGBA8, or R8 for BC4)
+		*/
+		static void decompress(const void *src, uint32_t width, uint32_t height, VkFormat format, void *dst)
+		{
+			const uint32_t blockSize = getBlockSize(format);
+			const uint32_t channels = getSourceChannels(format);
+			const uint8_t *srcData = static_cast<const uint8_t*>(src);
+			uint8_t *dstData = static_cast<uint8_t*>(dst);
+			const uint32_t blocksX = (width + 3) / 4;
+			for (uint32_t by = 0; by < (height + 3) / 4; by++)
+			{
+				for (uint32_t bx = 0; bx < blocksX; bx++)
+				{
+					uint8_t texels[16 * 4];
+					decodeBlock(srcData + (by * blocksX + bx) * blockSize, format, texels);
+					for (uint32_t y = 0; y < 4; y++)
+					{
+						for (uint32_t x = 0; x < 4; x++)
+						{
+							if ((bx * 4 + x < width) && (by * 4 + y < height))
+							{
+								memcpy(dstData + ((by * 4 + y) * width + bx * 4 + x) * channels, texels + (y * 4 + x) * channels, channels);
+							}
+						}
+					}
+				}
+			}
+		}
+
+	private:
+		vks::JobSystem *jobSystem;
+
+		/** @brief Images with less than this number of blocks are compressed on the calling thread */
+		static const uint32_t minParallelBlocks = 1024;
+
+		// Pixels of a single block in structure of arrays layout
+		struct Block {
+			float r[16];
+			float g[16];
+			float b[16];
+			float a[16];
+		};
+
+		// Fetch a 4x4 block, texels outside of the image are clamped to the border
+		static void loadBlock(const uint8_t *src, uint32_t width, uint32_t height, uint32_t channels, uint32_t bx, uint32_t by, Block &block)
+		{
+			for (uint32_t y = 0; y < 4; y++)
+			{
+				const uint32_t sy = std::min(by * 4 + y, height - 1);
+				for (uint32_t x = 0; x < 4; x++)
+				{
+					const uint32_t sx = std::min(bx * 4 + x, width - 1);
+					const uint8_t *texel = src + ((size_t)sy * width + sx) * channels;
+					const uint32_t i = y * 4 + x;
+					if (channels == 1)
+					{
+						block.r[i] = texel[0];
+						block.g[i] = block.b[i] = 0.0f;
+						block.a[i] = 255.0f;
+					}
+					else
+					{
+						block.r[i] = texel[0];
+						block.g[i] = texel[1];
+						block.b[i] = texel[2];
+						block.a[i] = texel[3];
+					}
+				}
+			}
+		}
+
+		/*
+		* Project all block pixels onto the line origin + t * dir and return the nearest of (steps + 1) evenly spaced levels
+		* dir has to be scaled by 1 / |dir|^2, the alpha channel is only included if useAlpha is set
+		*/
+		void projectLevels(const Block &block, const float origin[4], const float dir[4], bool useAlpha, uint32_t steps, int32_t levels[16])
+		{
+			const float scale = (float)steps;
+			uint32_t i = 0;
+			if (settings.simd)
+			{
+#if defined(VKS_SIMD_SSE2)
+				const __m128 dr = _mm_set1_ps(dir[0] * scale), dg = _mm_set1_ps(dir[1] * scale), db = _mm_set1_ps(dir[2] * scale), da = _mm_set1_ps(useAlpha ? dir[3] * scale : 0.0f);
+				const __m128 or_ = _mm_set1_ps(origin[0]), og = _mm_set1_ps(origin[1]), ob = _mm_set1_ps(origin[2]), oa = _mm_set1_ps(origin[3]);
+				const __m128 zero = _mm_setzero_ps(), maxLevel = _mm_set1_ps(scale), half = _mm_set1_ps(0.5f);
+				for (; i < 16; i += 4)
+				{
+					__m128 t = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(block.r + i), or_), dr);
+					t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(block.g + i), og), dg));
+					t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(block.b + i), ob), db));
+					t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(block.a + i), oa), da));
+					t = _mm_min_ps(_mm_max_ps(t, zero), maxLevel);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(levels + i), _mm_cvttps_epi32(_mm_add_ps(t, half)));
+				}
+#elif defined(VKS_SIMD_NEON)
+				const float32x4_t zero = vdupq_n_f32(0.0f), maxLevel = vdupq_n_f32(scale), half = vdupq_n_f32(0.5f);
+				for (; i < 16; i += 4)
+				{
+					float32x4_t t = vmulq_n_f32(vsubq_f32(vld1q_f32(block.r + i), vdupq_n_f32(origin[0])), dir[0] * scale);
+					t = vmlaq_n_f32(t, vsubq_f32(vld1q_f32(block.g + i), vdupq_n_f32(origin[1])), dir[1] * scale);
+					t = vmlaq_n_f32(t, vsubq_f32(vld1q_f32(block.b + i), vdupq_n_f32(origin[2])), dir[2] * scale);
+					t = vmlaq_n_f32(t, vsubq_f32(vld1q_f32(block.a + i), vdupq_n_f32(origin[3])), useAlpha ? dir[3] * scale : 0.0f);
+					t = vminq_f32(vmaxq_f32(t, zero), maxLevel);
+					vst1q_s32(levels + i, vcvtq_s32_f32(vaddq_f32(t, half)));
+				}
+#endif
+			}
+			for (; i < 16; i++)
+			{
+				float t = (block.r[i] - origin[0]) * dir[0] + (block.g[i] - origin[1]) * dir[1] + (block.b[i] - origin[2]) * dir[2];
+				if (useAlpha)
+				{
+					t += (block.a[i] - origin[3]) * dir[3];
+				}
+				t = std::min(std::max(t * scale, 0.0f), scale);
+				levels[i] = static_cast<int32_t>(t + 0.5f);
+			}
+		}
+
+		/*
+		* Fit two endpoints to the pixels of a block along their principal axis
+		* Only pixels with mask[i] set are considered, alpha is included if channels is 4
+		*/
+		static void fitPrincipalAxis(const Block &block, const bool mask[16], uint32_t channels, float e0[4], float e1[4])
+		{
+			const float *values[4] = { block.r, block.g, block.b, block.a };
+			float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			float count = 0.0f;
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				if (mask[i])
+				{
+					for (uint32_t c = 0; c < channels; c++)
+					{
+						mean[c] += values[c][i];
+					}
+					count += 1.0f;
+				}
+			}
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				mean[c] = (count > 0.0f) ? mean[c] / count : 0.0f;
+			}
+
+			float cov[4][4] = {};
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				if (!mask[i])
+				{
+					continue;
+				}
+				float d[4] = {};
+				for (uint32_t c = 0; c < channels; c++)
+				{
+					d[c] = values[c][i] - mean[c];
+				}
+				for (uint32_t r = 0; r < channels; r++)
+				{
+					for (uint32_t c = 0; c < channels; c++)
+					{
+						cov[r][c] += d[r] * d[c];
+					}
+				}
+			}
+
+			// Power iteration for the dominant eigenvector
+			float axis[4] = { 1.0f, 1.0f, 1.0f, (channels == 4) ? 1.0f : 0.0f };
+			for (uint32_t iteration = 0; iteration < 8; iteration++)
+			{
+				float next[4] = {};
+				float length = 0.0f;
+				for (uint32_t r = 0; r < channels; r++)
+				{
+					for (uint32_t c = 0; c < channels; c++)
+					{
+						next[r] += cov[r][c] * axis[c];
+					}
+					length = std::max(length, fabsf(next[r]));
+				}
+				if (length < 1e-6f)
+				{
+					break;
+				}
+				for (uint32_t c = 0; c < channels; c++)
+				{
+					axis[c] = next[c] / length;
+				}
+			}
+
+			float tMin = 0.0f, tMax = 0.0f;
+			bool first = true;
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				if (!mask[i])
+				{
+					continue;
+				}
+				float t = 0.0f;
+				for (uint32_t c = 0; c < channels; c++)
+				{
+					t += (values[c][i] - mean[c]) * axis[c];
+				}
+				tMin = first ? t : std::min(tMin, t);
+				tMax = first ? t : std::max(tMax, t);
+				first = false;
+			}
+
+			float lengthSqr = 0.0f;
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				lengthSqr += axis[c] * axis[c];
+			}
+			lengthSqr = std::max(lengthSqr, 1e-6f);
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				const float a = (c < channels) ? axis[c] / lengthSqr : 0.0f;
+				e0[c] = std::min(std::max(mean[c] + tMin * a, 0.0f), 255.0f);
+				e1[c] = std::min(std::max(mean[c] + tMax * a, 0.0f), 255.0f);
+			}
+			if (channels < 4)
+			{
+				e0[3] = e1[3] = 255.0f;
+			}
+		}
+
+		/*
+		* Least squares refinement of two endpoints for the given interpolation weights (0 = e0, 1 = e1) of each pixel
+		* Returns false if the system is singular, in which case the endpoints are left unchanged
+		*/
+		static bool refineEndpoints(const Block &block, const bool mask[16], const float weights[16], uint32_t channels, float e0[4], float e1[4])
+		{
+			const float *values[4] = { block.r, block.g, block.b, block.a };
+			float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+			float ax[4] = {}, bx[4] = {};
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				if (!mask[i])
+				{
+					continue;
+				}
+				const float b = weights[i];
+				const float a = 1.0f - b;
+				aa += a * a;
+				ab += a * b;
+				bb += b * b;
+				for (uint32_t c = 0; c < channels; c++)
+				{
+					ax[c] += a * values[c][i];
+					bx[c] += b * values[c][i];
+				}
+			}
+			const float det = aa * bb - ab * ab;
+			if (fabsf(det) < 1e-6f)
+			{
+				return false;
+			}
+			const float invDet = 1.0f / det;
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				e0[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) * invDet, 0.0f), 255.0f);
+				e1[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) * invDet, 0.0f), 255.0f);
+			}
+			return true;
+		}
+
+		static uint16_t packColor565(const float c[4])
+		{
+			const uint32_t r = static_cast<uint32_t>(c[0] * 31.0f / 255.0f + 0.5f);
+			const uint32_t g = static_cast<uint32_t>(c[1] * 63.0f / 255.0f + 0.5f);
+			const uint32_t b = static_cast<uint32_t>(c[2] * 31.0f / 255.0f + 0.5f);
+			return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+		}
+
+		static void unpackColor565(uint16_t c, float out[4])
+		{
+			const uint32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+			out[0] = (float)((r << 3) | (r >> 2));
+			out[1] = (float)((g << 2) | (g >> 4));
+			out[2] = (float)((b << 3) | (b >> 2));
+			out[3] = 255.0f;
+		}
+
+		// Returns the projection direction from a to b scaled by 1 / |b - a|^2
+		static void lineDirection(const float a[4], const float b[4], uint32_t channels, float dir[4])
+		{
+			float lengthSqr = 0.0f;
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				dir[c] = (c < channels) ? b[c] - a[c] : 0.0f;
+				lengthSqr += dir[c] * dir[c];
+			}
+			const float invLengthSqr = (lengthSqr > 0.0f) ? 1.0f / lengthSqr : 0.0f;
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				dir[c] *= invLengthSqr;
+			}
+		}
+
+		// Encode the color part of a BC1/BC3 block (transparent pixels are only used with BC1 with alpha)
+		void encodeColorBlock(const Block &block, bool allowTransparent, uint8_t *dst)
+		{
+			bool mask[16];
+			bool transparent = false;
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				mask[i] = !allowTransparent || (block.a[i] >= 128.0f);
+				transparent |= !mask[i];
+			}
+
+			uint16_t c0 = 0, c1 = 0;
+			uint32_t indices = 0;
+			if (std::find(mask, mask + 16, true) == mask + 16)
+			{
+				// All pixels are transparent
+				c1 = 0xFFFF;
+				indices = 0xFFFFFFFF;
+			}
+			else
+			{
+				float e0[4], e1[4];
+				fitPrincipalAxis(block, mask, 3, e0, e1);
+
+				// Four color blocks interpolate at thirds, three color blocks (with transparency) at halves
+				const uint32_t steps = transparent ? 2 : 3;
+				for (uint32_t iteration = 0; iteration < settings.refinementIterations; iteration++)
+				{
+					float dir[4];
+					int32_t levels[16];
+					float weights[16];
+					lineDirection(e0, e1, 3, dir);
+					projectLevels(block, e0, dir, false, steps, levels);
+					for (uint32_t i = 0; i < 16; i++)
+					{
+						weights[i] = levels[i] / (float)steps;
+					}
+					if (!refineEndpoints(block, mask, weights, 3, e0, e1))
+					{
+						break;
+					}
+				}
+
+				c0 = packColor565(e0);
+				c1 = packColor565(e1);
+				// The order of the endpoints selects the block mode
+				if ((transparent && (c0 > c1)) || (!transparent && (c0 < c1)))
+				{
+					std::swap(c0, c1);
+				}
+
+				float p0[4], p1[4], dir[4];
+				int32_t levels[16];
+				unpackColor565(c0, p0);
+				unpackColor565(c1, p1);
+				lineDirection(p0, p1, 3, dir);
+				projectLevels(block, p0, dir, false, steps, levels);
+
+				// Map evenly spaced levels to the palette order of the block
+				static const uint32_t fourColorIndices[4] = { 0, 2, 3, 1 };
+				static const uint32_t threeColorIndices[3] = { 0, 2, 1 };
+				for (uint32_t i = 0; i < 16; i++)
+				{
+					uint32_t index;
+					if (!mask[i])
+					{
+						index = 3;
+					}
+					else if (c0 == c1)
+					{
+						index = 0;
+					}
+					else
+					{
+						index = transparent ? threeColorIndices[levels[i]] : fourColorIndices[levels[i]];
+					}
+					indices |= index << (i * 2);
+				}
+			}
+
+			dst[0] = c0 & 0xFF;
+			dst[1] = c0 >> 8;
+			dst[2] = c1 & 0xFF;
+			dst[3] = c1 >> 8;
+			for (uint32_t i = 0; i < 4; i++)
+			{
+				dst[4 + i] = (indices >> (i * 8)) & 0xFF;
+			}
+		}
+
+		// Encode a single channel BC4 block (also used for the alpha part of BC3)
+		static void encodeSingleChannelBlock(const float values[16], uint8_t *dst)
+		{
+			float minValue = values[0], maxValue = values[0];
+			for (uint32_t i = 1; i < 16; i++)
+			{
+				minValue = std::min(minValue, values[i]);
+				maxValue = std::max(maxValue, values[i]);
+			}
+			const uint8_t a0 = static_cast<uint8_t>(maxValue + 0.5f);
+			const uint8_t a1 = static_cast<uint8_t>(minValue + 0.5f);
+			dst[0] = a0;
+			dst[1] = a1;
+
+			// Eight value mode (a0 > a1), the palette is a0, a1 followed by six interpolated values from a0 towards a1
+			uint64_t indices = 0;
+			if (a0 > a1)
+			{
+				const float scale = 7.0f / (float)(a0 - a1);
+				for (uint32_t i = 0; i < 16; i++)
+				{
+					const uint32_t level = static_cast<uint32_t>(std::min(std::max((values[i] - a1) * scale, 0.0f), 7.0f) + 0.5f);
+					const uint64_t index = (level == 7) ? 0 : (level == 0) ? 1 : 8 - level;
+					indices |= index << (i * 3);
+				}
+			}
+			for (uint32_t i = 0; i < 6; i++)
+			{
+				dst[2 + i] = (indices >> (i * 8)) & 0xFF;
+			}
+		}
+
+		// Writes consecutive bit fields into a 128 bit block (least significant bit first)
+		struct BitWriter {
+			uint8_t *data;
+			uint32_t position = 0;
+			BitWriter(uint8_t *data) : data(data)
+			{
+				memset(data, 0, 16);
+			}
+			void write(uint32_t value, uint32_t bitCount)
+			{
+				for (uint32_t i = 0; i < bitCount; i++, position++)
+				{
+					data[position >> 3] |= ((value >> i) & 1) << (position & 7);
+				}
+			}
+		};
+
+		// Encode a BC7 block using mode 6 (RGBA 7.7.7.7 endpoints with unique p-bits and 4 bit indices)
+		void encodeBC7Block(const Block &block, uint8_t *dst)
+		{
+			static const uint32_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+			bool mask[16];
+			std::fill(mask, mask + 16, true);
+			float e[2][4];
+			fitPrincipalAxis(block, mask, 4, e[0], e[1]);
+
+			for (uint32_t iteration = 0; iteration < settings.refinementIterations; iteration++)
+			{
+				float dir[4];
+				int32_t levels[16];
+				float w[16];
+				lineDirection(e[0], e[1], 4, dir);
+				projectLevels(block, e[0], dir, true, 15, levels);
+				for (uint32_t i = 0; i < 16; i++)
+				{
+					w[i] = weights[levels[i]] / 64.0f;
+				}
+				if (!refineEndpoints(block, mask, w, 4, e[0], e[1]))
+				{
+					break;
+				}
+			}
+
+			// Quantize endpoints to 7 bits plus the p-bit that gives the lowest error
+			uint32_t q[2][4], p[2];
+			float rec[2][4];
+			for (uint32_t j = 0; j < 2; j++)
+			{
+				float bestError = -1.0f;
+				for (uint32_t pbit = 0; pbit < 2; pbit++)
+				{
+					uint32_t quantized[4];
+					float error = 0.0f;
+					for (uint32_t c = 0; c < 4; c++)
+					{
+						quantized[c] = static_cast<uint32_t>(std::min(std::max((e[j][c] - pbit) * 0.5f + 0.5f, 0.0f), 127.0f));
+						const float d = (float)((quantized[c] << 1) | pbit) - e[j][c];
+						error += d * d;
+					}
+					if ((bestError < 0.0f) || (error < bestError))
+					{
+						bestError = error;
+						p[j] = pbit;
+						for (uint32_t c = 0; c < 4; c++)
+						{
+							q[j][c] = quantized[c];
+							rec[j][c] = (float)((quantized[c] << 1) | pbit);
+						}
+					}
+				}
+			}
+
+			// Select indices by projecting onto the reconstructed endpoints and snapping to the nearest (non-uniform) weight
+			float dir[4];
+			int32_t t64[16];
+			lineDirection(rec[0], rec[1], 4, dir);
+			projectLevels(block, rec[0], dir, true, 64, t64);
+			uint32_t indices[16];
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				uint32_t best = 0;
+				for (uint32_t k = 1; k < 16; k++)
+				{
+					if (abs((int32_t)weights[k] - t64[i]) < abs((int32_t)weights[best] - t64[i]))
+					{
+						best = k;
+					}
+				}
+				indices[i] = best;
+			}
+
+			// The most significant bit of the first (anchor) index is implicitly zero, so swap endpoints if required
+			if (indices[0] & 8)
+			{
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					std::swap(q[0][c], q[1][c]);
+				}
+				std::swap(p[0], p[1]);
+				for (uint32_t i = 0; i < 16; i++)
+				{
+					indices[i] = 15 - indices[i];
+				}
+			}
+
+			BitWriter writer(dst);
+			writer.write(1 << 6, 7);
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				writer.write(q[0][c], 7);
+				writer.write(q[1][c], 7);
+			}
+			writer.write(p[0], 1);
+			writer.write(p[1], 1);
+			writer.write(indices[0], 3);
+			for (uint32_t i = 1; i < 16; i++)
+			{
+				writer.write(indices[i], 4);
+			}
+		}
+
+		void compressBlockRows(const uint8_t *src, uint32_t width, uint32_t height, VkFormat format, uint8_t *dst, uint32_t y0, uint32_t y1)
+		{
+			const uint32_t blocksX = (width + 3) / 4;
+			const uint32_t blockSize = getBlockSize(format);
+			const uint32_t channels = getSourceChannels(format);
+			Block block;
+			for (uint32_t by = y0; by < y1; by++)
+			{
+				for (uint32_t bx = 0; bx < blocksX; bx++)
+				{
+					uint8_t *out = dst + (by * blocksX + bx) * blockSize;
+					loadBlock(src, width, height, channels, bx, by, block);
+					switch (format)
+					{
+					case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+					case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+						encodeColorBlock(block, false, out);
+						break;
+					case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+					case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+						encodeColorBlock(block, true, out);
+						break;
+					case VK_FORMAT_BC3_UNORM_BLOCK:
+					case VK_FORMAT_BC3_SRGB_BLOCK:
+						encodeSingleChannelBlock(block.a, out);
+						encodeColorBlock(block, false, out + 8);
+						break;
+					case VK_FORMAT_BC4_UNORM_BLOCK:
+						encodeSingleChannelBlock(block.r, out);
+						break;
+					case VK_FORMAT_BC7_UNORM_BLOCK:
+					case VK_FORMAT_BC7_SRGB_BLOCK:
+						encodeBC7Block(block, out);
+						break;
+					default:
+						break;
+					}
+				}
+			}
+		}
+
+		static void decodeColorBlock(const uint8_t *src, bool allowTransparent, uint8_t *texels)
+		{
+			const uint16_t c0 = src[0] | (src[1] << 8);
+			const uint16_t c1 = src[2] | (src[3] << 8);
+			float palette[4][4];
+			unpackColor565(c0, palette[0]);
+			unpackColor565(c1, palette[1]);
+			for (uint32_t c = 0; c < 3; c++)
+			{
+				if ((c0 > c1) || !allowTransparent)
+				{
+					palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+					palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+				}
+				else
+				{
+					palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+					palette[3][c] = 0.0f;
+				}
+			}
+			palette[2][3] = 255.0f;
+			palette[3][3] = ((c0 <= c1) && allowTransparent) ? 0.0f : 255.0f;
+			const uint32_t indices = src[4] | (src[5] << 8) | (src[6] << 16) | ((uint32_t)src[7] << 24);
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				const uint32_t index = (indices >> (i * 2)) & 3;
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					texels[i * 4 + c] = static_cast<uint8_t>(palette[index][c] + 0.5f);
+				}
+			}
+		}
+
+		static void decodeSingleChannelBlock(const uint8_t *src, uint8_t *texels, uint32_t stride)
+		{
+			float palette[8];
+			palette[0] = src[0];
+			palette[1] = src[1];
+			if (src[0] > src[1])
+			{
+				for (uint32_t i = 1; i < 7; i++)
+				{
+					palette[1 + i] = ((7 - i) * palette[0] + i * palette[1]) / 7.0f;
+				}
+			}
+			else
+			{
+				for (uint32_t i = 1; i < 5; i++)
+				{
+					palette[1 + i] = ((5 - i) * palette[0] + i * palette[1]) / 5.0f;
+				}
+				palette[6] = 0.0f;
+				palette[7] = 255.0f;
+			}
+			uint64_t indices = 0;
+			for (uint32_t i = 0; i < 6; i++)
+			{
+				indices |= (uint64_t)src[2 + i] << (i * 8);
+			}
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				texels[i * stride] = static_cast<uint8_t>(palette[(indices >> (i * 3)) & 7] + 0.5f);
+			}
+		}
+
+		// Decodes mode 6 BC7 blocks (the only mode written by this compressor)
+		static void decodeBC7Block(const uint8_t *src, uint8_t *texels)
+		{
+			static const uint32_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+			uint32_t position = 0;
+			auto read = [&](uint32_t bitCount) {
+				uint32_t value = 0;
+				for (uint32_t i = 0; i < bitCount; i++, position++)
+				{
+					value |= ((src[position >> 3] >> (position & 7)) & 1) << i;
+				}
+				return value;
+			};
+			if (read(7) != (1 << 6))
+			{
+				memset(texels, 0, 16 * 4);
+				return;
+			}
+			uint32_t e[2][4];
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				e[0][c] = read(7);
+				e[1][c] = read(7);
+			}
+			const uint32_t p0 = read(1);
+			const uint32_t p1 = read(1);
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				e[0][c] = (e[0][c] << 1) | p0;
+				e[1][c] = (e[1][c] << 1) | p1;
+			}
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				const uint32_t w = weights[read(i == 0 ? 3 : 4)];
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					texels[i * 4 + c] = static_cast<uint8_t>(((64 - w) * e[0][c] + w * e[1][c] + 32) >> 6);
+				}
+			}
+		}
+
+		// Decode a block into 16 texels (RGBA8, or R8 for BC4)
+		static void decodeBlock(const uint8_t *src, VkFormat format, uint8_t *texels)
+		{
+			switch (format)
+			{
+			case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+				decodeColorBlock(src, false, texels);
+				break;
+			case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+				decodeColorBlock(src, true, texels);
+				break;
+			case VK_FORMAT_BC3_UNORM_BLOCK:
+			case VK_FORMAT_BC3_SRGB_BLOCK:
+				decodeColorBlock(src + 8, false, texels);
+				decodeSingleChannelBlock(src, texels + 3, 4);
+				break;
+			case VK_FORMAT_BC4_UNORM_BLOCK:
+				decodeSingleChannelBlock(src, texels, 1);
+				break;
+			case VK_FORMAT_BC7_UNORM_BLOCK:
+			case VK_FORMAT_BC7_SRGB_BLOCK:
+				decodeBC7Block(src, texels);
+				break;
+			default:
+				break;
+			}
+		}
+
+		// PSNR over all channels that are stored by the format
+		static double calculatePSNR(const uint8_t *src, uint32_t width, uint32_t height, VkFormat format, const uint8_t *compressed)
+		{
+			const uint32_t channels = getSourceChannels(format);
+			const bool hasAlpha = (channels == 4) && (format != VK_FORMAT_BC1_RGB_UNORM_BLOCK) && (format != VK_FORMAT_BC1_RGB_SRGB_BLOCK);
+			const uint32_t comparedChannels = (channels == 1) ? 1 : (hasAlpha ? 4 : 3);
+			std::vector<uint8_t> decoded((size_t)width * height * channels);
+			decompress(compressed, width, height, format, decoded.data());
+			double error = 0.0;
+			for (size_t i = 0; i < (size_t)width * height; i++)
+			{
+				for (uint32_t c = 0; c < comparedChannels; c++)
+				{
+					const double d = (double)src[i * channels + c] - (double)decoded[i * channels + c];
+					error += d * d;
+				}
+			}
+			const double mse = error / ((double)width * height * comparedChannels);
+			return (mse > 0.0) ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+		}
+
+		// Split block rows into bands and distribute them across the job system
+		template<typename F>
+		void parallelBlockRows(uint32_t rowCount, uint32_t rowWidth, const F &fn)
+		{
+			if ((getThreadCount() < 2) || (rowCount * rowWidth < minParallelBlocks))
+			{
+				fn(0, rowCount);
+				return;
+			}
+			jobSystem->parallelFor(rowCount, fn);
+		}
+	};
+}
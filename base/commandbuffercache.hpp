@@ -0,0 +1,131 @@
+/*
+* Command buffer cache with dirty tracking
+*
+* Keeps a hash of the state that went into each recorded draw group (e.g. one secondary command buffer per object)
+* If the hash of the current state matches the one from the last recording, the previously recorded command buffer
+* can be reused and only groups whose state changed are recorded again
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <vector>
+#include <atomic>
+
+namespace vks
+{
+	/** @brief Accumulates a 64 bit FNV-1a hash of all values that affect the contents of a command buffer */
+	class StateHasher
+	{
+	public:
+		/** @brief Add the bytes of a plain data value (e.g. a handle, a vector or a matrix) */
+		template<typename T>
+		StateHasher &add(const T &value)
+		{
+			const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&value);
+			for (size_t i = 0; i < sizeof(T); i++)
+			{
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+			return *this;
+		}
+
+		uint64_t get() const
+		{
+			return hash;
+		}
+
+	private:
+		uint64_t hash = 14695981039346656037ull;
+	};
+
+	class CommandBufferCache
+	{
+	public:
+		struct Statistics {
+			uint32_t hits = 0;
+			uint32_t misses = 0;
+			/** @brief Share of the checked groups that could be reused (0.0 .. 1.0) */
+			float hitRate() const
+			{
+				const uint32_t total = hits + misses;
+				return (total > 0) ? (float)hits / (float)total : 0.0f;
+			}
+		};
+
+		/** @brief Set the number of draw groups, all groups are marked as dirty */
+		void resize(uint32_t groupCount)
+		{
+			groups = std::vector<Group>(groupCount);
+		}
+
+		/** @brief Mark all groups as dirty, e.g. after the command buffers have been recorded with other state outside of the cache */
+		void invalidate()
+		{
+			for (auto &group : groups)
+			{
+				group.valid = false;
+			}
+		}
+
+		/** @brief Mark a single group as dirty */
+		void invalidate(uint32_t group)
+		{
+			groups[group].valid = false;
+		}
+
+		/**
+		* Check if a group has to be recorded again and store the hash of its current state
+		* Can be called concurrently for different groups
+		*
+		* @param group Index of the draw group
+		* @param stateHash Hash of all state the group's command buffer depends on
+		*
+		* @return True if the group's command buffer needs to be recorded (state changed or group was invalidated)
+		*/
+		bool checkDirty(uint32_t group, uint64_t stateHash)
+		{
+			assert(group < groups.size());
+			Group &entry = groups[group];
+			if (entry.valid && entry.stateHash == stateHash)
+			{
+				frameHits.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			entry.stateHash = stateHash;
+			entry.valid = true;
+			frameMisses.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		/** @brief Start a new frame, the statistics of the previous frame are kept for getStatistics */
+		void nextFrame()
+		{
+			statistics.hits = frameHits.exchange(0);
+			statistics.misses = frameMisses.exchange(0);
+		}
+
+		/** @brief Returns the cache hits and misses of the last completed frame */
+		Statistics getStatistics() const
+		{
+			return statistics;
+		}
+
+	private:
+		struct Group {
+			uint64_t stateHash = 0;
+			bool valid = false;
+		};
+		std::vector<Group> groups;
+
+		std::atomic<uint32_t> frameHits{ 0 };
+		std::atomic<uint32_t> frameMisses{ 0 };
+		Statistics statistics;
+	};
+}
@@ -0,0 +1,126 @@
+/*
+* Back to front depth sorting for transparent draws
+*
+* Depths are quantized to a fixed number of bits relative to the current depth range and sorted with a parallel radix sort
+* With the default of 16 bits only two radix passes are needed, the quantization step is (max depth - min depth) / 65535
+* The result is a permutation that lists the items from the farthest to the closest one, e.g. to reorder vertices,
+* fill an index buffer or record draws
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "jobsystem.hpp"
+#include "radixsort.hpp"
+
+namespace vks
+{
+	class DepthSorter
+	{
+	public:
+		/** @brief Number of bits the depths are quantized to (1 .. 32) */
+		uint32_t depthBits = 16;
+
+		/** @brief Time (in ms) taken by the last call to sort */
+		double lastSortTime = 0.0;
+
+		/**
+		* Sort items back to front
+		*
+		* @param depths View space distances of the items (larger values are farther away)
+		* @param count Number of items
+		* @param jobSystem (Optional) Job system used for key generation and sorting of large arrays
+		*
+		* @return Indices of the items ordered from the farthest to the closest one, equal depths keep their relative order
+		*/
+		const std::vector<uint32_t> &sort(const float *depths, uint32_t count, JobSystem *jobSystem = nullptr)
+		{
+			assert(depthBits > 0 && depthBits <= 32);
+			auto tStart = std::chrono::high_resolution_clock::now();
+
+			entries.resize(count);
+			scratch.resize(count);
+			order.resize(count);
+
+			if (count > 0)
+			{
+				const bool parallel = jobSystem && (count >= radixSort.parallelThreshold);
+				const uint32_t chunkCount = parallel ? std::max(jobSystem->getThreadCount(), 1u) : 1;
+
+				// Depth range
+				std::vector<float> chunkMin(chunkCount, depths[0]);
+				std::vector<float> chunkMax(chunkCount, depths[0]);
+				forEachRange(jobSystem, parallel, count, chunkCount, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+				{
+					float minDepth = chunkMin[chunk];
+					float maxDepth = chunkMax[chunk];
+					for (uint32_t i = begin; i < end; i++)
+					{
+						minDepth = std::min(minDepth, depths[i]);
+						maxDepth = std::max(maxDepth, depths[i]);
+					}
+					chunkMin[chunk] = minDepth;
+					chunkMax[chunk] = maxDepth;
+				});
+				const float minDepth = *std::min_element(chunkMin.begin(), chunkMin.end());
+				const float maxDepth = *std::max_element(chunkMax.begin(), chunkMax.end());
+
+				// Keys are stored in the upper 32 bits of the entries, the item index in the lower ones
+				// Quantized depths are inverted so that an ascending sort puts the farthest items first
+				const double maxKey = (double)((1ull << depthBits) - 1);
+				const float scale = (maxDepth > minDepth) ? (float)(maxKey / (double)(maxDepth - minDepth)) : 0.0f;
+				forEachRange(jobSystem, parallel, count, chunkCount, [&](uint32_t, uint32_t begin, uint32_t end)
+				{
+					for (uint32_t i = begin; i < end; i++)
+					{
+						const uint64_t quantized = std::min((uint64_t)((depths[i] - minDepth) * scale), (uint64_t)maxKey);
+						const uint64_t key = (uint64_t)maxKey - quantized;
+						entries[i] = (key << 32) | i;
+					}
+				});
+
+				radixSort.sort(entries.data(), scratch.data(), count, [](uint64_t entry) { return entry >> 32; }, depthBits, jobSystem);
+
+				forEachRange(jobSystem, parallel, count, chunkCount, [&](uint32_t, uint32_t begin, uint32_t end)
+				{
+					for (uint32_t i = begin; i < end; i++)
+					{
+						order[i] = static_cast<uint32_t>(entries[i]);
+					}
+				});
+			}
+
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			lastSortTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+
+			return order;
+		}
+
+		/** @brief Returns the order of the last sort (farthest item first) */
+		const std::vector<uint32_t> &getOrder() const
+		{
+			return order;
+		}
+
+		/** @brief Sets the number of items below which everything is done on the calling thread */
+		void setParallelThreshold(uint32_t threshold)
+		{
+			radixSort.parallelThreshold = threshold;
+		}
+
+	private:
+		RadixSort radixSort;
+		std::vector<uint64_t> entries;
+		std::vector<uint64_t> scratch;
+		std::vector<uint32_t> order;
+	};
+}
@@ -0,0 +1,271 @@
+/*
+* State sorted draw list
+*
+* Draws are collected as packets with a 64 bit sort key, sorted (radix sort, in parallel for large lists) and then
+* recorded with all redundant pipeline, descriptor set, vertex/index buffer and push constant updates filtered out
+*
+* Default key layout (most significant bits first):
+*   pass (4) | pipeline (12) | material (16) | depth (32)
+* Passes are drawn in order, draws within a pass are grouped by pipeline and material and front to back inside each group
+* For passes that need back to front ordering (e.g. blending) use makeDepthFirstKey, which sorts by depth before state
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+#include "vulkan/vulkan.h"
+#include "jobsystem.hpp"
+#include "radixsort.hpp"
+
+namespace vks
+{
+	class DrawList
+	{
+	public:
+		static const uint32_t maxDescriptorSets = 4;
+
+		/** @brief All state needed for a single indexed draw */
+		struct DrawPacket {
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+			// Descriptor sets bound starting at set 0 (none if descriptorSetCount is zero)
+			VkDescriptorSet descriptorSets[maxDescriptorSets];
+			uint32_t descriptorSetCount = 0;
+			VkBuffer vertexBuffer = VK_NULL_HANDLE;
+			VkBuffer indexBuffer = VK_NULL_HANDLE;
+			uint32_t vertexBinding = 0;
+			// Push constant data is referenced, not copied, and must stay valid until the packets have been recorded
+			// Packets pointing to the same data only push it once
+			const void *pushConstants = nullptr;
+			uint32_t pushConstantSize = 0;
+			VkShaderStageFlags pushConstantStages = 0;
+			uint32_t indexCount = 0;
+			uint32_t firstIndex = 0;
+			int32_t vertexOffset = 0;
+		};
+
+		/** @brief Number of commands recorded by the last call to record() */
+		struct Statistics {
+			uint32_t draws = 0;
+			uint32_t pipelineBinds = 0;
+			uint32_t descriptorSetBinds = 0;
+			uint32_t vertexBufferBinds = 0;
+			uint32_t indexBufferBinds = 0;
+			uint32_t pushConstantUpdates = 0;
+			// Number of binds and updates that were skipped because the state was already set
+			uint32_t redundantChanges = 0;
+		};
+
+		/** @brief Lists with fewer packets are sorted on the calling thread */
+		uint32_t parallelSortThreshold = 16384;
+
+		/**
+		* Build a sort key that groups draws by state and orders them front to back within a group
+		*
+		* @param pass Coarse order of the draws (0 .. 15), e.g. opaque, sky, transparent
+		* @param pipeline Id of the pipeline (0 .. 4095)
+		* @param material Id of the material / descriptor set (0 .. 65535)
+		* @param depth View space distance of the draw (non-negative)
+		*/
+		static uint64_t makeKey(uint32_t pass, uint32_t pipeline, uint32_t material, float depth)
+		{
+			assert(pass < 16 && pipeline < 4096 && material < 65536);
+			return ((uint64_t)pass << 60) | ((uint64_t)pipeline << 48) | ((uint64_t)material << 32) | depthBits(depth);
+		}
+
+		/** @brief Build a sort key that orders the draws of a pass back to front (e.g. for blending), state is only used to break ties */
+		static uint64_t makeDepthFirstKey(uint32_t pass, uint32_t pipeline, uint32_t material, float depth)
+		{
+			assert(pass < 16 && pipeline < 4096 && material < 65536);
+			return ((uint64_t)pass << 60) | ((uint64_t)(~depthBits(depth) & 0xFFFFFFFFu) << 28) | ((uint64_t)pipeline << 16) | (uint64_t)material;
+		}
+
+		void clear()
+		{
+			packets.clear();
+			entries.clear();
+			sorted = true;
+		}
+
+		void add(uint64_t key, const DrawPacket &packet)
+		{
+			assert(packet.descriptorSetCount <= maxDescriptorSets);
+			entries.push_back({ key, static_cast<uint32_t>(packets.size()) });
+			packets.push_back(packet);
+			sorted = false;
+		}
+
+		uint32_t size() const
+		{
+			return static_cast<uint32_t>(packets.size());
+		}
+
+		/**
+		* Sort the packets by their keys (stable LSD radix sort with 8 bit digits)
+		* Digits that are the same for all keys are skipped, so keys that only use a few bits sort in a few passes
+		*
+		* @param jobSystem (Optional) Job system used to build the histograms and scatter the keys in parallel
+		*/
+		void sort(vks::JobSystem *jobSystem = nullptr)
+		{
+			const uint32_t count = static_cast<uint32_t>(entries.size());
+			if (sorted || count < 2)
+			{
+				sorted = true;
+				return;
+			}
+			sortBuffer.resize(count);
+			radixSort.parallelThreshold = parallelSortThreshold;
+			radixSort.sort(entries.data(), sortBuffer.data(), count, [](const Entry &entry) { return entry.key; }, 64, jobSystem);
+			sorted = true;
+		}
+
+		/**
+		* Record the draws in key order, sorts the list first if required
+		* State that is already set by the previous draw is not set again
+		*
+		* @param commandBuffer Command buffer inside a render pass
+		*/
+		void record(VkCommandBuffer commandBuffer)
+		{
+			sort();
+			statistics = Statistics();
+
+			VkPipeline currentPipeline = VK_NULL_HANDLE;
+			VkPipelineLayout currentLayout = VK_NULL_HANDLE;
+			VkDescriptorSet currentSets[maxDescriptorSets] = {};
+			uint32_t currentSetCount = 0;
+			VkBuffer currentVertexBuffer = VK_NULL_HANDLE;
+			uint32_t currentVertexBinding = 0;
+			VkBuffer currentIndexBuffer = VK_NULL_HANDLE;
+			const void *currentPushConstants = nullptr;
+
+			for (const Entry &entry : entries)
+			{
+				const DrawPacket &packet = packets[entry.index];
+
+				if (packet.pipeline != currentPipeline)
+				{
+					vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, packet.pipeline);
+					currentPipeline = packet.pipeline;
+					statistics.pipelineBinds++;
+				}
+				else
+				{
+					statistics.redundantChanges++;
+				}
+
+				if (packet.pipelineLayout != currentLayout)
+				{
+					// Bindings made with a different layout can't be relied on
+					currentLayout = packet.pipelineLayout;
+					currentSetCount = 0;
+					currentPushConstants = nullptr;
+				}
+
+				if (packet.descriptorSetCount > 0)
+				{
+					// Only rebind the sets starting at the first one that differs
+					uint32_t firstSet = 0;
+					while (firstSet < packet.descriptorSetCount && firstSet < currentSetCount && packet.descriptorSets[firstSet] == currentSets[firstSet])
+					{
+						firstSet++;
+					}
+					if (firstSet < packet.descriptorSetCount)
+					{
+						vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, packet.pipelineLayout, firstSet, packet.descriptorSetCount - firstSet, &packet.descriptorSets[firstSet], 0, nullptr);
+						statistics.descriptorSetBinds++;
+					}
+					else
+					{
+						statistics.redundantChanges++;
+					}
+					for (uint32_t i = firstSet; i < packet.descriptorSetCount; i++)
+					{
+						currentSets[i] = packet.descriptorSets[i];
+					}
+					currentSetCount = std::max(currentSetCount, packet.descriptorSetCount);
+				}
+
+				if (packet.vertexBuffer != currentVertexBuffer || packet.vertexBinding != currentVertexBinding)
+				{
+					VkDeviceSize offsets[1] = { 0 };
+					vkCmdBindVertexBuffers(commandBuffer, packet.vertexBinding, 1, &packet.vertexBuffer, offsets);
+					currentVertexBuffer = packet.vertexBuffer;
+					currentVertexBinding = packet.vertexBinding;
+					statistics.vertexBufferBinds++;
+				}
+				else
+				{
+					statistics.redundantChanges++;
+				}
+
+				if (packet.indexBuffer != currentIndexBuffer)
+				{
+					vkCmdBindIndexBuffer(commandBuffer, packet.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+					currentIndexBuffer = packet.indexBuffer;
+					statistics.indexBufferBinds++;
+				}
+				else
+				{
+					statistics.redundantChanges++;
+				}
+
+				if (packet.pushConstantSize > 0)
+				{
+					if (packet.pushConstants != currentPushConstants)
+					{
+						vkCmdPushConstants(commandBuffer, packet.pipelineLayout, packet.pushConstantStages, 0, packet.pushConstantSize, packet.pushConstants);
+						currentPushConstants = packet.pushConstants;
+						statistics.pushConstantUpdates++;
+					}
+					else
+					{
+						statistics.redundantChanges++;
+					}
+				}
+
+				vkCmdDrawIndexed(commandBuffer, packet.indexCount, 1, packet.firstIndex, packet.vertexOffset, 0);
+				statistics.draws++;
+			}
+		}
+
+		/** @brief Returns the number of commands recorded by the last call to record() */
+		const Statistics &getStatistics() const
+		{
+			return statistics;
+		}
+
+	private:
+		// Sort entries are kept separate from the packets, so the sort only moves 16 bytes per draw
+		struct Entry {
+			uint64_t key;
+			uint32_t index;
+		};
+
+		std::vector<DrawPacket> packets;
+		std::vector<Entry> entries;
+		std::vector<Entry> sortBuffer;
+		RadixSort radixSort;
+		bool sorted = true;
+		Statistics statistics;
+
+		/** @brief Maps a non-negative float to 32 bits that sort in the same order */
+		static uint64_t depthBits(float depth)
+		{
+			depth = std::max(depth, 0.0f);
+			uint32_t bits;
+			memcpy(&bits, &depth, sizeof(bits));
+			return bits;
+		}
+	};
+}
@@ -1,15 +1,26 @@
 /*
 * View frustum culling class
 *
+* Single objects can be tested against the frustum with the check functions, large numbers of objects should use the batch functions
+* Batches take spheres or boxes in structure of arrays layout and test 8 objects at once against each plane (AVX: 8 lanes, SSE2/NEON: 2 x 4 lanes, if available)
+*
 * Copyright (C) 2016 by Sascha Willems - www.saschawillems.de
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
+#pragma once
+
 #include <array>
+#include <vector>
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
 #include <glm/glm.hpp>
 
+#include "simd.hpp"
+
 namespace vks
 {
 	class Frustum
@@ -68,5 +79,378 @@ namespace vks
 			}
 			return true;
 		}
+
+		/**
+		* Check a sphere starting with the plane that culled it the last time (plane coherency)
+		*
+		* @param planeHint Plane to test first, updated with the culling plane if the sphere is outside
+		*/
+		bool checkSphere(glm::vec3 pos, float radius, uint8_t &planeHint)
+		{
+			for (uint32_t i = 0; i < 6; i++)
+			{
+				const uint32_t p = (planeHint + i) % 6;
+				if ((planes[p].x * pos.x) + (planes[p].y * pos.y) + (planes[p].z * pos.z) + planes[p].w <= -radius)
+				{
+					planeHint = static_cast<uint8_t>(p);
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/** @brief Check an axis aligned bounding box given by its min. and max. corners */
+		bool checkBox(glm::vec3 min, glm::vec3 max)
+		{
+			const glm::vec3 center = (min + max) * 0.5f;
+			const glm::vec3 extent = (max - min) * 0.5f;
+			for (uint32_t i = 0; i < planes.size(); i++)
+			{
+				// Projected radius of the box onto the plane normal
+				const float r = fabsf(planes[i].x) * extent.x + fabsf(planes[i].y) * extent.y + fabsf(planes[i].z) * extent.z;
+				if ((planes[i].x * center.x) + (planes[i].y * center.y) + (planes[i].z * center.z) + planes[i].w <= -r)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/**
+		* Check an oriented bounding box
+		*
+		* @param center Center of the box
+		* @param axes Normalized local axes of the box (columns)
+		* @param halfExtent Half size of the box along each of its axes
+		*/
+		bool checkOrientedBox(glm::vec3 center, glm::mat3 axes, glm::vec3 halfExtent)
+		{
+			for (uint32_t i = 0; i < planes.size(); i++)
+			{
+				const glm::vec3 n = glm::vec3(planes[i]);
+				const float r = fabsf(glm::dot(n, axes[0])) * halfExtent.x + fabsf(glm::dot(n, axes[1])) * halfExtent.y + fabsf(glm::dot(n, axes[2])) * halfExtent.z;
+				if (glm::dot(n, center) + planes[i].w <= -r)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/** @brief Spheres in structure of arrays layout for batch culling */
+		struct Spheres {
+			std::vector<float> x, y, z, radius;
+
+			void resize(size_t count)
+			{
+				x.resize(count);
+				y.resize(count);
+				z.resize(count);
+				radius.resize(count);
+			}
+
+			void set(size_t index, glm::vec3 pos, float r)
+			{
+				x[index] = pos.x;
+				y[index] = pos.y;
+				z[index] = pos.z;
+				radius[index] = r;
+			}
+
+			uint32_t size() const
+			{
+				return static_cast<uint32_t>(x.size());
+			}
+		};
+
+		/** @brief Axis aligned boxes (center and half extent) in structure of arrays layout for batch culling */
+		struct Boxes {
+			std::vector<float> centerX, centerY, centerZ, extentX, extentY, extentZ;
+
+			void resize(size_t count)
+			{
+				centerX.resize(count);
+				centerY.resize(count);
+				centerZ.resize(count);
+				extentX.resize(count);
+				extentY.resize(count);
+				extentZ.resize(count);
+			}
+
+			void set(size_t index, glm::vec3 min, glm::vec3 max)
+			{
+				const glm::vec3 center = (min + max) * 0.5f;
+				const glm::vec3 extent = (max - min) * 0.5f;
+				centerX[index] = center.x;
+				centerY[index] = center.y;
+				centerZ[index] = center.z;
+				extentX[index] = extent.x;
+				extentY[index] = extent.y;
+				extentZ[index] = extent.z;
+			}
+
+			uint32_t size() const
+			{
+				return static_cast<uint32_t>(centerX.size());
+			}
+		};
+
+		/** @brief Number of 32 bit words of a visibility mask for the given number of objects */
+		static uint32_t getMaskSize(uint32_t count)
+		{
+			return (count + 31) / 32;
+		}
+
+		/** @brief Number of plane hints for the given number of objects (one per group of 8 objects) */
+		static uint32_t getPlaneHintCount(uint32_t count)
+		{
+			return (count + 7) / 8;
+		}
+
+		/**
+		* Cull a batch of spheres
+		*
+		* @param spheres Spheres to test
+		* @param visibilityMask Receives one bit per sphere (set if visible), must hold at least getMaskSize words
+		* @param planeHints (Optional) One entry per group of 8 spheres (see getPlaneHintCount), initialized to zero
+		* Stores the plane that culled the whole group, which is tested first the next time (temporal coherency)
+		*
+		* @return Number of visible spheres
+		*/
+		uint32_t checkSpheres(const Spheres &spheres, uint32_t *visibilityMask, uint8_t *planeHints = nullptr)
+		{
+			return checkSpheres(spheres, 0, spheres.size(), visibilityMask, planeHints);
+		}
+
+		/**
+		* Cull a range of a batch of spheres, e.g. to split a large batch across threads
+		*
+		* @param first Index of the first sphere of the range
+		* @param count Number of spheres in the range
+		* @param visibilityMask Receives one bit per sphere of the range (bit 0 is the first sphere), must hold at least getMaskSize(count) words
+		* @param planeHints (Optional) One entry per group of 8 spheres of the range
+		*
+		* @return Number of visible spheres in the range
+		*/
+		uint32_t checkSpheres(const Spheres &spheres, uint32_t first, uint32_t count, uint32_t *visibilityMask, uint8_t *planeHints = nullptr)
+		{
+			assert(first + count <= spheres.size());
+			const float *x = spheres.x.data() + first;
+			const float *y = spheres.y.data() + first;
+			const float *z = spheres.z.data() + first;
+			const float *r = spheres.radius.data() + first;
+			return checkBatch(count, visibilityMask, planeHints, [&](uint32_t i, uint32_t p) {
+#if defined(VKS_SIMD_AVX)
+				const __m256 d = planeDistance8(p, x + i, y + i, z + i);
+				return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(d, negate(_mm256_loadu_ps(r + i)), _CMP_GT_OQ)));
+#elif defined(VKS_SIMD_SSE2)
+				const __m128 d0 = planeDistance4(p, x + i, y + i, z + i);
+				const __m128 d1 = planeDistance4(p, x + i + 4, y + i + 4, z + i + 4);
+				const __m128 sign = _mm_set1_ps(-0.0f);
+				const uint32_t m0 = _mm_movemask_ps(_mm_cmpgt_ps(d0, _mm_xor_ps(_mm_loadu_ps(r + i), sign)));
+				const uint32_t m1 = _mm_movemask_ps(_mm_cmpgt_ps(d1, _mm_xor_ps(_mm_loadu_ps(r + i + 4), sign)));
+				return m0 | (m1 << 4);
+#elif defined(VKS_SIMD_NEON)
+				const float32x4_t d0 = planeDistance4(p, x + i, y + i, z + i);
+				const float32x4_t d1 = planeDistance4(p, x + i + 4, y + i + 4, z + i + 4);
+				return movemask(vcgtq_f32(d0, vnegq_f32(vld1q_f32(r + i)))) | (movemask(vcgtq_f32(d1, vnegq_f32(vld1q_f32(r + i + 4)))) << 4);
+#else
+				uint32_t mask = 0;
+				for (uint32_t j = 0; j < 8; j++)
+				{
+					mask |= (planes[p].x * x[i + j] + planes[p].y * y[i + j] + planes[p].z * z[i + j] + planes[p].w > -r[i + j]) ? (1 << j) : 0;
+				}
+				return mask;
+#endif
+			}, [&](uint32_t i, uint32_t p) {
+				return planes[p].x * x[i] + planes[p].y * y[i] + planes[p].z * z[i] + planes[p].w > -r[i];
+			});
+		}
+
+		/**
+		* Cull a batch of axis aligned boxes
+		*
+		* @param boxes Boxes to test
+		* @param visibilityMask Receives one bit per box (set if visible), must hold at least getMaskSize words
+		* @param planeHints (Optional) One entry per group of 8 boxes (see checkSpheres)
+		*
+		* @return Number of visible boxes
+		*/
+		uint32_t checkBoxes(const Boxes &boxes, uint32_t *visibilityMask, uint8_t *planeHints = nullptr)
+		{
+			const float *x = boxes.centerX.data();
+			const float *y = boxes.centerY.data();
+			const float *z = boxes.centerZ.data();
+			const float *ex = boxes.extentX.data();
+			const float *ey = boxes.extentY.data();
+			const float *ez = boxes.extentZ.data();
+			std::array<glm::vec3, 6> absNormals;
+			for (uint32_t p = 0; p < 6; p++)
+			{
+				absNormals[p] = glm::abs(glm::vec3(planes[p]));
+			}
+			return checkBatch(boxes.size(), visibilityMask, planeHints, [&](uint32_t i, uint32_t p) {
+				// Projected radius of the box onto the plane normal
+				const glm::vec3 &n = absNormals[p];
+#if defined(VKS_SIMD_AVX)
+				const __m256 d = planeDistance8(p, x + i, y + i, z + i);
+				const __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(n.x), _mm256_loadu_ps(ex + i)), _mm256_mul_ps(_mm256_set1_ps(n.y), _mm256_loadu_ps(ey + i))), _mm256_mul_ps(_mm256_set1_ps(n.z), _mm256_loadu_ps(ez + i)));
+				return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(d, negate(r), _CMP_GT_OQ)));
+#elif defined(VKS_SIMD_SSE2)
+				const __m128 sign = _mm_set1_ps(-0.0f);
+				uint32_t mask = 0;
+				for (uint32_t h = 0; h < 8; h += 4)
+				{
+					const __m128 d = planeDistance4(p, x + i + h, y + i + h, z + i + h);
+					const __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(n.x), _mm_loadu_ps(ex + i + h)), _mm_mul_ps(_mm_set1_ps(n.y), _mm_loadu_ps(ey + i + h))), _mm_mul_ps(_mm_set1_ps(n.z), _mm_loadu_ps(ez + i + h)));
+					mask |= _mm_movemask_ps(_mm_cmpgt_ps(d, _mm_xor_ps(r, sign))) << h;
+				}
+				return mask;
+#elif defined(VKS_SIMD_NEON)
+				uint32_t mask = 0;
+				for (uint32_t h = 0; h < 8; h += 4)
+				{
+					const float32x4_t d = planeDistance4(p, x + i + h, y + i + h, z + i + h);
+					const float32x4_t r = vaddq_f32(vaddq_f32(vmulq_n_f32(vld1q_f32(ex + i + h), n.x), vmulq_n_f32(vld1q_f32(ey + i + h), n.y)), vmulq_n_f32(vld1q_f32(ez + i + h), n.z));
+					mask |= movemask(vcgtq_f32(d, vnegq_f32(r))) << h;
+				}
+				return mask;
+#else
+				uint32_t mask = 0;
+				for (uint32_t j = 0; j < 8; j++)
+				{
+					const float r = n.x * ex[i + j] + n.y * ey[i + j] + n.z * ez[i + j];
+					mask |= (planes[p].x * x[i + j] + planes[p].y * y[i + j] + planes[p].z * z[i + j] + planes[p].w > -r) ? (1 << j) : 0;
+				}
+				return mask;
+#endif
+			}, [&](uint32_t i, uint32_t p) {
+				const glm::vec3 &n = absNormals[p];
+				const float r = n.x * ex[i] + n.y * ey[i] + n.z * ez[i];
+				return planes[p].x * x[i] + planes[p].y * y[i] + planes[p].z * z[i] + planes[p].w > -r;
+			});
+		}
+
+		/**
+		* Convert a visibility mask into a compacted list of visible object indices
+		*
+		* @param visibilityMask Visibility mask written by one of the batch functions
+		* @param count Number of objects
+		* @param visibleIndices Receives the indices of the visible objects, must hold at least count entries
+		*
+		* @return Number of visible objects
+		*/
+		static uint32_t compact(const uint32_t *visibilityMask, uint32_t count, uint32_t *visibleIndices)
+		{
+			uint32_t visibleCount = 0;
+			for (uint32_t w = 0; w < getMaskSize(count); w++)
+			{
+				uint32_t bits = visibilityMask[w];
+				while (bits)
+				{
+					visibleIndices[visibleCount++] = w * 32 + countTrailingZeros(bits);
+					bits &= bits - 1;
+				}
+			}
+			return visibleCount;
+		}
+
+	private:
+		static uint32_t popCount(uint32_t v)
+		{
+			v = v - ((v >> 1) & 0x55555555);
+			v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+			return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+		}
+
+#if defined(VKS_SIMD_AVX)
+		static __m256 negate(__m256 v)
+		{
+			return _mm256_xor_ps(v, _mm256_set1_ps(-0.0f));
+		}
+
+		// Signed distance of 8 points to a plane
+		__m256 planeDistance8(uint32_t p, const float *x, const float *y, const float *z)
+		{
+			__m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes[p].x), _mm256_loadu_ps(x)), _mm256_set1_ps(planes[p].w));
+			d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(planes[p].y), _mm256_loadu_ps(y)));
+			return _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(planes[p].z), _mm256_loadu_ps(z)));
+		}
+#elif defined(VKS_SIMD_SSE2)
+		// Signed distance of 4 points to a plane
+		__m128 planeDistance4(uint32_t p, const float *x, const float *y, const float *z)
+		{
+			__m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].x), _mm_loadu_ps(x)), _mm_set1_ps(planes[p].w));
+			d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes[p].y), _mm_loadu_ps(y)));
+			return _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes[p].z), _mm_loadu_ps(z)));
+		}
+#elif defined(VKS_SIMD_NEON)
+		// Signed distance of 4 points to a plane
+		float32x4_t planeDistance4(uint32_t p, const float *x, const float *y, const float *z)
+		{
+			float32x4_t d = vaddq_f32(vmulq_n_f32(vld1q_f32(x), planes[p].x), vdupq_n_f32(planes[p].w));
+			d = vaddq_f32(d, vmulq_n_f32(vld1q_f32(y), planes[p].y));
+			return vaddq_f32(d, vmulq_n_f32(vld1q_f32(z), planes[p].z));
+		}
+
+		// Packs the lane results of a comparison into the lowest 4 bits
+		static uint32_t movemask(uint32x4_t v)
+		{
+			static const uint32_t bits[4] = { 1, 2, 4, 8 };
+			const uint32x4_t masked = vandq_u32(v, vld1q_u32(bits));
+			const uint32x2_t sum = vpadd_u32(vget_low_u32(masked), vget_high_u32(masked));
+			return vget_lane_u32(vpadd_u32(sum, sum), 0);
+		}
+#endif
+
+		/*
+			Tests groups of 8 objects against all planes, stopping as soon as all objects of a group are outside of one plane
+			testGroup(i, p) returns a bitmask of the objects i..i+7 that are not outside of plane p
+			testSingle(i, p) is used for the remaining objects at the end of the batch
+		*/
+		template<typename GroupTest, typename SingleTest>
+		uint32_t checkBatch(uint32_t count, uint32_t *visibilityMask, uint8_t *planeHints, GroupTest testGroup, SingleTest testSingle)
+		{
+			memset(visibilityMask, 0, getMaskSize(count) * sizeof(uint32_t));
+			uint32_t visibleCount = 0;
+			const uint32_t groupCount = getPlaneHintCount(count);
+			for (uint32_t g = 0; g < groupCount; g++)
+			{
+				const uint32_t i = g * 8;
+				const bool partial = (i + 8 > count);
+				uint32_t inside = partial ? ((1u << (count - i)) - 1) : 0xFF;
+				const uint32_t firstPlane = planeHints ? planeHints[g] % 6 : 0;
+				for (uint32_t k = 0; k < 6; k++)
+				{
+					const uint32_t p = (firstPlane + k) % 6;
+					if (partial)
+					{
+						for (uint32_t j = 0; i + j < count; j++)
+						{
+							if ((inside & (1 << j)) && !testSingle(i + j, p))
+							{
+								inside &= ~(1u << j);
+							}
+						}
+					}
+					else
+					{
+						inside &= testGroup(i, p);
+					}
+					if (inside == 0)
+					{
+						// No object of the group is left, start with the plane that culled the last of them the next time
+						if (planeHints)
+						{
+							planeHints[g] = static_cast<uint8_t>(p);
+						}
+						break;
+					}
+				}
+				visibilityMask[i / 32] |= inside << (i % 32);
+				visibleCount += popCount(inside);
+			}
+			return visibleCount;
+		}
 	};
 }
@@ -0,0 +1,168 @@
+/*
+* Perceptual image comparison for golden image tests
+*
+* Pixels are compared by their color difference in YIQ space, weighted the way the eye is sensitive to luma and chroma changes
+* (see "Measuring perceived color difference using YIQ NTSC transmission color space in mobile applications", Kotsarenko and Ramos, 2010)
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+namespace vks
+{
+	namespace imagecompare
+	{
+		/** @brief 8 bit RGB image with tightly packed rows */
+		struct Image {
+			uint32_t width = 0;
+			uint32_t height = 0;
+			std::vector<uint8_t> data;
+		};
+
+		struct Result {
+			// Number of pixels whose difference is above the threshold
+			uint32_t differentPixels = 0;
+			// Largest and average difference of all pixels (0 = identical, 1 = largest possible difference)
+			float maxDifference = 0.0f;
+			float meanDifference = 0.0f;
+			// Images of different sizes are never compared
+			bool sizeMismatch = false;
+			bool passed = false;
+		};
+
+		/** @brief Load a binary (P6) ppm with 8 bits per channel */
+		inline bool loadPPM(const std::string &filename, Image &image)
+		{
+			std::ifstream file(filename, std::ios::in | std::ios::binary);
+			if (!file.is_open())
+			{
+				return false;
+			}
+			// Header values are separated by whitespace and may be interleaved with comments
+			auto readValue = [&file]() -> std::string {
+				std::string value;
+				while (file >> value)
+				{
+					if (value[0] != '#')
+					{
+						return value;
+					}
+					std::string comment;
+					std::getline(file, comment);
+				}
+				return "";
+			};
+			if (readValue() != "P6")
+			{
+				return false;
+			}
+			image.width = (uint32_t)atoi(readValue().c_str());
+			image.height = (uint32_t)atoi(readValue().c_str());
+			if ((atoi(readValue().c_str()) != 255) || (image.width == 0) || (image.height == 0))
+			{
+				return false;
+			}
+			// Exactly one whitespace char separates the header from the pixel data
+			file.get();
+			image.data.resize((size_t)image.width * image.height * 3);
+			return (bool)file.read((char*)image.data.data(), image.data.size());
+		}
+
+		inline bool savePPM(const std::string &filename, const Image &image)
+		{
+			std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+			{
+				return false;
+			}
+			file << "P6\n" << image.width << "\n" << image.height << "\n255\n";
+			file.write((const char*)image.data.data(), image.data.size());
+			return (bool)file;
+		}
+
+		/** @brief Returns the perceptual difference of two RGB colors (0..1) */
+		inline float colorDifference(const uint8_t *a, const uint8_t *b)
+		{
+			const float dr = (float)a[0] - (float)b[0];
+			const float dg = (float)a[1] - (float)b[1];
+			const float db = (float)a[2] - (float)b[2];
+			const float y = dr * 0.29889531f + dg * 0.58662247f + db * 0.11448223f;
+			const float i = dr * 0.59597799f - dg * 0.27417610f - db * 0.32180189f;
+			const float q = dr * 0.21147017f - dg * 0.52261711f + db * 0.31114694f;
+			// 35215 is the largest possible weighted difference of two colors
+			const float delta = 0.5053f * y * y + 0.299f * i * i + 0.1957f * q * q;
+			return sqrtf(delta / 35215.0f);
+		}
+
+		/**
+		* Compare an image against a reference
+		*
+		* @param image Image to test
+		* @param reference Reference (golden) image
+		* @param threshold Difference (0..1) above which a pixel counts as different, small values are e.g. caused by different rounding of implementations
+		* @param maxDifferentPixels Fraction of all pixels that may be different for the comparison to pass (e.g. to allow for differently rasterized edges)
+		* @param diffImage (Optional) Receives an image highlighting the different pixels in red on top of a faded version of the reference
+		*/
+		inline Result compare(const Image &image, const Image &reference, float threshold, float maxDifferentPixels, Image *diffImage = nullptr)
+		{
+			Result result;
+			if ((image.width != reference.width) || (image.height != reference.height))
+			{
+				result.sizeMismatch = true;
+				return result;
+			}
+
+			const size_t pixelCount = (size_t)image.width * image.height;
+			if (diffImage)
+			{
+				diffImage->width = image.width;
+				diffImage->height = image.height;
+				diffImage->data.resize(pixelCount * 3);
+			}
+
+			double sum = 0.0;
+			for (size_t i = 0; i < pixelCount; i++)
+			{
+				const uint8_t *a = &image.data[i * 3];
+				const uint8_t *b = &reference.data[i * 3];
+				const float difference = colorDifference(a, b);
+				sum += difference;
+				result.maxDifference = std::max(result.maxDifference, difference);
+				const bool different = difference > threshold;
+				if (different)
+				{
+					result.differentPixels++;
+				}
+				if (diffImage)
+				{
+					uint8_t *dst = &diffImage->data[i * 3];
+					if (different)
+					{
+						dst[0] = 255;
+						dst[1] = 0;
+						dst[2] = 0;
+					}
+					else
+					{
+						const uint8_t luma = (uint8_t)(192 + (b[0] * 77 + b[1] * 150 + b[2] * 29) / (256 * 4));
+						dst[0] = dst[1] = dst[2] = luma;
+					}
+				}
+			}
+			result.meanDifference = (float)(sum / (double)pixelCount);
+			result.passed = (double)result.differentPixels <= (double)maxDifferentPixels * (double)pixelCount;
+			return result;
+		}
+	}
+}
@@ -0,0 +1,489 @@
+/*
+* Work stealing job system
+*
+* Every worker owns a lock-free double ended queue (Chase-Lev) of jobs, the owner pushes and pops at the bottom while
+* idle workers steal from the top of other queues, so a long running job on one thread doesn't stall the others
+* Jobs store their function object in a small fixed size buffer inside the job (no heap allocation per job) and are
+* allocated from per-worker ring buffers
+* Completion is tracked with counters, waiting on a counter executes pending jobs instead of blocking the thread
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <condition_variable>
+#include <type_traits>
+#include <utility>
+#include <new>
+
+#include "VulkanTools.h"
+
+namespace vks
+{
+	/** @brief Counts the unfinished jobs of a group, can be waited on with JobSystem::wait */
+	struct JobCounter
+	{
+		std::atomic<uint32_t> value{ 0 };
+
+		/** @brief Returns true if all jobs that have been added with this counter are finished */
+		bool done() const
+		{
+			return value.load(std::memory_order_acquire) == 0;
+		}
+	};
+
+	class JobSystem
+	{
+	public:
+		/** @brief Size of the buffer that stores a job's function object (including captures) */
+		static const size_t jobStorageSize = 104;
+
+		/**
+		* Start the worker threads
+		*
+		* @param threadCount Number of threads executing jobs, including the thread that creates the job system (which only runs jobs while waiting)
+		*/
+		JobSystem(uint32_t threadCount = std::thread::hardware_concurrency())
+		{
+			threadCount = std::max(threadCount, 1u);
+			ownerThread = std::this_thread::get_id();
+			workers.resize(threadCount);
+			for (uint32_t i = 0; i < threadCount; i++)
+			{
+				workers[i].reset(new Worker());
+				workers[i]->randomState = 0x9E3779B9u * (i + 1);
+			}
+			// Worker 0 is the creating thread
+			for (uint32_t i = 1; i < threadCount; i++)
+			{
+				workers[i]->thread = std::thread(&JobSystem::workerLoop, this, i);
+			}
+		}
+
+		~JobSystem()
+		{
+			wait();
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				destroying = true;
+			}
+			sleepCondition.notify_all();
+			for (auto &worker : workers)
+			{
+				if (worker->thread.joinable())
+				{
+					worker->thread.join();
+				}
+			}
+		}
+
+		/** @brief Returns the number of threads executing jobs (including the creating thread) */
+		uint32_t getThreadCount() const
+		{
+			return static_cast<uint32_t>(workers.size());
+		}
+
+		/**
+		* Returns the index of the calling thread (0 = creating thread, 1 .. threadCount - 1 = worker threads)
+		* Can be used to index per-thread resources from within a job
+		*/
+		uint32_t getThreadIndex() const
+		{
+			const ThreadContext &context = getThreadContext();
+			if (context.jobSystem == this)
+			{
+				return context.index;
+			}
+			// Only the creating thread and the job system's own workers may add and wait for jobs
+			// Any other thread would push to the creating thread's queue, which must only be pushed to by its owner
+			if (std::this_thread::get_id() != ownerThread)
+			{
+				vks::tools::exitFatal("Jobs can only be added and waited for by the thread that created the job system or one of its workers", "Error");
+			}
+			return 0;
+		}
+
+		/**
+		* Add a job, can be called from any job of this job system or the creating thread
+		*
+		* @param function Function object to execute, must fit into jobStorageSize bytes
+		* @param counter (Optional) Counter that is incremented now and decremented once the job has finished
+		*/
+		template<typename F>
+		void addJob(F &&function, JobCounter *counter = nullptr)
+		{
+			typedef typename std::decay<F>::type Function;
+			static_assert(sizeof(Function) <= jobStorageSize, "Job function object (captures) is too large");
+			static_assert(std::alignment_of<Function>::value <= std::alignment_of<Job>::value, "Job function object alignment not supported");
+
+			const uint32_t threadIndex = getThreadIndex();
+			Job *job = allocateJob(threadIndex);
+			new (job->storage) Function(std::forward<F>(function));
+			job->invoke = [](Job *job) {
+				Function *function = reinterpret_cast<Function*>(job->storage);
+				(*function)();
+				function->~Function();
+			};
+			job->counter = counter;
+			if (counter)
+			{
+				counter->value.fetch_add(1, std::memory_order_relaxed);
+			}
+			pendingJobs.fetch_add(1, std::memory_order_relaxed);
+
+			queuedJobs.fetch_add(1, std::memory_order_seq_cst);
+			if (!workers[threadIndex]->queue.push(job))
+			{
+				// Queue is full, run the job right away
+				queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+				execute(job);
+				return;
+			}
+			if (sleepingWorkers.load(std::memory_order_seq_cst) > 0)
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				sleepCondition.notify_one();
+			}
+		}
+
+		/**
+		* Split a range into chunks that are executed as separate jobs, does not wait for them
+		* The chunk size is chosen so that every thread gets several chunks to steal from
+		*
+		* @param count Number of items
+		* @param function Function object called with the (begin, end) range of a chunk
+		* @param counter Counter to wait on for the completion of all chunks
+		* @param minChunkSize Minimum number of items per chunk
+		*/
+		template<typename F>
+		void parallelFor(uint32_t count, const F &function, JobCounter &counter, uint32_t minChunkSize = 1)
+		{
+			if (count == 0)
+			{
+				return;
+			}
+			const uint32_t chunkSize = getChunkSize(count, minChunkSize);
+			for (uint32_t begin = 0; begin < count; begin += chunkSize)
+			{
+				const uint32_t end = std::min(begin + chunkSize, count);
+				addJob([function, begin, end] { function(begin, end); }, &counter);
+			}
+		}
+
+		/** @brief Blocking version of parallelFor, the calling thread executes chunks until all are finished */
+		template<typename F>
+		void parallelFor(uint32_t count, const F &function, uint32_t minChunkSize = 1)
+		{
+			const uint32_t chunkSize = getChunkSize(count, minChunkSize);
+			if (count <= chunkSize)
+			{
+				if (count > 0)
+				{
+					function(0, count);
+				}
+				return;
+			}
+			JobCounter counter;
+			// The function is only referenced, it outlives the chunks as this waits for them
+			const F *functionRef = &function;
+			for (uint32_t begin = 0; begin < count; begin += chunkSize)
+			{
+				const uint32_t end = std::min(begin + chunkSize, count);
+				addJob([functionRef, begin, end] { (*functionRef)(begin, end); }, &counter);
+			}
+			wait(counter);
+		}
+
+		/** @brief Execute pending jobs until all jobs that were added with the counter have finished */
+		void wait(const JobCounter &counter)
+		{
+			const uint32_t threadIndex = getThreadIndex();
+			while (!counter.done())
+			{
+				if (!executeNext(threadIndex))
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		/** @brief Execute pending jobs until all jobs of the job system have finished */
+		void wait()
+		{
+			const uint32_t threadIndex = getThreadIndex();
+			while (pendingJobs.load(std::memory_order_acquire) != 0)
+			{
+				if (!executeNext(threadIndex))
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+	private:
+		struct Job
+		{
+			alignas(16) unsigned char storage[jobStorageSize];
+			void(*invoke)(Job *job);
+			JobCounter *counter;
+			std::atomic<bool> active{ false };
+		};
+
+		/** @brief Fixed size lock-free work stealing queue (Chase-Lev, with the memory orderings from Le et al. 2013) */
+		class JobQueue
+		{
+		public:
+			static const int64_t capacity = 4096;
+
+			/** @brief Add a job at the bottom, only called by the owning thread */
+			bool push(Job *job)
+			{
+				const int64_t b = bottom.load(std::memory_order_relaxed);
+				const int64_t t = top.load(std::memory_order_acquire);
+				if (b - t >= capacity)
+				{
+					return false;
+				}
+				jobs[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return true;
+			}
+
+			/** @brief Take the most recently added job from the bottom, only called by the owning thread */
+			Job *pop()
+			{
+				const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+				bottom.store(b, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				int64_t t = top.load(std::memory_order_relaxed);
+				if (t > b)
+				{
+					// Empty
+					bottom.store(b + 1, std::memory_order_relaxed);
+					return nullptr;
+				}
+				Job *job = jobs[b & (capacity - 1)].load(std::memory_order_relaxed);
+				if (t == b)
+				{
+					// Last job, race against thieves
+					if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					{
+						job = nullptr;
+					}
+					bottom.store(b + 1, std::memory_order_relaxed);
+				}
+				return job;
+			}
+
+			/** @brief Take the oldest job from the top, called by other threads */
+			Job *steal()
+			{
+				int64_t t = top.load(std::memory_order_acquire);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				const int64_t b = bottom.load(std::memory_order_acquire);
+				if (t >= b)
+				{
+					return nullptr;
+				}
+				Job *job = jobs[t & (capacity - 1)].load(std::memory_order_relaxed);
+				if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				{
+					return nullptr;
+				}
+				return job;
+			}
+
+		private:
+			// Padded so the owner and the thieves don't share a cache line
+			std::atomic<int64_t> top{ 0 };
+			char padding[64 - sizeof(std::atomic<int64_t>)];
+			std::atomic<int64_t> bottom{ 0 };
+			std::atomic<Job*> jobs[capacity];
+		};
+
+		struct Worker
+		{
+			std::thread thread;
+			JobQueue queue;
+			// Ring buffer the worker allocates its jobs from, has the same size as the queue so a push can't fail
+			std::vector<Job> jobs{ static_cast<size_t>(JobQueue::capacity) };
+			uint32_t nextJob = 0;
+			uint32_t randomState;
+		};
+
+		struct ThreadContext
+		{
+			const JobSystem *jobSystem = nullptr;
+			uint32_t index = 0;
+		};
+
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::thread::id ownerThread;
+
+		// Jobs added but not finished yet
+		std::atomic<uint32_t> pendingJobs{ 0 };
+		// Jobs sitting in one of the queues, idle workers only go to sleep if this is zero
+		std::atomic<uint32_t> queuedJobs{ 0 };
+		std::atomic<uint32_t> sleepingWorkers{ 0 };
+		std::mutex sleepMutex;
+		std::condition_variable sleepCondition;
+		bool destroying = false;
+
+		static ThreadContext &getThreadContext()
+		{
+			static thread_local ThreadContext context;
+			return context;
+		}
+
+		uint32_t getChunkSize(uint32_t count, uint32_t minChunkSize) const
+		{
+			// Several chunks per thread leave room for balancing uneven chunks by stealing
+			const uint32_t chunkCount = getThreadCount() * 4;
+			return std::max((count + chunkCount - 1) / chunkCount, std::max(minChunkSize, 1u));
+		}
+
+		Job *allocateJob(uint32_t threadIndex)
+		{
+			Worker &worker = *workers[threadIndex];
+			const uint32_t count = static_cast<uint32_t>(worker.jobs.size());
+			while (true)
+			{
+				// Usually the next job is free, skip jobs that are still in flight (e.g. one that is adding nested jobs)
+				for (uint32_t i = 0; i < count; i++)
+				{
+					Job *job = &worker.jobs[worker.nextJob];
+					worker.nextJob = (worker.nextJob + 1) % count;
+					if (!job->active.load(std::memory_order_acquire))
+					{
+						job->active.store(true, std::memory_order_relaxed);
+						return job;
+					}
+				}
+				// All jobs of the ring buffer are in flight, help out until one has finished
+				if (!executeNext(threadIndex))
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		void execute(Job *job)
+		{
+			job->invoke(job);
+			JobCounter *counter = job->counter;
+			job->active.store(false, std::memory_order_release);
+			if (counter)
+			{
+				counter->value.fetch_sub(1, std::memory_order_release);
+			}
+			pendingJobs.fetch_sub(1, std::memory_order_release);
+		}
+
+		/** @brief Run one job from the thread's own queue or stolen from another thread, returns false if none was found */
+		bool executeNext(uint32_t threadIndex)
+		{
+			Worker &worker = *workers[threadIndex];
+			Job *job = worker.queue.pop();
+			if (!job)
+			{
+				// Start with a random victim so thieves don't all compete for the same queue
+				const uint32_t count = getThreadCount();
+				worker.randomState ^= worker.randomState << 13;
+				worker.randomState ^= worker.randomState >> 17;
+				worker.randomState ^= worker.randomState << 5;
+				const uint32_t start = worker.randomState % count;
+				for (uint32_t i = 0; i < count && !job; i++)
+				{
+					const uint32_t victim = (start + i) % count;
+					if (victim != threadIndex)
+					{
+						job = workers[victim]->queue.steal();
+					}
+				}
+			}
+			if (!job)
+			{
+				return false;
+			}
+			queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			execute(job);
+			return true;
+		}
+
+		void workerLoop(uint32_t index)
+		{
+			ThreadContext &context = getThreadContext();
+			context.jobSystem = this;
+			context.index = index;
+
+			while (true)
+			{
+				if (executeNext(index))
+				{
+					continue;
+				}
+				// Spin shortly before going to sleep, new jobs often follow right away
+				bool found = false;
+				for (uint32_t i = 0; i < 64 && !found; i++)
+				{
+					std::this_thread::yield();
+					found = queuedJobs.load(std::memory_order_relaxed) > 0;
+				}
+				if (found)
+				{
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+				sleepCondition.wait(lock, [this] { return destroying || queuedJobs.load(std::memory_order_seq_cst) > 0; });
+				sleepingWorkers.fetch_sub(1, std::memory_order_seq_cst);
+				if (destroying)
+				{
+					break;
+				}
+			}
+		}
+	};
+	/**
+	* Split [0, count) into chunkCount ranges and call function(chunk, begin, end) for each of them
+	* Used by algorithms that keep per chunk data (e.g. histograms), so the chunking must not depend on the job system's scheduling
+	*
+	* @param jobSystem Job system the chunks are distributed on, only used if parallel is set
+	* @param parallel If false, function is called once on the calling thread with chunk 0 covering the whole range
+	* @note Nothing is called for an empty range, and there are never more chunks than items (chunks past the last item are skipped)
+	*/
+	template<typename F>
+	void forEachRange(JobSystem *jobSystem, bool parallel, uint32_t count, uint32_t chunkCount, const F &function)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		if (!parallel)
+		{
+			function(0, 0, count);
+			return;
+		}
+		assert(jobSystem && (chunkCount > 0));
+		chunkCount = std::max(1u, std::min(chunkCount, count));
+		const uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+		jobSystem->parallelFor(chunkCount, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t chunk = begin; chunk < end; chunk++)
+			{
+				function(chunk, std::min(chunk * chunkSize, count), std::min((chunk + 1) * chunkSize, count));
+			}
+		});
+	}
+}
@@ -25,6 +25,7 @@
 #define KEY_B 0x42
 #define KEY_F 0x46
 #define KEY_L 0x4C
+#define KEY_M 0x4D
 #define KEY_N 0x4E
 #define KEY_O 0x4F
 #define KEY_T 0x54
@@ -48,6 +49,7 @@
 #define KEY_B 0xB
 #define KEY_F 0xC
 #define KEY_L 0xD
+#define KEY_M 0x15
 #define KEY_N 0xE
 #define KEY_O 0xF
 #define KEY_T 0x10
@@ -75,6 +77,7 @@
 #define KEY_B 0x38
 #define KEY_F 0x29
 #define KEY_L 0x2E
+#define KEY_M 0x3A
 #define KEY_N 0x39
 #define KEY_O 0x20
 #define KEY_T 0x1C
@@ -0,0 +1,779 @@
+/*
+* Host side mip map generator for uncompressed texture data
+*
+* Generates a complete mip chain from a base level using a box or a Kaiser windowed sinc filter
+* Filtering is done in linear space (sRGB formats are converted before and after filtering)
+* Rows are vectorized (SSE/AVX/NEON, if available) and split into bands that are distributed across a job system
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "vulkan/vulkan.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "simd.hpp"
+#include "jobsystem.hpp"
+
+namespace vks
+{
+	class MipmapGenerator
+	{
+	public:
+		enum Filter { FILTER_BOX = 0, FILTER_KAISER = 1 };
+
+		/** @brief Describes the location of a single mip level inside of the generated chain */
+		struct Level {
+			uint32_t width;
+			uint32_t height;
+			VkDeviceSize offset;
+			VkDeviceSize size;
+		};
+
+		struct Settings {
+			/** @brief Filter used for downsampling */
+			Filter filter = FILTER_BOX;
+			/** @brief Use vectorized code paths (set to false to force the scalar reference path) */
+			bool simd = true;
+			/** @brief Half width of the Kaiser filter in destination texels */
+			float kaiserWidth = 3.0f;
+			/** @brief Kaiser window shape parameter (higher values reduce ringing but blur more) */
+			float kaiserAlpha = 4.0f;
+		} settings;
+
+		/** @brief Time (in ms) taken by the last call to generate */
+		double lastGenerationTime = 0.0;
+
+		/** @param jobSystem (Optional) Job system the rows of large levels are distributed across, generates on the calling thread if not set */
+		MipmapGenerator(vks::JobSystem *jobSystem = nullptr)
+		{
+			this->jobSystem = jobSystem;
+		}
+
+		/** @brief Returns the number of threads used for generation */
+		uint32_t getThreadCount()
+		{
+			return jobSystem ? jobSystem->getThreadCount() : 1;
+		}
+
+		/** @brief Returns true if mip maps can be generated for the given format */
+		static bool formatSupported(VkFormat format)
+		{
+			return getFormatInfo(format).channels > 0;
+		}
+
+		/** @brief Returns the number of levels for a complete mip chain */
+		static uint32_t getMipLevelCount(uint32_t width, uint32_t height)
+		{
+			return static_cast<uint32_t>(floor(log2(std::max(width, height)))) + 1;
+		}
+
+		/**
+		* Calculate size and offset of all levels of a mip chain
+		*
+		* @param format Format of the texture data
+		* @param width Width of the base level
+		* @param height Height of the base level
+		* @param mipLevels Number of levels in the chain
+		* @param levels Receives the size and offset of each level
+		*
+		* @return Size of the complete chain in bytes
+		*
+		* @note Level offsets are aligned to satisfy the buffer offset requirements of vkCmdCopyBufferToImage
+		*/
+		static VkDeviceSize getLevels(VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, std::vector<Level> &levels)
+		{
+			const FormatInfo formatInfo = getFormatInfo(format);
+			assert(formatInfo.channels > 0);
+			const VkDeviceSize alignment = std::max<VkDeviceSize>(4, formatInfo.bytesPerPixel());
+			VkDeviceSize offset = 0;
+			levels.resize(mipLevels);
+			for (uint32_t i = 0; i < mipLevels; i++)
+			{
+				levels[i].width = std::max(width >> i, 1u);
+				levels[i].height = std::max(height >> i, 1u);
+				levels[i].offset = offset;
+				levels[i].size = (VkDeviceSize)levels[i].width * levels[i].height * formatInfo.bytesPerPixel();
+				offset += levels[i].size;
+				offset = (offset + alignment - 1) / alignment * alignment;
+			}
+			return offset;
+		}
+
+		/**
+		* Generate a mip chain
+		*
+		* @param src Pointer to the tightly packed base level data
+		* @param format Format of the texture data (see formatSupported)
+		* @param width Width of the base level
+		* @param height Height of the base level
+		* @param mipLevels Number of levels to generate (including the base level)
+		* @param dst Destination for the chain, must be at least the size returned by getLevels
+		* @param levels Receives the size and offset of each level inside of dst
+		*/
+		void generate(const void *src, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, void *dst, std::vector<Level> &levels)
+		{
+			assert(src && dst);
+			assert(formatSupported(format));
+
+			auto tStart = std::chrono::high_resolution_clock::now();
+
+			const FormatInfo formatInfo = getFormatInfo(format);
+			if (formatInfo.srgb)
+			{
+				// Make sure the conversion tables are initialized before any of the workers access them
+				srgbToLinearTable();
+				linearToSrgbTable();
+			}
+
+			getLevels(format, width, height, mipLevels, levels);
+			uint8_t *data = static_cast<uint8_t*>(dst);
+			memcpy(data + levels[0].offset, src, (size_t)levels[0].size);
+
+			// Each level is downsampled from the previous one
+			for (uint32_t i = 1; i < mipLevels; i++)
+			{
+				downsample(data + levels[i - 1].offset, levels[i - 1].width, levels[i - 1].height, data + levels[i].offset, levels[i].width, levels[i].height, formatInfo);
+			}
+
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			lastGenerationTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		}
+
+		/** @brief Generate a mip chain into a new host buffer (see generate above) */
+		std::vector<uint8_t> generate(const void *src, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, std::vector<Level> &levels)
+		{
+			std::vector<uint8_t> data(static_cast<size_t>(getLevels(format, width, height, mipLevels, levels)));
+			generate(src, format, width, height, mipLevels, data.data(), levels);
+			return data;
+		}
+
+	private:
+		vks::JobSystem *jobSystem;
+
+		/** @brief Levels with less than this number of texels are generated on the calling thread */
+		static const uint32_t minParallelTexels = 128 * 128;
+
+		struct FormatInfo {
+			uint32_t channels = 0;
+			uint32_t bytesPerChannel = 0;
+			bool srgb = false;
+			bool half = false;
+			uint32_t bytesPerPixel() const { return channels * bytesPerChannel; }
+		};
+
+		/** @brief Filter taps for one dimension, weights for each destination texel are stored with a stride of maxCount */
+		struct Taps {
+			std::vector<uint32_t> first;
+			std::vector<uint32_t> count;
+			std::vector<float> weights;
+			uint32_t maxCount = 0;
+		};
+
+		static FormatInfo getFormatInfo(VkFormat format)
+		{
+			FormatInfo info;
+			switch (format)
+			{
+			case VK_FORMAT_R8G8B8A8_UNORM:
+			case VK_FORMAT_B8G8R8A8_UNORM:
+				info.channels = 4;
+				info.bytesPerChannel = 1;
+				break;
+			case VK_FORMAT_R8G8B8A8_SRGB:
+			case VK_FORMAT_B8G8R8A8_SRGB:
+				info.channels = 4;
+				info.bytesPerChannel = 1;
+				info.srgb = true;
+				break;
+			case VK_FORMAT_R16G16B16A16_SFLOAT:
+				info.channels = 4;
+				info.bytesPerChannel = 2;
+				info.half = true;
+				break;
+			case VK_FORMAT_R8_UNORM:
+				info.channels = 1;
+				info.bytesPerChannel = 1;
+				break;
+			case VK_FORMAT_R16_UNORM:
+				info.channels = 1;
+				info.bytesPerChannel = 2;
+				break;
+			default:
+				break;
+			}
+			return info;
+		}
+
+		static const float* srgbToLinearTable()
+		{
+			static std::vector<float> table = []() {
+				std::vector<float> t(256);
+				for (uint32_t i = 0; i < 256; i++)
+				{
+					const float c = i / 255.0f;
+					t[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+				}
+				return t;
+			}();
+			return table.data();
+		}
+
+		// Linear to sRGB conversion is done with a table that is fine enough to keep the error below half a unit
+		static const uint32_t linearToSrgbTableSize = 16384;
+
+		static const uint8_t* linearToSrgbTable()
+		{
+			static std::vector<uint8_t> table = []() {
+				std::vector<uint8_t> t(linearToSrgbTableSize);
+				for (uint32_t i = 0; i < linearToSrgbTableSize; i++)
+				{
+					const float l = i / (float)(linearToSrgbTableSize - 1);
+					const float c = (l <= 0.0031308f) ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+					t[i] = static_cast<uint8_t>(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+				}
+				return t;
+			}();
+			return table.data();
+		}
+
+		// Zeroth order modified Bessel function of the first kind (used by the Kaiser window)
+		static float bessel0(float x)
+		{
+			float sum = 1.0f;
+			float term = 1.0f;
+			const float halfX = x * 0.5f;
+			for (uint32_t k = 1; k < 32; k++)
+			{
+				term *= (halfX / k) * (halfX / k);
+				sum += term;
+				if (term < sum * 1e-8f)
+				{
+					break;
+				}
+			}
+			return sum;
+		}
+
+		float kaiser(float t)
+		{
+			const float sinc = (fabsf(t) < 1e-6f) ? 1.0f : sinf((float)M_PI * t) / ((float)M_PI * t);
+			const float x = t / settings.kaiserWidth;
+			if (fabsf(x) >= 1.0f)
+			{
+				return 0.0f;
+			}
+			return sinc * bessel0(settings.kaiserAlpha * sqrtf(1.0f - x * x)) / bessel0(settings.kaiserAlpha);
+		}
+
+		// Calculate the source texel weights for each destination texel
+		void computeTaps(uint32_t srcSize, uint32_t dstSize, Taps &taps)
+		{
+			const float scale = (float)srcSize / (float)dstSize;
+			std::vector<std::vector<float>> weights(dstSize);
+			taps.first.resize(dstSize);
+			taps.count.resize(dstSize);
+			taps.maxCount = 0;
+
+			for (uint32_t x = 0; x < dstSize; x++)
+			{
+				int32_t lo, hi;
+				float center = 0.0f, radius = 0.0f;
+				if (settings.filter == FILTER_BOX)
+				{
+					lo = (int32_t)floorf(x * scale);
+					hi = (int32_t)ceilf((x + 1) * scale) - 1;
+				}
+				else
+				{
+					center = (x + 0.5f) * scale;
+					radius = settings.kaiserWidth * scale;
+					lo = (int32_t)floorf(center - radius);
+					hi = (int32_t)ceilf(center + radius);
+				}
+				// Taps outside of the image are clamped to the border
+				const int32_t first = std::max(lo, 0);
+				const int32_t last = std::min(hi, (int32_t)srcSize - 1);
+				std::vector<float> &w = weights[x];
+				w.assign(last - first + 1, 0.0f);
+				float sum = 0.0f;
+				for (int32_t i = lo; i <= hi; i++)
+				{
+					float weight;
+					if (settings.filter == FILTER_BOX)
+					{
+						// Weight by coverage of the destination texel footprint
+						weight = std::min((float)(i + 1), (x + 1) * scale) - std::max((float)i, x * scale);
+						if (weight <= 1e-6f)
+						{
+							continue;
+						}
+					}
+					else
+					{
+						weight = kaiser(((i + 0.5f) - center) / scale);
+					}
+					w[std::min(std::max(i, first), last) - first] += weight;
+					sum += weight;
+				}
+				for (auto &weight : w)
+				{
+					weight /= sum;
+				}
+				taps.first[x] = first;
+				taps.count[x] = static_cast<uint32_t>(w.size());
+				taps.maxCount = std::max(taps.maxCount, taps.count[x]);
+			}
+
+			taps.weights.assign(dstSize * taps.maxCount, 0.0f);
+			for (uint32_t x = 0; x < dstSize; x++)
+			{
+				std::copy(weights[x].begin(), weights[x].end(), taps.weights.begin() + x * taps.maxCount);
+			}
+		}
+
+		// Convert a row of texels into linear floating point values
+		void decodeRow(const uint8_t *src, float *dst, uint32_t width, const FormatInfo &formatInfo)
+		{
+			const uint32_t count = width * formatInfo.channels;
+			uint32_t i = 0;
+			if (formatInfo.srgb)
+			{
+				const float *table = srgbToLinearTable();
+				for (; i < count; i += 4)
+				{
+					dst[i + 0] = table[src[i + 0]];
+					dst[i + 1] = table[src[i + 1]];
+					dst[i + 2] = table[src[i + 2]];
+					dst[i + 3] = src[i + 3] * (1.0f / 255.0f);
+				}
+				return;
+			}
+			if (formatInfo.half)
+			{
+				const uint16_t *src16 = reinterpret_cast<const uint16_t*>(src);
+#if defined(VKS_SIMD_F16C)
+				if (settings.simd)
+				{
+					for (; i + 4 <= count; i += 4)
+					{
+						_mm_storeu_ps(dst + i, _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src16 + i))));
+					}
+				}
+#endif
+				for (; i < count; i++)
+				{
+					dst[i] = glm::unpackHalf1x16(src16[i]);
+				}
+				return;
+			}
+			if (formatInfo.bytesPerChannel == 2)
+			{
+				const uint16_t *src16 = reinterpret_cast<const uint16_t*>(src);
+#if defined(VKS_SIMD_SSE2)
+				if (settings.simd)
+				{
+					const __m128i zero = _mm_setzero_si128();
+					const __m128 scale = _mm_set1_ps(1.0f / 65535.0f);
+					for (; i + 8 <= count; i += 8)
+					{
+						const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src16 + i));
+						_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), scale));
+						_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), scale));
+					}
+				}
+#elif defined(VKS_SIMD_NEON)
+				if (settings.simd)
+				{
+					for (; i + 8 <= count; i += 8)
+					{
+						const uint16x8_t v = vld1q_u16(src16 + i);
+						vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))), 1.0f / 65535.0f));
+						vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))), 1.0f / 65535.0f));
+					}
+				}
+#endif
+				for (; i < count; i++)
+				{
+					dst[i] = src16[i] * (1.0f / 65535.0f);
+				}
+				return;
+			}
+#if defined(VKS_SIMD_SSE2)
+			if (settings.simd)
+			{
+				const __m128i zero = _mm_setzero_si128();
+				const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+				for (; i + 16 <= count; i += 16)
+				{
+					const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+					const __m128i lo = _mm_unpacklo_epi8(v, zero);
+					const __m128i hi = _mm_unpackhi_epi8(v, zero);
+					_mm_storeu_ps(dst + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+					_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+					_mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+					_mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+				}
+			}
+#elif defined(VKS_SIMD_NEON)
+			if (settings.simd)
+			{
+				for (; i + 16 <= count; i += 16)
+				{
+					const uint8x16_t v = vld1q_u8(src + i);
+					const uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+					const uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+					vst1q_f32(dst + i + 0, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), 1.0f / 255.0f));
+					vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), 1.0f / 255.0f));
+					vst1q_f32(dst + i + 8, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), 1.0f / 255.0f));
+					vst1q_f32(dst + i + 12, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), 1.0f / 255.0f));
+				}
+			}
+#endif
+			for (; i < count; i++)
+			{
+				dst[i] = src[i] * (1.0f / 255.0f);
+			}
+		}
+
+		// Convert a row of linear floating point values back to the texel format
+		void encodeRow(const float *src, uint8_t *dst, uint32_t width, const FormatInfo &formatInfo)
+		{
+			const uint32_t count = width * formatInfo.channels;
+			uint32_t i = 0;
+			if (formatInfo.srgb)
+			{
+				const uint8_t *table = linearToSrgbTable();
+				const float tableScale = (float)(linearToSrgbTableSize - 1);
+				for (; i < count; i += 4)
+				{
+					for (uint32_t c = 0; c < 3; c++)
+					{
+						dst[i + c] = table[static_cast<uint32_t>(std::min(std::max(src[i + c], 0.0f), 1.0f) * tableScale + 0.5f)];
+					}
+					dst[i + 3] = static_cast<uint8_t>(std::min(std::max(src[i + 3], 0.0f), 1.0f) * 255.0f + 0.5f);
+				}
+				return;
+			}
+			if (formatInfo.half)
+			{
+				uint16_t *dst16 = reinterpret_cast<uint16_t*>(dst);
+#if defined(VKS_SIMD_F16C)
+				if (settings.simd)
+				{
+					for (; i + 4 <= count; i += 4)
+					{
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(dst16 + i), _mm_cvtps_ph(_mm_loadu_ps(src + i), 0));
+					}
+				}
+#endif
+				for (; i < count; i++)
+				{
+					dst16[i] = static_cast<uint16_t>(glm::packHalf1x16(src[i]));
+				}
+				return;
+			}
+			if (formatInfo.bytesPerChannel == 2)
+			{
+				uint16_t *dst16 = reinterpret_cast<uint16_t*>(dst);
+#if defined(VKS_SIMD_SSE2)
+				if (settings.simd)
+				{
+					const __m128 zero = _mm_setzero_ps();
+					const __m128 one = _mm_set1_ps(1.0f);
+					const __m128 scale = _mm_set1_ps(65535.0f);
+					const __m128 half = _mm_set1_ps(0.5f);
+					// SSE2 has no unsigned 32 to 16 bit pack, so values are biased into the signed range and flipped back
+					const __m128i bias32 = _mm_set1_epi32(32768);
+					const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+					for (; i + 8 <= count; i += 8)
+					{
+						__m128 a = _mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), zero), one), scale), half);
+						__m128 b = _mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), zero), one), scale), half);
+						__m128i ia = _mm_sub_epi32(_mm_cvttps_epi32(a), bias32);
+						__m128i ib = _mm_sub_epi32(_mm_cvttps_epi32(b), bias32);
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dst16 + i), _mm_xor_si128(_mm_packs_epi32(ia, ib), bias16));
+					}
+				}
+#elif defined(VKS_SIMD_NEON)
+				if (settings.simd)
+				{
+					for (; i + 4 <= count; i += 4)
+					{
+						float32x4_t v = vminq_f32(vmaxq_f32(vld1q_f32(src + i), vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+						vst1_u16(dst16 + i, vmovn_u32(vcvtq_u32_f32(vmlaq_n_f32(vdupq_n_f32(0.5f), v, 65535.0f))));
+					}
+				}
+#endif
+				for (; i < count; i++)
+				{
+					dst16[i] = static_cast<uint16_t>(std::min(std::max(src[i], 0.0f), 1.0f) * 65535.0f + 0.5f);
+				}
+				return;
+			}
+#if defined(VKS_SIMD_SSE2)
+			if (settings.simd)
+			{
+				const __m128 zero = _mm_setzero_ps();
+				const __m128 one = _mm_set1_ps(1.0f);
+				const __m128 scale = _mm_set1_ps(255.0f);
+				const __m128 half = _mm_set1_ps(0.5f);
+				for (; i + 16 <= count; i += 16)
+				{
+					__m128i v[4];
+					for (uint32_t j = 0; j < 4; j++)
+					{
+						__m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + j * 4), zero), one);
+						v[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), half));
+					}
+					const __m128i lo = _mm_packs_epi32(v[0], v[1]);
+					const __m128i hi = _mm_packs_epi32(v[2], v[3]);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+				}
+			}
+#elif defined(VKS_SIMD_NEON)
+			if (settings.simd)
+			{
+				for (; i + 8 <= count; i += 8)
+				{
+					float32x4_t a = vminq_f32(vmaxq_f32(vld1q_f32(src + i), vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+					float32x4_t b = vminq_f32(vmaxq_f32(vld1q_f32(src + i + 4), vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+					uint32x4_t ia = vcvtq_u32_f32(vmlaq_n_f32(vdupq_n_f32(0.5f), a, 255.0f));
+					uint32x4_t ib = vcvtq_u32_f32(vmlaq_n_f32(vdupq_n_f32(0.5f), b, 255.0f));
+					vst1_u8(dst + i, vmovn_u16(vcombine_u16(vmovn_u32(ia), vmovn_u32(ib))));
+				}
+			}
+#endif
+			for (; i < count; i++)
+			{
+				dst[i] = static_cast<uint8_t>(std::min(std::max(src[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+			}
+		}
+
+		// Apply the horizontal filter taps to a decoded row
+		void filterRow(const float *src, float *dst, uint32_t dstWidth, uint32_t channels, const Taps &taps)
+		{
+			if (channels == 4 && settings.simd)
+			{
+#if defined(VKS_SIMD_SSE2)
+				for (uint32_t x = 0; x < dstWidth; x++)
+				{
+					const float *s = src + taps.first[x] * 4;
+					const float *w = &taps.weights[x * taps.maxCount];
+					__m128 acc = _mm_setzero_ps();
+					for (uint32_t j = 0; j < taps.count[x]; j++)
+					{
+						acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(s + j * 4), _mm_set1_ps(w[j])));
+					}
+					_mm_storeu_ps(dst + x * 4, acc);
+				}
+				return;
+#elif defined(VKS_SIMD_NEON)
+				for (uint32_t x = 0; x < dstWidth; x++)
+				{
+					const float *s = src + taps.first[x] * 4;
+					const float *w = &taps.weights[x * taps.maxCount];
+					float32x4_t acc = vdupq_n_f32(0.0f);
+					for (uint32_t j = 0; j < taps.count[x]; j++)
+					{
+						acc = vmlaq_n_f32(acc, vld1q_f32(s + j * 4), w[j]);
+					}
+					vst1q_f32(dst + x * 4, acc);
+				}
+				return;
+#endif
+			}
+			for (uint32_t x = 0; x < dstWidth; x++)
+			{
+				const float *s = src + taps.first[x] * channels;
+				const float *w = &taps.weights[x * taps.maxCount];
+				for (uint32_t c = 0; c < channels; c++)
+				{
+					float acc = 0.0f;
+					for (uint32_t j = 0; j < taps.count[x]; j++)
+					{
+						acc += s[j * channels + c] * w[j];
+					}
+					dst[x * channels + c] = acc;
+				}
+			}
+		}
+
+		// Weighted sum of horizontally filtered rows (vertical filter pass)
+		void blendRows(const float * const *rows, const float *weights, uint32_t rowCount, float *dst, uint32_t count)
+		{
+			uint32_t i = 0;
+			if (settings.simd)
+			{
+#if defined(VKS_SIMD_AVX)
+				for (; i + 8 <= count; i += 8)
+				{
+					__m256 acc = _mm256_mul_ps(_mm256_loadu_ps(rows[0] + i), _mm256_set1_ps(weights[0]));
+					for (uint32_t j = 1; j < rowCount; j++)
+					{
+						acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(rows[j] + i), _mm256_set1_ps(weights[j])));
+					}
+					_mm256_storeu_ps(dst + i, acc);
+				}
+#endif
+#if defined(VKS_SIMD_SSE2)
+				for (; i + 4 <= count; i += 4)
+				{
+					__m128 acc = _mm_mul_ps(_mm_loadu_ps(rows[0] + i), _mm_set1_ps(weights[0]));
+					for (uint32_t j = 1; j < rowCount; j++)
+					{
+						acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(rows[j] + i), _mm_set1_ps(weights[j])));
+					}
+					_mm_storeu_ps(dst + i, acc);
+				}
+#elif defined(VKS_SIMD_NEON)
+				for (; i + 4 <= count; i += 4)
+				{
+					float32x4_t acc = vmulq_n_f32(vld1q_f32(rows[0] + i), weights[0]);
+					for (uint32_t j = 1; j < rowCount; j++)
+					{
+						acc = vmlaq_n_f32(acc, vld1q_f32(rows[j] + i), weights[j]);
+					}
+					vst1q_f32(dst + i, acc);
+				}
+#endif
+			}
+			for (; i < count; i++)
+			{
+				float acc = rows[0][i] * weights[0];
+				for (uint32_t j = 1; j < rowCount; j++)
+				{
+					acc += rows[j][i] * weights[j];
+				}
+				dst[i] = acc;
+			}
+		}
+
+		// Generic separable downsampling of the destination rows [y0, y1)
+		void downsampleRows(const uint8_t *src, uint32_t srcWidth, uint8_t *dst, uint32_t dstWidth, const FormatInfo &formatInfo, const Taps &hTaps, const Taps &vTaps, uint32_t y0, uint32_t y1)
+		{
+			const uint32_t rowLength = dstWidth * formatInfo.channels;
+			const size_t srcPitch = (size_t)srcWidth * formatInfo.bytesPerPixel();
+			const size_t dstPitch = (size_t)dstWidth * formatInfo.bytesPerPixel();
+
+			// Horizontally filtered source rows are kept in a small ring, so rows shared by neighbouring destination rows are only filtered once
+			const uint32_t ringSize = vTaps.maxCount;
+			std::vector<float> decoded(srcWidth * formatInfo.channels);
+			std::vector<float> ring(ringSize * rowLength);
+			std::vector<int64_t> ringRows(ringSize, -1);
+			std::vector<const float*> rows(ringSize);
+			std::vector<float> blended(rowLength);
+
+			for (uint32_t y = y0; y < y1; y++)
+			{
+				for (uint32_t j = 0; j < vTaps.count[y]; j++)
+				{
+					const uint32_t srcRow = vTaps.first[y] + j;
+					const uint32_t slot = srcRow % ringSize;
+					float *filtered = &ring[slot * rowLength];
+					if (ringRows[slot] != srcRow)
+					{
+						decodeRow(src + srcRow * srcPitch, decoded.data(), srcWidth, formatInfo);
+						filterRow(decoded.data(), filtered, dstWidth, formatInfo.channels, hTaps);
+						ringRows[slot] = srcRow;
+					}
+					rows[j] = filtered;
+				}
+				blendRows(rows.data(), &vTaps.weights[y * vTaps.maxCount], vTaps.count[y], blended.data(), rowLength);
+				encodeRow(blended.data(), dst + y * dstPitch, dstWidth, formatInfo);
+			}
+		}
+
+		// Fast path for 2x2 box filtering of linear 8 bit RGBA data with even dimensions
+		void downsampleRowsBox8(const uint8_t *src, uint32_t srcWidth, uint8_t *dst, uint32_t dstWidth, uint32_t y0, uint32_t y1)
+		{
+			const size_t srcPitch = (size_t)srcWidth * 4;
+			const size_t dstPitch = (size_t)dstWidth * 4;
+			for (uint32_t y = y0; y < y1; y++)
+			{
+				const uint8_t *a = src + (y * 2) * srcPitch;
+				const uint8_t *b = a + srcPitch;
+				uint8_t *d = dst + y * dstPitch;
+				uint32_t x = 0;
+				if (settings.simd)
+				{
+#if defined(VKS_SIMD_SSE2)
+					// Two destination texels per iteration
+					const __m128i zero = _mm_setzero_si128();
+					const __m128i round = _mm_set1_epi16(2);
+					for (; x + 2 <= dstWidth; x += 2)
+					{
+						const __m128i ra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x * 8));
+						const __m128i rb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x * 8));
+						const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(ra, zero), _mm_unpacklo_epi8(rb, zero));
+						const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(ra, zero), _mm_unpackhi_epi8(rb, zero));
+						__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+						sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(d + x * 4), _mm_packus_epi16(sum, sum));
+					}
+#elif defined(VKS_SIMD_NEON)
+					for (; x + 2 <= dstWidth; x += 2)
+					{
+						const uint8x16_t ra = vld1q_u8(a + x * 8);
+						const uint8x16_t rb = vld1q_u8(b + x * 8);
+						const uint16x8_t lo = vaddl_u8(vget_low_u8(ra), vget_low_u8(rb));
+						const uint16x8_t hi = vaddl_u8(vget_high_u8(ra), vget_high_u8(rb));
+						const uint16x8_t sum = vcombine_u16(vadd_u16(vget_low_u16(lo), vget_high_u16(lo)), vadd_u16(vget_low_u16(hi), vget_high_u16(hi)));
+						vst1_u8(d + x * 4, vrshrn_n_u16(sum, 2));
+					}
+#endif
+				}
+				for (; x < dstWidth; x++)
+				{
+					for (uint32_t c = 0; c < 4; c++)
+					{
+						d[x * 4 + c] = static_cast<uint8_t>((a[x * 8 + c] + a[x * 8 + 4 + c] + b[x * 8 + c] + b[x * 8 + 4 + c] + 2) >> 2);
+					}
+				}
+			}
+		}
+
+		// Split destination rows into bands and distribute them across the job system
+		template<typename F>
+		void parallelRows(uint32_t rowCount, uint32_t rowWidth, const F &fn)
+		{
+			if ((getThreadCount() < 2) || (rowCount * rowWidth < minParallelTexels))
+			{
+				fn(0, rowCount);
+				return;
+			}
+			// The job system uses several bands per thread to even out differences in per thread progress
+			jobSystem->parallelFor(rowCount, fn);
+		}
+
+		void downsample(const uint8_t *src, uint32_t srcWidth, uint32_t srcHeight, uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight, const FormatInfo &formatInfo)
+		{
+			if ((settings.filter == FILTER_BOX) && (formatInfo.bytesPerPixel() == 4) && (formatInfo.channels == 4) && !formatInfo.srgb && (srcWidth == dstWidth * 2) && (srcHeight == dstHeight * 2))
+			{
+				parallelRows(dstHeight, dstWidth, [&](uint32_t y0, uint32_t y1) {
+					downsampleRowsBox8(src, srcWidth, dst, dstWidth, y0, y1);
+				});
+				return;
+			}
+
+			Taps hTaps, vTaps;
+			computeTaps(srcWidth, dstWidth, hTaps);
+			computeTaps(srcHeight, dstHeight, vTaps);
+			parallelRows(dstHeight, dstWidth, [&](uint32_t y0, uint32_t y1) {
+				downsampleRows(src, srcWidth, dst, dstWidth, formatInfo, hTaps, vTaps, y0, y1);
+			});
+		}
+	};
+}
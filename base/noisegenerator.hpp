@@ -0,0 +1,525 @@
+/*
+* Host side perlin and fractal noise generator for 3D textures
+*
+* Based on Ken Perlin's improved noise reference implementation (http://mrl.nyu.edu/~perlin/noise/)
+* Rows are evaluated several texels at once (AVX2: 8 lanes, SSE2/NEON: 4 lanes, if available) and the volume is split into
+* bricks of slices that are distributed across a job system, finished bricks can be consumed (e.g. uploaded) while generation is still running
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <vector>
+#include <numeric>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#include "simd.hpp"
+#include "jobsystem.hpp"
+
+namespace vks
+{
+	class NoiseGenerator
+	{
+	public:
+		struct Settings {
+			/** @brief Sum multiple octaves of perlin noise (fractal noise) instead of a single one */
+			bool fractal = true;
+			/** @brief Number of octaves for fractal noise */
+			uint32_t octaves = 6;
+			/** @brief Amplitude falloff between octaves for fractal noise */
+			float persistence = 0.5f;
+			/** @brief Frequency of the (first octave of the) noise across the whole volume */
+			float frequency = 1.0f;
+			/** @brief Scale applied to single octave perlin noise */
+			float amplitude = 1.0f;
+			/** @brief Use vectorized code paths (set to false to force the scalar reference path) */
+			bool simd = true;
+		} settings;
+
+		/** @brief Range of slices generated by a single brick */
+		struct Brick {
+			uint32_t firstSlice;
+			uint32_t sliceCount;
+		};
+
+		/** @brief Time (in ms) taken by the last generation (from start until the last brick has been finished) */
+		double lastGenerationTime = 0.0;
+
+		/**
+		* Create a noise generator
+		*
+		* @param jobSystem (Optional) Job system the bricks are generated on, generates on the calling thread if not set
+		* @note Bricks are regular jobs, so a thread waiting on the same job system may also pick them up
+		*/
+		NoiseGenerator(vks::JobSystem *jobSystem = nullptr)
+		{
+			this->jobSystem = jobSystem;
+			seed(std::random_device{}());
+		}
+
+		~NoiseGenerator()
+		{
+			wait();
+		}
+
+		/** @brief Returns the number of threads used for generation */
+		uint32_t getThreadCount()
+		{
+			return jobSystem ? jobSystem->getThreadCount() : 1;
+		}
+
+		/** @brief Generate a new permutation table from the given seed */
+		void seed(uint32_t seed)
+		{
+			assert(!busy());
+			// Random lookup for permutations containing all numbers from 0..255
+			std::vector<int32_t> plookup(256);
+			std::iota(plookup.begin(), plookup.end(), 0);
+			std::default_random_engine rndEngine(seed);
+			std::shuffle(plookup.begin(), plookup.end(), rndEngine);
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				permutations[i] = permutations[256 + i] = plookup[i];
+			}
+		}
+
+		/** @brief Evaluate a single octave of perlin noise at the given position (scalar reference) */
+		float perlin(float x, float y, float z)
+		{
+			// Find unit cube that contains point
+			const int32_t X = static_cast<int32_t>(floorf(x)) & 255;
+			const int32_t Y = static_cast<int32_t>(floorf(y)) & 255;
+			const int32_t Z = static_cast<int32_t>(floorf(z)) & 255;
+			// Find relative x,y,z of point in cube
+			x -= floorf(x);
+			y -= floorf(y);
+			z -= floorf(z);
+
+			// Compute fade curves for each of x,y,z
+			const float u = fade(x);
+			const float v = fade(y);
+			const float w = fade(z);
+
+			// Hash coordinates of the 8 cube corners
+			const int32_t A = permutations[X] + Y;
+			const int32_t AA = permutations[A] + Z;
+			const int32_t AB = permutations[A + 1] + Z;
+			const int32_t B = permutations[X + 1] + Y;
+			const int32_t BA = permutations[B] + Z;
+			const int32_t BB = permutations[B + 1] + Z;
+
+			// And add blended results for 8 corners of the cube
+			return lerp(w, lerp(v,
+				lerp(u, grad(permutations[AA], x, y, z), grad(permutations[BA], x - 1, y, z)), lerp(u, grad(permutations[AB], x, y - 1, z), grad(permutations[BB], x - 1, y - 1, z))),
+				lerp(v, lerp(u, grad(permutations[AA + 1], x, y, z - 1), grad(permutations[BA + 1], x - 1, y, z - 1)), lerp(u, grad(permutations[AB + 1], x, y - 1, z - 1), grad(permutations[BB + 1], x - 1, y - 1, z - 1))));
+		}
+
+		/** @brief Evaluate fractal noise (sum of settings.octaves perlin octaves) at the given position, normalized to [0..1] (scalar reference) */
+		float fractal(float x, float y, float z)
+		{
+			float sum = 0.0f;
+			float frequency = 1.0f;
+			float amplitude = 1.0f;
+			float max = 0.0f;
+			for (uint32_t i = 0; i < settings.octaves; i++)
+			{
+				sum += perlin(x * frequency, y * frequency, z * frequency) * amplitude;
+				max += amplitude;
+				amplitude *= settings.persistence;
+				frequency *= 2.0f;
+			}
+			sum = sum / max;
+			return (sum + 1.0f) / 2.0f;
+		}
+
+		/**
+		* Start generating a noise volume on the worker threads and return immediately
+		* Without a job system, the volume is generated before this function returns
+		* Texel values are wrapped into [0..1) before they're quantized to 8 bits
+		*
+		* @param dst Destination for the single channel 8 bit volume (width * height * depth), must stay valid until generation has finished
+		* @param width Width of the volume
+		* @param height Height of the volume
+		* @param depth Depth of the volume
+		* @param slicesPerBrick Number of slices per brick (work item), finished bricks are returned by getFinishedBricks
+		*/
+		void generateAsync(uint8_t *dst, uint32_t width, uint32_t height, uint32_t depth, uint32_t slicesPerBrick = 4)
+		{
+			assert(dst);
+			assert(!busy());
+			slicesPerBrick = std::max(slicesPerBrick, 1u);
+			const uint32_t brickCount = (depth + slicesPerBrick - 1) / slicesPerBrick;
+
+			{
+				std::lock_guard<std::mutex> lock(brickMutex);
+				finishedBricks.clear();
+			}
+			remainingBricks = brickCount;
+			tStart = std::chrono::high_resolution_clock::now();
+
+			const uint32_t threadCount = getThreadCount();
+			for (uint32_t i = 0; i < brickCount; i++)
+			{
+				Brick brick;
+				brick.firstSlice = i * slicesPerBrick;
+				brick.sliceCount = std::min(slicesPerBrick, depth - brick.firstSlice);
+				if (threadCount < 2)
+				{
+					generateBrick(dst, width, height, depth, brick);
+				}
+				else
+				{
+					jobSystem->addJob([this, dst, width, height, depth, brick] { generateBrick(dst, width, height, depth, brick); }, &brickCounter);
+				}
+			}
+		}
+
+		/** @brief Generate a noise volume and wait until all bricks have been finished (see generateAsync) */
+		void generate(uint8_t *dst, uint32_t width, uint32_t height, uint32_t depth)
+		{
+			const uint32_t threadCount = getThreadCount();
+			// Use more bricks than threads to even out differences in per thread progress
+			generateAsync(dst, width, height, depth, std::max(depth / (threadCount * 4), 1u));
+			wait();
+		}
+
+		/** @brief Returns true while bricks of the current volume are still being generated */
+		bool busy()
+		{
+			return remainingBricks > 0;
+		}
+
+		/** @brief Wait until all bricks of the current volume have been generated */
+		void wait()
+		{
+			if (jobSystem)
+			{
+				jobSystem->wait(brickCounter);
+			}
+		}
+
+		/**
+		* Append all bricks that have been finished since the last call to the given list
+		*
+		* @return True if all bricks of the current volume have been generated (and returned), checked together with collecting the bricks so the last ones can't be missed
+		*/
+		bool getFinishedBricks(std::vector<Brick> &bricks)
+		{
+			std::lock_guard<std::mutex> lock(brickMutex);
+			bricks.insert(bricks.end(), finishedBricks.begin(), finishedBricks.end());
+			finishedBricks.clear();
+			return remainingBricks == 0;
+		}
+
+	private:
+		vks::JobSystem *jobSystem;
+		vks::JobCounter brickCounter;
+		int32_t permutations[512];
+
+		std::mutex brickMutex;
+		std::vector<Brick> finishedBricks;
+		std::atomic<uint32_t> remainingBricks{ 0 };
+		std::chrono::high_resolution_clock::time_point tStart;
+
+		// Per row constants of a single octave (y and z are the same for all texels of a row)
+		struct RowOctave {
+			float frequency;
+			float amplitude;
+			int32_t Y, Z;
+			float y, z;
+			float v, w;
+		};
+
+		static float fade(float t)
+		{
+			return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+		}
+
+		static float lerp(float t, float a, float b)
+		{
+			return a + t * (b - a);
+		}
+
+		static float grad(int32_t hash, float x, float y, float z)
+		{
+			// Convert LO 4 bits of hash code into 12 gradient directions
+			const int32_t h = hash & 15;
+			const float u = h < 8 ? x : y;
+			const float v = h < 4 ? y : h == 12 || h == 14 ? x : z;
+			return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+		}
+
+		// Wraps the noise value into [0..1) and quantizes it to 8 bits
+		static uint8_t quantize(float n)
+		{
+			n = n - floorf(n);
+			return static_cast<uint8_t>(std::min(n * 255.0f, 255.0f));
+		}
+
+		/*
+			Lane abstractions for the vectorized row generation
+			Permutation lookups use hardware gathers on AVX2 and scalar loads for all other instruction sets
+		*/
+
+#if defined(VKS_SIMD_AVX2)
+		struct Lanes {
+			typedef __m256 F;
+			typedef __m256i I;
+			static const uint32_t count = 8;
+			static F set1(float v) { return _mm256_set1_ps(v); }
+			static F iota() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+			static F add(F a, F b) { return _mm256_add_ps(a, b); }
+			static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+			static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+			static F floor(F a) { return _mm256_floor_ps(a); }
+			static I toInt(F a) { return _mm256_cvttps_epi32(a); }
+			static I add(I a, int32_t b) { return _mm256_add_epi32(a, _mm256_set1_epi32(b)); }
+			static I andi(I a, int32_t b) { return _mm256_and_si256(a, _mm256_set1_epi32(b)); }
+			static I gather(const int32_t *table, I index) { return _mm256_i32gather_epi32(table, index, 4); }
+			static F grad(I hash, F x, F y, F z)
+			{
+				const I h = andi(hash, 15);
+				const F uMask = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+				const F u = _mm256_blendv_ps(y, x, uMask);
+				const F vxMask = _mm256_castsi256_ps(_mm256_or_si256(_mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)), _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+				const F vyMask = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+				const F v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, vxMask), y, vyMask);
+				// Bits 0 and 1 of the hash flip the signs of u and v
+				const F uSign = _mm256_castsi256_ps(_mm256_slli_epi32(andi(h, 1), 31));
+				const F vSign = _mm256_castsi256_ps(_mm256_slli_epi32(andi(h, 2), 30));
+				return _mm256_add_ps(_mm256_xor_ps(u, uSign), _mm256_xor_ps(v, vSign));
+			}
+			static void store(F a, float *dst) { _mm256_storeu_ps(dst, a); }
+		};
+#define VKS_NOISE_LANES
+#elif defined(VKS_SIMD_SSE2)
+		struct Lanes {
+			typedef __m128 F;
+			typedef __m128i I;
+			static const uint32_t count = 4;
+			static F set1(float v) { return _mm_set1_ps(v); }
+			static F iota() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+			static F add(F a, F b) { return _mm_add_ps(a, b); }
+			static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+			static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+			static F floor(F a)
+			{
+#if defined(VKS_SIMD_SSE41)
+				return _mm_floor_ps(a);
+#else
+				// Truncate and subtract one where truncation rounded up (negative values)
+				const F t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+				return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+#endif
+			}
+			static I toInt(F a) { return _mm_cvttps_epi32(a); }
+			static I add(I a, int32_t b) { return _mm_add_epi32(a, _mm_set1_epi32(b)); }
+			static I andi(I a, int32_t b) { return _mm_and_si128(a, _mm_set1_epi32(b)); }
+			static I gather(const int32_t *table, I index)
+			{
+				alignas(16) int32_t i[4];
+				_mm_store_si128(reinterpret_cast<I*>(i), index);
+				return _mm_setr_epi32(table[i[0]], table[i[1]], table[i[2]], table[i[3]]);
+			}
+			static F select(F mask, F a, F b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+			static F grad(I hash, F x, F y, F z)
+			{
+				const I h = andi(hash, 15);
+				const F uMask = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+				const F u = select(uMask, x, y);
+				const F vxMask = _mm_castsi128_ps(_mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)), _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+				const F vyMask = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+				const F v = select(vyMask, y, select(vxMask, x, z));
+				// Bits 0 and 1 of the hash flip the signs of u and v
+				const F uSign = _mm_castsi128_ps(_mm_slli_epi32(andi(h, 1), 31));
+				const F vSign = _mm_castsi128_ps(_mm_slli_epi32(andi(h, 2), 30));
+				return _mm_add_ps(_mm_xor_ps(u, uSign), _mm_xor_ps(v, vSign));
+			}
+			static void store(F a, float *dst) { _mm_storeu_ps(dst, a); }
+		};
+#define VKS_NOISE_LANES
+#elif defined(VKS_SIMD_NEON)
+		struct Lanes {
+			typedef float32x4_t F;
+			typedef int32x4_t I;
+			static const uint32_t count = 4;
+			static F set1(float v) { return vdupq_n_f32(v); }
+			static F iota() { const float v[4] = { 0.0f, 1.0f, 2.0f, 3.0f }; return vld1q_f32(v); }
+			static F add(F a, F b) { return vaddq_f32(a, b); }
+			static F sub(F a, F b) { return vsubq_f32(a, b); }
+			static F mul(F a, F b) { return vmulq_f32(a, b); }
+			static F floor(F a)
+			{
+				// Truncate and subtract one where truncation rounded up (negative values)
+				const F t = vcvtq_f32_s32(vcvtq_s32_f32(a));
+				return vsubq_f32(t, vreinterpretq_f32_u32(vandq_u32(vcgtq_f32(t, a), vreinterpretq_u32_f32(vdupq_n_f32(1.0f)))));
+			}
+			static I toInt(F a) { return vcvtq_s32_f32(a); }
+			static I add(I a, int32_t b) { return vaddq_s32(a, vdupq_n_s32(b)); }
+			static I andi(I a, int32_t b) { return vandq_s32(a, vdupq_n_s32(b)); }
+			static I gather(const int32_t *table, I index)
+			{
+				int32_t i[4];
+				vst1q_s32(i, index);
+				const int32_t v[4] = { table[i[0]], table[i[1]], table[i[2]], table[i[3]] };
+				return vld1q_s32(v);
+			}
+			static F grad(I hash, F x, F y, F z)
+			{
+				const I h = andi(hash, 15);
+				const F u = vbslq_f32(vcltq_s32(h, vdupq_n_s32(8)), x, y);
+				const uint32x4_t vxMask = vorrq_u32(vceqq_s32(h, vdupq_n_s32(12)), vceqq_s32(h, vdupq_n_s32(14)));
+				const F v = vbslq_f32(vcltq_s32(h, vdupq_n_s32(4)), y, vbslq_f32(vxMask, x, z));
+				// Bits 0 and 1 of the hash flip the signs of u and v
+				const uint32x4_t uSign = vshlq_n_u32(vreinterpretq_u32_s32(andi(h, 1)), 31);
+				const uint32x4_t vSign = vshlq_n_u32(vreinterpretq_u32_s32(andi(h, 2)), 30);
+				return vaddq_f32(vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(u), uSign)), vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(v), vSign)));
+			}
+			static void store(F a, float *dst) { vst1q_f32(dst, a); }
+		};
+#define VKS_NOISE_LANES
+#endif
+
+#if defined(VKS_NOISE_LANES)
+		static Lanes::F fade(Lanes::F t)
+		{
+			const Lanes::F p = Lanes::add(Lanes::mul(t, Lanes::sub(Lanes::mul(t, Lanes::set1(6.0f)), Lanes::set1(15.0f))), Lanes::set1(10.0f));
+			return Lanes::mul(Lanes::mul(Lanes::mul(t, t), t), p);
+		}
+
+		static Lanes::F lerp(Lanes::F t, Lanes::F a, Lanes::F b)
+		{
+			return Lanes::add(a, Lanes::mul(t, Lanes::sub(b, a)));
+		}
+
+		// Perlin noise for multiple texels along a row, only x differs between lanes
+		Lanes::F perlin(Lanes::F x, const RowOctave &row)
+		{
+			typedef Lanes L;
+			const L::F fx = L::floor(x);
+			const L::I X = L::andi(L::toInt(fx), 255);
+			x = L::sub(x, fx);
+			const L::F u = fade(x);
+			const L::F x1 = L::sub(x, L::set1(1.0f));
+
+			const L::I A = L::add(L::gather(permutations, X), row.Y);
+			const L::I AA = L::add(L::gather(permutations, A), row.Z);
+			const L::I AB = L::add(L::gather(permutations, L::add(A, 1)), row.Z);
+			const L::I B = L::add(L::gather(permutations, L::add(X, 1)), row.Y);
+			const L::I BA = L::add(L::gather(permutations, B), row.Z);
+			const L::I BB = L::add(L::gather(permutations, L::add(B, 1)), row.Z);
+
+			const L::F y = L::set1(row.y);
+			const L::F y1 = L::set1(row.y - 1.0f);
+			const L::F z = L::set1(row.z);
+			const L::F z1 = L::set1(row.z - 1.0f);
+			const L::F v = L::set1(row.v);
+			const L::F w = L::set1(row.w);
+
+			return lerp(w, lerp(v,
+				lerp(u, L::grad(L::gather(permutations, AA), x, y, z), L::grad(L::gather(permutations, BA), x1, y, z)), lerp(u, L::grad(L::gather(permutations, AB), x, y1, z), L::grad(L::gather(permutations, BB), x1, y1, z))),
+				lerp(v, lerp(u, L::grad(L::gather(permutations, L::add(AA, 1)), x, y, z1), L::grad(L::gather(permutations, L::add(BA, 1)), x1, y, z1)), lerp(u, L::grad(L::gather(permutations, L::add(AB, 1)), x, y1, z1), L::grad(L::gather(permutations, L::add(BB, 1)), x1, y1, z1))));
+		}
+#endif
+
+		void generateRow(uint8_t *dst, uint32_t width, uint32_t height, uint32_t depth, uint32_t y, uint32_t z)
+		{
+			const float ny = static_cast<float>(y) / static_cast<float>(height) * settings.frequency;
+			const float nz = static_cast<float>(z) / static_cast<float>(depth) * settings.frequency;
+			const float invWidth = settings.frequency / static_cast<float>(width);
+
+			uint32_t x = 0;
+#if defined(VKS_NOISE_LANES)
+			if (settings.simd)
+			{
+				// Everything that only depends on y and z is calculated once per row and octave
+				const uint32_t octaves = settings.fractal ? settings.octaves : 1;
+				std::vector<RowOctave> rowOctaves(octaves);
+				float frequency = 1.0f;
+				float amplitude = 1.0f;
+				float max = 0.0f;
+				for (auto &row : rowOctaves)
+				{
+					const float fy = ny * frequency;
+					const float fz = nz * frequency;
+					row.frequency = frequency;
+					row.amplitude = amplitude;
+					row.Y = static_cast<int32_t>(floorf(fy)) & 255;
+					row.Z = static_cast<int32_t>(floorf(fz)) & 255;
+					row.y = fy - floorf(fy);
+					row.z = fz - floorf(fz);
+					row.v = fade(row.y);
+					row.w = fade(row.z);
+					max += amplitude;
+					amplitude *= settings.persistence;
+					frequency *= 2.0f;
+				}
+
+				float values[Lanes::count];
+				for (; x + Lanes::count <= width; x += Lanes::count)
+				{
+					const Lanes::F nx = Lanes::mul(Lanes::add(Lanes::set1(static_cast<float>(x)), Lanes::iota()), Lanes::set1(invWidth));
+					Lanes::F n;
+					if (settings.fractal)
+					{
+						n = Lanes::set1(0.0f);
+						for (auto &row : rowOctaves)
+						{
+							n = Lanes::add(n, Lanes::mul(perlin(Lanes::mul(nx, Lanes::set1(row.frequency)), row), Lanes::set1(row.amplitude)));
+						}
+						n = Lanes::mul(Lanes::add(Lanes::mul(n, Lanes::set1(1.0f / max)), Lanes::set1(1.0f)), Lanes::set1(0.5f));
+					}
+					else
+					{
+						n = Lanes::mul(perlin(nx, rowOctaves[0]), Lanes::set1(settings.amplitude));
+					}
+					// Wrap into [0..1)
+					n = Lanes::sub(n, Lanes::floor(n));
+					Lanes::store(n, values);
+					for (uint32_t i = 0; i < Lanes::count; i++)
+					{
+						dst[x + i] = static_cast<uint8_t>(std::min(values[i] * 255.0f, 255.0f));
+					}
+				}
+			}
+#endif
+			// Scalar reference path and remainder
+			for (; x < width; x++)
+			{
+				const float nx = static_cast<float>(x) * invWidth;
+				const float n = settings.fractal ? fractal(nx, ny, nz) : perlin(nx, ny, nz) * settings.amplitude;
+				dst[x] = quantize(n);
+			}
+		}
+
+		void generateBrick(uint8_t *dst, uint32_t width, uint32_t height, uint32_t depth, Brick brick)
+		{
+			for (uint32_t z = brick.firstSlice; z < brick.firstSlice + brick.sliceCount; z++)
+			{
+				for (uint32_t y = 0; y < height; y++)
+				{
+					generateRow(dst + (static_cast<size_t>(z) * height + y) * width, width, height, depth, y, z);
+				}
+			}
+			std::lock_guard<std::mutex> lock(brickMutex);
+			finishedBricks.push_back(brick);
+			if (--remainingBricks == 0)
+			{
+				auto tEnd = std::chrono::high_resolution_clock::now();
+				lastGenerationTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+			}
+		}
+	};
+}
+
+#undef VKS_NOISE_LANES
@@ -0,0 +1,671 @@
+/*
+* Software occlusion culling on the CPU
+*
+* Rasterizes a small set of occluder meshes into a low resolution depth buffer, builds a hierarchical depth (Hi-Z) pyramid from it
+* and tests object bounding boxes against that pyramid before any command buffers are recorded
+*
+* Triangles are transformed, near plane clipped and binned into screen tiles in parallel, tiles are then rasterized in parallel
+* Rasterization evaluates edge functions and depth for 4 (SSE2/NEON) or 8 (AVX) pixels at once, with a scalar fallback
+* Depth is stored as 1 / w (larger values are closer), which interpolates linearly in screen space and doesn't depend on the projection's depth range
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <glm/glm.hpp>
+
+#include "simd.hpp"
+#include "jobsystem.hpp"
+#include "aabbtree.hpp"
+
+namespace vks
+{
+	class OcclusionCuller
+	{
+	public:
+		struct Settings {
+			/** @brief Size of the depth buffer (width must be a multiple of 8) */
+			uint32_t width = 320;
+			uint32_t height = 192;
+			/** @brief Size of the screen tiles that triangles are binned into (width must be a multiple of 8) */
+			uint32_t tileWidth = 64;
+			uint32_t tileHeight = 32;
+			/** @brief Use vectorized code paths (set to false to force the scalar reference path) */
+			bool simd = true;
+		} settings;
+
+		struct Statistics {
+			uint32_t occluderTriangles = 0;
+			uint32_t rasterizedTriangles = 0;
+			uint32_t testedObjects = 0;
+			uint32_t occludedObjects = 0;
+			uint32_t outsideObjects = 0;
+			/** @brief Time (in ms) for transforming, binning and rasterizing the occluders */
+			double rasterTime = 0.0;
+			/** @brief Time (in ms) for building the Hi-Z pyramid */
+			double hizTime = 0.0;
+			/** @brief Time (in ms) for the last batch of object tests */
+			double testTime = 0.0;
+		} stats;
+
+		/**
+		* Create an occlusion culler
+		*
+		* @param jobSystem (Optional) Job system used for rasterization and testing (everything runs on the calling thread if not set)
+		*/
+		OcclusionCuller(vks::JobSystem *jobSystem = nullptr)
+		{
+			this->jobSystem = jobSystem;
+		}
+
+		/** @brief Returns the number of threads used for rasterization and testing (1 = calling thread only) */
+		uint32_t getThreadCount()
+		{
+			return jobSystem ? jobSystem->getThreadCount() : 1;
+		}
+
+		/** @brief Remove all occluders */
+		void clearOccluders()
+		{
+			occluders.clear();
+			stats.occluderTriangles = 0;
+		}
+
+		/**
+		* Add an occluder mesh
+		* Occluders should be large, closed and simple meshes (walls, floors, big pillars), they are rasterized every frame
+		*
+		* @param positions Pointer to the first vertex position (three floats)
+		* @param vertexStride Distance between two vertex positions in bytes
+		* @param vertexCount Number of vertices
+		* @param indices Triangle list indices
+		* @param indexCount Number of indices
+		* @param transform Model matrix applied to the positions
+		*/
+		void addOccluder(const float *positions, uint32_t vertexStride, uint32_t vertexCount, const uint32_t *indices, uint32_t indexCount, const glm::mat4 &transform = glm::mat4())
+		{
+			Occluder occluder;
+			occluder.positions.resize(vertexCount);
+			for (uint32_t i = 0; i < vertexCount; i++)
+			{
+				const float *p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + i * vertexStride);
+				occluder.positions[i] = glm::vec3(transform * glm::vec4(p[0], p[1], p[2], 1.0f));
+			}
+			occluder.indices.assign(indices, indices + indexCount);
+			occluders.push_back(occluder);
+			stats.occluderTriangles += indexCount / 3;
+		}
+
+		/**
+		* Rasterize all occluders for the current view and build the Hi-Z pyramid
+		*
+		* @param viewProjection Combined view and projection matrix used for rendering
+		* @param zNear Distance of the near plane, geometry closer than this is clipped like on the GPU
+		*/
+		void render(const glm::mat4 &viewProjection, float zNear)
+		{
+			assert(settings.width % 8 == 0 && settings.tileWidth % 8 == 0);
+			auto tStart = std::chrono::high_resolution_clock::now();
+
+			this->viewProjection = viewProjection;
+			this->zNear = zNear;
+			resize();
+
+			// Transform, clip and bin triangles, each job works on a range of triangles and fills its own bins
+			const uint32_t jobCount = getThreadCount();
+			setupJobs.resize(jobCount);
+			uint32_t triangleCount = 0;
+			for (auto &occluder : occluders)
+			{
+				triangleCount += static_cast<uint32_t>(occluder.indices.size() / 3);
+			}
+			const uint32_t trianglesPerJob = (triangleCount + jobCount - 1) / jobCount;
+			parallelFor(jobCount, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++)
+				{
+					const uint32_t first = std::min(i * trianglesPerJob, triangleCount);
+					const uint32_t last = std::min(first + trianglesPerJob, triangleCount);
+					setupTriangles(setupJobs[i], first, last);
+				}
+			});
+
+			// Rasterize tiles, each tile is only ever written by one job
+			parallelFor(tileCountX * tileCountY, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t tile = begin; tile < end; tile++)
+				{
+					rasterizeTile(tile);
+				}
+			});
+
+			stats.rasterizedTriangles = 0;
+			for (auto &job : setupJobs)
+			{
+				stats.rasterizedTriangles += static_cast<uint32_t>(job.triangles.size());
+			}
+
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			stats.rasterTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+
+			tStart = std::chrono::high_resolution_clock::now();
+			buildHiZ();
+			tEnd = std::chrono::high_resolution_clock::now();
+			stats.hizTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		}
+
+		/**
+		* Test a single bounding box against the view and the occluders rendered by the last call to render
+		*
+		* @return False if the box is completely outside of the view or hidden behind the occluders
+		*/
+		bool isVisible(const vks::AABB &bounds, bool *outside = nullptr) const
+		{
+			if (outside)
+			{
+				*outside = false;
+			}
+
+			// Project the corners of the box
+			glm::vec2 screenMin(FLT_MAX);
+			glm::vec2 screenMax(-FLT_MAX);
+			float maxDepth = 0.0f;
+			for (uint32_t i = 0; i < 8; i++)
+			{
+				const glm::vec3 corner = glm::vec3((i & 1) ? bounds.max.x : bounds.min.x, (i & 2) ? bounds.max.y : bounds.min.y, (i & 4) ? bounds.max.z : bounds.min.z);
+				const glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+				if (clip.w < zNear)
+				{
+					// Box intersects the near plane, always visible
+					return true;
+				}
+				const float invW = 1.0f / clip.w;
+				const glm::vec2 screen = toScreen(clip, invW);
+				screenMin = glm::min(screenMin, screen);
+				screenMax = glm::max(screenMax, screen);
+				maxDepth = std::max(maxDepth, invW);
+			}
+
+			if (screenMax.x < 0.0f || screenMax.y < 0.0f || screenMin.x >= (float)settings.width || screenMin.y >= (float)settings.height)
+			{
+				if (outside)
+				{
+					*outside = true;
+				}
+				return false;
+			}
+
+			int32_t x0 = std::max(static_cast<int32_t>(screenMin.x), 0);
+			int32_t y0 = std::max(static_cast<int32_t>(screenMin.y), 0);
+			int32_t x1 = std::min(static_cast<int32_t>(screenMax.x), static_cast<int32_t>(settings.width) - 1);
+			int32_t y1 = std::min(static_cast<int32_t>(screenMax.y), static_cast<int32_t>(settings.height) - 1);
+
+			// Select the pyramid level at which the box covers at most 4 x 4 texels
+			uint32_t level = 0;
+			while ((x1 - x0 > 3 || y1 - y0 > 3) && level + 1 < hiz.size())
+			{
+				level++;
+				x0 >>= 1;
+				y0 >>= 1;
+				x1 >>= 1;
+				y1 >>= 1;
+			}
+			const HiZLevel &hizLevel = hiz[level];
+			x1 = std::min(x1, static_cast<int32_t>(hizLevel.width) - 1);
+			y1 = std::min(y1, static_cast<int32_t>(hizLevel.height) - 1);
+
+			// Occluded if the closest point of the box is behind the farthest occluder in all covered texels
+			for (int32_t y = y0; y <= y1; y++)
+			{
+				const float *row = &hizLevel.depth[y * hizLevel.width];
+				for (int32_t x = x0; x <= x1; x++)
+				{
+					if (maxDepth >= row[x])
+					{
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		/**
+		* Test a batch of bounding boxes, distributed across the job system's threads
+		*
+		* @param bounds Boxes to test
+		* @param visibility Receives one entry per box (1 = visible)
+		*
+		* @return Number of visible boxes
+		*/
+		uint32_t testBoxes(const std::vector<vks::AABB> &bounds, std::vector<uint8_t> &visibility)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+			const uint32_t count = static_cast<uint32_t>(bounds.size());
+			visibility.resize(count);
+			const uint32_t jobCount = getThreadCount();
+			const uint32_t boxesPerJob = (count + jobCount - 1) / jobCount;
+			std::vector<uint32_t> occluded(jobCount, 0), outside(jobCount, 0);
+			parallelFor(jobCount, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++)
+				{
+					const uint32_t first = std::min(i * boxesPerJob, count);
+					const uint32_t last = std::min(first + boxesPerJob, count);
+					for (uint32_t j = first; j < last; j++)
+					{
+						bool isOutside;
+						visibility[j] = isVisible(bounds[j], &isOutside) ? 1 : 0;
+						if (!visibility[j])
+						{
+							(isOutside ? outside[i] : occluded[i])++;
+						}
+					}
+				}
+			});
+
+			stats.testedObjects = count;
+			stats.occludedObjects = 0;
+			stats.outsideObjects = 0;
+			for (uint32_t i = 0; i < jobCount; i++)
+			{
+				stats.occludedObjects += occluded[i];
+				stats.outsideObjects += outside[i];
+			}
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			stats.testTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+			return count - stats.occludedObjects - stats.outsideObjects;
+		}
+
+		/** @brief Depth buffer of the last render call (1 / w, 0 = no occluder), e.g. for debug display */
+		const std::vector<float> &getDepthBuffer() const
+		{
+			return hiz[0].depth;
+		}
+
+	private:
+		struct Occluder {
+			std::vector<glm::vec3> positions;
+			std::vector<uint32_t> indices;
+		};
+		std::vector<Occluder> occluders;
+
+		// Screen space triangle with edge functions (e = a * x + b * y + c, inside if all are >= 0) and a depth plane
+		struct Triangle {
+			float edgeA[3], edgeB[3], edgeC[3];
+			float depthA, depthB, depthC;
+			int32_t minX, minY, maxX, maxY;
+		};
+
+		struct SetupJob {
+			std::vector<Triangle> triangles;
+			// Triangle indices per tile
+			std::vector<std::vector<uint32_t>> bins;
+		};
+		std::vector<SetupJob> setupJobs;
+
+		struct HiZLevel {
+			uint32_t width;
+			uint32_t height;
+			std::vector<float> depth;
+		};
+		// Level 0 is the depth buffer, each following level stores the farthest depth of the texels it covers
+		std::vector<HiZLevel> hiz;
+
+		uint32_t tileCountX = 0;
+		uint32_t tileCountY = 0;
+		glm::mat4 viewProjection;
+		float zNear = 0.1f;
+
+		vks::JobSystem *jobSystem;
+
+		// Runs function(begin, end) for sub ranges of [0, count) and returns once all of them are finished
+		template<typename F>
+		void parallelFor(uint32_t count, const F &function)
+		{
+			if (getThreadCount() < 2)
+			{
+				function(0, count);
+			}
+			else
+			{
+				jobSystem->parallelFor(count, function);
+			}
+		}
+
+		glm::vec2 toScreen(const glm::vec4 &clip, float invW) const
+		{
+			return glm::vec2((clip.x * invW * 0.5f + 0.5f) * settings.width, (clip.y * invW * 0.5f + 0.5f) * settings.height);
+		}
+
+		void resize()
+		{
+			tileCountX = (settings.width + settings.tileWidth - 1) / settings.tileWidth;
+			tileCountY = (settings.height + settings.tileHeight - 1) / settings.tileHeight;
+			if (hiz.empty() || hiz[0].width != settings.width || hiz[0].height != settings.height)
+			{
+				hiz.clear();
+				uint32_t w = settings.width;
+				uint32_t h = settings.height;
+				while (true)
+				{
+					HiZLevel level;
+					level.width = w;
+					level.height = h;
+					level.depth.resize(w * h);
+					hiz.push_back(level);
+					if (w == 1 && h == 1)
+					{
+						break;
+					}
+					w = std::max(w / 2, 1u);
+					h = std::max(h / 2, 1u);
+				}
+			}
+		}
+
+		void setupTriangles(SetupJob &job, uint32_t first, uint32_t last)
+		{
+			job.triangles.clear();
+			job.bins.resize(tileCountX * tileCountY);
+			for (auto &bin : job.bins)
+			{
+				bin.clear();
+			}
+
+			uint32_t base = 0;
+			for (auto &occluder : occluders)
+			{
+				const uint32_t count = static_cast<uint32_t>(occluder.indices.size() / 3);
+				// Part of this occluder's triangles that fall into the job's range
+				const uint32_t t0 = std::max(first, base) - base;
+				const uint32_t t1 = std::min(last, base + count);
+				for (uint32_t t = t0; t + base < t1; t++)
+				{
+					glm::vec4 clip[3];
+					for (uint32_t v = 0; v < 3; v++)
+					{
+						clip[v] = viewProjection * glm::vec4(occluder.positions[occluder.indices[t * 3 + v]], 1.0f);
+					}
+					clipAndSetup(job, clip);
+				}
+				base += count;
+				if (base >= last)
+				{
+					break;
+				}
+			}
+		}
+
+		// Clip a triangle against the near plane (may result in a quad) and set up the resulting triangles
+		void clipAndSetup(SetupJob &job, const glm::vec4 *clip)
+		{
+			glm::vec4 polygon[4];
+			uint32_t count = 0;
+			for (uint32_t i = 0; i < 3; i++)
+			{
+				const glm::vec4 &a = clip[i];
+				const glm::vec4 &b = clip[(i + 1) % 3];
+				const float da = a.w - zNear;
+				const float db = b.w - zNear;
+				if (da >= 0.0f)
+				{
+					polygon[count++] = a;
+				}
+				if ((da >= 0.0f) != (db >= 0.0f))
+				{
+					polygon[count++] = a + (b - a) * (da / (da - db));
+				}
+			}
+			for (uint32_t i = 2; i < count; i++)
+			{
+				setupTriangle(job, polygon[0], polygon[i - 1], polygon[i]);
+			}
+		}
+
+		void setupTriangle(SetupJob &job, const glm::vec4 &c0, const glm::vec4 &c1, const glm::vec4 &c2)
+		{
+			const float z[3] = { 1.0f / c0.w, 1.0f / c1.w, 1.0f / c2.w };
+			const glm::vec2 p[3] = { toScreen(c0, z[0]), toScreen(c1, z[1]), toScreen(c2, z[2]) };
+
+			const float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+			if (fabsf(area) < 1.0e-6f)
+			{
+				return;
+			}
+
+			Triangle tri;
+			const glm::vec2 bbMin = glm::min(glm::min(p[0], p[1]), p[2]);
+			const glm::vec2 bbMax = glm::max(glm::max(p[0], p[1]), p[2]);
+			tri.minX = std::max(static_cast<int32_t>(floorf(bbMin.x)), 0);
+			tri.minY = std::max(static_cast<int32_t>(floorf(bbMin.y)), 0);
+			tri.maxX = std::min(static_cast<int32_t>(ceilf(bbMax.x)), static_cast<int32_t>(settings.width) - 1);
+			tri.maxY = std::min(static_cast<int32_t>(ceilf(bbMax.y)), static_cast<int32_t>(settings.height) - 1);
+			if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+			{
+				return;
+			}
+
+			// Edge functions are evaluated at pixel centers and oriented so that the inside is positive for both windings
+			const float orientation = (area > 0.0f) ? 1.0f : -1.0f;
+			for (uint32_t i = 0; i < 3; i++)
+			{
+				const glm::vec2 &a = p[(i + 1) % 3];
+				const glm::vec2 &b = p[(i + 2) % 3];
+				tri.edgeA[i] = (a.y - b.y) * orientation;
+				tri.edgeB[i] = (b.x - a.x) * orientation;
+				tri.edgeC[i] = -(tri.edgeA[i] * (a.x - 0.5f) + tri.edgeB[i] * (a.y - 0.5f));
+			}
+
+			// Depth plane
+			const float dzdx = ((z[1] - z[0]) * (p[2].y - p[0].y) - (z[2] - z[0]) * (p[1].y - p[0].y)) / area;
+			const float dzdy = ((z[2] - z[0]) * (p[1].x - p[0].x) - (z[1] - z[0]) * (p[2].x - p[0].x)) / area;
+			tri.depthA = dzdx;
+			tri.depthB = dzdy;
+			tri.depthC = z[0] - dzdx * (p[0].x - 0.5f) - dzdy * (p[0].y - 0.5f);
+
+			const uint32_t index = static_cast<uint32_t>(job.triangles.size());
+			job.triangles.push_back(tri);
+			for (uint32_t ty = tri.minY / settings.tileHeight; ty <= tri.maxY / settings.tileHeight; ty++)
+			{
+				for (uint32_t tx = tri.minX / settings.tileWidth; tx <= tri.maxX / settings.tileWidth; tx++)
+				{
+					job.bins[ty * tileCountX + tx].push_back(index);
+				}
+			}
+		}
+
+		void rasterizeTile(uint32_t tile)
+		{
+			const int32_t tileX0 = (tile % tileCountX) * settings.tileWidth;
+			const int32_t tileY0 = (tile / tileCountX) * settings.tileHeight;
+			const int32_t tileX1 = std::min(tileX0 + static_cast<int32_t>(settings.tileWidth), static_cast<int32_t>(settings.width)) - 1;
+			const int32_t tileY1 = std::min(tileY0 + static_cast<int32_t>(settings.tileHeight), static_cast<int32_t>(settings.height)) - 1;
+			float *depth = hiz[0].depth.data();
+			const int32_t pitch = static_cast<int32_t>(settings.width);
+
+			for (int32_t y = tileY0; y <= tileY1; y++)
+			{
+				memset(&depth[y * pitch + tileX0], 0, (tileX1 - tileX0 + 1) * sizeof(float));
+			}
+
+			for (auto &job : setupJobs)
+			{
+				for (auto index : job.bins[tile])
+				{
+					const Triangle &tri = job.triangles[index];
+					const int32_t x0 = std::max(tri.minX, tileX0);
+					const int32_t x1 = std::min(tri.maxX, tileX1);
+					const int32_t y0 = std::max(tri.minY, tileY0);
+					const int32_t y1 = std::min(tri.maxY, tileY1);
+					if (settings.simd)
+					{
+						rasterizeSimd(tri, depth, pitch, x0, y0, x1, y1);
+					}
+					else
+					{
+						rasterizeScalar(tri, depth, pitch, x0, y0, x1, y1);
+					}
+				}
+			}
+		}
+
+		static void rasterizeScalar(const Triangle &tri, float *depth, int32_t pitch, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+		{
+			for (int32_t y = y0; y <= y1; y++)
+			{
+				float *row = &depth[y * pitch];
+				for (int32_t x = x0; x <= x1; x++)
+				{
+					const float fx = (float)x;
+					const float fy = (float)y;
+					const float e0 = tri.edgeA[0] * fx + (tri.edgeB[0] * fy + tri.edgeC[0]);
+					const float e1 = tri.edgeA[1] * fx + (tri.edgeB[1] * fy + tri.edgeC[1]);
+					const float e2 = tri.edgeA[2] * fx + (tri.edgeB[2] * fy + tri.edgeC[2]);
+					if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f)
+					{
+						const float z = tri.depthA * fx + (tri.depthB * fy + tri.depthC);
+						row[x] = std::max(row[x], z);
+					}
+				}
+			}
+		}
+
+		/*
+			Pixels are processed in aligned groups of 4 or 8 along each row
+			Groups may start before x0 or end after x1, but these pixels are still inside of the tile and fail the edge tests if outside of the triangle
+		*/
+		static void rasterizeSimd(const Triangle &tri, float *depth, int32_t pitch, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+		{
+#if defined(VKS_SIMD_AVX)
+			const int32_t lanes = 8;
+			const __m256 laneOffset = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 step = _mm256_set1_ps((float)lanes);
+			const int32_t xStart = x0 & ~(lanes - 1);
+			for (int32_t y = y0; y <= y1; y++)
+			{
+				float *row = &depth[y * pitch];
+				const float fy = (float)y;
+				const __m256 e0Row = _mm256_set1_ps(tri.edgeB[0] * fy + tri.edgeC[0]);
+				const __m256 e1Row = _mm256_set1_ps(tri.edgeB[1] * fy + tri.edgeC[1]);
+				const __m256 e2Row = _mm256_set1_ps(tri.edgeB[2] * fy + tri.edgeC[2]);
+				const __m256 zRow = _mm256_set1_ps(tri.depthB * fy + tri.depthC);
+				__m256 fx = _mm256_add_ps(_mm256_set1_ps((float)xStart), laneOffset);
+				for (int32_t x = xStart; x <= x1; x += lanes)
+				{
+					// Evaluated per group (instead of stepping) to match the scalar path exactly
+					const __m256 e0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.edgeA[0]), fx), e0Row);
+					const __m256 e1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.edgeA[1]), fx), e1Row);
+					const __m256 e2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.edgeA[2]), fx), e2Row);
+					const __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)), _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+					if (_mm256_movemask_ps(inside))
+					{
+						const __m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.depthA), fx), zRow);
+						const __m256 current = _mm256_loadu_ps(&row[x]);
+						_mm256_storeu_ps(&row[x], _mm256_blendv_ps(current, _mm256_max_ps(current, z), inside));
+					}
+					fx = _mm256_add_ps(fx, step);
+				}
+			}
+#elif defined(VKS_SIMD_SSE2)
+			const int32_t lanes = 4;
+			const __m128 laneOffset = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 step = _mm_set1_ps((float)lanes);
+			const int32_t xStart = x0 & ~(lanes - 1);
+			for (int32_t y = y0; y <= y1; y++)
+			{
+				float *row = &depth[y * pitch];
+				const float fy = (float)y;
+				const __m128 e0Row = _mm_set1_ps(tri.edgeB[0] * fy + tri.edgeC[0]);
+				const __m128 e1Row = _mm_set1_ps(tri.edgeB[1] * fy + tri.edgeC[1]);
+				const __m128 e2Row = _mm_set1_ps(tri.edgeB[2] * fy + tri.edgeC[2]);
+				const __m128 zRow = _mm_set1_ps(tri.depthB * fy + tri.depthC);
+				__m128 fx = _mm_add_ps(_mm_set1_ps((float)xStart), laneOffset);
+				for (int32_t x = xStart; x <= x1; x += lanes)
+				{
+					const __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edgeA[0]), fx), e0Row);
+					const __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edgeA[1]), fx), e1Row);
+					const __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edgeA[2]), fx), e2Row);
+					const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+					if (_mm_movemask_ps(inside))
+					{
+						const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.depthA), fx), zRow);
+						const __m128 current = _mm_loadu_ps(&row[x]);
+						const __m128 updated = _mm_max_ps(current, z);
+						_mm_storeu_ps(&row[x], _mm_or_ps(_mm_and_ps(inside, updated), _mm_andnot_ps(inside, current)));
+					}
+					fx = _mm_add_ps(fx, step);
+				}
+			}
+#elif defined(VKS_SIMD_NEON)
+			const int32_t lanes = 4;
+			const float laneOffsets[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+			const float32x4_t laneOffset = vld1q_f32(laneOffsets);
+			const float32x4_t zero = vdupq_n_f32(0.0f);
+			const float32x4_t step = vdupq_n_f32((float)lanes);
+			const int32_t xStart = x0 & ~(lanes - 1);
+			for (int32_t y = y0; y <= y1; y++)
+			{
+				float *row = &depth[y * pitch];
+				const float fy = (float)y;
+				const float32x4_t e0Row = vdupq_n_f32(tri.edgeB[0] * fy + tri.edgeC[0]);
+				const float32x4_t e1Row = vdupq_n_f32(tri.edgeB[1] * fy + tri.edgeC[1]);
+				const float32x4_t e2Row = vdupq_n_f32(tri.edgeB[2] * fy + tri.edgeC[2]);
+				const float32x4_t zRow = vdupq_n_f32(tri.depthB * fy + tri.depthC);
+				float32x4_t fx = vaddq_f32(vdupq_n_f32((float)xStart), laneOffset);
+				for (int32_t x = xStart; x <= x1; x += lanes)
+				{
+					const float32x4_t e0 = vaddq_f32(vmulq_n_f32(fx, tri.edgeA[0]), e0Row);
+					const float32x4_t e1 = vaddq_f32(vmulq_n_f32(fx, tri.edgeA[1]), e1Row);
+					const float32x4_t e2 = vaddq_f32(vmulq_n_f32(fx, tri.edgeA[2]), e2Row);
+					const float32x4_t z = vaddq_f32(vmulq_n_f32(fx, tri.depthA), zRow);
+					const uint32x4_t inside = vandq_u32(vandq_u32(vcgeq_f32(e0, zero), vcgeq_f32(e1, zero)), vcgeq_f32(e2, zero));
+					const float32x4_t current = vld1q_f32(&row[x]);
+					vst1q_f32(&row[x], vbslq_f32(inside, vmaxq_f32(current, z), current));
+					fx = vaddq_f32(fx, step);
+				}
+			}
+#else
+			rasterizeScalar(tri, depth, pitch, x0, y0, x1, y1);
+#endif
+		}
+
+		// Each texel of the next level stores the farthest (smallest) depth of the texels it covers, odd sizes fold the last row and column into their neighbour
+		void buildHiZ()
+		{
+			for (size_t l = 1; l < hiz.size(); l++)
+			{
+				const HiZLevel &src = hiz[l - 1];
+				HiZLevel &dst = hiz[l];
+				for (uint32_t y = 0; y < dst.height; y++)
+				{
+					const uint32_t sy0 = std::min(y * 2, src.height - 1);
+					const uint32_t sy1 = (y == dst.height - 1) ? src.height - 1 : std::min(y * 2 + 1, src.height - 1);
+					for (uint32_t x = 0; x < dst.width; x++)
+					{
+						const uint32_t sx0 = std::min(x * 2, src.width - 1);
+						const uint32_t sx1 = (x == dst.width - 1) ? src.width - 1 : std::min(x * 2 + 1, src.width - 1);
+						float farthest = FLT_MAX;
+						for (uint32_t sy = sy0; sy <= sy1; sy++)
+						{
+							for (uint32_t sx = sx0; sx <= sx1; sx++)
+							{
+								farthest = std::min(farthest, src.depth[sy * src.width + sx]);
+							}
+						}
+						dst.depth[y * dst.width + x] = farthest;
+					}
+				}
+			}
+		}
+	};
+}
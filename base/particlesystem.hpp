@@ -0,0 +1,604 @@
+/*
+* CPU fire particle system
+*
+* Particles are stored as structure of arrays, with one pool per particle type (flame and smoke), so the update kernels
+* run over contiguous attribute streams without any per-particle branching and can be vectorized (SSE/NEON, if available)
+* Pools are split into fixed size blocks that are updated in parallel on the job system
+*
+* One update is done in three passes:
+*   1. Integrate all particles (per block, in parallel) and collect the ones that reached the end of their life
+*   2. Transition expired particles (flame -> smoke or respawn, smoke -> respawn), this moves particles between pools
+*   3. Write the vertices of all particles (per block, in parallel) directly to the destination (e.g. mapped buffer memory)
+* For blending in the correct order, the vertices can also be written in a given (e.g. depth sorted) order instead
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "simd.hpp"
+#include "jobsystem.hpp"
+
+namespace vks
+{
+	class ParticleSystem
+	{
+	public:
+		enum Type { TYPE_FLAME = 0, TYPE_SMOKE = 1, TYPE_COUNT = 2 };
+
+		/** @brief Vertex layout of a single particle as consumed by the particle shaders */
+		struct Vertex {
+			glm::vec4 pos;
+			glm::vec4 color;
+			float alpha;
+			float size;
+			float rotation;
+			uint32_t type;
+		};
+
+		struct Settings {
+			/** @brief Center of the sphere new flame particles are spawned in */
+			glm::vec3 emitterPos = glm::vec3(0.0f);
+			/** @brief Radius of the sphere new flame particles are spawned in */
+			float emitterRadius = 8.0f;
+			glm::vec3 minVel = glm::vec3(-3.0f, 0.5f, -3.0f);
+			glm::vec3 maxVel = glm::vec3(3.0f, 7.0f, 3.0f);
+			/** @brief Chance of an expired flame particle turning into smoke instead of respawning */
+			float smokeChance = 0.05f;
+			/** @brief Use vectorized code paths (set to false to force the scalar reference path) */
+			bool simd = true;
+		} settings;
+
+		/** @brief Time (in ms) taken by the last call to update */
+		double lastUpdateTime = 0.0;
+
+		/**
+		* Create a particle system
+		*
+		* @param count Total number of particles (flame and smoke), stays constant over the lifetime of the particle system
+		* @param jobSystem Job system used to update the blocks in parallel (nullptr updates on the calling thread)
+		* @param seed Seed of the random generator used for spawning particles
+		*/
+		ParticleSystem(uint32_t count, JobSystem *jobSystem = nullptr, uint32_t seed = 0) : count(count), jobSystem(jobSystem), rndGen(seed)
+		{
+			assert(count > 0);
+			for (auto &pool : pools)
+			{
+				for (auto &attribute : pool.attributes)
+				{
+					attribute.resize(count);
+				}
+			}
+		}
+
+		/** @brief Respawn all particles as flames, with a fade in based on their height inside of the emitter */
+		void reset()
+		{
+			pools[TYPE_SMOKE].count = 0;
+			Pool &flames = pools[TYPE_FLAME];
+			flames.count = count;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				initFlame(flames, i);
+				flames[Pool::ALPHA][i] = 1.0f - (fabs(flames[Pool::POS_Y][i]) / (settings.emitterRadius * 2.0f));
+			}
+		}
+
+		/** @brief Returns the total number of particles, this is also the number of vertices written */
+		uint32_t getCount() const
+		{
+			return count;
+		}
+
+		/** @brief Returns the number of particles of the given type */
+		uint32_t getCount(Type type) const
+		{
+			return pools[type].count;
+		}
+
+		/**
+		* Advance the simulation
+		*
+		* @param frameTimer Time step in seconds
+		* @param vertices Destination for the vertices of all particles (getCount() elements), may be nullptr to only advance the simulation
+		*
+		* @note Vertices are written sequentially in a single pass, so the destination can be write-combined mapped memory
+		*/
+		void update(float frameTimer, Vertex *vertices)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+
+			const float particleTimer = frameTimer * 0.45f;
+
+			// Pass 1: Integrate and collect expired particles per block
+			updateBlocks();
+			forEachBlock([&](const Block &block, std::vector<uint32_t> &expired)
+			{
+				expired.clear();
+				if (block.type == TYPE_FLAME)
+				{
+					integrateFlames(block.begin, block.end, particleTimer, expired);
+				}
+				else
+				{
+					integrateSmoke(block.begin, block.end, frameTimer, particleTimer, expired);
+				}
+			});
+
+			// Pass 2: Transitions are rare compared to the particle count, and move particles between pools, so they are done serially
+			transition();
+
+			// Pass 3: Write the vertices
+			if (vertices)
+			{
+				writeVertices(vertices);
+			}
+
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			lastUpdateTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		}
+
+		/**
+		* Write the vertices of all particles without advancing the simulation
+		* Flame particles come first, followed by the smoke particles
+		*
+		* @param vertices Destination for the vertices of all particles (getCount() elements)
+		*/
+		void writeVertices(Vertex *vertices)
+		{
+			assert(vertices);
+			updateBlocks();
+			forEachBlock([&](const Block &block, std::vector<uint32_t> &)
+			{
+				const Pool &pool = pools[block.type];
+				const uint32_t offset = (block.type == TYPE_FLAME) ? 0 : pools[TYPE_FLAME].count;
+				const float *posX = pool[Pool::POS_X];
+				const float *posY = pool[Pool::POS_Y];
+				const float *posZ = pool[Pool::POS_Z];
+				const float *alpha = pool[Pool::ALPHA];
+				const float *size = pool[Pool::SIZE];
+				const float *rotation = pool[Pool::ROTATION];
+				const float *color = pool[Pool::COLOR];
+				Vertex *dst = vertices + offset;
+				for (uint32_t i = block.begin; i < block.end; i++)
+				{
+					dst[i].pos = glm::vec4(posX[i], posY[i], posZ[i], 1.0f);
+					dst[i].color = glm::vec4(color[i]);
+					dst[i].alpha = alpha[i];
+					dst[i].size = size[i];
+					dst[i].rotation = rotation[i];
+					dst[i].type = block.type;
+				}
+			});
+		}
+
+		/**
+		* Write the vertices of all particles in the given order, e.g. sorted back to front for blending
+		*
+		* @param vertices Destination for the vertices of all particles (getCount() elements)
+		* @param order Particle index for each vertex, indices are in the order used by writeVertices and getDepths (flames first)
+		*/
+		void writeVertices(Vertex *vertices, const uint32_t *order)
+		{
+			assert(vertices && order);
+			const uint32_t flameCount = pools[TYPE_FLAME].count;
+			auto gather = [&](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = begin; i < end; i++)
+				{
+					const Type type = (order[i] < flameCount) ? TYPE_FLAME : TYPE_SMOKE;
+					const uint32_t index = (type == TYPE_FLAME) ? order[i] : order[i] - flameCount;
+					const Pool &pool = pools[type];
+					vertices[i].pos = glm::vec4(pool[Pool::POS_X][index], pool[Pool::POS_Y][index], pool[Pool::POS_Z][index], 1.0f);
+					vertices[i].color = glm::vec4(pool[Pool::COLOR][index]);
+					vertices[i].alpha = pool[Pool::ALPHA][index];
+					vertices[i].size = pool[Pool::SIZE][index];
+					vertices[i].rotation = pool[Pool::ROTATION][index];
+					vertices[i].type = type;
+				}
+			};
+			if (jobSystem && count > blockSize)
+			{
+				jobSystem->parallelFor(count, gather, blockSize);
+			}
+			else
+			{
+				gather(0, count);
+			}
+		}
+
+		/**
+		* Get the view space distance of all particles (flames first, followed by the smoke particles)
+		*
+		* @param view Matrix transforming particle positions into view space (camera looking down -z)
+		* @param depths Destination for the distances of all particles (getCount() elements)
+		*/
+		void getDepths(const glm::mat4 &view, float *depths)
+		{
+			assert(depths);
+			// Distance along the view direction is the negated z row of the view matrix
+			const glm::vec4 plane = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+			updateBlocks();
+			forEachBlock([&](const Block &block, std::vector<uint32_t> &)
+			{
+				const Pool &pool = pools[block.type];
+				const float *posX = pool[Pool::POS_X];
+				const float *posY = pool[Pool::POS_Y];
+				const float *posZ = pool[Pool::POS_Z];
+				float *dst = depths + ((block.type == TYPE_FLAME) ? 0 : pools[TYPE_FLAME].count);
+				uint32_t i = block.begin;
+#if defined(VKS_SIMD_SSE2)
+				if (settings.simd)
+				{
+					const __m128 px = _mm_set1_ps(plane.x);
+					const __m128 py = _mm_set1_ps(plane.y);
+					const __m128 pz = _mm_set1_ps(plane.z);
+					const __m128 pw = _mm_set1_ps(plane.w);
+					for (; i + 4 <= block.end; i += 4)
+					{
+						__m128 d = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&posX[i]), px), pw);
+						d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(&posY[i]), py));
+						d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(&posZ[i]), pz));
+						_mm_storeu_ps(&dst[i], d);
+					}
+				}
+#elif defined(VKS_SIMD_NEON)
+				if (settings.simd)
+				{
+					const float32x4_t pw = vdupq_n_f32(plane.w);
+					for (; i + 4 <= block.end; i += 4)
+					{
+						float32x4_t d = vmlaq_n_f32(pw, vld1q_f32(&posX[i]), plane.x);
+						d = vmlaq_n_f32(d, vld1q_f32(&posY[i]), plane.y);
+						d = vmlaq_n_f32(d, vld1q_f32(&posZ[i]), plane.z);
+						vst1q_f32(&dst[i], d);
+					}
+				}
+#endif
+				for (; i < block.end; i++)
+				{
+					dst[i] = posX[i] * plane.x + posY[i] * plane.y + posZ[i] * plane.z + plane.w;
+				}
+			});
+		}
+
+	private:
+		/** @brief Number of particles per block, large enough to amortize the job overhead */
+		static const uint32_t blockSize = 4096;
+
+		struct Pool {
+			enum Attribute { POS_X, POS_Y, POS_Z, VEL_X, VEL_Y, VEL_Z, ALPHA, SIZE, ROTATION, ROTATION_SPEED, COLOR, ATTRIBUTE_COUNT };
+			std::array<std::vector<float>, ATTRIBUTE_COUNT> attributes;
+			uint32_t count = 0;
+
+			float *operator[](Attribute attribute) { return attributes[attribute].data(); }
+			const float *operator[](Attribute attribute) const { return attributes[attribute].data(); }
+
+			/** @brief Remove a particle by moving the last one into its place */
+			void remove(uint32_t index)
+			{
+				assert(index < count);
+				count--;
+				for (auto &attribute : attributes)
+				{
+					attribute[index] = attribute[count];
+				}
+			}
+		};
+
+		/** @brief Range of particles of a single pool that is processed by one job */
+		struct Block {
+			Type type;
+			uint32_t begin;
+			uint32_t end;
+		};
+
+		uint32_t count;
+		JobSystem *jobSystem;
+		std::mt19937 rndGen;
+		std::array<Pool, TYPE_COUNT> pools;
+		std::vector<Block> blocks;
+		// Indices of the particles that expired in the current update, one list per block
+		std::vector<std::vector<uint32_t>> expired;
+
+		float rnd(float range)
+		{
+			return range * std::uniform_real_distribution<float>(0.0f, 1.0f)(rndGen);
+		}
+
+		/** @brief Split the pools into blocks, as pool sizes change with every update */
+		void updateBlocks()
+		{
+			blocks.clear();
+			for (uint32_t type = 0; type < TYPE_COUNT; type++)
+			{
+				for (uint32_t begin = 0; begin < pools[type].count; begin += blockSize)
+				{
+					blocks.push_back({ static_cast<Type>(type), begin, std::min(begin + blockSize, pools[type].count) });
+				}
+			}
+			if (expired.size() < blocks.size())
+			{
+				expired.resize(blocks.size());
+			}
+		}
+
+		template<typename F>
+		void forEachBlock(const F &function)
+		{
+			const uint32_t blockCount = static_cast<uint32_t>(blocks.size());
+			auto processBlocks = [&](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = begin; i < end; i++)
+				{
+					function(blocks[i], expired[i]);
+				}
+			};
+			if (jobSystem && blockCount > 1)
+			{
+				jobSystem->parallelFor(blockCount, processBlocks);
+			}
+			else
+			{
+				processBlocks(0, blockCount);
+			}
+		}
+
+		/** @brief Append the indices of the lanes set in a 4 bit mask */
+		static void appendExpired(std::vector<uint32_t> &expired, uint32_t index, uint32_t mask)
+		{
+			while (mask)
+			{
+				const uint32_t lane = (mask & 1) ? 0 : (mask & 2) ? 1 : (mask & 4) ? 2 : 3;
+				expired.push_back(index + lane);
+				mask &= mask - 1;
+			}
+		}
+
+		void integrateFlames(uint32_t begin, uint32_t end, float particleTimer, std::vector<uint32_t> &expired)
+		{
+			Pool &pool = pools[TYPE_FLAME];
+			float *posY = pool[Pool::POS_Y];
+			float *alpha = pool[Pool::ALPHA];
+			float *size = pool[Pool::SIZE];
+			float *rotation = pool[Pool::ROTATION];
+			const float *velY = pool[Pool::VEL_Y];
+			const float *rotationSpeed = pool[Pool::ROTATION_SPEED];
+
+			const float posStep = particleTimer * 3.5f;
+			const float alphaStep = particleTimer * 2.5f;
+			const float sizeStep = particleTimer * 0.5f;
+
+			uint32_t i = begin;
+#if defined(VKS_SIMD_SSE2)
+			if (settings.simd)
+			{
+				const __m128 vPosStep = _mm_set1_ps(posStep);
+				const __m128 vAlphaStep = _mm_set1_ps(alphaStep);
+				const __m128 vSizeStep = _mm_set1_ps(sizeStep);
+				const __m128 vRotationStep = _mm_set1_ps(particleTimer);
+				const __m128 vMaxAlpha = _mm_set1_ps(2.0f);
+				for (; i + 4 <= end; i += 4)
+				{
+					_mm_storeu_ps(&posY[i], _mm_sub_ps(_mm_loadu_ps(&posY[i]), _mm_mul_ps(_mm_loadu_ps(&velY[i]), vPosStep)));
+					_mm_storeu_ps(&size[i], _mm_sub_ps(_mm_loadu_ps(&size[i]), vSizeStep));
+					_mm_storeu_ps(&rotation[i], _mm_add_ps(_mm_loadu_ps(&rotation[i]), _mm_mul_ps(_mm_loadu_ps(&rotationSpeed[i]), vRotationStep)));
+					const __m128 a = _mm_add_ps(_mm_loadu_ps(&alpha[i]), vAlphaStep);
+					_mm_storeu_ps(&alpha[i], a);
+					appendExpired(expired, i, static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpgt_ps(a, vMaxAlpha))));
+				}
+			}
+#elif defined(VKS_SIMD_NEON)
+			if (settings.simd)
+			{
+				const float32x4_t vPosStep = vdupq_n_f32(posStep);
+				const float32x4_t vAlphaStep = vdupq_n_f32(alphaStep);
+				const float32x4_t vSizeStep = vdupq_n_f32(sizeStep);
+				const float32x4_t vRotationStep = vdupq_n_f32(particleTimer);
+				const float32x4_t vMaxAlpha = vdupq_n_f32(2.0f);
+				for (; i + 4 <= end; i += 4)
+				{
+					vst1q_f32(&posY[i], vmlsq_f32(vld1q_f32(&posY[i]), vld1q_f32(&velY[i]), vPosStep));
+					vst1q_f32(&size[i], vsubq_f32(vld1q_f32(&size[i]), vSizeStep));
+					vst1q_f32(&rotation[i], vmlaq_f32(vld1q_f32(&rotation[i]), vld1q_f32(&rotationSpeed[i]), vRotationStep));
+					const float32x4_t a = vaddq_f32(vld1q_f32(&alpha[i]), vAlphaStep);
+					vst1q_f32(&alpha[i], a);
+					appendExpired(expired, i, neonMask(vcgtq_f32(a, vMaxAlpha)));
+				}
+			}
+#endif
+			for (; i < end; i++)
+			{
+				posY[i] -= velY[i] * posStep;
+				alpha[i] += alphaStep;
+				size[i] -= sizeStep;
+				rotation[i] += particleTimer * rotationSpeed[i];
+				if (alpha[i] > 2.0f)
+				{
+					expired.push_back(i);
+				}
+			}
+		}
+
+		void integrateSmoke(uint32_t begin, uint32_t end, float frameTimer, float particleTimer, std::vector<uint32_t> &expired)
+		{
+			Pool &pool = pools[TYPE_SMOKE];
+			float *posX = pool[Pool::POS_X];
+			float *posY = pool[Pool::POS_Y];
+			float *posZ = pool[Pool::POS_Z];
+			float *alpha = pool[Pool::ALPHA];
+			float *size = pool[Pool::SIZE];
+			float *rotation = pool[Pool::ROTATION];
+			float *color = pool[Pool::COLOR];
+			const float *velX = pool[Pool::VEL_X];
+			const float *velY = pool[Pool::VEL_Y];
+			const float *velZ = pool[Pool::VEL_Z];
+			const float *rotationSpeed = pool[Pool::ROTATION_SPEED];
+
+			const float alphaStep = particleTimer * 1.25f;
+			const float sizeStep = particleTimer * 0.125f;
+			const float colorStep = particleTimer * 0.05f;
+
+			uint32_t i = begin;
+#if defined(VKS_SIMD_SSE2)
+			if (settings.simd)
+			{
+				const __m128 vPosStep = _mm_set1_ps(frameTimer);
+				const __m128 vAlphaStep = _mm_set1_ps(alphaStep);
+				const __m128 vSizeStep = _mm_set1_ps(sizeStep);
+				const __m128 vColorStep = _mm_set1_ps(colorStep);
+				const __m128 vRotationStep = _mm_set1_ps(particleTimer);
+				const __m128 vMaxAlpha = _mm_set1_ps(2.0f);
+				for (; i + 4 <= end; i += 4)
+				{
+					_mm_storeu_ps(&posX[i], _mm_sub_ps(_mm_loadu_ps(&posX[i]), _mm_mul_ps(_mm_loadu_ps(&velX[i]), vPosStep)));
+					_mm_storeu_ps(&posY[i], _mm_sub_ps(_mm_loadu_ps(&posY[i]), _mm_mul_ps(_mm_loadu_ps(&velY[i]), vPosStep)));
+					_mm_storeu_ps(&posZ[i], _mm_sub_ps(_mm_loadu_ps(&posZ[i]), _mm_mul_ps(_mm_loadu_ps(&velZ[i]), vPosStep)));
+					_mm_storeu_ps(&size[i], _mm_add_ps(_mm_loadu_ps(&size[i]), vSizeStep));
+					_mm_storeu_ps(&color[i], _mm_sub_ps(_mm_loadu_ps(&color[i]), vColorStep));
+					_mm_storeu_ps(&rotation[i], _mm_add_ps(_mm_loadu_ps(&rotation[i]), _mm_mul_ps(_mm_loadu_ps(&rotationSpeed[i]), vRotationStep)));
+					const __m128 a = _mm_add_ps(_mm_loadu_ps(&alpha[i]), vAlphaStep);
+					_mm_storeu_ps(&alpha[i], a);
+					appendExpired(expired, i, static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpgt_ps(a, vMaxAlpha))));
+				}
+			}
+#elif defined(VKS_SIMD_NEON)
+			if (settings.simd)
+			{
+				const float32x4_t vPosStep = vdupq_n_f32(frameTimer);
+				const float32x4_t vAlphaStep = vdupq_n_f32(alphaStep);
+				const float32x4_t vSizeStep = vdupq_n_f32(sizeStep);
+				const float32x4_t vColorStep = vdupq_n_f32(colorStep);
+				const float32x4_t vRotationStep = vdupq_n_f32(particleTimer);
+				const float32x4_t vMaxAlpha = vdupq_n_f32(2.0f);
+				for (; i + 4 <= end; i += 4)
+				{
+					vst1q_f32(&posX[i], vmlsq_f32(vld1q_f32(&posX[i]), vld1q_f32(&velX[i]), vPosStep));
+					vst1q_f32(&posY[i], vmlsq_f32(vld1q_f32(&posY[i]), vld1q_f32(&velY[i]), vPosStep));
+					vst1q_f32(&posZ[i], vmlsq_f32(vld1q_f32(&posZ[i]), vld1q_f32(&velZ[i]), vPosStep));
+					vst1q_f32(&size[i], vaddq_f32(vld1q_f32(&size[i]), vSizeStep));
+					vst1q_f32(&color[i], vsubq_f32(vld1q_f32(&color[i]), vColorStep));
+					vst1q_f32(&rotation[i], vmlaq_f32(vld1q_f32(&rotation[i]), vld1q_f32(&rotationSpeed[i]), vRotationStep));
+					const float32x4_t a = vaddq_f32(vld1q_f32(&alpha[i]), vAlphaStep);
+					vst1q_f32(&alpha[i], a);
+					appendExpired(expired, i, neonMask(vcgtq_f32(a, vMaxAlpha)));
+				}
+			}
+#endif
+			for (; i < end; i++)
+			{
+				posX[i] -= velX[i] * frameTimer;
+				posY[i] -= velY[i] * frameTimer;
+				posZ[i] -= velZ[i] * frameTimer;
+				alpha[i] += alphaStep;
+				size[i] += sizeStep;
+				color[i] -= colorStep;
+				rotation[i] += particleTimer * rotationSpeed[i];
+				if (alpha[i] > 2.0f)
+				{
+					expired.push_back(i);
+				}
+			}
+		}
+
+#if defined(VKS_SIMD_NEON)
+		static uint32_t neonMask(uint32x4_t mask)
+		{
+			return (vgetq_lane_u32(mask, 0) & 1) | (vgetq_lane_u32(mask, 1) & 2) | (vgetq_lane_u32(mask, 2) & 4) | (vgetq_lane_u32(mask, 3) & 8);
+		}
+#endif
+
+		/** @brief Spawn a new flame particle at a random point inside of the emitter sphere */
+		void initFlame(Pool &pool, uint32_t index)
+		{
+			const float theta = rnd(2.0f * float(M_PI));
+			const float phi = rnd(float(M_PI)) - float(M_PI) / 2.0f;
+			const float r = rnd(settings.emitterRadius);
+			pool[Pool::POS_X][index] = settings.emitterPos.x + r * cos(theta) * cos(phi);
+			pool[Pool::POS_Y][index] = settings.emitterPos.y + r * sin(phi);
+			pool[Pool::POS_Z][index] = settings.emitterPos.z + r * sin(theta) * cos(phi);
+			pool[Pool::VEL_X][index] = 0.0f;
+			pool[Pool::VEL_Y][index] = settings.minVel.y + rnd(settings.maxVel.y - settings.minVel.y);
+			pool[Pool::VEL_Z][index] = 0.0f;
+			pool[Pool::ALPHA][index] = rnd(0.75f);
+			pool[Pool::SIZE][index] = 1.0f + rnd(0.5f);
+			pool[Pool::ROTATION][index] = rnd(2.0f * float(M_PI));
+			pool[Pool::ROTATION_SPEED][index] = rnd(2.0f) - rnd(2.0f);
+			pool[Pool::COLOR][index] = 1.0f;
+		}
+
+		/** @brief Turn a flame particle into a smoke particle that rises from the flame's position */
+		void initSmoke(Pool &pool, uint32_t index, const Pool &flames, uint32_t flameIndex)
+		{
+			pool[Pool::POS_X][index] = settings.emitterPos.x + (flames[Pool::POS_X][flameIndex] - settings.emitterPos.x) * 0.5f;
+			pool[Pool::POS_Y][index] = flames[Pool::POS_Y][flameIndex];
+			pool[Pool::POS_Z][index] = settings.emitterPos.z + (flames[Pool::POS_Z][flameIndex] - settings.emitterPos.z) * 0.5f;
+			pool[Pool::VEL_X][index] = rnd(1.0f) - rnd(1.0f);
+			pool[Pool::VEL_Y][index] = (settings.minVel.y * 2.0f) + rnd(settings.maxVel.y - settings.minVel.y);
+			pool[Pool::VEL_Z][index] = rnd(1.0f) - rnd(1.0f);
+			pool[Pool::ALPHA][index] = 0.0f;
+			pool[Pool::SIZE][index] = 1.0f + rnd(0.5f);
+			pool[Pool::ROTATION][index] = flames[Pool::ROTATION][flameIndex];
+			pool[Pool::ROTATION_SPEED][index] = rnd(1.0f) - rnd(1.0f);
+			pool[Pool::COLOR][index] = 0.25f + rnd(0.25f);
+		}
+
+		/** @brief Visit the expired particles of one type in descending index order */
+		template<typename F>
+		void forEachExpiredDescending(Type type, const F &function)
+		{
+			for (size_t b = blocks.size(); b-- > 0;)
+			{
+				if (blocks[b].type != type)
+				{
+					continue;
+				}
+				for (size_t i = expired[b].size(); i-- > 0;)
+				{
+					function(expired[b][i]);
+				}
+			}
+		}
+
+		void transition()
+		{
+			Pool &flames = pools[TYPE_FLAME];
+			Pool &smoke = pools[TYPE_SMOKE];
+			// Removing moves the last particle of a pool into the removed slot
+			// Visiting in descending order guarantees that the moved particle has already been visited
+			forEachExpiredDescending(TYPE_FLAME, [&](uint32_t index)
+			{
+				// Flame particles have a chance of turning into smoke
+				if (rnd(1.0f) < settings.smokeChance)
+				{
+					initSmoke(smoke, smoke.count++, flames, index);
+					flames.remove(index);
+				}
+				else
+				{
+					initFlame(flames, index);
+				}
+			});
+			forEachExpiredDescending(TYPE_SMOKE, [&](uint32_t index)
+			{
+				// Smoke particles respawn as flames at the end of their life
+				initFlame(flames, flames.count++);
+				smoke.remove(index);
+			});
+			assert(flames.count + smoke.count == count);
+		}
+	};
+}
@@ -0,0 +1,134 @@
+/*
+* Parallel LSD radix sort
+*
+* Stable least significant digit first radix sort with 8 bit digits for arbitrary elements with an unsigned integer key
+* Large arrays are split into one chunk per thread, each chunk builds its own histogram and scatters its own elements
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+#include "jobsystem.hpp"
+
+namespace vks
+{
+	class RadixSort
+	{
+	public:
+		/** @brief Arrays with fewer elements are sorted on the calling thread */
+		uint32_t parallelThreshold = 16384;
+
+		/**
+		* Sort elements by their keys in ascending order
+		* Digits that are the same for all keys are skipped, so keys that only use a few bits sort in a few passes
+		*
+		* @param data Elements to sort, receives the sorted elements
+		* @param scratch Temporary storage for at least count elements
+		* @param count Number of elements
+		* @param getKey Function object returning the (up to 64 bit) unsigned key of an element
+		* @param keyBits Number of key bits to sort by (starting at the least significant bit)
+		* @param jobSystem (Optional) Job system used to build the histograms and scatter the elements in parallel
+		*
+		* @note Elements are moved with memcpy, so they need to be trivially copyable
+		*/
+		template<typename T, typename K>
+		void sort(T *data, T *scratch, uint32_t count, const K &getKey, uint32_t keyBits = 64, vks::JobSystem *jobSystem = nullptr)
+		{
+			assert(keyBits > 0 && keyBits <= 64);
+			if (count < 2)
+			{
+				return;
+			}
+
+			const uint32_t chunkCount = (jobSystem && count >= parallelThreshold) ? std::max(jobSystem->getThreadCount(), 1u) : 1;
+			const uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+			// Find the digits that differ between the keys, all others are skipped
+			const uint64_t firstKey = getKey(data[0]);
+			uint64_t differingBits = 0;
+			for (uint32_t i = 1; i < count; i++)
+			{
+				differingBits |= getKey(data[i]) ^ firstKey;
+			}
+
+			T *source = data;
+			T *destination = scratch;
+			// One histogram per chunk, turned into the chunk's scatter offsets
+			histograms.resize(chunkCount * 256);
+			const uint32_t digitCount = (keyBits + 7) / 8;
+			for (uint32_t digit = 0; digit < digitCount; digit++)
+			{
+				const uint32_t shift = digit * 8;
+				if (((differingBits >> shift) & 0xFF) == 0)
+				{
+					continue;
+				}
+
+				forEachChunk(jobSystem, chunkCount, [&](uint32_t chunk) {
+					uint32_t *histogram = &histograms[chunk * 256];
+					memset(histogram, 0, 256 * sizeof(uint32_t));
+					const uint32_t end = std::min((chunk + 1) * chunkSize, count);
+					for (uint32_t i = chunk * chunkSize; i < end; i++)
+					{
+						histogram[(getKey(source[i]) >> shift) & 0xFF]++;
+					}
+				});
+
+				// Exclusive prefix sum over buckets first and chunks second keeps the sort stable
+				uint32_t offset = 0;
+				for (uint32_t bucket = 0; bucket < 256; bucket++)
+				{
+					for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+					{
+						const uint32_t bucketCount = histograms[chunk * 256 + bucket];
+						histograms[chunk * 256 + bucket] = offset;
+						offset += bucketCount;
+					}
+				}
+
+				forEachChunk(jobSystem, chunkCount, [&](uint32_t chunk) {
+					uint32_t *offsets = &histograms[chunk * 256];
+					const uint32_t end = std::min((chunk + 1) * chunkSize, count);
+					for (uint32_t i = chunk * chunkSize; i < end; i++)
+					{
+						destination[offsets[(getKey(source[i]) >> shift) & 0xFF]++] = source[i];
+					}
+				});
+				std::swap(source, destination);
+			}
+
+			if (source != data)
+			{
+				memcpy(data, source, count * sizeof(T));
+			}
+		}
+
+	private:
+		std::vector<uint32_t> histograms;
+
+		template<typename F>
+		static void forEachChunk(vks::JobSystem *jobSystem, uint32_t chunkCount, const F &function)
+		{
+			if (chunkCount == 1)
+			{
+				function(0);
+				return;
+			}
+			jobSystem->parallelFor(chunkCount, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t chunk = begin; chunk < end; chunk++)
+				{
+					function(chunk);
+				}
+			});
+		}
+	};
+}
@@ -0,0 +1,71 @@
+/*
+* SIMD instruction set detection
+*
+* Maps compiler specific target macros to a common set of defines and pulls in the matching intrinsic headers
+* Code using these should always provide a scalar fallback for targets where none of them are defined
+* Also provides portable wrappers for bit scan intrinsics used when walking SIMD result masks
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// x86 / x64
+#if defined(__AVX2__)
+#define VKS_SIMD_AVX2
+#endif
+#if defined(__AVX__)
+#define VKS_SIMD_AVX
+#endif
+// MSVC does not define separate macros for F16C and FMA, both are implied by /arch:AVX2
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define VKS_SIMD_F16C
+#endif
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define VKS_SIMD_FMA
+#endif
+#if defined(__SSE4_1__) || defined(VKS_SIMD_AVX)
+#define VKS_SIMD_SSE41
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define VKS_SIMD_SSE2
+#endif
+
+// ARM
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VKS_SIMD_NEON
+#endif
+
+#if defined(VKS_SIMD_AVX) || defined(VKS_SIMD_F16C) || defined(VKS_SIMD_FMA)
+#include <immintrin.h>
+#elif defined(VKS_SIMD_SSE41)
+#include <smmintrin.h>
+#elif defined(VKS_SIMD_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(VKS_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace vks
+{
+	/** @brief Returns the index of the lowest set bit, v must not be zero */
+	inline uint32_t countTrailingZeros(uint32_t v)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, v);
+		return static_cast<uint32_t>(index);
+#else
+		return static_cast<uint32_t>(__builtin_ctz(v));
+#endif
+	}
+}
@@ -0,0 +1,275 @@
+/*
+* Frame task graph
+*
+* Describes the CPU work of a frame as tasks that declare which (named) resources they read and write
+* Dependencies are derived from the order the tasks are added in (read after write, write after read and write after write),
+* independent tasks are executed concurrently on the job system
+* Every execution is timed, the report contains the frame's critical path (the chain of dependent tasks that took the longest)
+*
+* Copyright (C) 2017 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+#include "jobsystem.hpp"
+
+namespace vks
+{
+	class TaskGraph
+	{
+	public:
+		struct TaskTiming {
+			// Start and end relative to the start of the graph's execution (in ms)
+			double start;
+			double end;
+			uint32_t threadIndex;
+		};
+
+		struct Report {
+			// Wall clock time of the whole graph (in ms)
+			double frameTime = 0.0;
+			// Summed duration of the tasks on the critical path (in ms)
+			double criticalPathTime = 0.0;
+			// Task indices of the critical path, in execution order
+			std::vector<uint32_t> criticalPath;
+			// Timings for all tasks, indexed like the tasks
+			std::vector<TaskTiming> tasks;
+		};
+
+		/**
+		* Add a task, tasks that access the same resources are executed in the order they were added in
+		*
+		* @param name Name of the task (used in the report)
+		* @param function Function executed by the task
+		* @param reads Names of the resources the task reads
+		* @param writes Names of the resources the task writes
+		*
+		* @return Index of the task
+		*/
+		uint32_t addTask(const std::string &name, std::function<void()> function, const std::vector<std::string> &reads, const std::vector<std::string> &writes)
+		{
+			const uint32_t index = static_cast<uint32_t>(tasks.size());
+			tasks.push_back(std::unique_ptr<Task>(new Task()));
+			Task &task = *tasks.back();
+			task.name = name;
+			task.function = function;
+
+			for (auto &resourceName : reads)
+			{
+				Resource &resource = resources[resourceName];
+				// Read after write
+				if (resource.lastWriter >= 0)
+				{
+					addDependency(index, resource.lastWriter);
+				}
+				resource.readers.push_back(index);
+			}
+			for (auto &resourceName : writes)
+			{
+				Resource &resource = resources[resourceName];
+				// Write after write
+				if (resource.lastWriter >= 0)
+				{
+					addDependency(index, resource.lastWriter);
+				}
+				// Write after read
+				for (auto reader : resource.readers)
+				{
+					if (reader != index)
+					{
+						addDependency(index, reader);
+					}
+				}
+				resource.readers.clear();
+				resource.lastWriter = static_cast<int32_t>(index);
+			}
+			return index;
+		}
+
+		/** @brief Add an explicit dependency between two tasks that don't share a resource, dependency must have been added before task */
+		void addDependency(uint32_t task, uint32_t dependency)
+		{
+			assert(dependency < task);
+			auto &dependencies = tasks[task]->dependencies;
+			if (std::find(dependencies.begin(), dependencies.end(), dependency) == dependencies.end())
+			{
+				dependencies.push_back(dependency);
+				tasks[dependency]->successors.push_back(task);
+			}
+		}
+
+		/** @brief Remove all tasks and resources */
+		void clear()
+		{
+			tasks.clear();
+			resources.clear();
+			report = Report();
+		}
+
+		/**
+		* Execute all tasks, returns when all of them have finished
+		* Tasks without dependencies start right away, every finished task starts the successors whose dependencies are complete
+		*
+		* @param jobSystem Job system the tasks are executed on, the calling thread helps out while waiting
+		*/
+		void execute(vks::JobSystem &jobSystem)
+		{
+			this->jobSystem = &jobSystem;
+			for (auto &task : tasks)
+			{
+				task->remainingDependencies.store(static_cast<uint32_t>(task->dependencies.size()), std::memory_order_relaxed);
+			}
+
+			vks::JobCounter counter;
+			this->counter = &counter;
+			startTime = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < tasks.size(); i++)
+			{
+				if (tasks[i]->dependencies.empty())
+				{
+					jobSystem.addJob([this, i] { runTask(i); }, &counter);
+				}
+			}
+			jobSystem.wait(counter);
+			const double frameTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+			updateReport(frameTime);
+			this->counter = nullptr;
+		}
+
+		/** @brief Returns the timings and the critical path of the last execution */
+		const Report &getReport() const
+		{
+			return report;
+		}
+
+		const std::string &getTaskName(uint32_t index) const
+		{
+			return tasks[index]->name;
+		}
+
+		uint32_t getTaskCount() const
+		{
+			return static_cast<uint32_t>(tasks.size());
+		}
+
+		/** @brief Returns the critical path of the last execution as text, e.g. "cull 0.10 > record 0.52 = 0.62 ms of 0.70 ms" */
+		std::string getCriticalPathString() const
+		{
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2);
+			for (size_t i = 0; i < report.criticalPath.size(); i++)
+			{
+				const uint32_t index = report.criticalPath[i];
+				ss << (i > 0 ? " > " : "") << tasks[index]->name << " " << report.tasks[index].end - report.tasks[index].start;
+			}
+			ss << " = " << report.criticalPathTime << " ms of " << report.frameTime << " ms";
+			return ss.str();
+		}
+
+	private:
+		struct Task {
+			std::string name;
+			std::function<void()> function;
+			std::vector<uint32_t> dependencies;
+			std::vector<uint32_t> successors;
+			std::atomic<uint32_t> remainingDependencies{ 0 };
+			std::chrono::high_resolution_clock::time_point start;
+			std::chrono::high_resolution_clock::time_point end;
+			uint32_t threadIndex = 0;
+		};
+		std::vector<std::unique_ptr<Task>> tasks;
+
+		struct Resource {
+			int32_t lastWriter = -1;
+			// Tasks that read the resource since it was last written
+			std::vector<uint32_t> readers;
+		};
+		std::map<std::string, Resource> resources;
+
+		vks::JobSystem *jobSystem = nullptr;
+		vks::JobCounter *counter = nullptr;
+		std::chrono::high_resolution_clock::time_point startTime;
+		Report report;
+
+		void runTask(uint32_t index)
+		{
+			Task &task = *tasks[index];
+			task.threadIndex = jobSystem->getThreadIndex();
+			task.start = std::chrono::high_resolution_clock::now();
+			task.function();
+			task.end = std::chrono::high_resolution_clock::now();
+
+			for (auto successor : task.successors)
+			{
+				// The counter is incremented for the successor before this job decrements it, so execute() can't return early
+				if (tasks[successor]->remainingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				{
+					jobSystem->addJob([this, successor] { runTask(successor); }, counter);
+				}
+			}
+		}
+
+		void updateReport(double frameTime)
+		{
+			const uint32_t count = static_cast<uint32_t>(tasks.size());
+			report.frameTime = frameTime;
+			report.tasks.resize(count);
+			report.criticalPath.clear();
+			report.criticalPathTime = 0.0;
+
+			// Tasks are stored in a valid topological order (dependencies are always added before their dependents)
+			std::vector<double> pathTime(count);
+			std::vector<int32_t> pathPredecessor(count, -1);
+			int32_t last = -1;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const Task &task = *tasks[i];
+				TaskTiming &timing = report.tasks[i];
+				timing.start = std::chrono::duration<double, std::milli>(task.start - startTime).count();
+				timing.end = std::chrono::duration<double, std::milli>(task.end - startTime).count();
+				timing.threadIndex = task.threadIndex;
+
+				double longestDependency = 0.0;
+				for (auto dependency : task.dependencies)
+				{
+					if (pathTime[dependency] > longestDependency || pathPredecessor[i] < 0)
+					{
+						longestDependency = pathTime[dependency];
+						pathPredecessor[i] = static_cast<int32_t>(dependency);
+					}
+				}
+				pathTime[i] = longestDependency + (timing.end - timing.start);
+				if (last < 0 || pathTime[i] > pathTime[last])
+				{
+					last = static_cast<int32_t>(i);
+				}
+			}
+
+			if (last >= 0)
+			{
+				report.criticalPathTime = pathTime[last];
+				for (int32_t i = last; i >= 0; i = pathPredecessor[i])
+				{
+					report.criticalPath.push_back(static_cast<uint32_t>(i));
+				}
+				std::reverse(report.criticalPath.begin(), report.criticalPath.end());
+			}
+		}
+	};
+}
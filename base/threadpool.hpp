@@ -1,15 +1,19 @@
 /*
-* Basic C++11 based thread pool with per-thread job queues
+* Basic C++11 based worker thread with a job queue
 *
 * Copyright (C) 2016 by Sascha Willems - www.saschawillems.de
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
+#pragma once
+
 #include <vector>
 #include <thread>
 #include <queue>
 #include <mutex>
+#include <memory>
+#include <functional>
 #include <condition_variable>
 
 // make_unique is not available in C++11
@@ -91,30 +95,5 @@ namespace vks
 			condition.wait(lock, [this]() { return jobQueue.empty(); });
 		}
 	};
-	
-	class ThreadPool
-	{
-	public:
-		std::vector<std::unique_ptr<Thread>> threads;
-
-		// Sets the number of threads to be allocted in this pool
-		void setThreadCount(uint32_t count)
-		{
-			threads.clear();
-			for (uint32_t i = 0; i < count; ++i)
-			{
-				threads.push_back(make_unique<Thread>());
-			}
-		}
-
-		// Wait until all threads have finished their work items
-		void wait()
-		{
-			for (auto &thread : threads)
-			{
-				thread->wait();
-			}
-		}
-	};
 
 }
\ No newline at end of file
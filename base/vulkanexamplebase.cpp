@@ -7,6 +7,7 @@
 */
 
 #include "vulkanexamplebase.h"
+#include "imagecompare.hpp"
 
 std::vector<const char*> VulkanExampleBase::args;
 
@@ -20,20 +21,28 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	appInfo.pEngineName = name.c_str();
 	appInfo.apiVersion = VK_API_VERSION_1_0;
 
-	std::vector<const char*> instanceExtensions = { VK_KHR_SURFACE_EXTENSION_NAME };
+	std::vector<const char*> instanceExtensions;
 
-	// Enable surface extensions depending on os
+	// Enable surface extensions depending on os (not required when rendering headless)
+	if (!settings.headless)
+	{
+		instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #if defined(_WIN32)
-	instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #elif defined(__ANDROID__)
-	instanceExtensions.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
 #elif defined(_DIRECT2DISPLAY)
-	instanceExtensions.push_back(VK_KHR_DISPLAY_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_DISPLAY_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	instanceExtensions.push_back(VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME);
 #elif defined(__linux__)
-	instanceExtensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
 #endif
+	}
+	if (settings.validation)
+	{
+		instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+	}
 
 	VkInstanceCreateInfo instanceCreateInfo = {};
 	instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -41,10 +50,6 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	instanceCreateInfo.pApplicationInfo = &appInfo;
 	if (instanceExtensions.size() > 0)
 	{
-		if (settings.validation)
-		{
-			instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-		}
 		instanceCreateInfo.enabledExtensionCount = (uint32_t)instanceExtensions.size();
 		instanceCreateInfo.ppEnabledExtensionNames = instanceExtensions.data();
 	}
@@ -190,8 +195,18 @@ void VulkanExampleBase::prepare()
 			&height,
 			shaderStages
 			);
+		// Frame times shown by the overlay would make captured frames differ between runs
+		if (regression.frame > 0)
+		{
+			textOverlay->visible = false;
+		}
 		updateTextOverlay();
 	}
+
+	if (regression.frame > 0)
+	{
+		setupRegressionCapture();
+	}
 }
 
 VkPipelineShaderStageCreateInfo VulkanExampleBase::loadShader(std::string fileName, VkShaderStageFlagBits stage)
@@ -214,6 +229,13 @@ void VulkanExampleBase::renderLoop()
 {
 	destWidth = width;
 	destHeight = height;
+#if !defined(__ANDROID__)
+	if (settings.headless)
+	{
+		renderLoopHeadless();
+		return;
+	}
+#endif
 #if defined(_WIN32)
 	MSG msg;
 	while (TRUE)
@@ -240,7 +262,8 @@ void VulkanExampleBase::renderLoop()
 		frameCounter++;
 		auto tEnd = std::chrono::high_resolution_clock::now();
 		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-		frameTimer = (float)tDiff / 1000.0f;
+		// Fixed time step for golden image captures, so animations are at the same state for the captured frame in every run
+		frameTimer = (regression.frame > 0) ? regression.timeStep : (float)tDiff / 1000.0f;
 		camera.update(frameTimer);
 		if (camera.moving())
 		{
@@ -308,7 +331,7 @@ void VulkanExampleBase::renderLoop()
 			frameCounter++;
 			auto tEnd = std::chrono::high_resolution_clock::now();
 			auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-			frameTimer = tDiff / 1000.0f;
+			frameTimer = (regression.frame > 0) ? regression.timeStep : tDiff / 1000.0f;
 			camera.update(frameTimer);
 			// Convert to clamped timer value
 			if (!paused)
@@ -392,7 +415,7 @@ void VulkanExampleBase::renderLoop()
 		frameCounter++;
 		auto tEnd = std::chrono::high_resolution_clock::now();
 		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-		frameTimer = tDiff / 1000.0f;
+		frameTimer = (regression.frame > 0) ? regression.timeStep : tDiff / 1000.0f;
 		camera.update(frameTimer);
 		if (camera.moving())
 		{
@@ -436,7 +459,7 @@ void VulkanExampleBase::renderLoop()
 		frameCounter++;
 		auto tEnd = std::chrono::high_resolution_clock::now();
 		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-		frameTimer = tDiff / 1000.0f;
+		frameTimer = (regression.frame > 0) ? regression.timeStep : tDiff / 1000.0f;
 		camera.update(frameTimer);
 		if (camera.moving())
 		{
@@ -485,7 +508,7 @@ void VulkanExampleBase::renderLoop()
 		frameCounter++;
 		auto tEnd = std::chrono::high_resolution_clock::now();
 		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-		frameTimer = tDiff / 1000.0f;
+		frameTimer = (regression.frame > 0) ? regression.timeStep : tDiff / 1000.0f;
 		camera.update(frameTimer);
 		if (camera.moving())
 		{
@@ -532,6 +555,8 @@ void VulkanExampleBase::updateTextOverlay()
 
 	std::stringstream ss;
 	ss << std::fixed << std::setprecision(3) << (frameTimer * 1000.0f) << "ms (" << lastFPS << " fps)";
+	// CPU cost of the previous overlay update and the number of chars it uploaded, only texts that changed are uploaded again
+	ss << ", overlay " << textOverlay->statistics.updateTime << " ms (" << textOverlay->statistics.uploadedChars << "/" << textOverlay->statistics.charCount << " chars)";
 	textOverlay->addText(ss.str(), 5.0f, 25.0f, VulkanTextOverlay::alignLeft);
 
 	std::string deviceName(deviceProperties.deviceName);
@@ -543,6 +568,12 @@ void VulkanExampleBase::updateTextOverlay()
 	getOverlayText(textOverlay);
 
 	textOverlay->endTextUpdate();
+
+	// Growing the overlay buffers invalidates draws recorded into the example's command buffers
+	if (textOverlayInMainPass && textOverlay->drawCommandsInvalid && prepared)
+	{
+		buildCommandBuffers();
+	}
 }
 
 void VulkanExampleBase::getOverlayText(VulkanTextOverlay *textOverlay)
@@ -550,15 +581,67 @@ void VulkanExampleBase::getOverlayText(VulkanTextOverlay *textOverlay)
 	// Can be overriden in derived class
 }
 
+#if !defined(__ANDROID__)
+void VulkanExampleBase::renderLoopHeadless()
+{
+	// There are no window system events, frames are rendered with the fixed time step until the regression capture has finished
+	while (true)
+	{
+#if defined(_WIN32)
+		// finishRegressionCapture posts the quit message to the thread's queue, which doesn't need a window
+		MSG msg;
+		if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE) && (msg.message == WM_QUIT))
+		{
+			break;
+		}
+#else
+		if (quit)
+		{
+			break;
+		}
+#endif
+		if (viewUpdated)
+		{
+			viewUpdated = false;
+			viewChanged();
+		}
+		render();
+		frameTimer = regression.timeStep;
+		camera.update(frameTimer);
+		if (camera.moving())
+		{
+			viewUpdated = true;
+		}
+		if (!paused)
+		{
+			timer += timerSpeed * frameTimer;
+			if (timer > 1.0)
+			{
+				timer -= 1.0f;
+			}
+		}
+	}
+	// Flush device to make sure all resources can be freed 
+	vkDeviceWaitIdle(device);
+}
+#endif
+
 void VulkanExampleBase::prepareFrame()
 {
 	// Acquire the next image from the swap chaing
 	VK_CHECK_RESULT(swapChain.acquireNextImage(semaphores.presentComplete, &currentBuffer));
+	if (enableTextOverlay)
+	{
+		// Visibility is part of the overlay's draw parameters, so recorded draws don't need to change when toggling it
+		textOverlay->updateDrawCommand();
+	}
 }
 
 void VulkanExampleBase::submitFrame()
 {
-	bool submitTextOverlay = enableTextOverlay && textOverlay->visible;
+	bool submitTextOverlay = enableTextOverlay && textOverlay->visible && !textOverlayInMainPass;
+
+	auto tStart = std::chrono::high_resolution_clock::now();
 
 	if (submitTextOverlay)
 	{
@@ -590,9 +673,169 @@ void VulkanExampleBase::submitFrame()
 		submitInfo.pSignalSemaphores = &semaphores.renderComplete;
 	}
 
-	VK_CHECK_RESULT(swapChain.queuePresent(queue, currentBuffer, submitTextOverlay ? semaphores.textOverlayComplete : semaphores.renderComplete));
+	VkSemaphore waitSemaphore = submitTextOverlay ? semaphores.textOverlayComplete : semaphores.renderComplete;
+	if (regressionCapture)
+	{
+		waitSemaphore = submitRegressionCapture(waitSemaphore);
+	}
+
+	VK_CHECK_RESULT(swapChain.queuePresent(queue, currentBuffer, waitSemaphore));
+
+	if (enableTextOverlay)
+	{
+		textOverlay->statistics.submitTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+	}
 
 	VK_CHECK_RESULT(vkQueueWaitIdle(queue));
+
+	if (enableTextOverlay && textOverlay->visible)
+	{
+		textOverlay->resolveTimestamps(currentBuffer);
+	}
+
+	if (regressionCapture && (regressionFrameIndex == regression.frame))
+	{
+		finishRegressionCapture();
+	}
+}
+
+void VulkanExampleBase::setupRegressionCapture()
+{
+	delete regressionCapture;
+	regressionCapture = nullptr;
+
+	// Swap chain images can only be copied from if they have been created with the transfer source usage flag
+	// Note: Must match the condition used in VulkanSwapChain::create
+	VkFormatProperties formatProps;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, swapChain.colorFormat, &formatProps);
+	if (!vks::FrameCapture::isFormatSupported(swapChain.colorFormat) || !(formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT))
+	{
+		std::cerr << "Golden image capture is not supported for the swap chain format " << swapChain.colorFormat << std::endl;
+		regression.frame = 0;
+		exitCode = 1;
+#if defined(_WIN32)
+		PostQuitMessage(0);
+#elif !defined(__ANDROID__)
+		quit = true;
+#endif
+		return;
+	}
+
+	regressionCapture = new vks::FrameCapture(vulkanDevice, swapChain.colorFormat, width, height, 1);
+	if (regressionCaptureComplete == VK_NULL_HANDLE)
+	{
+		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &regressionCaptureComplete));
+	}
+}
+
+VkSemaphore VulkanExampleBase::submitRegressionCapture(VkSemaphore waitSemaphore)
+{
+	// Frame times are measured from the start of one frame's submission to the next, the first frame also contains the startup
+	auto tNow = std::chrono::high_resolution_clock::now();
+	if (regressionFrameIndex > 0)
+	{
+		regressionFrameTimes.push_back(std::chrono::duration<double, std::milli>(tNow - regressionFrameStart).count());
+	}
+	regressionFrameStart = tNow;
+
+	regressionFrameIndex++;
+	if (regressionFrameIndex != regression.frame)
+	{
+		return waitSemaphore;
+	}
+
+	VkCommandBuffer commandBuffer;
+	VkFence fence;
+	if (!regressionCapture->record(swapChain.images[currentBuffer], regression.filename, vks::FrameCapture::FILE_FORMAT_PPM, &commandBuffer, &fence))
+	{
+		return waitSemaphore;
+	}
+
+	// The copy runs after the frame has been rendered and presentation waits for it
+	// The semaphore wait must cover the source stage of the first barrier recorded by FrameCapture::record (color attachment output),
+	// waiting at the transfer stage only would leave that barrier's layout transition unsynchronized with the render submission
+	VkPipelineStageFlags stageFlags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	VkSubmitInfo captureSubmitInfo = vks::initializers::submitInfo();
+	captureSubmitInfo.pWaitDstStageMask = &stageFlags;
+	captureSubmitInfo.waitSemaphoreCount = 1;
+	captureSubmitInfo.pWaitSemaphores = &waitSemaphore;
+	captureSubmitInfo.commandBufferCount = 1;
+	captureSubmitInfo.pCommandBuffers = &commandBuffer;
+	captureSubmitInfo.signalSemaphoreCount = 1;
+	captureSubmitInfo.pSignalSemaphores = &regressionCaptureComplete;
+	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &captureSubmitInfo, fence));
+
+	return regressionCaptureComplete;
+}
+
+void VulkanExampleBase::finishRegressionCapture()
+{
+	// Waits for the file to be written
+	regressionCapture->flush();
+	delete regressionCapture;
+	regressionCapture = nullptr;
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Captured frame " << regression.frame << " to " << regression.filename << std::endl;
+	// Goldens are only comparable between captures on the same driver, the runner records this line along with them
+	std::cout << "Capture device: " << deviceProperties.deviceName << " (driver version " << deviceProperties.driverVersion << ", API " << (deviceProperties.apiVersion >> 22) << "." << ((deviceProperties.apiVersion >> 12) & 0x3ff) << "." << (deviceProperties.apiVersion & 0xfff) << ")" << std::endl;
+	if (!regressionFrameTimes.empty())
+	{
+		std::vector<double> frameTimes = regressionFrameTimes;
+		std::sort(frameTimes.begin(), frameTimes.end());
+		double sum = 0.0;
+		for (auto frameTime : frameTimes)
+		{
+			sum += frameTime;
+		}
+		std::cout << "Frame time (ms): avg " << sum / (double)frameTimes.size() << ", median " << frameTimes[frameTimes.size() / 2] << ", min " << frameTimes.front() << ", max " << frameTimes.back() << " (" << frameTimes.size() << " frames)" << std::endl;
+	}
+
+	if (!regression.golden.empty())
+	{
+		vks::imagecompare::Image captured, golden;
+		if (!vks::imagecompare::loadPPM(regression.filename, captured))
+		{
+			std::cerr << "Could not load captured image " << regression.filename << std::endl;
+			exitCode = 1;
+		}
+		else if (!vks::imagecompare::loadPPM(regression.golden, golden))
+		{
+			std::cerr << "Could not load golden image " << regression.golden << std::endl;
+			exitCode = 1;
+		}
+		else
+		{
+			vks::imagecompare::Image diff;
+			const vks::imagecompare::Result result = vks::imagecompare::compare(captured, golden, regression.threshold, regression.maxDifferentPixels, &diff);
+			if (result.sizeMismatch)
+			{
+				std::cout << "Golden image comparison FAILED: size " << captured.width << "x" << captured.height << " doesn't match golden image size " << golden.width << "x" << golden.height << std::endl;
+			}
+			else
+			{
+				std::cout << "Golden image comparison " << (result.passed ? "passed" : "FAILED") << ": " << result.differentPixels << " different pixels, max difference " << result.maxDifference << ", mean difference " << result.meanDifference << std::endl;
+			}
+			if (!result.passed)
+			{
+				if (!result.sizeMismatch)
+				{
+					const std::string diffFilename = regression.filename + ".diff.ppm";
+					vks::imagecompare::savePPM(diffFilename, diff);
+					std::cout << "Differences written to " << diffFilename << std::endl;
+				}
+				exitCode = 1;
+			}
+		}
+	}
+
+	// Exit the render loop
+#if defined(_WIN32)
+	PostQuitMessage(0);
+#elif !defined(__ANDROID__)
+	quit = true;
+#endif
 }
 
 VulkanExampleBase::VulkanExampleBase(bool enableValidation)
@@ -641,6 +884,46 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 			uint32_t h = strtol(args[i + 1], &endptr, 10);
 			if (endptr != args[i + 1]) { height = h; };
 		}
+		// Golden image regression capture
+		if (i + 1 < args.size())
+		{
+			if (args[i] == std::string("-capture"))
+			{
+				regression.frame = strtol(args[i + 1], nullptr, 10);
+			}
+			if (args[i] == std::string("-capturefile"))
+			{
+				regression.filename = args[i + 1];
+			}
+			if (args[i] == std::string("-golden"))
+			{
+				regression.golden = args[i + 1];
+			}
+			if (args[i] == std::string("-threshold"))
+			{
+				regression.threshold = strtof(args[i + 1], nullptr);
+			}
+			if (args[i] == std::string("-maxdiff"))
+			{
+				regression.maxDifferentPixels = strtof(args[i + 1], nullptr);
+			}
+			if (args[i] == std::string("-timestep"))
+			{
+				regression.timeStep = strtof(args[i + 1], nullptr);
+			}
+		}
+#if !defined(__ANDROID__)
+		if (args[i] == std::string("-headless"))
+		{
+			settings.headless = true;
+		}
+#endif
+	}
+
+	// Without a window there is nothing to look at, so headless rendering only makes sense for capturing a frame
+	if (settings.headless && (regression.frame == 0))
+	{
+		vks::tools::exitFatal("Headless rendering (-headless) requires a frame to capture (-capture)", "Fatal error");
 	}
 	
 #if defined(__ANDROID__)
@@ -650,9 +933,15 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 #elif defined(_DIRECT2DISPLAY)
 
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	initWaylandConnection();
+	if (!settings.headless)
+	{
+		initWaylandConnection();
+	}
 #elif defined(__linux__)
-	initxcbConnection();
+	if (!settings.headless)
+	{
+		initxcbConnection();
+	}
 #endif
 
 #if defined(_WIN32)
@@ -692,10 +981,19 @@ VulkanExampleBase::~VulkanExampleBase()
 
 	vkDestroyCommandPool(device, cmdPool, nullptr);
 
+	delete parallelRecorder;
+	delete jobSystem;
+
 	vkDestroySemaphore(device, semaphores.presentComplete, nullptr);
 	vkDestroySemaphore(device, semaphores.renderComplete, nullptr);
 	vkDestroySemaphore(device, semaphores.textOverlayComplete, nullptr);
 
+	delete regressionCapture;
+	if (regressionCaptureComplete != VK_NULL_HANDLE)
+	{
+		vkDestroySemaphore(device, regressionCaptureComplete, nullptr);
+	}
+
 	if (enableTextOverlay)
 	{
 		delete textOverlay;
@@ -713,23 +1011,29 @@ VulkanExampleBase::~VulkanExampleBase()
 #if defined(_DIRECT2DISPLAY)
 
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	wl_shell_surface_destroy(shell_surface);
-	wl_surface_destroy(surface);
-	if (keyboard)
-		wl_keyboard_destroy(keyboard);
-	if (pointer)
-		wl_pointer_destroy(pointer);
-	wl_seat_destroy(seat);
-	wl_shell_destroy(shell);
-	wl_compositor_destroy(compositor);
-	wl_registry_destroy(registry);
-	wl_display_disconnect(display);
+	if (!settings.headless)
+	{
+		wl_shell_surface_destroy(shell_surface);
+		wl_surface_destroy(surface);
+		if (keyboard)
+			wl_keyboard_destroy(keyboard);
+		if (pointer)
+			wl_pointer_destroy(pointer);
+		wl_seat_destroy(seat);
+		wl_shell_destroy(shell);
+		wl_compositor_destroy(compositor);
+		wl_registry_destroy(registry);
+		wl_display_disconnect(display);
+	}
 #elif defined(__linux)
 #if defined(__ANDROID__)
 	// todo : android cleanup (if required)
 #else
-	xcb_destroy_window(connection, window);
-	xcb_disconnect(connection);
+	if (!settings.headless)
+	{
+		xcb_destroy_window(connection, window);
+		xcb_disconnect(connection);
+	}
 #endif
 #endif
 }
@@ -855,7 +1159,11 @@ void VulkanExampleBase::initVulkan()
 	VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &depthFormat);
 	assert(validDepthFormat);
 
-	swapChain.connect(instance, physicalDevice, device);
+	// Headless rendering has no surface, the swap chain is replaced by offscreen images in initSwapchain
+	if (!settings.headless)
+	{
+		swapChain.connect(instance, physicalDevice, device);
+	}
 
 	// Create synchronization objects
 	VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
@@ -912,6 +1220,11 @@ HWND VulkanExampleBase::setupWindow(HINSTANCE hinstance, WNDPROC wndproc)
 {
 	this->windowInstance = hinstance;
 
+	if (settings.headless)
+	{
+		return nullptr;
+	}
+
 	WNDCLASSEX wndClass;
 
 	wndClass.cbSize = sizeof(WNDCLASSEX);
@@ -1599,6 +1912,11 @@ static void PopupDoneCb(void *data, struct wl_shell_surface *shell_surface)
 
 wl_shell_surface *VulkanExampleBase::setupWindow()
 {
+	if (settings.headless)
+	{
+		return nullptr;
+	}
+
 	surface = wl_compositor_create_surface(compositor);
 	shell_surface = wl_shell_get_shell_surface(shell, surface);
 
@@ -1623,6 +1941,11 @@ static inline xcb_intern_atom_reply_t* intern_atom_helper(xcb_connection_t *conn
 // Set up a window using XCB and request event types
 xcb_window_t VulkanExampleBase::setupWindow()
 {
+	if (settings.headless)
+	{
+		return 0;
+	}
+
 	uint32_t value_mask, value_list[32];
 
 	window = xcb_generate_id(connection);
@@ -2061,6 +2384,11 @@ void VulkanExampleBase::windowResize()
 
 	camera.updateAspectRatio((float)width / (float)height);
 
+	if (regressionCapture)
+	{
+		setupRegressionCapture();
+	}
+
 	// Notify derived class
 	windowResized();
 	viewChanged();
@@ -2068,6 +2396,45 @@ void VulkanExampleBase::windowResize()
 	prepared = true;
 }
 
+vks::JobSystem *VulkanExampleBase::getJobSystem()
+{
+	if (!jobSystem)
+	{
+		jobSystem = new vks::JobSystem();
+	}
+	return jobSystem;
+}
+
+uint32_t VulkanExampleBase::getRandomSeed()
+{
+	if (regression.frame > 0)
+	{
+		return 0;
+	}
+	return static_cast<uint32_t>(time(NULL));
+}
+
+void VulkanExampleBase::recordParallel(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t itemCount, const vks::ParallelRecorder::RecordFunction &recordItems, const VkCommandBufferInheritanceInfo *inheritanceInfo, uint32_t pass)
+{
+	if (!parallelRecorder)
+	{
+		parallelRecorder = new vks::ParallelRecorder(device, swapChain.queueNodeIndex, getJobSystem());
+	}
+
+	VkCommandBufferInheritanceInfo defaultInheritanceInfo = vks::initializers::commandBufferInheritanceInfo();
+	defaultInheritanceInfo.renderPass = renderPass;
+	defaultInheritanceInfo.framebuffer = frameBuffers[frameIndex];
+
+	// Dynamic state is not inherited from the primary command buffer
+	const VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+	const VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+	parallelRecorder->record(commandBuffer, frameIndex, inheritanceInfo ? *inheritanceInfo : defaultInheritanceInfo, itemCount, [&](VkCommandBuffer secondary, uint32_t firstItem, uint32_t lastItem) {
+		vkCmdSetViewport(secondary, 0, 1, &viewport);
+		vkCmdSetScissor(secondary, 0, 1, &scissor);
+		recordItems(secondary, firstItem, lastItem);
+	}, pass);
+}
+
 void VulkanExampleBase::windowResized()
 {
 	// Can be overriden in derived class
@@ -2075,6 +2442,11 @@ void VulkanExampleBase::windowResized()
 
 void VulkanExampleBase::initSwapchain()
 {
+	if (settings.headless)
+	{
+		swapChain.initHeadless(physicalDevice, device, queue, vulkanDevice->queueFamilyIndices.graphics);
+		return;
+	}
 #if defined(_WIN32)
 	swapChain.initSurface(windowInstance, window);
 #elif defined(__ANDROID__)	
@@ -46,6 +46,9 @@
 #include "VulkanDevice.hpp"
 #include "VulkanSwapChain.hpp"
 #include "VulkanTextOverlay.hpp"
+#include "VulkanFrameCapture.hpp"
+#include "VulkanParallelRecorder.hpp"
+#include "jobsystem.hpp"
 #include "camera.hpp"
 
 class VulkanExampleBase
@@ -63,6 +66,18 @@ private:
 	bool resizing = false;
 	// Called if the window is resized and some resources have to be recreatesd
 	void windowResize();
+	// Job system and secondary command buffer pools for parallel recording, created on first use
+	vks::JobSystem *jobSystem = nullptr;
+	vks::ParallelRecorder *parallelRecorder = nullptr;
+	// Golden image capture state
+	uint32_t regressionFrameIndex = 0;
+	std::vector<double> regressionFrameTimes;
+	std::chrono::high_resolution_clock::time_point regressionFrameStart;
+	vks::FrameCapture *regressionCapture = nullptr;
+	VkSemaphore regressionCaptureComplete = VK_NULL_HANDLE;
+	void setupRegressionCapture();
+	VkSemaphore submitRegressionCapture(VkSemaphore waitSemaphore);
+	void finishRegressionCapture();
 protected:
 	// Last frame time, measured using a high performance timer (if available)
 	float frameTimer = 1.0f;
@@ -144,8 +159,32 @@ public:
 		bool fullscreen = false;
 		/** @brief Set to true if v-sync will be forced for the swapchain */
 		bool vsync = false;
+		/** @brief Render to offscreen images without creating a window, surface or swap chain (-headless, desktop only, requires -capture) */
+		bool headless = false;
 	} settings;
 
+	/**
+	* @brief Golden image regression settings, set by command line arguments
+	* Captures a single frame (with animations advanced by a fixed time step and the text overlay hidden), optionally compares it against a golden image and exits
+	*/
+	struct RegressionSettings {
+		/** @brief Frame to capture (-capture, counted from 1), 0 disables the capture */
+		uint32_t frame = 0;
+		/** @brief File the captured frame is written to as ppm (-capturefile) */
+		std::string filename = "capture.ppm";
+		/** @brief Golden ppm image the capture is compared against (-golden), no comparison if empty */
+		std::string golden;
+		/** @brief Perceptual difference (0..1) above which a pixel counts as different (-threshold) */
+		float threshold = 0.1f;
+		/** @brief Fraction of pixels that may differ for the comparison to pass (-maxdiff) */
+		float maxDifferentPixels = 0.001f;
+		/** @brief Time step (s) used instead of the measured frame time for the timer, animations and the camera (-timestep) */
+		float timeStep = 1.0f / 60.0f;
+	} regression;
+
+	/** @brief Returned by the application, non zero if the golden image comparison failed */
+	int exitCode = 0;
+
 	VkClearColorValue defaultClearColor = { { 0.025f, 0.025f, 0.025f, 1.0f } };
 
 	float zoom = 0;
@@ -161,6 +200,8 @@ public:
 	bool paused = false;
 
 	bool enableTextOverlay = false;
+	/** @brief Set if the example records the text overlay into its own render pass (see VulkanTextOverlay::cmdDraw), skips the separate overlay submission */
+	bool textOverlayInMainPass = false;
 	VulkanTextOverlay *textOverlay;
 
 	// Use to adjust mouse rotation speed
@@ -359,6 +400,25 @@ public:
 	// Create a cache pool for rendering pipelines
 	void createPipelineCache();
 
+	/** @brief Returns the job system shared by the base class and the examples (created on first use with one thread per core) */
+	vks::JobSystem *getJobSystem();
+
+	/** @brief Returns a seed for random number generators, fixed when capturing a regression frame so the captured image is reproducible */
+	uint32_t getRandomSeed();
+
+	/**
+	* Record the items (e.g. draws) of a render pass into secondary command buffers on all cores and execute them from the primary command buffer
+	* The secondary command buffers start with viewport and scissor set to the window size
+	*
+	* @param commandBuffer Primary command buffer, must be inside a render pass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+	* @param frameIndex Index of the frame buffer (and draw command buffer) that is recorded, each frame uses separate command pools
+	* @param itemCount Number of items to record
+	* @param recordItems Records a range of items into a secondary command buffer, called concurrently from different threads
+	* @param inheritanceInfo (Optional) Render pass and framebuffer, defaults to the default render pass and the frame's framebuffer
+	* @param pass (Optional) Index to distinguish multiple parallel recordings within the same frame
+	*/
+	void recordParallel(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t itemCount, const vks::ParallelRecorder::RecordFunction &recordItems, const VkCommandBufferInheritanceInfo *inheritanceInfo = nullptr, uint32_t pass = 0);
+
 	// Prepare commonly used Vulkan functions
 	virtual void prepare();
 
@@ -367,6 +427,10 @@ public:
 	
 	// Start the main render loop
 	void renderLoop();
+#if !defined(__ANDROID__)
+	// Render loop used instead if there is no window (settings.headless)
+	void renderLoopHeadless();
+#endif
 
 	void updateTextOverlay();
 
@@ -412,8 +476,9 @@ int APIENTRY WinMain(																				\
 	vulkanExample->initSwapchain();																	\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
+	int exitCode = vulkanExample->exitCode;															\
 	delete(vulkanExample);																			\
-	return 0;																						\
+	return exitCode;																				\
 }																									
 #elif defined(__ANDROID__)
 // Android entry point
@@ -446,8 +511,9 @@ int main(const int argc, const char *argv[])													    \
 	vulkanExample->initSwapchain();																	\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
+	int exitCode = vulkanExample->exitCode;															\
 	delete(vulkanExample);																			\
-	return 0;																						\
+	return exitCode;																				\
 }
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
 #define VULKAN_EXAMPLE_MAIN()																		\
@@ -461,8 +527,9 @@ int main(const int argc, const char *argv[])													    \
 	vulkanExample->initSwapchain();																	\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
+	int exitCode = vulkanExample->exitCode;															\
 	delete(vulkanExample);																			\
-	return 0;																						\
+	return exitCode;																				\
 }
 #elif defined(__linux__)
 // Linux entry point
@@ -484,7 +551,8 @@ int main(const int argc, const char *argv[])													    \
 	vulkanExample->initSwapchain();																	\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
+	int exitCode = vulkanExample->exitCode;															\
 	delete(vulkanExample);																			\
-	return 0;																						\
+	return exitCode;																				\
 }
 #endif
@@ -14,6 +14,8 @@
 #include <time.h> 
 #include <vector>
 #include <random>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -25,6 +27,7 @@
 #include "VulkanBuffer.hpp"
 #include "VulkanModel.hpp"
 #include "frustum.hpp"
+#include "VulkanTimestampQueries.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define INSTANCE_BUFFER_BIND_ID 1
@@ -118,6 +121,14 @@ public:
 	// View frustum for culling invisible objects
 	vks::Frustum frustum;
 
+	// GPU time of the culling dispatch and of the object draws (compare with the CPU culling of the indirectdraw example)
+	struct {
+		vks::TimestampQueries *compute = nullptr;
+		vks::TimestampQueries *graphics = nullptr;
+		double cullTime = 0.0;
+		double drawTime = 0.0;
+	} timings;
+
 	uint32_t objectCount = 0;
 
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
@@ -148,6 +159,8 @@ public:
 		vkDestroyFence(device, compute.fence, nullptr);
 		vkDestroyCommandPool(device, compute.commandPool, nullptr);
 		vkDestroySemaphore(device, compute.semaphore, nullptr);
+		delete timings.compute;
+		delete timings.graphics;
 	}
 
 	void reBuildCommandBuffers()
@@ -182,6 +195,8 @@ public:
 
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
+			timings.graphics->cmdReset(drawCmdBuffers[i], i);
+
 			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
@@ -194,6 +209,7 @@ public:
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
 
 			// Mesh containing the LODs
+			timings.graphics->cmdWriteTimestamp(drawCmdBuffers[i], i, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.plants);
 			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &models.lodObject.vertices.buffer, offsets);
 			vkCmdBindVertexBuffers(drawCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &instanceBuffer.buffer, offsets);
@@ -212,6 +228,7 @@ public:
 					vkCmdDrawIndexedIndirect(drawCmdBuffers[i], indirectCommandsBuffer.buffer, j * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
 				}
 			}	
+			timings.graphics->cmdWriteTimestamp(drawCmdBuffers[i], i, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
@@ -291,6 +308,8 @@ public:
 
 		VK_CHECK_RESULT(vkBeginCommandBuffer(compute.commandBuffer, &cmdBufInfo));
 
+		timings.compute->cmdReset(compute.commandBuffer, 0);
+
 		// Add memory barrier to ensure that the indirect commands have been consumed before the compute shader updates them
 		VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
 		bufferBarrier.buffer = indirectCommandsBuffer.buffer;
@@ -315,7 +334,9 @@ public:
 		// Dispatch the compute job
 		// The compute shader will do the frustum culling and adjust the indirect draw calls depending on object visibility. 
 		// It also determines the lod to use depending on distance to the viewer.
+		timings.compute->cmdWriteTimestamp(compute.commandBuffer, 0, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 		vkCmdDispatch(compute.commandBuffer, objectCount / 16, 1, 1);
+		timings.compute->cmdWriteTimestamp(compute.commandBuffer, 0, 1, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
 		// Add memory barrier to ensure that the compute shader has finished writing the indirect command buffer before it's consumed
 		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
@@ -821,6 +842,16 @@ public:
 
 		// Get draw count from compute
 		memcpy(&indirectStats, indirectDrawCountBuffer.mapped, sizeof(indirectStats));
+
+		// The graphics submission waited for the compute submission, so both have finished
+		if (timings.compute->resolve(0))
+		{
+			timings.cullTime = timings.compute->getDuration(0, 1);
+		}
+		if (timings.graphics->resolve(currentBuffer))
+		{
+			timings.drawTime = timings.graphics->getDuration(0, 1);
+		}
 	}
 
 	void prepare()
@@ -833,6 +864,8 @@ public:
 		preparePipelines();
 		setupDescriptorPool();
 		setupDescriptorSet();
+		timings.compute = new vks::TimestampQueries(vulkanDevice, 2, 1, vulkanDevice->queueFamilyIndices.compute);
+		timings.graphics = new vks::TimestampQueries(vulkanDevice, 2, static_cast<uint32_t>(drawCmdBuffers.size()), vulkanDevice->queueFamilyIndices.graphics);
 		prepareCompute();
 		buildCommandBuffers();
 		prepared = true;
@@ -876,6 +909,9 @@ public:
 		{
 			textOverlay->addText("lod " + std::to_string(i) + ": " + std::to_string(indirectStats.lodCount[i]), 5.0f, 125.0f + (float)i * 20.0f, VulkanTextOverlay::alignLeft);
 		}
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(2) << "GPU cull " << timings.cullTime << " ms, draw " << timings.drawTime << " ms";
+		textOverlay->addText(ss.str(), 5.0f, 125.0f + (float)(MAX_LOD_LEVEL + 1) * 20.0f, VulkanTextOverlay::alignLeft);
 	}
 };
 
@@ -12,6 +12,9 @@
 #include <assert.h>
 #include <vector>
 #include <random>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -21,6 +24,9 @@
 #include <vulkan/vulkan.h>
 #include "vulkanexamplebase.h"
 #include "VulkanTexture.hpp"
+#include "VulkanDepthSort.hpp"
+#include "VulkanTimestampQueries.hpp"
+#include "barneshut.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -30,11 +36,75 @@
 #else
 #define PARTICLES_PER_ATTRACTOR 4 * 1024
 #endif
+// Above this particle count only the Barnes-Hut solver is fast enough
+#define MAX_ALL_PAIRS_PARTICLES 6 * 16 * 1024
 
 class VulkanExample : public VulkanExampleBase
 {
 public:
 	uint32_t numParticles;
+	uint32_t particlesPerAttractor = PARTICLES_PER_ATTRACTOR;
+	// Selectable particle counts per attractor (the largest one results in ~1M particles)
+	const std::vector<uint32_t> particleCountSteps = { 1024, 4 * 1024, 16 * 1024, 64 * 1024, 170 * 1024 };
+
+	// The velocity pass either sums up the forces of all particle pairs (O(n^2)) or traverses an octree (Barnes-Hut, O(n log n))
+	// that is built on the host from the previous step's positions
+	enum Solver { SOLVER_ALL_PAIRS, SOLVER_BARNES_HUT };
+	Solver solver = SOLVER_ALL_PAIRS;
+	vks::BarnesHut *barnesHut = nullptr;
+
+	// Comparison of one GPU velocity step against the CPU reference
+	struct {
+		bool done = false;
+		Solver solver;
+		uint32_t samples;
+		// Relative difference between the GPU and the CPU accelerations (same solver)
+		float maxError;
+		float averageError;
+		// Relative difference between the Barnes-Hut and the exact all pairs accelerations on the CPU
+		float averageApproximationError;
+		double cpuTime;
+	} validation;
+
+	// Sort the particles back to front on the GPU and draw them indexed in that order
+	// Particles are blended additively, so the image doesn't change, but this shows how to sort a compute written buffer without a host round trip
+	bool depthSort = false;
+	vks::DepthSort *depthSorter = nullptr;
+	double gpuSortTime = 0.0;
+
+	// Each simulation step copies its results to the vertex (and index) buffer of one of two slots, which is then rendered by the graphics queue
+	// The step for the next frame writes to the other slot, so it runs on the compute queue while the current frame is being rendered
+	struct Slot {
+		vks::Buffer vertexBuffer;							// Copy of the particles for rendering
+		vks::Buffer indexBuffer;							// Copy of the sorted particle indices (depth sorting only)
+		VkCommandBuffer computeCommandBuffer;				// Simulation step writing this slot
+		std::vector<VkCommandBuffer> drawCommandBuffers;	// One per swap chain image
+		VkSemaphore computeComplete;						// Signaled by the step, waited on by the frame rendering this slot
+		VkSemaphore graphicsComplete;						// Signaled by the frame, waited on by the next step writing this slot
+		bool graphicsPending = false;						// True if graphicsComplete has been signaled but not waited on yet
+	};
+	std::array<Slot, 2> slots;
+	// Slot written by the last submitted step
+	uint32_t currentSlot = 0;
+	bool stepSubmitted = false;
+
+	// GPU timings of the last step (including the sort) and the frame it ran concurrently with
+	enum ComputeTimestamp { TIMESTAMP_STEP_BEGIN, TIMESTAMP_SORT_BEGIN, TIMESTAMP_SORT_END, TIMESTAMP_STEP_END, TIMESTAMP_COUNT };
+	vks::TimestampQueries *computeTimestamps = nullptr;
+	vks::TimestampQueries *graphicsTimestamps = nullptr;
+	struct {
+		bool valid = false;
+		double stepTime;
+		double frameTime;
+		double overlap;
+	} timeline;
+
+	struct SortBenchmarkResult {
+		uint32_t count;
+		double time;
+		bool sorted;
+	};
+	std::vector<SortBenchmarkResult> sortBenchmarkResults;
 
 	struct {
 		vks::Texture2D particle;
@@ -63,17 +133,26 @@ public:
 
 	// Resources for the compute part of the example
 	struct {
-		vks::Buffer storageBuffer;					// (Shader) storage buffer object containing the particles
+		vks::Buffer storageBuffer;					// (Shader) storage buffer object containing the particles, only accessed by the compute queue
 		vks::Buffer uniformBuffer;					// Uniform buffer object containing particle system parameters
 		VkQueue queue;								// Separate queue for compute commands (queue family may differ from the one used for graphics)
 		VkCommandPool commandPool;					// Use a separate command pool (queue family may differ from the one used for graphics)
-		VkCommandBuffer commandBuffer;				// Command buffer storing the dispatch commands and barriers
-		VkFence fence;								// Synchronization fence to avoid rewriting compute CB if still in use
+		VkFence fence;								// Signaled once the last simulation step has finished, only one step is in flight at a time
 		VkDescriptorSetLayout descriptorSetLayout;	// Compute shader binding layout
 		VkDescriptorSet descriptorSet;				// Compute shader bindings
 		VkPipelineLayout pipelineLayout;			// Layout of the compute pipeline
 		VkPipeline pipelineCalculate;				// Compute pipeline for N-Body velocity calculation (1st pass)
 		VkPipeline pipelineIntegrate;				// Compute pipeline for euler integration (2nd pass)
+		VkPipeline pipelineBarnesHut;				// Compute pipeline for Barnes-Hut velocity calculation (replaces the 1st pass)
+		struct {
+			vks::Buffer nodes;						// Octree nodes (device local)
+			vks::Buffer bodies;						// Bodies in the order referenced by the octree leaves (device local)
+			vks::Buffer nodesStaging;
+			vks::Buffer bodiesStaging;
+			vks::Buffer particles;					// Host visible copy of the particles the octree is built from
+			uint32_t nodeCount = 0;
+			uint32_t nodeCapacity = 0;
+		} octree;
 		VkPipeline blur;
 		VkPipelineLayout pipelineLayoutBlur;
 		VkDescriptorSetLayout descriptorSetLayoutBlur;
@@ -119,8 +198,21 @@ public:
 		vkDestroyDescriptorSetLayout(device, compute.descriptorSetLayout, nullptr);
 		vkDestroyPipeline(device, compute.pipelineCalculate, nullptr);
 		vkDestroyPipeline(device, compute.pipelineIntegrate, nullptr);
+		vkDestroyPipeline(device, compute.pipelineBarnesHut, nullptr);
+		destroyOctreeBuffers();
 		vkDestroyFence(device, compute.fence, nullptr);
 		vkDestroyCommandPool(device, compute.commandPool, nullptr);
+		delete depthSorter;
+		delete barnesHut;
+
+		destroySlotBuffers();
+		for (auto &slot : slots)
+		{
+			vkDestroySemaphore(device, slot.computeComplete, nullptr);
+			vkDestroySemaphore(device, slot.graphicsComplete, nullptr);
+		}
+		delete computeTimestamps;
+		delete graphicsTimestamps;
 
 		textures.particle.destroy();
 		textures.gradient.destroy();
@@ -134,11 +226,19 @@ public:
 
 	void buildCommandBuffers()
 	{
-		// Destroy command buffers if already present
-		if (!checkCommandBuffers())
+		// The draw command buffers of the base class are replaced by one set per slot, as each slot has its own vertex buffer
+		for (auto &slot : slots)
 		{
-			destroyCommandBuffers();
-			createCommandBuffers();
+			if (slot.drawCommandBuffers.size() != drawCmdBuffers.size())
+			{
+				if (!slot.drawCommandBuffers.empty())
+				{
+					vkFreeCommandBuffers(device, cmdPool, static_cast<uint32_t>(slot.drawCommandBuffers.size()), slot.drawCommandBuffers.data());
+				}
+				slot.drawCommandBuffers.resize(drawCmdBuffers.size());
+				VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, static_cast<uint32_t>(slot.drawCommandBuffers.size()));
+				VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, slot.drawCommandBuffers.data()));
+			}
 		}
 
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
@@ -156,82 +256,159 @@ public:
 		renderPassBeginInfo.clearValueCount = 2;
 		renderPassBeginInfo.pClearValues = clearValues;
 
-		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
+		for (uint32_t s = 0; s < static_cast<uint32_t>(slots.size()); s++)
 		{
-			// Set target frame buffer
-			renderPassBeginInfo.framebuffer = frameBuffers[i];
+			for (int32_t i = 0; i < slots[s].drawCommandBuffers.size(); ++i)
+			{
+				VkCommandBuffer commandBuffer = slots[s].drawCommandBuffers[i];
 
-			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
+				// Set target frame buffer
+				renderPassBeginInfo.framebuffer = frameBuffers[i];
 
-			// Draw the particle system using the update vertex buffer
+				VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
 
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+				graphicsTimestamps->cmdReset(commandBuffer, s);
+				graphicsTimestamps->cmdWriteTimestamp(commandBuffer, s, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 
-			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+				// Acquire the buffers released by the compute queue (see buildComputeCommandBuffer)
+				// Not required if both queues are from the same family, the semaphore the frame waits on already makes the compute results visible
+				if (vulkanDevice->queueFamilyIndices.graphics != vulkanDevice->queueFamilyIndices.compute)
+				{
+					std::vector<VkBufferMemoryBarrier> bufferBarriers(1, vks::initializers::bufferMemoryBarrier());
+					bufferBarriers[0].buffer = slots[s].vertexBuffer.buffer;
+					bufferBarriers[0].size = slots[s].vertexBuffer.descriptor.range;
+					bufferBarriers[0].srcAccessMask = 0;
+					bufferBarriers[0].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+					bufferBarriers[0].srcQueueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
+					bufferBarriers[0].dstQueueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;
+					if (depthSort)
+					{
+						bufferBarriers.push_back(bufferBarriers[0]);
+						bufferBarriers[1].buffer = slots[s].indexBuffer.buffer;
+						bufferBarriers[1].size = slots[s].indexBuffer.descriptor.range;
+						bufferBarriers[1].dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
+					}
+
+					vkCmdPipelineBarrier(
+						commandBuffer,
+						VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+						VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+						VK_FLAGS_NONE,
+						0, nullptr,
+						static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+						0, nullptr);
+				}
 
-			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
-			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+				// Draw the particle system using the update vertex buffer
 
-			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
+				vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-			VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &compute.storageBuffer.buffer, offsets);
-			vkCmdDraw(drawCmdBuffers[i], numParticles, 1, 0, 0);
+				VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+				vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-			vkCmdEndRenderPass(drawCmdBuffers[i]);
+				VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+				vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
-		}
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
+
+				VkDeviceSize offsets[1] = { 0 };
+				vkCmdBindVertexBuffers(commandBuffer, VERTEX_BUFFER_BIND_ID, 1, &slots[s].vertexBuffer.buffer, offsets);
+				if (depthSort)
+				{
+					// The sorted particle indices are used as the index buffer
+					vkCmdBindIndexBuffer(commandBuffer, slots[s].indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+					vkCmdDrawIndexed(commandBuffer, numParticles, 1, 0, 0, 0);
+				}
+				else
+				{
+					vkCmdDraw(commandBuffer, numParticles, 1, 0, 0);
+				}
+
+				vkCmdEndRenderPass(commandBuffer);
+
+				// No release back to the compute queue: The next step overwrites the slot's buffers, so their contents don't need to be preserved
+				// The semaphore signaled by this frame keeps the next step from writing them too early
 
+				graphicsTimestamps->cmdWriteTimestamp(commandBuffer, s, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+				VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+			}
+		}
 	}
 
-	void buildComputeCommandBuffer()
+	void buildComputeCommandBuffer(uint32_t slotIndex)
 	{
+		Slot &slot = slots[slotIndex];
+		VkCommandBuffer commandBuffer = slot.computeCommandBuffer;
+
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
-		VK_CHECK_RESULT(vkBeginCommandBuffer(compute.commandBuffer, &cmdBufInfo));
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+
+		computeTimestamps->cmdReset(commandBuffer, slotIndex);
+		computeTimestamps->cmdWriteTimestamp(commandBuffer, slotIndex, TIMESTAMP_STEP_BEGIN, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 
 		// Compute particle movement
 
-		// Add memory barrier to ensure that the (graphics) vertex shader has fetched attributes before compute starts to write to the buffer
+		// Add memory barrier to ensure that the previous step has finished writing the buffer and copying it to its slot before this step writes to it
+		// The storage buffer never leaves the compute queue, so no ownership transfer is necessary
 		VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
 		bufferBarrier.buffer = compute.storageBuffer.buffer;
 		bufferBarrier.size = compute.storageBuffer.descriptor.range;
-		bufferBarrier.srcAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;						// Vertex shader invocations have finished reading from the buffer
-		bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;								// Compute shader wants to write to the buffer
-		// Transfer ownership if compute and graphics queue familiy indices differ
-		bufferBarrier.srcQueueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;			
-		bufferBarrier.dstQueueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;			
+		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 
 		vkCmdPipelineBarrier(
-			compute.commandBuffer,
-			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
 			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
 			VK_FLAGS_NONE,
 			0, nullptr,
 			1, &bufferBarrier,
 			0, nullptr);
 
-		vkCmdBindPipeline(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineCalculate);
-		vkCmdBindDescriptorSets(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, 0);
+		if (depthSort)
+		{
+			// The sorted indices must have been copied by the previous step before they are overwritten
+			VkBufferMemoryBarrier indexBarrier = bufferBarrier;
+			indexBarrier.buffer = depthSorter->buffers.values.buffer;
+			indexBarrier.size = depthSorter->buffers.values.descriptor.range;
+			indexBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			indexBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			vkCmdPipelineBarrier(
+				commandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_FLAGS_NONE,
+				0, nullptr,
+				1, &indexBarrier,
+				0, nullptr);
+		}
+
+		if (solver == SOLVER_BARNES_HUT)
+		{
+			cmdUploadOctree(commandBuffer);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineBarnesHut);
+		}
+		else
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineCalculate);
+		}
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, 0);
 
 		// First pass: Calculate particle movement
 		// -------------------------------------------------------------------------------------------------------
-		vkCmdDispatch(compute.commandBuffer, numParticles / 256, 1, 1);
+		vkCmdDispatch(commandBuffer, numParticles / 256, 1, 1);
 
 		// Add memory barrier to ensure that compute shader has finished writing to the buffer 
 		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;								// Compute shader has finished writes to the buffer
 		bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;					
-		bufferBarrier.buffer = compute.storageBuffer.buffer;
-		bufferBarrier.size = compute.storageBuffer.descriptor.range;
-		// No ownership transfer necessary
-		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED; 
-		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 
 		vkCmdPipelineBarrier(
-			compute.commandBuffer,
+			commandBuffer,
 			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
 			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
 			VK_FLAGS_NONE,
@@ -241,29 +418,180 @@ public:
 
 		// Second pass: Integrate particles
 		// -------------------------------------------------------------------------------------------------------
-		vkCmdBindPipeline(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineIntegrate);
-		vkCmdDispatch(compute.commandBuffer, numParticles / 256, 1, 1);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineIntegrate);
+		vkCmdDispatch(commandBuffer, numParticles / 256, 1, 1);
 
-		// Add memory barrier to ensure that compute shader has finished writing to the buffer
-		// Without this the (rendering) vertex shader may display incomplete results (partial data from last frame) 
-		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;								// Compute shader has finished writes to the buffer
-		bufferBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;						// Vertex shader invocations want to read from the buffer
-		bufferBarrier.buffer = compute.storageBuffer.buffer;
-		bufferBarrier.size = compute.storageBuffer.descriptor.range;
-		// Transfer ownership if compute and graphics queue familiy indices differ
-		bufferBarrier.srcQueueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
-		bufferBarrier.dstQueueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;
+		if (solver == SOLVER_BARNES_HUT)
+		{
+			// The next step's octree is built from the integrated positions
+			cmdReadbackParticles(commandBuffer);
+		}
+
+		// Optional third pass: Sort particles back to front
+		// -------------------------------------------------------------------------------------------------------
+		computeTimestamps->cmdWriteTimestamp(commandBuffer, slotIndex, TIMESTAMP_SORT_BEGIN, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+		if (depthSort)
+		{
+			// Key generation reads the integrated positions
+			bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(
+				commandBuffer,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_FLAGS_NONE,
+				0, nullptr,
+				1, &bufferBarrier,
+				0, nullptr);
+
+			depthSorter->cmdSort(commandBuffer, numParticles);
+		}
+		computeTimestamps->cmdWriteTimestamp(commandBuffer, slotIndex, TIMESTAMP_SORT_END, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+		// Add memory barrier to ensure that the compute shaders have finished writing to the buffers before they're copied
+		std::vector<VkBufferMemoryBarrier> bufferBarriers(1, bufferBarrier);
+		bufferBarriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		bufferBarriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		if (depthSort)
+		{
+			bufferBarriers.push_back(bufferBarriers[0]);
+			bufferBarriers[1].buffer = depthSorter->buffers.values.buffer;
+			bufferBarriers[1].size = depthSorter->buffers.values.descriptor.range;
+		}
 
 		vkCmdPipelineBarrier(
-			compute.commandBuffer,
+			commandBuffer,
 			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
 			VK_FLAGS_NONE,
 			0, nullptr,
-			1, &bufferBarrier,
+			static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
 			0, nullptr);
 
-		vkEndCommandBuffer(compute.commandBuffer);
+		// Copy the results to the slot's buffers
+		// The submission waits for the last frame that rendered this slot at the transfer stage, so the passes above may still overlap with it
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = numParticles * sizeof(Particle);
+		vkCmdCopyBuffer(commandBuffer, compute.storageBuffer.buffer, slot.vertexBuffer.buffer, 1, &copyRegion);
+		if (depthSort)
+		{
+			copyRegion.size = numParticles * sizeof(uint32_t);
+			vkCmdCopyBuffer(commandBuffer, depthSorter->buffers.values.buffer, slot.indexBuffer.buffer, 1, &copyRegion);
+		}
+
+		// Release the slot's buffers to the graphics queue (matching the acquire in buildCommandBuffers)
+		// Compute and graphics queue may have different queue families (see VulkanDevice::createLogicalDevice)
+		// If they are the same, the semaphore signaled by the submission makes the copies visible to the graphics queue
+		if (vulkanDevice->queueFamilyIndices.graphics != vulkanDevice->queueFamilyIndices.compute)
+		{
+			bufferBarriers[0].buffer = slot.vertexBuffer.buffer;
+			bufferBarriers[0].size = slot.vertexBuffer.descriptor.range;
+			if (depthSort)
+			{
+				bufferBarriers[1].buffer = slot.indexBuffer.buffer;
+				bufferBarriers[1].size = slot.indexBuffer.descriptor.range;
+			}
+			for (auto &releaseBarrier : bufferBarriers)
+			{
+				releaseBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				releaseBarrier.dstAccessMask = 0;
+				releaseBarrier.srcQueueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
+				releaseBarrier.dstQueueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;
+			}
+
+			vkCmdPipelineBarrier(
+				commandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				VK_FLAGS_NONE,
+				0, nullptr,
+				static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+				0, nullptr);
+		}
+
+		computeTimestamps->cmdWriteTimestamp(commandBuffer, slotIndex, TIMESTAMP_STEP_END, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+		vkEndCommandBuffer(commandBuffer);
+	}
+
+	void buildComputeCommandBuffers()
+	{
+		for (uint32_t i = 0; i < static_cast<uint32_t>(slots.size()); i++)
+		{
+			buildComputeCommandBuffer(i);
+		}
+	}
+
+	// Copy the octree from the staging buffers, which are written on the host before each step
+	void cmdUploadOctree(VkCommandBuffer commandBuffer)
+	{
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = compute.octree.nodeCount * sizeof(vks::BarnesHut::Node);
+		vkCmdCopyBuffer(commandBuffer, compute.octree.nodesStaging.buffer, compute.octree.nodes.buffer, 1, &copyRegion);
+		copyRegion.size = numParticles * sizeof(glm::vec4);
+		vkCmdCopyBuffer(commandBuffer, compute.octree.bodiesStaging.buffer, compute.octree.bodies.buffer, 1, &copyRegion);
+
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		struct {
+			float thetaSquared;
+			uint32_t nodeCount;
+		} pushConsts;
+		pushConsts.thetaSquared = barnesHut->settings.theta * barnesHut->settings.theta;
+		pushConsts.nodeCount = compute.octree.nodeCount;
+		vkCmdPushConstants(commandBuffer, compute.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConsts), &pushConsts);
+	}
+
+	// Copy the particles to the host visible buffer
+	void cmdReadbackParticles(VkCommandBuffer commandBuffer)
+	{
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = numParticles * sizeof(Particle);
+		vkCmdCopyBuffer(commandBuffer, compute.storageBuffer.buffer, compute.octree.particles.buffer, 1, &copyRegion);
+
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	// Synchronous copy of the current particles to the host visible buffer, the compute queue must be idle
+	void readbackParticles()
+	{
+		VkCommandBuffer copyCmd = createComputeCommandBuffer();
+		cmdReadbackParticles(copyCmd);
+		flushComputeCommandBuffer(copyCmd);
+	}
+
+	// One time command buffer for the compute queue
+	// All transfers from and to the storage buffer are done on the compute queue, so it never has to change the queue family
+	VkCommandBuffer createComputeCommandBuffer()
+	{
+		VkCommandBuffer commandBuffer;
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(compute.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &commandBuffer));
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		return commandBuffer;
+	}
+
+	// Submit a command buffer created by createComputeCommandBuffer, wait for it to finish and free it
+	void flushComputeCommandBuffer(VkCommandBuffer commandBuffer)
+	{
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+		VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
+		computeSubmitInfo.commandBufferCount = 1;
+		computeSubmitInfo.pCommandBuffers = &commandBuffer;
+		VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &computeSubmitInfo, VK_NULL_HANDLE));
+		VK_CHECK_RESULT(vkQueueWaitIdle(compute.queue));
+		vkFreeCommandBuffers(device, compute.commandPool, 1, &commandBuffer);
 	}
 
 	// Setup and fill the compute shader storage buffers containing the particles
@@ -285,19 +613,19 @@ public:
 		};
 #endif
 
-		numParticles = static_cast<uint32_t>(attractors.size()) * PARTICLES_PER_ATTRACTOR;
+		numParticles = static_cast<uint32_t>(attractors.size()) * particlesPerAttractor;
 
 		// Initial particle positions
 		std::vector<Particle> particleBuffer(numParticles);
 
-		std::mt19937 rndGen(static_cast<uint32_t>(time(0)));
+		std::mt19937 rndGen(getRandomSeed());
 		std::normal_distribution<float> rndDist(0.0f, 1.0f);
 
 		for (uint32_t i = 0; i < static_cast<uint32_t>(attractors.size()); i++)
 		{
-			for (uint32_t j = 0; j < PARTICLES_PER_ATTRACTOR; j++)
+			for (uint32_t j = 0; j < particlesPerAttractor; j++)
 			{
-				Particle &particle = particleBuffer[i * PARTICLES_PER_ATTRACTOR + j];
+				Particle &particle = particleBuffer[i * particlesPerAttractor + j];
 
 				// First particle in group as heavy center of gravity
 				if (j == 0)
@@ -343,18 +671,19 @@ public:
 			particleBuffer.data());
 
 		vulkanDevice->createBuffer(
-			// The SSBO will be used as a storage buffer for the compute pipeline and as a vertex buffer in the graphics pipeline
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			// The SSBO will be used as a storage buffer for the compute pipeline, the results of each step are copied to the vertex buffers of the slots
+			// It's also copied back to the host to build the Barnes-Hut octree
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 			&compute.storageBuffer,
 			storageBufferSize);
 
 		// Copy to staging buffer
-		VkCommandBuffer copyCmd = VulkanExampleBase::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		VkCommandBuffer copyCmd = createComputeCommandBuffer();
 		VkBufferCopy copyRegion = {};
 		copyRegion.size = storageBufferSize;
 		vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, compute.storageBuffer.buffer, 1, &copyRegion);
-		VulkanExampleBase::flushCommandBuffer(copyCmd, queue, true);
+		flushComputeCommandBuffer(copyCmd);
 
 		stagingBuffer.destroy();
 
@@ -392,12 +721,109 @@ public:
 		vertices.inputState.pVertexAttributeDescriptions = vertices.attributeDescriptions.data();
 	}
 
+	// Setup the buffers the graphics queue renders from
+	void prepareSlotBuffers()
+	{
+		for (auto &slot : slots)
+		{
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&slot.vertexBuffer,
+				numParticles * sizeof(Particle)));
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&slot.indexBuffer,
+				numParticles * sizeof(uint32_t)));
+		}
+	}
+
+	void destroySlotBuffers()
+	{
+		for (auto &slot : slots)
+		{
+			slot.vertexBuffer.destroy();
+			slot.indexBuffer.destroy();
+		}
+	}
+
+	// Setup the buffers for the Barnes-Hut octree
+	void prepareOctreeBuffers()
+	{
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&compute.octree.bodies,
+			numParticles * sizeof(glm::vec4)));
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&compute.octree.bodiesStaging,
+			numParticles * sizeof(glm::vec4)));
+		VK_CHECK_RESULT(compute.octree.bodiesStaging.map());
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&compute.octree.particles,
+			numParticles * sizeof(Particle)));
+		VK_CHECK_RESULT(compute.octree.particles.map());
+		// Leaves hold up to 8 bodies, so this is usually enough for all nodes
+		prepareOctreeNodeBuffers(numParticles / 2);
+	}
+
+	// The node buffers are recreated with a larger size if a tree doesn't fit
+	void prepareOctreeNodeBuffers(uint32_t nodeCapacity)
+	{
+		compute.octree.nodeCapacity = nodeCapacity;
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&compute.octree.nodes,
+			nodeCapacity * sizeof(vks::BarnesHut::Node)));
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&compute.octree.nodesStaging,
+			nodeCapacity * sizeof(vks::BarnesHut::Node)));
+		VK_CHECK_RESULT(compute.octree.nodesStaging.map());
+	}
+
+	void destroyOctreeBuffers()
+	{
+		compute.octree.nodes.destroy();
+		compute.octree.nodesStaging.destroy();
+		compute.octree.bodies.destroy();
+		compute.octree.bodiesStaging.destroy();
+		compute.octree.particles.destroy();
+	}
+
+	// Build the octree from the particles in the host visible buffer and copy it to the staging buffers
+	void updateOctree()
+	{
+		const Particle *particles = static_cast<const Particle*>(compute.octree.particles.mapped);
+		barnesHut->build(&particles[0].pos, numParticles, sizeof(Particle));
+
+		const std::vector<vks::BarnesHut::Node> &nodes = barnesHut->getNodes();
+		compute.octree.nodeCount = static_cast<uint32_t>(nodes.size());
+		if (compute.octree.nodeCount > compute.octree.nodeCapacity)
+		{
+			// The compute queue is idle at this point and the graphics queue doesn't use the octree
+			compute.octree.nodes.destroy();
+			compute.octree.nodesStaging.destroy();
+			prepareOctreeNodeBuffers(compute.octree.nodeCount + compute.octree.nodeCount / 2);
+			updateComputeDescriptorSet();
+		}
+		memcpy(compute.octree.nodesStaging.mapped, nodes.data(), nodes.size() * sizeof(vks::BarnesHut::Node));
+		memcpy(compute.octree.bodiesStaging.mapped, barnesHut->getBodies().data(), numParticles * sizeof(glm::vec4));
+	}
+
 	void setupDescriptorPool()
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes =
 		{
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3),
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2)
 		};
 
@@ -540,12 +966,12 @@ public:
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &graphics.pipeline));
 	}
 
-	void prepareCompute()
+	void prepareComputeQueue()
 	{
 		// Create a compute capable device queue
 		// The VulkanDevice::createLogicalDevice functions finds a compute capable queue and prefers queue families that only support compute
 		// Depending on the implementation this may result in different queue family indices for graphics and computes,
-		// requiring proper synchronization (see the memory barriers in buildComputeCommandBuffer)
+		// requiring proper synchronization (see the memory barriers in buildComputeCommandBuffer and buildCommandBuffers)
 		VkDeviceQueueCreateInfo queueCreateInfo = {};
 		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 		queueCreateInfo.pNext = NULL;
@@ -553,6 +979,39 @@ public:
 		queueCreateInfo.queueCount = 1;
 		vkGetDeviceQueue(device, vulkanDevice->queueFamilyIndices.compute, 0, &compute.queue);
 
+		// Separate command pool as queue family for compute may be different than graphics
+		VkCommandPoolCreateInfo cmdPoolInfo = {};
+		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		cmdPoolInfo.queueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &compute.commandPool));
+
+		// Create a command buffer for compute operations and the semaphores for cross queue synchronization for each slot
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+			vks::initializers::commandBufferAllocateInfo(
+				compute.commandPool,
+				VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+				1);
+		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+
+		for (auto &slot : slots)
+		{
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &slot.computeCommandBuffer));
+			VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &slot.computeComplete));
+			VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &slot.graphicsComplete));
+		}
+
+		// Fence for compute CB sync
+		VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &compute.fence));
+
+		// Timestamps for the GPU timeline, each slot has its own query pool on both queues
+		computeTimestamps = new vks::TimestampQueries(vulkanDevice, TIMESTAMP_COUNT, static_cast<uint32_t>(slots.size()), vulkanDevice->queueFamilyIndices.compute);
+		graphicsTimestamps = new vks::TimestampQueries(vulkanDevice, 2, static_cast<uint32_t>(slots.size()), vulkanDevice->queueFamilyIndices.graphics);
+	}
+
+	void prepareCompute()
+	{
 		// Create compute pipeline
 		// Compute pipelines are created separate from graphics pipelines even if they use the same queue (family index)
 
@@ -567,6 +1026,16 @@ public:
 				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
 				VK_SHADER_STAGE_COMPUTE_BIT,
 				1),
+			// Binding 2 : Octree nodes (Barnes-Hut)
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				2),
+			// Binding 3 : Octree bodies (Barnes-Hut)
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				3),
 		};
 
 		VkDescriptorSetLayoutCreateInfo descriptorLayout =
@@ -581,6 +1050,11 @@ public:
 				&compute.descriptorSetLayout,
 				1);
 
+		// Barnes-Hut opening criterion and node count
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(float) + sizeof(uint32_t), 0);
+		pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr,	&compute.pipelineLayout));
 
 		VkDescriptorSetAllocateInfo allocInfo =
@@ -591,23 +1065,7 @@ public:
 
 		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &compute.descriptorSet));
 
-		std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets =
-		{
-			// Binding 0 : Particle position storage buffer
-			vks::initializers::writeDescriptorSet(
-				compute.descriptorSet,
-				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-				0,
-				&compute.storageBuffer.descriptor),
-			// Binding 1 : Uniform buffer
-			vks::initializers::writeDescriptorSet(
-				compute.descriptorSet,
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				1,
-				&compute.uniformBuffer.descriptor)
-		};
-
-		vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
+		updateComputeDescriptorSet();
 
 		// Create pipelines
 		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(compute.pipelineLayout, 0);
@@ -629,7 +1087,9 @@ public:
 		specializationMapEntries.push_back(vks::initializers::specializationMapEntry(2, offsetof(SpecializationData, power), sizeof(float)));
 		specializationMapEntries.push_back(vks::initializers::specializationMapEntry(3, offsetof(SpecializationData, soften), sizeof(float)));
 
-		specializationData.sharedDataSize = std::min((uint32_t)1024, (uint32_t)(vulkanDevice->properties.limits.maxComputeSharedMemorySize / sizeof(glm::vec4)));
+		// The shader stages one position per invocation and iteration, so the shared data size has to match the work group size
+		// (a larger size skips particles, which was found by comparing against the CPU reference)
+		specializationData.sharedDataSize = std::min((uint32_t)256, (uint32_t)(vulkanDevice->properties.limits.maxComputeSharedMemorySize / sizeof(glm::vec4)));
 
 		specializationData.gravity = 0.002f;
 		specializationData.power = 0.75f;
@@ -641,32 +1101,70 @@ public:
 
 		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.pipelineCalculate));
 
+		// Alternative 1st pass using the octree, shares the force parameters
+		computePipelineCreateInfo.stage = loadShader(getAssetPath() + "shaders/computenbody/particle_barneshut.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.pipelineBarnesHut));
+
+		barnesHut = new vks::BarnesHut(getJobSystem());
+		barnesHut->settings.gravity = specializationData.gravity;
+		barnesHut->settings.power = specializationData.power;
+		barnesHut->settings.soften = specializationData.soften;
+
 		// 2nd pass
 		computePipelineCreateInfo.stage = loadShader(getAssetPath() + "shaders/computenbody/particle_integrate.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
 		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.pipelineIntegrate));
 
-		// Separate command pool as queue family for compute may be different than graphics
-		VkCommandPoolCreateInfo cmdPoolInfo = {};
-		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		cmdPoolInfo.queueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
-		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &compute.commandPool));
+		prepareDepthSort();
 
-		// Create a command buffer for compute operations
-		VkCommandBufferAllocateInfo cmdBufAllocateInfo =
-			vks::initializers::commandBufferAllocateInfo(
-				compute.commandPool,
-				VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-				1);	
+		// Build the command buffers containing the compute dispatch commands, one per slot
+		buildComputeCommandBuffers();
+	}
 
-		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &compute.commandBuffer));
+	void updateComputeDescriptorSet()
+	{
+		std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets =
+		{
+			// Binding 0 : Particle position storage buffer
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				0,
+				&compute.storageBuffer.descriptor),
+			// Binding 1 : Uniform buffer
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+				1,
+				&compute.uniformBuffer.descriptor),
+			// Binding 2 : Octree nodes
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				2,
+				&compute.octree.nodes.descriptor),
+			// Binding 3 : Octree bodies
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				3,
+				&compute.octree.bodies.descriptor)
+		};
 
-		// Fence for compute CB sync
-		VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &compute.fence));
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
+	}
 
-		// Build a single command buffer containing the compute dispatch commands
-		buildComputeCommandBuffer();
+	// Particle sorting, uses the first vec4 (position) of each particle for the view distance
+	void prepareDepthSort()
+	{
+		delete depthSorter;
+		depthSorter = new vks::DepthSort(vulkanDevice, numParticles);
+		depthSorter->prepare(
+			loadShader(getAssetPath() + "shaders/base/depthsortkeys.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT),
+			loadShader(getAssetPath() + "shaders/base/depthsortbitonic.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT),
+			pipelineCache,
+			compute.storageBuffer.descriptor,
+			sizeof(Particle));
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
@@ -711,33 +1209,150 @@ public:
 		memcpy(graphics.uniformBuffer.mapped, &graphics.ubo, sizeof(graphics.ubo));
 	}
 
-	void draw()
+	// Update the host side inputs of a simulation step and submit it, the previous step must have finished
+	void submitComputeStep(uint32_t slotIndex)
 	{
-		// Submit graphics commands
-		VulkanExampleBase::prepareFrame();
-
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		Slot &slot = slots[slotIndex];
 
-		VulkanExampleBase::submitFrame();
+		updateUniformBuffers();
+		if (solver == SOLVER_BARNES_HUT)
+		{
+			// The previous step has finished and its particles have been copied back, so the octree for this step can be built
+			// The command buffer is recorded again, as the node count changes with every step
+			updateOctree();
+			buildComputeCommandBuffer(slotIndex);
+		}
+		if (depthSort)
+		{
+			depthSorter->update(camera.matrices.view);
+		}
 
-		// Submit compute commands
-		vkWaitForFences(device, 1, &compute.fence, VK_TRUE, UINT64_MAX);
-		vkResetFences(device, 1, &compute.fence);
+		// The copies to the slot's buffers have to wait for the last frame that rendered this slot, the passes before them don't
+		VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
 
 		VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
+		computeSubmitInfo.waitSemaphoreCount = slot.graphicsPending ? 1 : 0;
+		computeSubmitInfo.pWaitSemaphores = &slot.graphicsComplete;
+		computeSubmitInfo.pWaitDstStageMask = &waitStageMask;
 		computeSubmitInfo.commandBufferCount = 1;
-		computeSubmitInfo.pCommandBuffers = &compute.commandBuffer;
+		computeSubmitInfo.pCommandBuffers = &slot.computeCommandBuffer;
+		computeSubmitInfo.signalSemaphoreCount = 1;
+		computeSubmitInfo.pSignalSemaphores = &slot.computeComplete;
 
+		VK_CHECK_RESULT(vkResetFences(device, 1, &compute.fence));
 		VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &computeSubmitInfo, compute.fence));
+		slot.graphicsPending = false;
+		stepSubmitted = true;
+	}
+
+	// Pick up the GPU timings of the last step and the previous frame, which the step ran concurrently with
+	void updateTimeline()
+	{
+		if (computeTimestamps->resolve(currentSlot))
+		{
+			gpuSortTime = computeTimestamps->getDuration(TIMESTAMP_SORT_BEGIN, TIMESTAMP_SORT_END);
+		}
+		else
+		{
+			return;
+		}
+		// The previous frame rendered the other slot, the graphics queue is idle after each frame (see VulkanExampleBase::submitFrame)
+		const uint32_t previousSlot = (currentSlot + 1) % static_cast<uint32_t>(slots.size());
+		if (!slots[previousSlot].graphicsPending || !graphicsTimestamps->resolve(previousSlot))
+		{
+			return;
+		}
+		timeline.stepTime = computeTimestamps->getDuration(TIMESTAMP_STEP_BEGIN, TIMESTAMP_STEP_END);
+		timeline.frameTime = graphicsTimestamps->getDuration(0, 1);
+		// Only meaningful if both queues use the same timestamp clock, which is the case on common implementations
+		const double begin = std::max(computeTimestamps->getTime(TIMESTAMP_STEP_BEGIN), graphicsTimestamps->getTime(0));
+		const double end = std::min(computeTimestamps->getTime(TIMESTAMP_STEP_END), graphicsTimestamps->getTime(1));
+		timeline.overlap = std::max(end - begin, 0.0);
+		timeline.valid = true;
+	}
+
+	// Wait for both queues and drop the results of the pending step, the next frame then starts with a new step
+	// Required if a change affects the buffers or command buffers of the pending step or frame
+	void resetComputeSteps()
+	{
+		vkQueueWaitIdle(queue);
+		vkQueueWaitIdle(compute.queue);
+
+		// Signaled semaphores have to be waited on before they can be signaled again
+		std::vector<VkSemaphore> pendingSemaphores;
+		if (stepSubmitted)
+		{
+			pendingSemaphores.push_back(slots[currentSlot].computeComplete);
+		}
+		for (auto &slot : slots)
+		{
+			if (slot.graphicsPending)
+			{
+				pendingSemaphores.push_back(slot.graphicsComplete);
+				slot.graphicsPending = false;
+			}
+		}
+		if (!pendingSemaphores.empty())
+		{
+			std::vector<VkPipelineStageFlags> waitStageMasks(pendingSemaphores.size(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+			VkSubmitInfo waitSubmitInfo = vks::initializers::submitInfo();
+			waitSubmitInfo.waitSemaphoreCount = static_cast<uint32_t>(pendingSemaphores.size());
+			waitSubmitInfo.pWaitSemaphores = pendingSemaphores.data();
+			waitSubmitInfo.pWaitDstStageMask = waitStageMasks.data();
+			VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &waitSubmitInfo, VK_NULL_HANDLE));
+			VK_CHECK_RESULT(vkQueueWaitIdle(compute.queue));
+		}
+		stepSubmitted = false;
+		timeline.valid = false;
+	}
+
+	void draw()
+	{
+		VulkanExampleBase::prepareFrame();
+
+		if (!stepSubmitted)
+		{
+			// The first frame has no step started by a previous frame
+			submitComputeStep(currentSlot);
+		}
+
+		// Submit graphics commands
+		// Rendering waits for the swap chain image and for the step that wrote the current slot's buffers
+		Slot &slot = slots[currentSlot];
+		std::array<VkSemaphore, 2> waitSemaphores = { semaphores.presentComplete, slot.computeComplete };
+		std::array<VkPipelineStageFlags, 2> waitStageMasks = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT };
+		std::array<VkSemaphore, 2> signalSemaphores = { semaphores.renderComplete, slot.graphicsComplete };
+
+		VkSubmitInfo graphicsSubmitInfo = vks::initializers::submitInfo();
+		graphicsSubmitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+		graphicsSubmitInfo.pWaitSemaphores = waitSemaphores.data();
+		graphicsSubmitInfo.pWaitDstStageMask = waitStageMasks.data();
+		graphicsSubmitInfo.commandBufferCount = 1;
+		graphicsSubmitInfo.pCommandBuffers = &slot.drawCommandBuffers[currentBuffer];
+		graphicsSubmitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+		graphicsSubmitInfo.pSignalSemaphores = signalSemaphores.data();
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &graphicsSubmitInfo, VK_NULL_HANDLE));
+		slot.graphicsPending = true;
+
+		// Submit compute commands for the next frame before presenting, so the step runs while this frame is rendered
+		// The last step had to finish before this frame could start, so waiting for it doesn't stall for long
+		// Its command buffer, the uniform buffer and the octree staging buffers can then be reused
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &compute.fence, VK_TRUE, UINT64_MAX));
+		updateTimeline();
+		currentSlot = (currentSlot + 1) % static_cast<uint32_t>(slots.size());
+		submitComputeStep(currentSlot);
+
+		VulkanExampleBase::submitFrame();
 	}
 
 	void prepare()
 	{
 		VulkanExampleBase::prepare();
 		loadAssets();
+		prepareComputeQueue();
 		prepareStorageBuffers();
+		prepareSlotBuffers();
+		prepareOctreeBuffers();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
 		preparePipelines();
@@ -752,14 +1367,365 @@ public:
 	{
 		if (!prepared)
 			return;
+		// The compute uniform buffer is updated in draw, as it may only be written while no step is in flight
 		draw();
-		updateUniformBuffers();
 	}
 
 	virtual void viewChanged()
 	{
 		updateGraphicsUniformBuffers();
 	}
+
+	void toggleDepthSort()
+	{
+		// The pending step was recorded without the index buffer copy, so it's dropped along with the command buffers
+		resetComputeSteps();
+		depthSort = !depthSort;
+		gpuSortTime = 0.0;
+		buildComputeCommandBuffers();
+		buildCommandBuffers();
+	}
+
+	void setSolver(Solver newSolver)
+	{
+		if ((newSolver == SOLVER_ALL_PAIRS) && (numParticles > MAX_ALL_PAIRS_PARTICLES))
+		{
+			return;
+		}
+		vkQueueWaitIdle(queue);
+		vkQueueWaitIdle(compute.queue);
+		if ((newSolver == SOLVER_BARNES_HUT) && (solver != SOLVER_BARNES_HUT))
+		{
+			// The first octree is built from the current particles, after that each step copies its results back
+			readbackParticles();
+			updateOctree();
+		}
+		solver = newSolver;
+		// The pending step has finished and still uses the previous solver, its results are valid nonetheless
+		buildComputeCommandBuffers();
+	}
+
+	// Select the next larger (direction = 1) or smaller (direction = -1) particle count and restart the simulation
+	void changeParticleCount(int32_t direction)
+	{
+		auto step = std::find(particleCountSteps.begin(), particleCountSteps.end(), particlesPerAttractor);
+		const int32_t index = (step != particleCountSteps.end()) ? static_cast<int32_t>(step - particleCountSteps.begin()) : 1;
+		const int32_t newIndex = std::min(std::max(index + direction, 0), static_cast<int32_t>(particleCountSteps.size()) - 1);
+		if (newIndex == index)
+		{
+			return;
+		}
+
+		resetComputeSteps();
+
+		particlesPerAttractor = particleCountSteps[newIndex];
+		compute.storageBuffer.destroy();
+		destroySlotBuffers();
+		destroyOctreeBuffers();
+		prepareStorageBuffers();
+		prepareSlotBuffers();
+		prepareOctreeBuffers();
+		updateComputeDescriptorSet();
+		prepareDepthSort();
+		// The particle count is read from the uniform buffer, so it needs to be updated before the next step
+		updateUniformBuffers();
+
+		if (numParticles > MAX_ALL_PAIRS_PARTICLES)
+		{
+			solver = SOLVER_BARNES_HUT;
+		}
+		if (solver == SOLVER_BARNES_HUT)
+		{
+			readbackParticles();
+			updateOctree();
+		}
+		buildComputeCommandBuffers();
+		buildCommandBuffers();
+	}
+
+	// Run a single velocity step on the GPU and compare the resulting accelerations against the CPU solver
+	void validateSolver()
+	{
+		vkQueueWaitIdle(queue);
+		vkQueueWaitIdle(compute.queue);
+
+		readbackParticles();
+		Particle *mapped = static_cast<Particle*>(compute.octree.particles.mapped);
+		const std::vector<Particle> before(mapped, mapped + numParticles);
+		updateOctree();
+
+		// With a delta time of 1 the velocity change of the step equals the acceleration
+		compute.ubo.deltaT = 1.0f;
+		memcpy(compute.uniformBuffer.mapped, &compute.ubo, sizeof(compute.ubo));
+
+		VkCommandBuffer commandBuffer = createComputeCommandBuffer();
+		if (solver == SOLVER_BARNES_HUT)
+		{
+			cmdUploadOctree(commandBuffer);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineBarnesHut);
+		}
+		else
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineCalculate);
+		}
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, 0);
+		vkCmdDispatch(commandBuffer, numParticles / 256, 1, 1);
+		cmdReadbackParticles(commandBuffer);
+		flushComputeCommandBuffer(commandBuffer);
+
+		const std::vector<Particle> after(mapped, mapped + numParticles);
+
+		// Restore the particles modified by the step
+		vks::Buffer stagingBuffer;
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&stagingBuffer,
+			numParticles * sizeof(Particle),
+			(void*)before.data()));
+		// The storage buffer is owned by the compute queue family
+		VkCommandBuffer copyCmd = createComputeCommandBuffer();
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = numParticles * sizeof(Particle);
+		vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, compute.storageBuffer.buffer, 1, &copyRegion);
+		flushComputeCommandBuffer(copyCmd);
+		stagingBuffer.destroy();
+		memcpy(mapped, before.data(), numParticles * sizeof(Particle));
+		updateUniformBuffers();
+
+		// CPU reference for all particles using the octree built above
+		std::vector<glm::vec4> accelerations(numParticles);
+		barnesHut->computeAccelerations(accelerations.data());
+
+		// The exact all pairs sum is O(n) per particle, so only a subset is compared
+		validation.done = true;
+		validation.solver = solver;
+		validation.samples = std::min(numParticles, 1024u);
+		validation.maxError = 0.0f;
+		validation.averageError = 0.0f;
+		validation.averageApproximationError = 0.0f;
+		validation.cpuTime = barnesHut->statistics.buildTime + barnesHut->statistics.forceTime;
+		for (uint32_t sample = 0; sample < validation.samples; sample++)
+		{
+			const uint32_t i = static_cast<uint32_t>((uint64_t)sample * numParticles / validation.samples);
+			const glm::vec3 gpuAcceleration = glm::vec3(after[i].vel - before[i].vel);
+			const glm::vec3 exactAcceleration = barnesHut->getExactAcceleration(glm::vec3(before[i].pos));
+			const glm::vec3 approximatedAcceleration = glm::vec3(accelerations[i]);
+			const glm::vec3 reference = (solver == SOLVER_BARNES_HUT) ? approximatedAcceleration : exactAcceleration;
+			const float error = glm::length(gpuAcceleration - reference) / std::max(glm::length(reference), 1e-6f);
+			validation.maxError = std::max(validation.maxError, error);
+			validation.averageError += error / validation.samples;
+			validation.averageApproximationError += glm::length(approximatedAcceleration - exactAcceleration) / std::max(glm::length(exactAcceleration), 1e-6f) / validation.samples;
+		}
+
+		std::cout << "Validation (" << ((solver == SOLVER_BARNES_HUT) ? "Barnes-Hut" : "all pairs") << ", " << numParticles << " particles): ";
+		std::cout << "avg. error " << validation.averageError << ", max. error " << validation.maxError << ", Barnes-Hut vs. all pairs " << validation.averageApproximationError;
+		std::cout << ", CPU build " << barnesHut->statistics.buildTime << " ms, forces " << barnesHut->statistics.forceTime << " ms" << std::endl;
+	}
+
+	// Sort random positions for increasing element counts (up to 1M) and check the resulting key order
+	void runSortBenchmark()
+	{
+		vkQueueWaitIdle(queue);
+		vkQueueWaitIdle(compute.queue);
+
+		const uint32_t maxCount = 1024 * 1024;
+
+		std::vector<glm::vec4> positions(maxCount);
+		std::mt19937 rndGen(0);
+		std::uniform_real_distribution<float> rndDist(-64.0f, 64.0f);
+		for (auto &position : positions)
+		{
+			position = glm::vec4(rndDist(rndGen), rndDist(rndGen), rndDist(rndGen), 1.0f);
+		}
+
+		vks::Buffer positionBuffer;
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&positionBuffer,
+			maxCount * sizeof(glm::vec4),
+			positions.data()));
+		vks::Buffer readbackBuffer;
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&readbackBuffer,
+			maxCount * sizeof(uint32_t)));
+		VK_CHECK_RESULT(readbackBuffer.map());
+
+		vks::DepthSort sorter(vulkanDevice, maxCount);
+		sorter.prepare(
+			loadShader(getAssetPath() + "shaders/base/depthsortkeys.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT),
+			loadShader(getAssetPath() + "shaders/base/depthsortbitonic.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT),
+			pipelineCache,
+			positionBuffer.descriptor,
+			sizeof(glm::vec4));
+		sorter.update(camera.matrices.view);
+		vks::TimestampQueries queries(vulkanDevice, 2, 1, vulkanDevice->queueFamilyIndices.compute);
+
+		VkCommandBuffer commandBuffer;
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(compute.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &commandBuffer));
+		VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FLAGS_NONE);
+		VkFence fence;
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
+
+		sortBenchmarkResults.clear();
+		for (uint32_t count = 1024; count <= maxCount; count *= 4)
+		{
+			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+			VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+			queries.cmdReset(commandBuffer, 0);
+			queries.cmdWriteTimestamp(commandBuffer, 0, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+			sorter.cmdSort(commandBuffer, count);
+			queries.cmdWriteTimestamp(commandBuffer, 0, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+			VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+			memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+			VkBufferCopy copyRegion = {};
+			copyRegion.size = count * sizeof(uint32_t);
+			vkCmdCopyBuffer(commandBuffer, sorter.buffers.keys.buffer, readbackBuffer.buffer, 1, &copyRegion);
+			memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+			VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+			VkSubmitInfo benchmarkSubmitInfo = vks::initializers::submitInfo();
+			benchmarkSubmitInfo.commandBufferCount = 1;
+			benchmarkSubmitInfo.pCommandBuffers = &commandBuffer;
+			VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &benchmarkSubmitInfo, fence));
+			VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+			VK_CHECK_RESULT(vkResetFences(device, 1, &fence));
+
+			SortBenchmarkResult result = {};
+			result.count = count;
+			result.time = queries.resolve(0) ? queries.getDuration(0, 1) : 0.0;
+			const uint32_t *keys = static_cast<const uint32_t*>(readbackBuffer.mapped);
+			result.sorted = std::is_sorted(keys, keys + count);
+			sortBenchmarkResults.push_back(result);
+
+			std::cout << "GPU depth sort: " << count << " keys (" << vks::DepthSort::getDispatchCount(count) << " dispatches) in " << result.time << " ms" << (result.sorted ? "" : ", ORDER INVALID") << std::endl;
+		}
+
+		vkDestroyFence(device, fence, nullptr);
+		vkFreeCommandBuffers(device, compute.commandPool, 1, &commandBuffer);
+		readbackBuffer.destroy();
+		positionBuffer.destroy();
+	}
+
+	virtual void keyPressed(uint32_t keyCode)
+	{
+		switch (keyCode)
+		{
+		case KEY_O:
+		case GAMEPAD_BUTTON_X:
+			toggleDepthSort();
+			updateTextOverlay();
+			break;
+		case KEY_B:
+		case GAMEPAD_BUTTON_A:
+			runSortBenchmark();
+			updateTextOverlay();
+			break;
+		case KEY_N:
+		case GAMEPAD_BUTTON_Y:
+			setSolver((solver == SOLVER_ALL_PAIRS) ? SOLVER_BARNES_HUT : SOLVER_ALL_PAIRS);
+			updateTextOverlay();
+			break;
+		case KEY_KPADD:
+		case GAMEPAD_BUTTON_R1:
+			changeParticleCount(1);
+			updateTextOverlay();
+			break;
+		case KEY_KPSUB:
+		case GAMEPAD_BUTTON_L1:
+			changeParticleCount(-1);
+			updateTextOverlay();
+			break;
+		case KEY_M:
+			// Cycle through 0.25, 0.5, 0.75 and 1.0, the command buffer picks up the new value with the next step
+			barnesHut->settings.theta = (barnesHut->settings.theta >= 1.0f) ? 0.25f : barnesHut->settings.theta + 0.25f;
+			updateTextOverlay();
+			break;
+		case KEY_T:
+		case GAMEPAD_BUTTON_B:
+			validateSolver();
+			updateTextOverlay();
+			break;
+		}
+	}
+
+	virtual void getOverlayText(VulkanTextOverlay *textOverlay)
+	{
+#if defined(__ANDROID__)
+		textOverlay->addText("Press \"Button X\" to toggle depth sorting, \"Button A\" to run the sort benchmark", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Press \"Button Y\" to toggle the solver, \"L1/R1\" to change the particle count", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Press \"Button B\" to validate against the CPU reference", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+#else
+		textOverlay->addText("Press \"O\" to toggle depth sorting, \"B\" to run the sort benchmark", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Press \"N\" to toggle the solver, \"+/-\" to change the particle count", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Press \"M\" to change theta, \"T\" to validate against the CPU reference", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+#endif
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(3);
+		ss << numParticles << " particles, ";
+		if (solver == SOLVER_BARNES_HUT)
+		{
+			ss << "Barnes-Hut (theta " << std::setprecision(2) << barnesHut->settings.theta << ", " << compute.octree.nodeCount << " nodes, build " << barnesHut->statistics.buildTime << " ms)";
+		}
+		else
+		{
+			ss << "all pairs";
+		}
+		textOverlay->addText(ss.str(), 5.0f, 130.0f, VulkanTextOverlay::alignLeft);
+		ss.str("");
+		ss << std::setprecision(3);
+		if (depthSort)
+		{
+			ss << "GPU depth sort: " << numParticles << " particles in " << gpuSortTime << " ms";
+		}
+		else
+		{
+			ss << "Depth sort disabled";
+		}
+		textOverlay->addText(ss.str(), 5.0f, 145.0f, VulkanTextOverlay::alignLeft);
+		ss.str("");
+		if (timeline.valid)
+		{
+			ss << "GPU: step " << timeline.stepTime << " ms, frame " << timeline.frameTime << " ms, overlap " << timeline.overlap << " ms";
+		}
+		else
+		{
+			ss << "GPU timestamps not available";
+		}
+		textOverlay->addText(ss.str(), 5.0f, 160.0f, VulkanTextOverlay::alignLeft);
+		float y = 175.0f;
+		if (validation.done)
+		{
+			ss.str("");
+			ss << "Validation (" << ((validation.solver == SOLVER_BARNES_HUT) ? "Barnes-Hut" : "all pairs") << ", " << validation.samples << " samples): ";
+			ss << "avg. error " << validation.averageError * 100.0f << "%, max. " << validation.maxError * 100.0f << "%, CPU " << validation.cpuTime << " ms";
+			textOverlay->addText(ss.str(), 5.0f, y, VulkanTextOverlay::alignLeft);
+			y += 15.0f;
+			if (validation.solver == SOLVER_BARNES_HUT)
+			{
+				ss.str("");
+				ss << "Barnes-Hut vs. all pairs: avg. error " << validation.averageApproximationError * 100.0f << "%";
+				textOverlay->addText(ss.str(), 5.0f, y, VulkanTextOverlay::alignLeft);
+				y += 15.0f;
+			}
+		}
+		for (auto &result : sortBenchmarkResults)
+		{
+			ss.str("");
+			ss << result.count << " keys: " << result.time << " ms" << (result.sorted ? "" : " (invalid order)");
+			textOverlay->addText(ss.str(), 5.0f, y, VulkanTextOverlay::alignLeft);
+			y += 15.0f;
+		}
+	}
 };
 
 VULKAN_EXAMPLE_MAIN()
\ No newline at end of file
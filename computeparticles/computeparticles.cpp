@@ -14,6 +14,8 @@
 #include <assert.h>
 #include <vector>
 #include <random>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -23,6 +25,7 @@
 #include <vulkan/vulkan.h>
 #include "vulkanexamplebase.h"
 #include "VulkanTexture.hpp"
+#include "VulkanTimestampQueries.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -61,12 +64,11 @@ public:
 
 	// Resources for the compute part of the example
 	struct {
-		vks::Buffer storageBuffer;					// (Shader) storage buffer object containing the particles
+		vks::Buffer storageBuffer;					// (Shader) storage buffer object containing the particles, only accessed by the compute queue
 		vks::Buffer uniformBuffer;					// Uniform buffer object containing particle system parameters
 		VkQueue queue;								// Separate queue for compute commands (queue family may differ from the one used for graphics)
 		VkCommandPool commandPool;					// Use a separate command pool (queue family may differ from the one used for graphics)
-		VkCommandBuffer commandBuffer;				// Command buffer storing the dispatch commands and barriers
-		VkFence fence;								// Synchronization fence to avoid rewriting compute CB if still in use
+		VkFence fence;								// Signaled once the last simulation step has finished, only one step is in flight at a time
 		VkDescriptorSetLayout descriptorSetLayout;	// Compute shader binding layout
 		VkDescriptorSet descriptorSet;				// Compute shader bindings
 		VkPipelineLayout pipelineLayout;			// Layout of the compute pipeline
@@ -79,6 +81,31 @@ public:
 		} ubo;
 	} compute;
 
+	// Each simulation step copies its results to the vertex buffer of one of two slots, which is then rendered by the graphics queue
+	// The step for the next frame writes to the other slot, so it runs on the compute queue while the current frame is being rendered
+	struct Slot {
+		vks::Buffer vertexBuffer;							// Copy of the particles for rendering
+		VkCommandBuffer computeCommandBuffer;				// Simulation step writing this slot
+		std::vector<VkCommandBuffer> drawCommandBuffers;	// One per swap chain image
+		VkSemaphore computeComplete;						// Signaled by the step, waited on by the frame rendering this slot
+		VkSemaphore graphicsComplete;						// Signaled by the frame, waited on by the next step writing this slot
+		bool graphicsPending = false;						// True if graphicsComplete has been signaled but not waited on yet
+	};
+	std::array<Slot, 2> slots;
+	// Slot written by the last submitted step
+	uint32_t currentSlot = 0;
+	bool stepSubmitted = false;
+
+	// GPU timings of the last step and the frame it ran concurrently with
+	vks::TimestampQueries *computeTimestamps = nullptr;
+	vks::TimestampQueries *graphicsTimestamps = nullptr;
+	struct {
+		bool valid = false;
+		double stepTime;
+		double frameTime;
+		double overlap;
+	} timeline;
+
 	// SSBO particle declaration
 	struct Particle {
 		glm::vec2 pos;								// Particle position
@@ -108,6 +135,15 @@ public:
 		vkDestroyFence(device, compute.fence, nullptr);
 		vkDestroyCommandPool(device, compute.commandPool, nullptr);
 
+		for (auto &slot : slots)
+		{
+			slot.vertexBuffer.destroy();
+			vkDestroySemaphore(device, slot.computeComplete, nullptr);
+			vkDestroySemaphore(device, slot.graphicsComplete, nullptr);
+		}
+		delete computeTimestamps;
+		delete graphicsTimestamps;
+
 		textures.particle.destroy();
 		textures.gradient.destroy();
 	}
@@ -120,11 +156,19 @@ public:
 
 	void buildCommandBuffers()
 	{
-		// Destroy command buffers if already present
-		if (!checkCommandBuffers())
+		// The draw command buffers of the base class are replaced by one set per slot, as each slot has its own vertex buffer
+		for (auto &slot : slots)
 		{
-			destroyCommandBuffers();
-			createCommandBuffers();
+			if (slot.drawCommandBuffers.size() != drawCmdBuffers.size())
+			{
+				if (!slot.drawCommandBuffers.empty())
+				{
+					vkFreeCommandBuffers(device, cmdPool, static_cast<uint32_t>(slot.drawCommandBuffers.size()), slot.drawCommandBuffers.data());
+				}
+				slot.drawCommandBuffers.resize(drawCmdBuffers.size());
+				VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, static_cast<uint32_t>(slot.drawCommandBuffers.size()));
+				VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, slot.drawCommandBuffers.data()));
+			}
 		}
 
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
@@ -142,92 +186,154 @@ public:
 		renderPassBeginInfo.clearValueCount = 2;
 		renderPassBeginInfo.pClearValues = clearValues;
 
-		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
+		for (uint32_t s = 0; s < static_cast<uint32_t>(slots.size()); s++)
 		{
-			// Set target frame buffer
-			renderPassBeginInfo.framebuffer = frameBuffers[i];
+			for (int32_t i = 0; i < slots[s].drawCommandBuffers.size(); ++i)
+			{
+				VkCommandBuffer commandBuffer = slots[s].drawCommandBuffers[i];
 
-			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
+				// Set target frame buffer
+				renderPassBeginInfo.framebuffer = frameBuffers[i];
 
-			// Draw the particle system using the update vertex buffer
+				VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
 
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+				graphicsTimestamps->cmdReset(commandBuffer, s);
+				graphicsTimestamps->cmdWriteTimestamp(commandBuffer, s, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 
-			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+				// Acquire the vertex buffer released by the compute queue (see buildComputeCommandBuffer)
+				// Not required if both queues are from the same family, the semaphore the frame waits on already makes the compute results visible
+				if (vulkanDevice->queueFamilyIndices.graphics != vulkanDevice->queueFamilyIndices.compute)
+				{
+					VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+					bufferBarrier.buffer = slots[s].vertexBuffer.buffer;
+					bufferBarrier.size = slots[s].vertexBuffer.descriptor.range;
+					bufferBarrier.srcAccessMask = 0;
+					bufferBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+					bufferBarrier.srcQueueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
+					bufferBarrier.dstQueueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;
 
-			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
-			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+					vkCmdPipelineBarrier(
+						commandBuffer,
+						VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+						VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+						VK_FLAGS_NONE,
+						0, nullptr,
+						1, &bufferBarrier,
+						0, nullptr);
+				}
 
-			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
+				// Draw the particle system using the update vertex buffer
 
-			VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &compute.storageBuffer.buffer, offsets);
-			vkCmdDraw(drawCmdBuffers[i], PARTICLE_COUNT, 1, 0, 0);
+				vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-			vkCmdEndRenderPass(drawCmdBuffers[i]);
+				VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+				vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
-		}
+				VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+				vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
+
+				VkDeviceSize offsets[1] = { 0 };
+				vkCmdBindVertexBuffers(commandBuffer, VERTEX_BUFFER_BIND_ID, 1, &slots[s].vertexBuffer.buffer, offsets);
+				vkCmdDraw(commandBuffer, PARTICLE_COUNT, 1, 0, 0);
+
+				vkCmdEndRenderPass(commandBuffer);
+
+				// No release back to the compute queue: The next step overwrites the whole vertex buffer, so its contents don't need to be preserved
+				// The semaphore signaled by this frame keeps the next step from writing it too early
+
+				graphicsTimestamps->cmdWriteTimestamp(commandBuffer, s, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
+				VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+			}
+		}
 	}
 
-	void buildComputeCommandBuffer()
+	void buildComputeCommandBuffer(uint32_t slotIndex)
 	{
+		Slot &slot = slots[slotIndex];
+
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
-		VK_CHECK_RESULT(vkBeginCommandBuffer(compute.commandBuffer, &cmdBufInfo));
+		VK_CHECK_RESULT(vkBeginCommandBuffer(slot.computeCommandBuffer, &cmdBufInfo));
+
+		computeTimestamps->cmdReset(slot.computeCommandBuffer, slotIndex);
+		computeTimestamps->cmdWriteTimestamp(slot.computeCommandBuffer, slotIndex, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 
 		// Compute particle movement
 
-		// Add memory barrier to ensure that the (graphics) vertex shader has fetched attributes before compute starts to write to the buffer
+		// Add memory barrier to ensure that the previous step has finished writing the buffer and copying it to its slot before this step writes to it
+		// The storage buffer never leaves the compute queue, so no ownership transfer is necessary
 		VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
 		bufferBarrier.buffer = compute.storageBuffer.buffer;
 		bufferBarrier.size = compute.storageBuffer.descriptor.range;
-		bufferBarrier.srcAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;						// Vertex shader invocations have finished reading from the buffer
-		bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;								// Compute shader wants to write to the buffer
-		// Compute and graphics queue may have different queue families (see VulkanDevice::createLogicalDevice)
-		// For the barrier to work across different queues, we need to set their family indices
-		bufferBarrier.srcQueueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;			// Required as compute and graphics queue may have different families
-		bufferBarrier.dstQueueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;			// Required as compute and graphics queue may have different families
+		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 
 		vkCmdPipelineBarrier(
-			compute.commandBuffer,
-			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			slot.computeCommandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
 			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
 			VK_FLAGS_NONE,
 			0, nullptr,
 			1, &bufferBarrier,
 			0, nullptr);
 
-		vkCmdBindPipeline(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
-		vkCmdBindDescriptorSets(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, 0);
+		vkCmdBindPipeline(slot.computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
+		vkCmdBindDescriptorSets(slot.computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, 0);
 
 		// Dispatch the compute job
-		vkCmdDispatch(compute.commandBuffer, PARTICLE_COUNT / 256, 1, 1);
+		vkCmdDispatch(slot.computeCommandBuffer, PARTICLE_COUNT / 256, 1, 1);
 
-		// Add memory barrier to ensure that compute shader has finished writing to the buffer
-		// Without this the (rendering) vertex shader may display incomplete results (partial data from last frame) 
-		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;								// Compute shader has finished writes to the buffer
-		bufferBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;						// Vertex shader invocations want to read from the buffer
-		bufferBarrier.buffer = compute.storageBuffer.buffer;
-		bufferBarrier.size = compute.storageBuffer.descriptor.range;
-		// Compute and graphics queue may have different queue families (see VulkanDevice::createLogicalDevice)
-		// For the barrier to work across different queues, we need to set their family indices
-		bufferBarrier.srcQueueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;			// Required as compute and graphics queue may have different families
-		bufferBarrier.dstQueueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;			// Required as compute and graphics queue may have different families
+		// Add memory barrier to ensure that compute shader has finished writing to the buffer before it's copied
+		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
 		vkCmdPipelineBarrier(
-			compute.commandBuffer,
+			slot.computeCommandBuffer,
 			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
 			VK_FLAGS_NONE,
 			0, nullptr,
 			1, &bufferBarrier,
 			0, nullptr);
 
-		vkEndCommandBuffer(compute.commandBuffer);
+		// Copy the results to the slot's vertex buffer
+		// The submission waits for the last frame that rendered this slot at the transfer stage, so the dispatch above may still overlap with it
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = PARTICLE_COUNT * sizeof(Particle);
+		vkCmdCopyBuffer(slot.computeCommandBuffer, compute.storageBuffer.buffer, slot.vertexBuffer.buffer, 1, &copyRegion);
+
+		// Release the vertex buffer to the graphics queue (matching the acquire in buildCommandBuffers)
+		// Compute and graphics queue may have different queue families (see VulkanDevice::createLogicalDevice)
+		// If they are the same, the semaphore signaled by the submission makes the copy visible to the graphics queue
+		if (vulkanDevice->queueFamilyIndices.graphics != vulkanDevice->queueFamilyIndices.compute)
+		{
+			VkBufferMemoryBarrier releaseBarrier = vks::initializers::bufferMemoryBarrier();
+			releaseBarrier.buffer = slot.vertexBuffer.buffer;
+			releaseBarrier.size = slot.vertexBuffer.descriptor.range;
+			releaseBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			releaseBarrier.dstAccessMask = 0;
+			releaseBarrier.srcQueueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
+			releaseBarrier.dstQueueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;
+
+			vkCmdPipelineBarrier(
+				slot.computeCommandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				VK_FLAGS_NONE,
+				0, nullptr,
+				1, &releaseBarrier,
+				0, nullptr);
+		}
+
+		computeTimestamps->cmdWriteTimestamp(slot.computeCommandBuffer, slotIndex, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+		vkEndCommandBuffer(slot.computeCommandBuffer);
 	}
 
 	// Setup and fill the compute shader storage buffers containing the particles
@@ -260,18 +366,38 @@ public:
 			particleBuffer.data());
 
 		vulkanDevice->createBuffer(
-			// The SSBO will be used as a storage buffer for the compute pipeline and as a vertex buffer in the graphics pipeline
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			// The SSBO will be used as a storage buffer for the compute pipeline, the results of each step are copied to the vertex buffers of the slots
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 			&compute.storageBuffer,
 			storageBufferSize);
 
+		for (auto &slot : slots)
+		{
+			vulkanDevice->createBuffer(
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&slot.vertexBuffer,
+				storageBufferSize);
+		}
+
 		// Copy to staging buffer
-		VkCommandBuffer copyCmd = VulkanExampleBase::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		// This is done on the compute queue, so the storage buffer is owned by the compute queue family from the start
+		VkCommandBuffer copyCmd;
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(compute.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &copyCmd));
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
 		VkBufferCopy copyRegion = {};
 		copyRegion.size = storageBufferSize;
 		vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, compute.storageBuffer.buffer, 1, &copyRegion);
-		VulkanExampleBase::flushCommandBuffer(copyCmd, queue, true);
+		VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
+		VkSubmitInfo copySubmitInfo = vks::initializers::submitInfo();
+		copySubmitInfo.commandBufferCount = 1;
+		copySubmitInfo.pCommandBuffers = &copyCmd;
+		VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &copySubmitInfo, VK_NULL_HANDLE));
+		VK_CHECK_RESULT(vkQueueWaitIdle(compute.queue));
+		vkFreeCommandBuffers(device, compute.commandPool, 1, &copyCmd);
 
 		stagingBuffer.destroy();
 
@@ -470,12 +596,12 @@ public:
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &graphics.pipeline));
 	}
 
-	void prepareCompute()
+	void prepareComputeQueue()
 	{
 		// Create a compute capable device queue
 		// The VulkanDevice::createLogicalDevice functions finds a compute capable queue and prefers queue families that only support compute
 		// Depending on the implementation this may result in different queue family indices for graphics and computes,
-		// requiring proper synchronization (see the memory barriers in buildComputeCommandBuffer)
+		// requiring proper synchronization (see the memory barriers in buildComputeCommandBuffer and buildCommandBuffers)
 		VkDeviceQueueCreateInfo queueCreateInfo = {};
 		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 		queueCreateInfo.pNext = NULL;
@@ -483,6 +609,39 @@ public:
 		queueCreateInfo.queueCount = 1;
 		vkGetDeviceQueue(device, vulkanDevice->queueFamilyIndices.compute, 0, &compute.queue);
 
+		// Separate command pool as queue family for compute may be different than graphics
+		VkCommandPoolCreateInfo cmdPoolInfo = {};
+		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		cmdPoolInfo.queueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &compute.commandPool));
+
+		// Create a command buffer for compute operations and the semaphores for cross queue synchronization for each slot
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+			vks::initializers::commandBufferAllocateInfo(
+				compute.commandPool,
+				VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+				1);
+		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+
+		for (auto &slot : slots)
+		{
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &slot.computeCommandBuffer));
+			VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &slot.computeComplete));
+			VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &slot.graphicsComplete));
+		}
+
+		// Fence for compute CB sync
+		VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &compute.fence));
+
+		// Timestamps for the GPU timeline, each slot has its own query pool on both queues
+		computeTimestamps = new vks::TimestampQueries(vulkanDevice, 2, static_cast<uint32_t>(slots.size()), vulkanDevice->queueFamilyIndices.compute);
+		graphicsTimestamps = new vks::TimestampQueries(vulkanDevice, 2, static_cast<uint32_t>(slots.size()), vulkanDevice->queueFamilyIndices.graphics);
+	}
+
+	void prepareCompute()
+	{
 		// Create compute pipeline
 		// Compute pipelines are created separate from graphics pipelines even if they use the same queue (family index)
 
@@ -544,28 +703,11 @@ public:
 		computePipelineCreateInfo.stage = loadShader(getAssetPath() + "shaders/computeparticles/particle.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
 		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.pipeline));
 
-		// Separate command pool as queue family for compute may be different than graphics
-		VkCommandPoolCreateInfo cmdPoolInfo = {};
-		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		cmdPoolInfo.queueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
-		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &compute.commandPool));
-
-		// Create a command buffer for compute operations
-		VkCommandBufferAllocateInfo cmdBufAllocateInfo =
-			vks::initializers::commandBufferAllocateInfo(
-				compute.commandPool,
-				VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-				1);	
-
-		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &compute.commandBuffer));
-
-		// Fence for compute CB sync
-		VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &compute.fence));
-
-		// Build a single command buffer containing the compute dispatch commands
-		buildComputeCommandBuffer();
+		// Build the command buffers containing the compute dispatch commands, one per slot
+		for (uint32_t i = 0; i < static_cast<uint32_t>(slots.size()); i++)
+		{
+			buildComputeCommandBuffer(i);
+		}
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
@@ -603,32 +745,93 @@ public:
 		memcpy(compute.uniformBuffer.mapped, &compute.ubo, sizeof(compute.ubo));
 	}
 
-	void draw()
+	// Submit the simulation step writing the given slot
+	void submitComputeStep(uint32_t slotIndex)
 	{
-		// Submit graphics commands
-		VulkanExampleBase::prepareFrame();
+		Slot &slot = slots[slotIndex];
 
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
-
-		VulkanExampleBase::submitFrame();
-
-		// Submit compute commands
-		vkWaitForFences(device, 1, &compute.fence, VK_TRUE, UINT64_MAX);
-		vkResetFences(device, 1, &compute.fence);
+		// The copy to the vertex buffer has to wait for the last frame that rendered this slot, the dispatch before it doesn't
+		VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
 
 		VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
+		computeSubmitInfo.waitSemaphoreCount = slot.graphicsPending ? 1 : 0;
+		computeSubmitInfo.pWaitSemaphores = &slot.graphicsComplete;
+		computeSubmitInfo.pWaitDstStageMask = &waitStageMask;
 		computeSubmitInfo.commandBufferCount = 1;
-		computeSubmitInfo.pCommandBuffers = &compute.commandBuffer;
+		computeSubmitInfo.pCommandBuffers = &slot.computeCommandBuffer;
+		computeSubmitInfo.signalSemaphoreCount = 1;
+		computeSubmitInfo.pSignalSemaphores = &slot.computeComplete;
 
+		VK_CHECK_RESULT(vkResetFences(device, 1, &compute.fence));
 		VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &computeSubmitInfo, compute.fence));
+		slot.graphicsPending = false;
+		stepSubmitted = true;
+	}
+
+	// Pick up the GPU timings of the last step and the previous frame, which the step ran concurrently with
+	void updateTimeline()
+	{
+		// The previous frame rendered the other slot, the graphics queue is idle after each frame (see VulkanExampleBase::submitFrame)
+		const uint32_t previousSlot = (currentSlot + 1) % static_cast<uint32_t>(slots.size());
+		if (!slots[previousSlot].graphicsPending || !computeTimestamps->resolve(currentSlot) || !graphicsTimestamps->resolve(previousSlot))
+		{
+			return;
+		}
+		timeline.stepTime = computeTimestamps->getDuration(0, 1);
+		timeline.frameTime = graphicsTimestamps->getDuration(0, 1);
+		// Only meaningful if both queues use the same timestamp clock, which is the case on common implementations
+		const double begin = std::max(computeTimestamps->getTime(0), graphicsTimestamps->getTime(0));
+		const double end = std::min(computeTimestamps->getTime(1), graphicsTimestamps->getTime(1));
+		timeline.overlap = std::max(end - begin, 0.0);
+		timeline.valid = true;
+	}
+
+	void draw()
+	{
+		VulkanExampleBase::prepareFrame();
+
+		if (!stepSubmitted)
+		{
+			// The first frame has no step started by a previous frame
+			updateUniformBuffers();
+			submitComputeStep(currentSlot);
+		}
+
+		// Submit graphics commands
+		// Rendering waits for the swap chain image and for the step that wrote the current slot's vertex buffer
+		Slot &slot = slots[currentSlot];
+		std::array<VkSemaphore, 2> waitSemaphores = { semaphores.presentComplete, slot.computeComplete };
+		std::array<VkPipelineStageFlags, 2> waitStageMasks = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT };
+		std::array<VkSemaphore, 2> signalSemaphores = { semaphores.renderComplete, slot.graphicsComplete };
+
+		VkSubmitInfo graphicsSubmitInfo = vks::initializers::submitInfo();
+		graphicsSubmitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+		graphicsSubmitInfo.pWaitSemaphores = waitSemaphores.data();
+		graphicsSubmitInfo.pWaitDstStageMask = waitStageMasks.data();
+		graphicsSubmitInfo.commandBufferCount = 1;
+		graphicsSubmitInfo.pCommandBuffers = &slot.drawCommandBuffers[currentBuffer];
+		graphicsSubmitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+		graphicsSubmitInfo.pSignalSemaphores = signalSemaphores.data();
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &graphicsSubmitInfo, VK_NULL_HANDLE));
+		slot.graphicsPending = true;
+
+		// Submit compute commands for the next frame before presenting, so the step runs while this frame is rendered
+		// The last step had to finish before this frame could start, so waiting for it doesn't stall for long
+		// Its command buffer can then be reused and the uniform buffer can be updated
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &compute.fence, VK_TRUE, UINT64_MAX));
+		updateTimeline();
+		updateUniformBuffers();
+		currentSlot = (currentSlot + 1) % static_cast<uint32_t>(slots.size());
+		submitComputeStep(currentSlot);
+
+		VulkanExampleBase::submitFrame();
 	}
 
 	void prepare()
 	{
 		VulkanExampleBase::prepare();
 		loadAssets();
+		prepareComputeQueue();
 		prepareStorageBuffers();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
@@ -646,6 +849,7 @@ public:
 			return;
 		draw();
 
+		// The uniform buffer is updated in draw, as it may only be written while no step is in flight
 		if (animate)
 		{
 			if (animStart > 0.0f)
@@ -659,8 +863,6 @@ public:
 					timer = 0.f;
 			}
 		}
-		
-		updateUniformBuffers();
 	}
 
 	void toggleAnimation()
@@ -678,6 +880,31 @@ public:
 			break;
 		}
 	}
+
+	virtual void getOverlayText(VulkanTextOverlay *textOverlay)
+	{
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(2);
+		if (vulkanDevice->queueFamilyIndices.compute != vulkanDevice->queueFamilyIndices.graphics)
+		{
+			ss << "Dedicated compute queue family " << vulkanDevice->queueFamilyIndices.compute;
+		}
+		else
+		{
+			ss << "Compute and graphics share queue family " << vulkanDevice->queueFamilyIndices.compute;
+		}
+		textOverlay->addText(ss.str(), 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		ss.str("");
+		if (timeline.valid)
+		{
+			ss << "GPU: step " << timeline.stepTime << " ms, frame " << timeline.frameTime << " ms, overlap " << timeline.overlap << " ms";
+		}
+		else
+		{
+			ss << "GPU timestamps not available";
+		}
+		textOverlay->addText(ss.str(), 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+	}
 };
 
 VULKAN_EXAMPLE_MAIN()
\ No newline at end of file
@@ -1,2 +1,5 @@
 glslangvalidator -V textoverlay.vert -o textoverlay.vert.spv
-glslangvalidator -V textoverlay.frag -o textoverlay.frag.spv
\ No newline at end of file
+glslangvalidator -V textoverlay.frag -o textoverlay.frag.spv
+glslangvalidator -V clusteredlights.comp -o clusteredlights.comp.spv
+glslangvalidator -V depthsortkeys.comp -o depthsortkeys.comp.spv
+glslangvalidator -V depthsortbitonic.comp -o depthsortbitonic.comp.spv
\ No newline at end of file
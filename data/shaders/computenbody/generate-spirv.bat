@@ -0,0 +1,5 @@
+glslangvalidator -V particle.vert -o particle.vert.spv
+glslangvalidator -V particle.frag -o particle.frag.spv
+glslangvalidator -V particle_calculate.comp -o particle_calculate.comp.spv
+glslangvalidator -V particle_integrate.comp -o particle_integrate.comp.spv
+glslangvalidator -V particle_barneshut.comp -o particle_barneshut.comp.spv
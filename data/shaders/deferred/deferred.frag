@@ -3,6 +3,8 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
+// Clustered shading of the G-Buffer
+// Set 0: G-Buffer
 layout (binding = 1) uniform sampler2D samplerposition;
 layout (binding = 2) uniform sampler2D samplerNormal;
 layout (binding = 3) uniform sampler2D samplerAlbedo;
@@ -17,12 +19,31 @@ struct Light {
 	float radius;
 };
 
-layout (binding = 4) uniform UBO 
+// Light clusters (see base/VulkanClusteredLights.hpp)
+layout (set = 1, binding = 0) uniform Params 
 {
-	Light lights[6];
+	mat4 view;
 	vec4 viewPos;
-} ubo;
+	vec4 tileSize;
+	uvec4 grid;
+	vec4 shading;
+	uvec4 limits;
+} params;
 
+layout (set = 1, binding = 1) readonly buffer Lights
+{
+	Light lights[];
+};
+
+layout (set = 1, binding = 2) readonly buffer Clusters
+{
+	uvec2 clusters[];
+};
+
+layout (set = 1, binding = 3) readonly buffer LightIndices
+{
+	uint lightIndices[];
+};
 
 void main() 
 {
@@ -30,46 +51,46 @@ void main()
 	vec3 fragPos = texture(samplerposition, inUV).rgb;
 	vec3 normal = texture(samplerNormal, inUV).rgb;
 	vec4 albedo = texture(samplerAlbedo, inUV);
-	
-	#define lightCount 6
-	#define ambient 0.0
-	
+
+	// Find the fragment's cluster from its screen tile and (exponentially sliced) view space depth
+	float depth = -(params.view * vec4(fragPos, 1.0)).z;
+	uvec3 cluster;
+	cluster.xy = min(uvec2(gl_FragCoord.xy / params.tileSize.xy), params.grid.xy - 1);
+	cluster.z = uint(clamp(log(max(depth, 0.0001)) * params.tileSize.z + params.tileSize.w, 0.0, float(params.grid.z - 1)));
+	uvec2 lightList = clusters[cluster.x + params.grid.x * (cluster.y + params.grid.y * cluster.z)];
+
+	vec3 N = normalize(normal);
+	vec3 V = normalize(params.viewPos.xyz - fragPos);
+
 	// Ambient part
-	vec3 fragcolor  = albedo.rgb * ambient;
-	
-	for(int i = 0; i < lightCount; ++i)
+	vec3 fragcolor = albedo.rgb * params.shading.x;
+
+	// Only the lights assigned to the cluster are evaluated
+	for (uint i = 0; i < lightList.y; i++)
 	{
+		Light light = lights[lightIndices[lightList.x + i]];
+
 		// Vector to light
-		vec3 L = ubo.lights[i].position.xyz - fragPos;
-		// Distance from light to fragment position
-		float dist = length(L);
-
-		// Viewer to fragment
-		vec3 V = ubo.viewPos.xyz - fragPos;
-		V = normalize(V);
-		
-		//if(dist < ubo.lights[i].radius)
-		{
-			// Light to fragment
-			L = normalize(L);
-
-			// Attenuation
-			float atten = ubo.lights[i].radius / (pow(dist, 2.0) + 1.0);
-
-			// Diffuse part
-			vec3 N = normalize(normal);
-			float NdotL = max(0.0, dot(N, L));
-			vec3 diff = ubo.lights[i].color * albedo.rgb * NdotL * atten;
-
-			// Specular part
-			// Specular map values are stored in alpha of albedo mrt
-			vec3 R = reflect(-L, N);
-			float NdotR = max(0.0, dot(R, V));
-			vec3 spec = ubo.lights[i].color * albedo.a * pow(NdotR, 16.0) * atten;
-
-			fragcolor += diff + spec;	
-		}	
-	}    	
-   
-  outFragcolor = vec4(fragcolor, 1.0);	
-}
\ No newline at end of file
+		vec3 L = light.position.xyz - fragPos;
+		float dist2 = dot(L, L);
+		L = normalize(L);
+
+		// Attenuation falls off to zero at the light's range, so lights outside of a cluster never contribute
+		float falloff = clamp(1.0 - dist2 / (light.radius * light.radius), 0.0, 1.0);
+		float atten = falloff * falloff;
+
+		// Diffuse part
+		float NdotL = max(0.0, dot(N, L));
+		vec3 diff = light.color * albedo.rgb * NdotL * atten;
+
+		// Specular part
+		// Specular map values are stored in alpha of albedo mrt
+		vec3 R = reflect(-L, N);
+		float NdotR = max(0.0, dot(R, V));
+		vec3 spec = light.color * albedo.a * pow(NdotR, 16.0) * atten * params.shading.y;
+
+		fragcolor += diff + spec;
+	}
+
+	outFragcolor = vec4(fragcolor, 1.0);
+}
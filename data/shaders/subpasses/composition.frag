@@ -3,6 +3,8 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
+// Clustered shading of the G-Buffer
+// Set 0: G-Buffer attachments written by the previous sub pass
 layout (input_attachment_index = 1, binding = 0) uniform subpassInput samplerposition;
 layout (input_attachment_index = 2, binding = 1) uniform subpassInput samplerNormal;
 layout (input_attachment_index = 3, binding = 2) uniform subpassInput samplerAlbedo;
@@ -14,20 +16,37 @@ layout (location = 1) out vec4 outPosition;
 layout (location = 2) out vec4 outNormal;
 layout (location = 3) out vec4 outAlbedo;
 
-layout (constant_id = 0) const int NUM_LIGHTS = 64;
-
 struct Light {
 	vec4 position;
 	vec3 color;
 	float radius;
 };
 
-layout (binding = 3) uniform UBO 
+// Light clusters (see base/VulkanClusteredLights.hpp)
+layout (set = 1, binding = 0) uniform Params 
 {
+	mat4 view;
 	vec4 viewPos;
-	Light lights[NUM_LIGHTS];
-} ubo;
+	vec4 tileSize;
+	uvec4 grid;
+	vec4 shading;
+	uvec4 limits;
+} params;
+
+layout (set = 1, binding = 1) readonly buffer Lights
+{
+	Light lights[];
+};
 
+layout (set = 1, binding = 2) readonly buffer Clusters
+{
+	uvec2 clusters[];
+};
+
+layout (set = 1, binding = 3) readonly buffer LightIndices
+{
+	uint lightIndices[];
+};
 
 void main() 
 {
@@ -35,47 +54,51 @@ void main()
 	vec3 fragPos = subpassLoad(samplerposition).rgb;
 	vec3 normal = subpassLoad(samplerNormal).rgb;
 	vec4 albedo = subpassLoad(samplerAlbedo);
-	
-	#define ambient 0.15
-	
+
+	// Find the fragment's cluster from its screen tile and (exponentially sliced) view space depth
+	float depth = -(params.view * vec4(fragPos, 1.0)).z;
+	uvec3 cluster;
+	cluster.xy = min(uvec2(gl_FragCoord.xy / params.tileSize.xy), params.grid.xy - 1);
+	cluster.z = uint(clamp(log(max(depth, 0.0001)) * params.tileSize.z + params.tileSize.w, 0.0, float(params.grid.z - 1)));
+	uvec2 lightList = clusters[cluster.x + params.grid.x * (cluster.y + params.grid.y * cluster.z)];
+
+	vec3 N = normalize(normal);
+	vec3 V = normalize(params.viewPos.xyz - fragPos);
+
 	// Ambient part
-	vec3 fragcolor  = albedo.rgb * ambient;
-	
-	for(int i = 0; i < NUM_LIGHTS; ++i)
+	vec3 fragcolor = albedo.rgb * params.shading.x;
+
+	// Only the lights assigned to the cluster are evaluated
+	for (uint i = 0; i < lightList.y; i++)
 	{
+		Light light = lights[lightIndices[lightList.x + i]];
+
 		// Vector to light
-		vec3 L = ubo.lights[i].position.xyz - fragPos;
-		// Distance from light to fragment position
-		float dist = length(L);
-
-		// Viewer to fragment
-		vec3 V = ubo.viewPos.xyz - fragPos;
-		V = normalize(V);
-		
-		// Light to fragment
+		vec3 L = light.position.xyz - fragPos;
+		float dist2 = dot(L, L);
 		L = normalize(L);
 
-		// Attenuation
-		float atten = ubo.lights[i].radius / (pow(dist, 2.0) + 1.0);
+		// Attenuation falls off to zero at the light's range, so lights outside of a cluster never contribute
+		float falloff = clamp(1.0 - dist2 / (light.radius * light.radius), 0.0, 1.0);
+		float atten = falloff * falloff;
 
 		// Diffuse part
-		vec3 N = normalize(normal);
 		float NdotL = max(0.0, dot(N, L));
-		vec3 diff = ubo.lights[i].color * albedo.rgb * NdotL * atten;
+		vec3 diff = light.color * albedo.rgb * NdotL * atten;
 
 		// Specular part
 		// Specular map values are stored in alpha of albedo mrt
 		vec3 R = reflect(-L, N);
 		float NdotR = max(0.0, dot(R, V));
-		//vec3 spec = ubo.lights[i].color * albedo.a * pow(NdotR, 32.0) * atten;
+		vec3 spec = light.color * albedo.a * pow(NdotR, 16.0) * atten * params.shading.y;
+
+		fragcolor += diff + spec;
+	}
 
-		fragcolor += diff;// + spec;	
-	}    	
-   
 	outFragcolor = vec4(fragcolor, 1.0);
 
 	// Write G-Buffer attachments to avoid undefined behaviour (validation error)
 	outPosition = vec4(0.0);
 	outNormal = vec4(0.0);
 	outAlbedo = vec4(0.0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,6 @@
+glslangvalidator -V gbuffer.vert -o gbuffer.vert.spv
+glslangvalidator -V gbuffer.frag -o gbuffer.frag.spv
+glslangvalidator -V composition.vert -o composition.vert.spv
+glslangvalidator -V composition.frag -o composition.frag.spv
+glslangvalidator -V transparent.vert -o transparent.vert.spv
+glslangvalidator -V transparent.frag -o transparent.frag.spv
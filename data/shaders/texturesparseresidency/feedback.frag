@@ -0,0 +1,35 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Virtual texture and page dimensions, mip tail start and feedback downscale (log2) are set by the application
+layout (constant_id = 0) const float TEXTURE_WIDTH = 8192.0;
+layout (constant_id = 1) const float TEXTURE_HEIGHT = 8192.0;
+layout (constant_id = 2) const float PAGE_WIDTH = 128.0;
+layout (constant_id = 3) const float PAGE_HEIGHT = 128.0;
+layout (constant_id = 4) const float MIP_TAIL_START = 7.0;
+layout (constant_id = 5) const float FEEDBACK_LOD_OFFSET = 3.0;
+
+layout (location = 0) in vec2 inUV;
+layout (location = 1) in float inLodBias;
+
+// Requested page as (mip level << 24) | (page y << 12) | page x, 0xFFFFFFFF = no request
+layout (location = 0) out uint outPageRequest;
+
+void main() 
+{
+	// Mip level the virtual texture would be sampled at
+	// Derivatives are taken at feedback resolution, so they need to be scaled down to the final resolution
+	vec2 texel = inUV * vec2(TEXTURE_WIDTH, TEXTURE_HEIGHT);
+	vec2 dx = dFdx(texel);
+	vec2 dy = dFdy(texel);
+	float lod = max(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) - FEEDBACK_LOD_OFFSET + inLodBias), 0.0);
+
+	// Page inside the requested mip level
+	vec2 page = floor(fract(inUV) * vec2(TEXTURE_WIDTH, TEXTURE_HEIGHT) / (vec2(PAGE_WIDTH, PAGE_HEIGHT) * exp2(lod)));
+	uint request = (uint(lod) << 24) | (uint(page.y) << 12) | uint(page.x);
+
+	// The mip tail is always resident
+	outPageRequest = (lod >= MIP_TAIL_START) ? 0xFFFFFFFF : request;
+}
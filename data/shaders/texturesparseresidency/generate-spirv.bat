@@ -0,0 +1,3 @@
+glslangvalidator -V sparseresidency.vert -o sparseresidency.vert.spv
+glslangvalidator -V sparseresidency.frag -o sparseresidency.frag.spv
+glslangvalidator -V feedback.frag -o feedback.frag.spv
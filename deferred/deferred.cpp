@@ -11,6 +11,9 @@
 #include <string.h>
 #include <assert.h>
 #include <vector>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -22,10 +25,17 @@
 #include "VulkanBuffer.hpp"
 #include "VulkanTexture.hpp"
 #include "VulkanModel.hpp"
+#include "VulkanClusteredLights.hpp"
+#include "VulkanTimestampQueries.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
 
+// Lights are culled into clusters, so the composition can handle thousands of them
+#define MAX_LIGHT_COUNT 10000
+// The first lights are the animated lights of the scene, all others are placed randomly
+#define ANIMATED_LIGHT_COUNT 6
+
 // Texture properties
 #define TEX_DIM 2048
 #define TEX_FILTER VK_FILTER_LINEAR
@@ -77,21 +87,17 @@ public:
 		glm::vec4 instancePos[3];
 	} uboVS, uboOffscreenVS;
 
-	struct Light {
-		glm::vec4 position;
-		glm::vec3 color;
-		float radius;
-	};
+	vks::ClusteredLights *clusteredLights = nullptr;
+	vks::ClusteredLights::Builder lightBuilder = vks::ClusteredLights::BUILDER_CPU;
+	uint32_t lightCount = 1024;
+	vks::LightCountSweep lightCountSweep;
 
-	struct {
-		Light lights[6];
-		glm::vec4 viewPos;
-	} uboFragmentLights;
+	// GPU time of the cluster assignment and the composition
+	vks::TimestampQueries *timestamps = nullptr;
 
 	struct {
 		vks::Buffer vsFullScreen;
 		vks::Buffer vsOffscreen;
-		vks::Buffer fsLights;
 	} uniformBuffers;
 
 	struct {
@@ -196,7 +202,9 @@ public:
 		// Uniform buffers
 		uniformBuffers.vsOffscreen.destroy();
 		uniformBuffers.vsFullScreen.destroy();
-		uniformBuffers.fsLights.destroy();
+
+		delete clusteredLights;
+		delete timestamps;
 
 		vkFreeCommandBuffers(device, cmdPool, 1, &offScreenCmdBuffer);
 
@@ -544,6 +552,15 @@ public:
 
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
+			timestamps->cmdReset(drawCmdBuffers[i], i);
+			timestamps->cmdWriteTimestamp(drawCmdBuffers[i], i, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+			// With the GPU builder the lights are assigned to the clusters right before the composition
+			if (lightBuilder == vks::ClusteredLights::BUILDER_GPU)
+			{
+				clusteredLights->cmdBuild(drawCmdBuffers[i]);
+			}
+
 			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
@@ -553,7 +570,9 @@ public:
 			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
 			VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.deferred, 0, 1, &descriptorSet, 0, NULL);
+			// Set 0: G-Buffer, set 1: Light clusters
+			std::array<VkDescriptorSet, 2> compositionSets = { descriptorSet, clusteredLights->descriptorSet };
+			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.deferred, 0, static_cast<uint32_t>(compositionSets.size()), compositionSets.data(), 0, NULL);
 
 			if (debugDisplay)
 			{
@@ -577,6 +596,8 @@ public:
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
+			timestamps->cmdWriteTimestamp(drawCmdBuffers[i], i, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 		}
 	}
@@ -740,11 +761,6 @@ public:
 				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 				VK_SHADER_STAGE_FRAGMENT_BIT,
 				3),
-			// Binding 4 : Fragment shader uniform buffer
-			vks::initializers::descriptorSetLayoutBinding(
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				VK_SHADER_STAGE_FRAGMENT_BIT,
-				4),
 		};
 
 		VkDescriptorSetLayoutCreateInfo descriptorLayout =
@@ -754,14 +770,18 @@ public:
 
 		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &descriptorSetLayout));
 
+		// The composition reads the light clusters from set 1
+		std::array<VkDescriptorSetLayout, 2> setLayouts = { descriptorSetLayout, clusteredLights->descriptorSetLayout };
+
 		VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo =
 			vks::initializers::pipelineLayoutCreateInfo(
-				&descriptorSetLayout,
-				1);
+				setLayouts.data(),
+				static_cast<uint32_t>(setLayouts.size()));
 
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayouts.deferred));
 
 		// Offscreen (scene) rendering pipeline layout
+		pPipelineLayoutCreateInfo.setLayoutCount = 1;
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayouts.offscreen));
 	}
 
@@ -822,12 +842,6 @@ public:
 				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 				3,
 				&texDescriptorAlbedo),
-			// Binding 4 : Fragment shader uniform buffer
-			vks::initializers::writeDescriptorSet(
-				descriptorSet,
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				4,
-				&uniformBuffers.fsLights.descriptor),
 		};
 
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
@@ -1009,17 +1023,9 @@ public:
 			&uniformBuffers.vsOffscreen,
 			sizeof(uboOffscreenVS)));
 
-		// Deferred fragment shader
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&uniformBuffers.fsLights,
-			sizeof(uboFragmentLights)));
-
 		// Map persistent
 		VK_CHECK_RESULT(uniformBuffers.vsFullScreen.map());
 		VK_CHECK_RESULT(uniformBuffers.vsOffscreen.map());
-		VK_CHECK_RESULT(uniformBuffers.fsLights.map());
 
 		// Init some values
 		uboOffscreenVS.instancePos[0] = glm::vec4(0.0f);
@@ -1056,53 +1062,73 @@ public:
 		memcpy(uniformBuffers.vsOffscreen.mapped, &uboOffscreenVS, sizeof(uboOffscreenVS));
 	}
 
-	// Update fragment shader light position uniform block
+	void prepareClusteredLights()
+	{
+		clusteredLights = new vks::ClusteredLights(vulkanDevice, MAX_LIGHT_COUNT, getJobSystem());
+		clusteredLights->prepareCompute(loadShader(getAssetPath() + "shaders/base/clusteredlights.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT), pipelineCache);
+		setLightCount(lightCount);
+		timestamps = new vks::TimestampQueries(vulkanDevice, 2, static_cast<uint32_t>(drawCmdBuffers.size()), vulkanDevice->queueFamilyIndices.graphics);
+	}
+
+	// Regenerate the random lights, the animated ones are written on top of the first lights with every update
+	void setLightCount(uint32_t count)
+	{
+		lightCount = std::max(std::min(count, (uint32_t)MAX_LIGHT_COUNT), (uint32_t)ANIMATED_LIGHT_COUNT);
+		clusteredLights->generateRandomLights(lightCount, glm::vec3(-12.0f, -2.0f, -12.0f), glm::vec3(12.0f, 1.0f, 12.0f), 0.5f, 2.5f);
+	}
+
+	// Update the lights and assign them to the clusters
 	void updateUniformBufferDeferredLights()
 	{
+		std::vector<vks::ClusteredLights::Light> &lights = clusteredLights->lights;
+
 		// White
-		uboFragmentLights.lights[0].position = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
-		uboFragmentLights.lights[0].color = glm::vec3(1.5f);
-		uboFragmentLights.lights[0].radius = 15.0f * 0.25f;
+		lights[0].position = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+		lights[0].color = glm::vec3(1.5f);
+		lights[0].radius = 15.0f * 0.25f;
 		// Red
-		uboFragmentLights.lights[1].position = glm::vec4(-2.0f, 0.0f, 0.0f, 0.0f);
-		uboFragmentLights.lights[1].color = glm::vec3(1.0f, 0.0f, 0.0f);
-		uboFragmentLights.lights[1].radius = 15.0f;
+		lights[1].position = glm::vec4(-2.0f, 0.0f, 0.0f, 0.0f);
+		lights[1].color = glm::vec3(1.0f, 0.0f, 0.0f);
+		lights[1].radius = 15.0f;
 		// Blue
-		uboFragmentLights.lights[2].position = glm::vec4(2.0f, 1.0f, 0.0f, 0.0f);
-		uboFragmentLights.lights[2].color = glm::vec3(0.0f, 0.0f, 2.5f);
-		uboFragmentLights.lights[2].radius = 5.0f;
+		lights[2].position = glm::vec4(2.0f, 1.0f, 0.0f, 0.0f);
+		lights[2].color = glm::vec3(0.0f, 0.0f, 2.5f);
+		lights[2].radius = 5.0f;
 		// Yellow
-		uboFragmentLights.lights[3].position = glm::vec4(0.0f, 0.9f, 0.5f, 0.0f);
-		uboFragmentLights.lights[3].color = glm::vec3(1.0f, 1.0f, 0.0f);
-		uboFragmentLights.lights[3].radius = 2.0f;
+		lights[3].position = glm::vec4(0.0f, 0.9f, 0.5f, 0.0f);
+		lights[3].color = glm::vec3(1.0f, 1.0f, 0.0f);
+		lights[3].radius = 2.0f;
 		// Green
-		uboFragmentLights.lights[4].position = glm::vec4(0.0f, 0.5f, 0.0f, 0.0f);
-		uboFragmentLights.lights[4].color = glm::vec3(0.0f, 1.0f, 0.2f);
-		uboFragmentLights.lights[4].radius = 5.0f;
+		lights[4].position = glm::vec4(0.0f, 0.5f, 0.0f, 0.0f);
+		lights[4].color = glm::vec3(0.0f, 1.0f, 0.2f);
+		lights[4].radius = 5.0f;
 		// Yellow
-		uboFragmentLights.lights[5].position = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
-		uboFragmentLights.lights[5].color = glm::vec3(1.0f, 0.7f, 0.3f);
-		uboFragmentLights.lights[5].radius = 25.0f;
+		lights[5].position = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+		lights[5].color = glm::vec3(1.0f, 0.7f, 0.3f);
+		lights[5].radius = 25.0f;
 
-		uboFragmentLights.lights[0].position.x = sin(glm::radians(360.0f * timer)) * 5.0f;
-		uboFragmentLights.lights[0].position.z = cos(glm::radians(360.0f * timer)) * 5.0f;
+		lights[0].position.x = sin(glm::radians(360.0f * timer)) * 5.0f;
+		lights[0].position.z = cos(glm::radians(360.0f * timer)) * 5.0f;
 
-		uboFragmentLights.lights[1].position.x = -4.0f + sin(glm::radians(360.0f * timer) + 45.0f) * 2.0f;
-		uboFragmentLights.lights[1].position.z =  0.0f + cos(glm::radians(360.0f * timer) + 45.0f) * 2.0f;
+		lights[1].position.x = -4.0f + sin(glm::radians(360.0f * timer) + 45.0f) * 2.0f;
+		lights[1].position.z =  0.0f + cos(glm::radians(360.0f * timer) + 45.0f) * 2.0f;
 
-		uboFragmentLights.lights[2].position.x = 4.0f + sin(glm::radians(360.0f * timer)) * 2.0f;
-		uboFragmentLights.lights[2].position.z = 0.0f + cos(glm::radians(360.0f * timer)) * 2.0f;
+		lights[2].position.x = 4.0f + sin(glm::radians(360.0f * timer)) * 2.0f;
+		lights[2].position.z = 0.0f + cos(glm::radians(360.0f * timer)) * 2.0f;
 
-		uboFragmentLights.lights[4].position.x = 0.0f + sin(glm::radians(360.0f * timer + 90.0f)) * 5.0f;
-		uboFragmentLights.lights[4].position.z = 0.0f - cos(glm::radians(360.0f * timer + 45.0f)) * 5.0f;
+		lights[4].position.x = 0.0f + sin(glm::radians(360.0f * timer + 90.0f)) * 5.0f;
+		lights[4].position.z = 0.0f - cos(glm::radians(360.0f * timer + 45.0f)) * 5.0f;
 
-		uboFragmentLights.lights[5].position.x = 0.0f + sin(glm::radians(-360.0f * timer + 135.0f)) * 10.0f;
-		uboFragmentLights.lights[5].position.z = 0.0f - cos(glm::radians(-360.0f * timer - 45.0f)) * 10.0f;
+		lights[5].position.x = 0.0f + sin(glm::radians(-360.0f * timer + 135.0f)) * 10.0f;
+		lights[5].position.z = 0.0f - cos(glm::radians(-360.0f * timer - 45.0f)) * 10.0f;
 
 		// Current view position
-		uboFragmentLights.viewPos = glm::vec4(camera.position, 0.0f) * glm::vec4(-1.0f, 1.0f, -1.0f, 1.0f);
+		glm::vec4 viewPos = glm::vec4(camera.position, 0.0f) * glm::vec4(-1.0f, 1.0f, -1.0f, 1.0f);
 
-		memcpy(uniformBuffers.fsLights.mapped, &uboFragmentLights, sizeof(uboFragmentLights));
+		// Positions in the G-Buffer have a flipped y axis
+		glm::mat4 view = camera.matrices.view * glm::scale(glm::mat4(), glm::vec3(1.0f, -1.0f, 1.0f));
+
+		clusteredLights->update(view, camera.matrices.perspective, camera.getNearClip(), camera.getFarClip(), width, height, viewPos, lightBuilder);
 	}
 
 	void draw()
@@ -1153,6 +1179,7 @@ public:
 		generateQuads();
 		setupVertexDescriptions();
 		prepareOffscreenFramebuffer();
+		prepareClusteredLights();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
 		preparePipelines();
@@ -1168,6 +1195,11 @@ public:
 		if (!prepared)
 			return;
 		draw();
+		if (lightCountSweep.update(timestamps, currentBuffer, frameTimer * 1000.0, clusteredLights, lightBuilder))
+		{
+			setLightCount(lightCountSweep.getLightCount());
+			updateTextOverlay();
+		}
 		updateUniformBufferDeferredLights();
 	}
 
@@ -1192,6 +1224,28 @@ public:
 			toggleDebugDisplay();
 			updateTextOverlay();
 			break;
+		case KEY_KPADD:
+		case GAMEPAD_BUTTON_R1:
+			setLightCount(lightCount * 2);
+			updateTextOverlay();
+			break;
+		case KEY_KPSUB:
+		case GAMEPAD_BUTTON_L1:
+			setLightCount(lightCount / 2);
+			updateTextOverlay();
+			break;
+		case KEY_B:
+		case GAMEPAD_BUTTON_X:
+			lightBuilder = (lightBuilder == vks::ClusteredLights::BUILDER_CPU) ? vks::ClusteredLights::BUILDER_GPU : vks::ClusteredLights::BUILDER_CPU;
+			reBuildCommandBuffers();
+			updateTextOverlay();
+			break;
+		case KEY_T:
+		case GAMEPAD_BUTTON_Y:
+			lightCountSweep.start(lightCount);
+			setLightCount(lightCountSweep.getLightCount());
+			updateTextOverlay();
+			break;
 		}
 	}
 
@@ -1199,9 +1253,12 @@ public:
 	{
 #if defined(__ANDROID__)
 		textOverlay->addText("\"Button A\" to toggle debug display", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("\"L1/R1\" to change light count, \"Button X\" to toggle cluster builder, \"Button Y\" to measure", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
 #else
 		textOverlay->addText("\"F2\" to toggle debug display", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("\"+/-\" to change light count, \"B\" to toggle cluster builder, \"T\" to measure", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
 #endif
+		lightCountSweep.addOverlayText(textOverlay, 115.0f, lightCount, clusteredLights, lightBuilder);
 		// Render targets
 		if (debugDisplay)
 		{
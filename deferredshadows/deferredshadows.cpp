@@ -12,6 +12,9 @@
 #include <assert.h>
 #include <vector>
 #include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -24,6 +27,8 @@
 #include "VulkanFrameBuffer.hpp"
 #include "VulkanTexture.hpp"
 #include "VulkanModel.hpp"
+#include "VulkanClusteredLights.hpp"
+#include "VulkanTimestampQueries.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -47,6 +52,9 @@
 // Must match the LIGHT_COUNT define in the shadow and deferred shaders
 #define LIGHT_COUNT 3
 
+// Additional unshadowed point lights, culled into clusters and added on top of the shadowed lights
+#define MAX_CLUSTERED_LIGHT_COUNT 10000
+
 class VulkanExample : public VulkanExampleBase
 {
 public:
@@ -136,6 +144,7 @@ public:
 		VkPipeline offscreen;
 		VkPipeline debug;
 		VkPipeline shadowpass;
+		VkPipeline clustered;
 	} pipelines;
 
 	struct {
@@ -168,6 +177,14 @@ public:
 	// Semaphore used to synchronize between offscreen and final scene rendering
 	VkSemaphore offscreenSemaphore = VK_NULL_HANDLE;
 
+	vks::ClusteredLights *clusteredLights = nullptr;
+	vks::ClusteredLights::Builder lightBuilder = vks::ClusteredLights::BUILDER_CPU;
+	uint32_t lightCount = 256;
+	vks::LightCountSweep lightCountSweep;
+
+	// GPU time of the cluster assignment and the composition passes
+	vks::TimestampQueries *timestamps = nullptr;
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		enableTextOverlay = true;
@@ -202,6 +219,7 @@ public:
 		vkDestroyPipeline(device, pipelines.offscreen, nullptr);
 		vkDestroyPipeline(device, pipelines.shadowpass, nullptr);
 		vkDestroyPipeline(device, pipelines.debug, nullptr);
+		vkDestroyPipeline(device, pipelines.clustered, nullptr);
 
 		vkDestroyPipelineLayout(device, pipelineLayouts.deferred, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayouts.offscreen, nullptr);
@@ -228,6 +246,9 @@ public:
 		textures.background.normalMap.destroy();
 
 		vkDestroySemaphore(device, offscreenSemaphore, nullptr);
+
+		delete clusteredLights;
+		delete timestamps;
 	}
 
 	// Enable physical device features required for this example				
@@ -487,6 +508,15 @@ public:
 
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
+			timestamps->cmdReset(drawCmdBuffers[i], i);
+			timestamps->cmdWriteTimestamp(drawCmdBuffers[i], i, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+			// With the GPU builder the lights are assigned to the clusters right before the composition
+			if (lightBuilder == vks::ClusteredLights::BUILDER_GPU)
+			{
+				clusteredLights->cmdBuild(drawCmdBuffers[i]);
+			}
+
 			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
@@ -496,7 +526,9 @@ public:
 			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
 			VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.deferred, 0, 1, &descriptorSet, 0, NULL);
+			// Set 0: G-Buffer and shadow maps, set 1: Light clusters
+			std::array<VkDescriptorSet, 2> compositionSets = { descriptorSet, clusteredLights->descriptorSet };
+			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.deferred, 0, static_cast<uint32_t>(compositionSets.size()), compositionSets.data(), 0, NULL);
 
 			// Final composition as full screen quad
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.deferred);
@@ -504,6 +536,10 @@ public:
 			vkCmdBindIndexBuffer(drawCmdBuffers[i], models.quad.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 			vkCmdDrawIndexed(drawCmdBuffers[i], 6, 1, 0, 0, 0);
 
+			// Clustered point lights are blended on top of the shadowed composition
+			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.clustered);
+			vkCmdDrawIndexed(drawCmdBuffers[i], 6, 1, 0, 0, 0);
+
 			if (debugDisplay)
 			{
 				// Visualize depth maps
@@ -513,6 +549,8 @@ public:
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
+			timestamps->cmdWriteTimestamp(drawCmdBuffers[i], i, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 		}
 	}
@@ -683,14 +721,18 @@ public:
 
 		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &descriptorSetLayout));
 
+		// The composition passes read the light clusters from set 1
+		std::array<VkDescriptorSetLayout, 2> setLayouts = { descriptorSetLayout, clusteredLights->descriptorSetLayout };
+
 		VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo =
 			vks::initializers::pipelineLayoutCreateInfo(
-				&descriptorSetLayout,
-				1);
+				setLayouts.data(),
+				static_cast<uint32_t>(setLayouts.size()));
 
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayouts.deferred));
 
 		// Offscreen (scene) rendering pipeline layout
+		pPipelineLayoutCreateInfo.setLayoutCount = 1;
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayouts.offscreen));
 	}
 
@@ -913,6 +955,21 @@ public:
 
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.deferred));
 
+		// Clustered point lights pipeline, adds the unshadowed lights to the composition
+		// Uses the clustered shading pass of the deferred example (no ambient term is added, see vks::ClusteredLights::ambient)
+		shaderStages[1] = loadShader(getAssetPath() + "shaders/deferred/deferred.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+		blendAttachmentState.blendEnable = VK_TRUE;
+		blendAttachmentState.colorBlendOp = VK_BLEND_OP_ADD;
+		blendAttachmentState.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		blendAttachmentState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		blendAttachmentState.alphaBlendOp = VK_BLEND_OP_ADD;
+		blendAttachmentState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		blendAttachmentState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		depthStencilState.depthWriteEnable = VK_FALSE;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.clustered));
+		blendAttachmentState.blendEnable = VK_FALSE;
+		depthStencilState.depthWriteEnable = VK_TRUE;
+
 		// Debug display pipeline
 		shaderStages[0] = loadShader(getAssetPath() + "shaders/deferredshadows/debug.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
 		shaderStages[1] = loadShader(getAssetPath() + "shaders/deferredshadows/debug.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
@@ -1090,6 +1147,23 @@ public:
 		uboFragmentLights.viewPos = glm::vec4(camera.position, 0.0f) * glm::vec4(-1.0f, 1.0f, -1.0f, 1.0f);;
 	
 		memcpy(uniformBuffers.fsLights.mapped, &uboFragmentLights, sizeof(uboFragmentLights));
+
+		clusteredLights->update(camera.matrices.view, camera.matrices.perspective, zNear, zFar, width, height, uboFragmentLights.viewPos, lightBuilder);
+	}
+
+	void prepareClusteredLights()
+	{
+		clusteredLights = new vks::ClusteredLights(vulkanDevice, MAX_CLUSTERED_LIGHT_COUNT, getJobSystem());
+		clusteredLights->prepareCompute(loadShader(getAssetPath() + "shaders/base/clusteredlights.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT), pipelineCache);
+		setLightCount(lightCount);
+		timestamps = new vks::TimestampQueries(vulkanDevice, 2, static_cast<uint32_t>(drawCmdBuffers.size()), vulkanDevice->queueFamilyIndices.graphics);
+	}
+
+	void setLightCount(uint32_t count)
+	{
+		lightCount = std::max(std::min(count, (uint32_t)MAX_CLUSTERED_LIGHT_COUNT), 1u);
+		// The scene's up axis is -y
+		clusteredLights->generateRandomLights(lightCount, glm::vec3(-15.0f, -6.0f, -15.0f), glm::vec3(15.0f, -0.25f, 15.0f), 1.0f, 3.0f);
 	}
 
 	void draw()
@@ -1133,6 +1207,7 @@ public:
 		deferredSetup();
 		shadowSetup();
 		initLights();
+		prepareClusteredLights();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
 		preparePipelines();
@@ -1148,6 +1223,11 @@ public:
 		if (!prepared)
 			return;
 		draw();
+		if (lightCountSweep.update(timestamps, currentBuffer, frameTimer * 1000.0, clusteredLights, lightBuilder))
+		{
+			setLightCount(lightCountSweep.getLightCount());
+			updateTextOverlay();
+		}
 		updateUniformBufferDeferredLights();
 	}
 
@@ -1183,6 +1263,28 @@ public:
 			toggleShadows();
 			updateTextOverlay();
 			break;
+		case KEY_KPADD:
+		case GAMEPAD_BUTTON_R1:
+			setLightCount(lightCount * 2);
+			updateTextOverlay();
+			break;
+		case KEY_KPSUB:
+		case GAMEPAD_BUTTON_L1:
+			setLightCount(lightCount / 2);
+			updateTextOverlay();
+			break;
+		case KEY_B:
+		case GAMEPAD_BUTTON_B:
+			lightBuilder = (lightBuilder == vks::ClusteredLights::BUILDER_CPU) ? vks::ClusteredLights::BUILDER_GPU : vks::ClusteredLights::BUILDER_CPU;
+			reBuildCommandBuffers();
+			updateTextOverlay();
+			break;
+		case KEY_T:
+		case GAMEPAD_BUTTON_Y:
+			lightCountSweep.start(lightCount);
+			setLightCount(lightCountSweep.getLightCount());
+			updateTextOverlay();
+			break;
 		}
 	}
 
@@ -1191,10 +1293,13 @@ public:
 #if defined(__ANDROID__)
 		textOverlay->addText("Press \"Button A\" to toggle debug view", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
 		textOverlay->addText("Press \"Button X\" to toggle shadows", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Press \"L1/R1\" to change light count, \"Button B\" to toggle cluster builder, \"Button Y\" to measure", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
 #else
 		textOverlay->addText("Press \"F1\" to toggle debug view", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
 		textOverlay->addText("Press \"F2\" to toggle shadows", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Press \"+/-\" to change light count, \"B\" to toggle cluster builder, \"T\" to measure", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
 #endif
+		lightCountSweep.addOverlayText(textOverlay, 130.0f, lightCount, clusteredLights, lightBuilder);
 	}
 };
 
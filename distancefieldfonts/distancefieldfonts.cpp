@@ -15,6 +15,7 @@
 #include <assert.h>
 #include <vector>
 #include <array>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -25,45 +26,21 @@
 #include "vulkanexamplebase.h"
 #include "VulkanTexture.hpp"
 #include "VulkanBuffer.hpp"
+#include "bitmapfont.hpp"
+#include "VulkanTextBatch.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
 
-// Vertex layout for this example
-struct Vertex {
-	float pos[3];
-	float uv[2];
-};
-
-// AngelCode .fnt format structs and classes
-struct bmchar {
-	uint32_t x, y;
-	uint32_t width;
-	uint32_t height;
-	int32_t xoffset;
-	int32_t yoffset;
-	int32_t xadvance;
-	uint32_t page;
-};
-
-// Quick and dirty : complete ASCII table
-// Only chars present in the .fnt are filled with data!
-std::array<bmchar, 255> fontChars;
-
-int32_t nextValuePair(std::stringstream *stream)
-{
-	std::string pair;
-	*stream >> pair;
-	size_t spos = pair.find("=");
-	std::string value = pair.substr(spos + 1);
-	int32_t val = std::stoi(value);
-	return val;
-}
+// Number of labels in the map annotation mode (columns x rows)
+#define LABEL_COLUMNS 200
+#define LABEL_ROWS 100
 
 class VulkanExample : public VulkanExampleBase
 {
 public:
 	bool splitScreen = true;
+	bool showLabels = false;
 
 	struct {
 		vks::Texture2D fontSDF;
@@ -76,9 +53,18 @@ public:
 		std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
 	} vertices;
 
-	vks::Buffer vertexBuffer;
-	vks::Buffer indexBuffer;
-	uint32_t indexCount;
+	// Glyph table of the AngelCode font
+	vks::BitmapFont font;
+	// All texts of a frame are drawn from a single buffer
+	vks::TextBatch *textBatch = nullptr;
+
+	// Map annotation like labels, the texts are generated once, their transforms are updated every frame
+	struct Label {
+		std::string text;
+		glm::vec3 position;
+		float rotation;
+	};
+	std::vector<Label> labels;
 
 	struct {
 		vks::Buffer vs;
@@ -131,72 +117,12 @@ public:
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
-		vertexBuffer.destroy();
-		indexBuffer.destroy();
+		delete textBatch;
 
 		uniformBuffers.vs.destroy();
 		uniformBuffers.fs.destroy();
 	}
 
-	// Basic parser fpr AngelCode bitmap font format files
-	// See http://www.angelcode.com/products/bmfont/doc/file_format.html for details
-	void parsebmFont()
-	{
-		std::string fileName = getAssetPath() + "font.fnt";
-
-#if defined(__ANDROID__)
-		// Font description file is stored inside the apk
-		// So we need to load it using the asset manager
-		AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, fileName.c_str(), AASSET_MODE_STREAMING);
-		assert(asset);
-		size_t size = AAsset_getLength(asset);
-
-		assert(size > 0);
-
-		void *fileData = malloc(size);
-		AAsset_read(asset, fileData, size);
-		AAsset_close(asset);
-
-		std::stringbuf sbuf((const char*)fileData);
-		std::istream istream(&sbuf);
-#else
-		std::filebuf fileBuffer;
-		fileBuffer.open(fileName, std::ios::in);
-		std::istream istream(&fileBuffer);
-#endif
-
-		assert(istream.good());
-
-		while (!istream.eof())
-		{
-			std::string line;
-			std::stringstream lineStream;
-			std::getline(istream, line);
-			lineStream << line;
-
-			std::string info;
-			lineStream >> info;
-
-			if (info == "char")
-			{
-				std::string pair;
-
-				// char id
-				uint32_t charid = nextValuePair(&lineStream);
-				// Char properties
-				fontChars[charid].x = nextValuePair(&lineStream);
-				fontChars[charid].y = nextValuePair(&lineStream);
-				fontChars[charid].width = nextValuePair(&lineStream);
-				fontChars[charid].height = nextValuePair(&lineStream);
-				fontChars[charid].xoffset = nextValuePair(&lineStream);
-				fontChars[charid].yoffset = nextValuePair(&lineStream);
-				fontChars[charid].xadvance = nextValuePair(&lineStream);
-				fontChars[charid].page = nextValuePair(&lineStream);
-			}
-		}
-
-	}
-
 	void loadAssets()
 	{
 		textures.fontSDF.loadFromFile(getAssetPath() + "textures/font_sdf_rgba.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
@@ -244,14 +170,11 @@ public:
 			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
 			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
-			VkDeviceSize offsets[1] = { 0 };
-
 			// Signed distance field font
+			// The batch is rebuilt every frame, the draw reads the glyph count from the batch's indirect buffer
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.sdf, 0, NULL);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.sdf);
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &vertexBuffer.buffer, offsets);
-			vkCmdBindIndexBuffer(drawCmdBuffers[i], indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(drawCmdBuffers[i], indexCount, 1, 0, 0, 0);
+			textBatch->cmdDraw(drawCmdBuffers[i], i, VERTEX_BUFFER_BIND_ID);
 
 			// Linear filtered bitmap font
 			if (splitScreen)
@@ -260,7 +183,7 @@ public:
 				vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
 				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.bitmap, 0, NULL);
 				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.bitmap);
-				vkCmdDrawIndexed(drawCmdBuffers[i], indexCount, 1, 0, 0, 0);
+				textBatch->cmdDraw(drawCmdBuffers[i], i, VERTEX_BUFFER_BIND_ID);
 			}
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
@@ -269,78 +192,52 @@ public:
 		}
 	}
 
-	// Creates a vertex buffer containing quads for the passed text
-	void generateText(std:: string text)
+	// Generate the texts and positions of the labels, laid out in a grid like map annotations
+	void generateLabels()
 	{
-		std::vector<Vertex> vertices;
-		std::vector<uint32_t> indices;
-		uint32_t indexOffset = 0;
-
-		float w = (float)textures.fontSDF.width;
-
-		float posx = 0.0f;
-		float posy = 0.0f;
-
-		for (uint32_t i = 0; i < text.size(); i++)
+		labels.clear();
+		labels.reserve(LABEL_COLUMNS * LABEL_ROWS);
+		for (uint32_t y = 0; y < LABEL_ROWS; y++)
 		{
-			bmchar *charInfo = &fontChars[(int)text[i]];
-
-			if (charInfo->width == 0)
-				charInfo->width = 36;
-
-			float charw = ((float)(charInfo->width) / 36.0f);
-			float dimx = 1.0f * charw;
-			float charh = ((float)(charInfo->height) / 36.0f);
-			float dimy = 1.0f * charh;
-			posy = 1.0f - charh;
-
-			float us = charInfo->x / w;
-			float ue = (charInfo->x + charInfo->width) / w;
-			float ts = charInfo->y / w;
-			float te = (charInfo->y + charInfo->height) / w;
+			for (uint32_t x = 0; x < LABEL_COLUMNS; x++)
+			{
+				Label label;
+				std::stringstream ss;
+				ss << (char)('A' + (y % 26)) << (y / 26) << "-" << x;
+				label.text = ss.str();
+				label.position = glm::vec3(((float)x - LABEL_COLUMNS / 2.0f) * 0.12f, ((float)y - LABEL_ROWS / 2.0f) * 0.06f, 0.0f);
+				label.rotation = (float)((x * 7 + y * 13) % 360);
+				labels.push_back(label);
+			}
+		}
+	}
 
-			float xo = charInfo->xoffset / 36.0f;
-			float yo = charInfo->yoffset / 36.0f;
+	// Append all texts of the current frame to the text batch
+	void buildTextBatch()
+	{
+		textBatch->begin(currentBuffer);
 
-			vertices.push_back({ { posx + dimx + xo,  posy + dimy, 0.0f }, { ue, te } });
-			vertices.push_back({ { posx + xo,         posy + dimy, 0.0f }, { us, te } });
-			vertices.push_back({ { posx + xo,         posy,        0.0f }, { us, ts } });
-			vertices.push_back({ { posx + dimx + xo,  posy,        0.0f }, { ue, ts } });
+		// Centered on the origin (one font unit is the line height up to the baseline)
+		textBatch->add("Vulkan", glm::mat4(), glm::vec2(0.5f));
 
-			std::array<uint32_t, 6> letterIndices = { 0,1,2, 2,3,0 };
-			for (auto& index : letterIndices)
+		if (showLabels)
+		{
+			const glm::mat4 labelScale = glm::scale(glm::mat4(), glm::vec3(0.025f));
+			for (auto &label : labels)
 			{
-				indices.push_back(indexOffset + index);
+				glm::mat4 transform = glm::translate(glm::mat4(), label.position);
+				transform = glm::rotate(transform, glm::radians(label.rotation + timer * 360.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+				textBatch->add(label.text, transform * labelScale, glm::vec2(0.5f));
 			}
-			indexOffset += 4;
-
-			float advance = ((float)(charInfo->xadvance) / 36.0f);
-			posx += advance;
 		}
-		indexCount = static_cast<uint32_t>(indices.size());
 
-		// Center
-		for (auto& v : vertices)
+		textBatch->end();
+
+		// The batch buffers grew, so the command buffers need to bind the new ones
+		if (textBatch->drawCommandsInvalid)
 		{
-			v.pos[0] -= posx / 2.0f;
-			v.pos[1] -= 0.5f;
+			buildCommandBuffers();
 		}
-
-		// Generate host accesible buffers for the text vertices and indices and upload the data
-
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&vertexBuffer,
-			vertices.size() * sizeof(Vertex),
-			vertices.data()));
-
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&indexBuffer,
-			indices.size() * sizeof(uint32_t),
-			indices.data()));
 	}
 
 	void setupVertexDescriptions()
@@ -350,7 +247,7 @@ public:
 		vertices.bindingDescriptions[0] =
 			vks::initializers::vertexInputBindingDescription(
 				VERTEX_BUFFER_BIND_ID, 
-				sizeof(Vertex), 
+				sizeof(vks::TextBatch::Vertex), 
 				VK_VERTEX_INPUT_RATE_VERTEX);
 
 		// Attribute descriptions
@@ -369,7 +266,7 @@ public:
 				VERTEX_BUFFER_BIND_ID,
 				1,
 				VK_FORMAT_R32G32_SFLOAT,
-				sizeof(float) * 3);
+				offsetof(vks::TextBatch::Vertex, uv));
 
 		vertices.inputState = vks::initializers::pipelineVertexInputStateCreateInfo();
 		vertices.inputState.vertexBindingDescriptionCount = static_cast<uint32_t>(vertices.bindingDescriptions.size());
@@ -640,6 +537,9 @@ public:
 	{
 		VulkanExampleBase::prepareFrame();
 
+		// The previous frame has finished (see render), so the batch of this swap chain image can be written
+		buildTextBatch();
+
 		// Command buffer to be sumitted to the queue
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
@@ -653,9 +553,13 @@ public:
 	void prepare()
 	{
 		VulkanExampleBase::prepare();
-		parsebmFont();
+		if (!font.loadFromFile(getAssetPath() + "font.fnt"))
+		{
+			vks::tools::exitFatal("Could not load the font description \"font.fnt\"!", "Error");
+		}
 		loadAssets();
-		generateText("Vulkan");
+		generateLabels();
+		textBatch = new vks::TextBatch(vulkanDevice, &font, static_cast<uint32_t>(drawCmdBuffers.size()));
 		setupVertexDescriptions();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
@@ -687,6 +591,12 @@ public:
 		updateUniformBuffers();
 	}
 
+	void toggleLabels()
+	{
+		showLabels = !showLabels;
+		updateTextOverlay();
+	}
+
 	void toggleFontOutline()
 	{
 		uboFS.outline = !uboFS.outline;
@@ -705,6 +615,10 @@ public:
 		case GAMEPAD_BUTTON_A:
 			toggleFontOutline();
 			break;
+		case KEY_L:
+		case GAMEPAD_BUTTON_Y:
+			toggleLabels();
+			break;
 
 		}
 	}
@@ -714,10 +628,23 @@ public:
 #if defined(__ANDROID__)
 		textOverlay->addText("\"Button A\" to toggle outline", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
 		textOverlay->addText("\"Button X\" to toggle splitscreen", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("\"Button Y\" to toggle labels", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
 #else
 		textOverlay->addText("\"o\" to toggle outline", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
 		textOverlay->addText("\"s\" to toggle splitscreen", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("\"l\" to toggle labels", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
 #endif
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(3);
+		ss << "Font loaded in " << font.statistics.loadTime << " ms (" << (font.statistics.loadedFromCache ? "binary cache" : "parsed") << ")";
+		textOverlay->addText(ss.str(), 5.0f, 130.0f, VulkanTextOverlay::alignLeft);
+		// The text overlay is first updated by the base class, before the batch has been created
+		if (textBatch)
+		{
+			ss.str("");
+			ss << "Batch: " << textBatch->statistics.textCount << " texts, " << textBatch->statistics.glyphCount << " glyphs in one draw, built in " << textBatch->statistics.buildTime << " ms";
+			textOverlay->addText(ss.str(), 5.0f, 145.0f, VulkanTextOverlay::alignLeft);
+		}
 	}
 };
 
@@ -15,6 +15,11 @@
 * The example shows how to setup and fill such a buffer on the CPU side, stages it to the device and
 * shows how to render it using only one draw command.
 *
+* Optionally (default) the instances are culled against the view frustum on the CPU every frame, spread across the
+* job system. The visible instances are compacted per plant type into a persistently mapped per-frame instance buffer
+* and the indirect commands are written directly into a mapped per-frame indirect buffer.
+* Compare the CPU and GPU timings with those of the computecullandlod example, which does the culling in a compute shader.
+*
 * See readme.md for details
 *
 */
@@ -26,6 +31,9 @@
 #include <time.h> 
 #include <vector>
 #include <random>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -37,11 +45,17 @@
 #include "VulkanBuffer.hpp"
 #include "VulkanTexture.hpp"
 #include "VulkanModel.hpp"
+#include "VulkanTimestampQueries.hpp"
+#include "frustum.hpp"
+#include "jobsystem.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define INSTANCE_BUFFER_BIND_ID 1
 #define ENABLE_VALIDATION false
 
+// Number of instances culled and compacted by one job, must be a multiple of 32 and divide OBJECT_INSTANCE_COUNT
+#define CULL_CHUNK_SIZE 256
+
 // Number of instances per object
 #if defined(__ANDROID__)
 #define OBJECT_INSTANCE_COUNT 1024
@@ -121,6 +135,37 @@ public:
 	// Store the indirect draw commands containing index offsets and instance count per object
 	std::vector<VkDrawIndexedIndirectCommand> indirectCommands;
 
+	// Per-frame CPU culling
+	bool cpuCulling = true;
+	vks::JobSystem *jobSystem = nullptr;
+	vks::Frustum frustum;
+	// CPU copy of all instances and their world space bounding spheres
+	std::vector<InstanceData> instances;
+	vks::Frustum::Spheres instanceBounds;
+	std::vector<uint32_t> visibilityMask;
+	std::vector<uint32_t> chunkVisibleCount;
+	// First instance in the compacted instance buffer for each chunk
+	std::vector<uint32_t> chunkOffset;
+
+	// Buffers written by the CPU culling, one set per command buffer so a frame never overwrites data the GPU may still read
+	struct CullingFrame {
+		// Compacted visible instances
+		vks::Buffer instances;
+		// One indirect command per plant type followed by the number of non-empty commands
+		vks::Buffer indirectCommands;
+	};
+	std::vector<CullingFrame> cullingFrames;
+
+	struct {
+		uint32_t visibleObjects = 0;
+		uint32_t drawCount = 0;
+		double cpuTime = 0.0;
+		double gpuTime = 0.0;
+	} cullingStats;
+
+	// GPU time of the plant draws
+	vks::TimestampQueries *timestamps = nullptr;
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		enableTextOverlay = true;
@@ -147,6 +192,12 @@ public:
 		instanceBuffer.destroy();
 		indirectCommandsBuffer.destroy();
 		uniformData.scene.destroy();
+		for (auto &frame : cullingFrames)
+		{
+			frame.instances.destroy();
+			frame.indirectCommands.destroy();
+		}
+		delete timestamps;
 	}
 
 	void reBuildCommandBuffers()
@@ -181,6 +232,8 @@ public:
 
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
+			timestamps->cmdReset(drawCmdBuffers[i], i);
+
 			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
@@ -193,11 +246,16 @@ public:
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
 
 			// Plants
+			// With CPU culling the instances and indirect commands are taken from the buffers written for this frame
+			VkBuffer plantInstances = cpuCulling ? cullingFrames[i].instances.buffer : instanceBuffer.buffer;
+			VkBuffer plantCommands = cpuCulling ? cullingFrames[i].indirectCommands.buffer : indirectCommandsBuffer.buffer;
+
+			timestamps->cmdWriteTimestamp(drawCmdBuffers[i], i, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.plants);
 			// Binding point 0 : Mesh vertex buffer
 			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &models.plants.vertices.buffer, offsets);
 			// Binding point 1 : Instance data buffer
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &instanceBuffer.buffer, offsets);
+			vkCmdBindVertexBuffers(drawCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &plantInstances, offsets);
 			
 			vkCmdBindIndexBuffer(drawCmdBuffers[i], models.plants.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 
@@ -206,16 +264,17 @@ public:
 			// Index offsets and instance count are taken from the indirect buffer
 			if (vulkanDevice->features.multiDrawIndirect)
 			{
-				vkCmdDrawIndexedIndirect(drawCmdBuffers[i], indirectCommandsBuffer.buffer, 0, indirectDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+				vkCmdDrawIndexedIndirect(drawCmdBuffers[i], plantCommands, 0, indirectDrawCount, sizeof(VkDrawIndexedIndirectCommand));
 			}
 			else
 			{
 				// If multi draw is not available, we must issue separate draw commands
 				for (auto j = 0; j < indirectCommands.size(); j++)
 				{
-					vkCmdDrawIndexedIndirect(drawCmdBuffers[i], indirectCommandsBuffer.buffer, j * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+					vkCmdDrawIndexedIndirect(drawCmdBuffers[i], plantCommands, j * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
 				}
 			}
+			timestamps->cmdWriteTimestamp(drawCmdBuffers[i], i, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
 			// Ground
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.ground);
@@ -581,7 +640,7 @@ public:
 		std::vector<InstanceData> instanceData;
 		instanceData.resize(objectCount);
 
-		std::mt19937 rndGenerator((unsigned)time(NULL));
+		std::mt19937 rndGenerator(getRandomSeed());
 		std::uniform_real_distribution<float> uniformDist(0.0f, 1.0f);
 
 		for (uint32_t i = 0; i < objectCount; i++)
@@ -594,6 +653,16 @@ public:
 			instanceData[i].texIndex = i / OBJECT_INSTANCE_COUNT;
 		}
 
+		// Keep a copy and the bounds of all instances for the CPU culling
+		instances = instanceData;
+		instanceBounds.resize(objectCount);
+		const glm::vec3 modelCenter = (models.plants.dim.min + models.plants.dim.max) * 0.5f;
+		const float modelRadius = glm::length(models.plants.dim.size) * 0.5f;
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			instanceBounds.set(i, getInstancePosition(instanceData[i], modelCenter), modelRadius * instanceData[i].scale);
+		}
+
 		vks::Buffer stagingBuffer;
 		VK_CHECK_RESULT(vulkanDevice->createBuffer(
 			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
@@ -613,6 +682,124 @@ public:
 		stagingBuffer.destroy();
 	}
 
+	// Transforms a model space position by an instance the same way the plant vertex shader does
+	glm::vec3 getInstancePosition(const InstanceData &instance, glm::vec3 pos)
+	{
+		glm::mat4 mx, my, mz;
+		float s = sin(instance.rot.x);
+		float c = cos(instance.rot.x);
+		mx[0] = glm::vec4(c, s, 0.0f, 0.0f);
+		mx[1] = glm::vec4(-s, c, 0.0f, 0.0f);
+		s = sin(instance.rot.y);
+		c = cos(instance.rot.y);
+		my[0] = glm::vec4(c, 0.0f, s, 0.0f);
+		my[2] = glm::vec4(-s, 0.0f, c, 0.0f);
+		s = sin(instance.rot.z);
+		c = cos(instance.rot.z);
+		mz[1] = glm::vec4(0.0f, c, s, 0.0f);
+		mz[2] = glm::vec4(0.0f, -s, c, 0.0f);
+		return glm::vec3(glm::vec4(pos * instance.scale + instance.pos, 1.0f) * (mz * my * mx));
+	}
+
+	// Create the persistently mapped buffers the CPU culling writes to
+	void prepareCullingBuffers()
+	{
+		jobSystem = getJobSystem();
+		visibilityMask.resize(vks::Frustum::getMaskSize(objectCount));
+		chunkVisibleCount.resize(objectCount / CULL_CHUNK_SIZE);
+		chunkOffset.resize(objectCount / CULL_CHUNK_SIZE);
+
+		cullingFrames.resize(drawCmdBuffers.size());
+		for (auto &frame : cullingFrames)
+		{
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&frame.instances,
+				objectCount * sizeof(InstanceData)));
+			VK_CHECK_RESULT(frame.instances.map());
+
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(
+				VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&frame.indirectCommands,
+				indirectCommands.size() * sizeof(VkDrawIndexedIndirectCommand) + sizeof(uint32_t)));
+			VK_CHECK_RESULT(frame.indirectCommands.map());
+		}
+
+		timestamps = new vks::TimestampQueries(vulkanDevice, 2, static_cast<uint32_t>(drawCmdBuffers.size()), vulkanDevice->queueFamilyIndices.graphics);
+	}
+
+	/**
+	* Cull all instances against the view frustum and write the visible ones and the indirect commands into the frame's buffers
+	* Culling and compaction are split into chunks that run on the job system, only the per plant type offsets are summed up serially
+	*/
+	void cullInstances(uint32_t frameIndex)
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+
+		frustum.update(camera.matrices.perspective * camera.matrices.view);
+		const uint32_t chunkCount = objectCount / CULL_CHUNK_SIZE;
+
+		// Cull the chunks
+		jobSystem->parallelFor(chunkCount, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t chunk = begin; chunk < end; chunk++)
+			{
+				chunkVisibleCount[chunk] = frustum.checkSpheres(instanceBounds, chunk * CULL_CHUNK_SIZE, CULL_CHUNK_SIZE, &visibilityMask[chunk * CULL_CHUNK_SIZE / 32]);
+			}
+		});
+
+		// Assign the compacted instance ranges, plant types without visible instances don't get a command
+		VkDrawIndexedIndirectCommand *commands = reinterpret_cast<VkDrawIndexedIndirectCommand*>(cullingFrames[frameIndex].indirectCommands.mapped);
+		const uint32_t chunksPerType = OBJECT_INSTANCE_COUNT / CULL_CHUNK_SIZE;
+		uint32_t firstInstance = 0;
+		uint32_t drawCount = 0;
+		for (uint32_t type = 0; type < indirectCommands.size(); type++)
+		{
+			uint32_t instanceCount = 0;
+			for (uint32_t chunk = type * chunksPerType; chunk < (type + 1) * chunksPerType; chunk++)
+			{
+				chunkOffset[chunk] = firstInstance + instanceCount;
+				instanceCount += chunkVisibleCount[chunk];
+			}
+			if (instanceCount > 0)
+			{
+				VkDrawIndexedIndirectCommand &command = commands[drawCount++];
+				command = indirectCommands[type];
+				command.firstInstance = firstInstance;
+				command.instanceCount = instanceCount;
+			}
+			firstInstance += instanceCount;
+		}
+		// The command buffers always draw all commands, unused ones draw nothing
+		for (uint32_t i = drawCount; i < indirectCommands.size(); i++)
+		{
+			commands[i] = {};
+		}
+		// The draw count follows the commands (e.g. for use with an indirect count extension)
+		*reinterpret_cast<uint32_t*>(&commands[indirectCommands.size()]) = drawCount;
+
+		// Copy the visible instances of each chunk to their compacted position
+		InstanceData *visibleInstances = reinterpret_cast<InstanceData*>(cullingFrames[frameIndex].instances.mapped);
+		jobSystem->parallelFor(chunkCount, [&](uint32_t begin, uint32_t end) {
+			uint32_t visibleIndices[CULL_CHUNK_SIZE];
+			for (uint32_t chunk = begin; chunk < end; chunk++)
+			{
+				const uint32_t visibleCount = vks::Frustum::compact(&visibilityMask[chunk * CULL_CHUNK_SIZE / 32], CULL_CHUNK_SIZE, visibleIndices);
+				InstanceData *dst = visibleInstances + chunkOffset[chunk];
+				const InstanceData *src = &instances[chunk * CULL_CHUNK_SIZE];
+				for (uint32_t i = 0; i < visibleCount; i++)
+				{
+					dst[i] = src[visibleIndices[i]];
+				}
+			}
+		});
+
+		cullingStats.visibleObjects = firstInstance;
+		cullingStats.drawCount = drawCount;
+		cullingStats.cpuTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+	}
+
 	void prepareUniformBuffers()
 	{
 		VK_CHECK_RESULT(vulkanDevice->createBuffer(
@@ -641,6 +828,12 @@ public:
 	{
 		VulkanExampleBase::prepareFrame();
 
+		// The previous submission of this command buffer has finished, so its culling buffers can be overwritten
+		if (cpuCulling)
+		{
+			cullInstances(currentBuffer);
+		}
+
 		// Command buffer to be sumitted to the queue
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
@@ -649,6 +842,11 @@ public:
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 
 		VulkanExampleBase::submitFrame();
+
+		if (timestamps->resolve(currentBuffer))
+		{
+			cullingStats.gpuTime = timestamps->getDuration(0, 1);
+		}
 	}
 
 	void prepare()
@@ -657,6 +855,7 @@ public:
 		loadAssets();
 		prepareIndirectData();
 		prepareInstanceData();
+		prepareCullingBuffers();
 		setupVertexDescriptions();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
@@ -681,12 +880,44 @@ public:
 		updateUniformBuffer(true);
 	}
 
+	virtual void keyPressed(uint32_t keyCode)
+	{
+		switch (keyCode)
+		{
+		case KEY_SPACE:
+		case GAMEPAD_BUTTON_A:
+			cpuCulling = !cpuCulling;
+			reBuildCommandBuffers();
+			break;
+		}
+	}
+
 	virtual void getOverlayText(VulkanTextOverlay *textOverlay)
 	{
-		textOverlay->addText(std::to_string(objectCount) + " objects", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		if (cpuCulling)
+		{
+			textOverlay->addText(std::to_string(cullingStats.visibleObjects) + " of " + std::to_string(objectCount) + " objects visible (" + std::to_string(cullingStats.drawCount) + " draws)", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		}
+		else
+		{
+			textOverlay->addText(std::to_string(objectCount) + " objects", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		}
+#if defined(__ANDROID__)
+		textOverlay->addText(std::string("CPU culling ") + (cpuCulling ? "on" : "off") + " (\"Button A\" to toggle)", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+#else
+		textOverlay->addText(std::string("CPU culling ") + (cpuCulling ? "on" : "off") + " (\"space\" to toggle)", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+#endif
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(2);
+		if (cpuCulling)
+		{
+			ss << "CPU cull " << cullingStats.cpuTime << " ms (" << jobSystem->getThreadCount() << " threads), ";
+		}
+		ss << "GPU plants " << cullingStats.gpuTime << " ms";
+		textOverlay->addText(ss.str(), 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
 		if (!vulkanDevice->features.multiDrawIndirect)
 		{
-			textOverlay->addText("multiDrawIndirect not supported", 5.0f, 105.0f, VulkanTextOverlay::alignLeft);
+			textOverlay->addText("multiDrawIndirect not supported", 5.0f, 135.0f, VulkanTextOverlay::alignLeft);
 		}
 	}
 };
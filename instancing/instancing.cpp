@@ -95,7 +95,7 @@ public:
 	{
 		title = "Vulkan Example - Instanced mesh rendering";
 		enableTextOverlay = true;
-		srand((unsigned int)time(NULL));
+		srand(getRandomSeed());
 		zoom = -18.5f;
 		rotation = { -17.2f, -4.7f, 0.0f };
 		cameraPos = { 5.5f, -1.85f, 0.0f };
@@ -428,7 +428,7 @@ public:
 		std::vector<InstanceData> instanceData;
 		instanceData.resize(INSTANCE_COUNT);
 
-		std::mt19937 rndGenerator((unsigned int)time(NULL));
+		std::mt19937 rndGenerator(getRandomSeed());
 		std::uniform_real_distribution<float> uniformDist(0.0, 1.0);
 
 		// Distribute rocks randomly on two different rings
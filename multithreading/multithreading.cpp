@@ -13,6 +13,9 @@
 #include <vector>
 #include <thread>
 #include <random>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -22,8 +25,11 @@
 #include <vulkan/vulkan.h>
 #include "vulkanexamplebase.h"
 
-#include "threadpool.hpp"
+#include "jobsystem.hpp"
+#include "taskgraph.hpp"
+#include "commandbuffercache.hpp"
 #include "frustum.hpp"
+#include "aabbtree.hpp"
 
 #include "VulkanModel.hpp"
 
@@ -105,7 +111,16 @@ public:
 	};
 	std::vector<ThreadData> threadData;
 
-	vks::ThreadPool threadPool;
+	// CPU stages of a frame, independent stages are executed concurrently on the job system
+	vks::TaskGraph frameGraph;
+	// Inheritance info for the secondary command buffers of the frame that is currently updated
+	// The secondary command buffers don't reference a framebuffer, so they can be reused for all swap chain images
+	VkCommandBufferInheritanceInfo frameInheritanceInfo;
+	VkFramebuffer currentFrameBuffer;
+
+	// Hashes of the state each secondary command buffer was recorded with (one group per object plus the sky sphere)
+	// Only objects whose state changed since the last frame are recorded again
+	vks::CommandBufferCache commandBufferCache;
 
 	// Fence to wait for all command buffers to finish before
 	// presenting to the swap chain
@@ -118,6 +133,45 @@ public:
 	// View frustum for culling invisible objects
 	vks::Frustum frustum;
 
+	// Object bounding spheres in SoA layout for batch culling all objects before dispatching the thread jobs
+	vks::Frustum::Spheres cullingSpheres;
+	std::vector<uint32_t> visibilityMask;
+	std::vector<uint8_t> cullingPlaneHints;
+	uint32_t visibleObjectCount = 0;
+
+	// Bounding volume hierarchy of all objects, used for culling (alternative to the batch culling) and picking
+	vks::AABBTree sceneTree;
+	std::vector<int32_t> sceneTreeProxies;
+	std::vector<uint32_t> visibleObjects;
+	bool useSceneTree = true;
+
+	// Object selected with the mouse cursor (highlighted in white)
+	struct {
+		int32_t index = -1;
+		glm::vec3 color;
+	} pickedObject;
+
+	// Culling microbenchmark results (in ms)
+	struct CullingBenchmark {
+		uint32_t objectCount;
+		double scalar;
+		double batchSpheres;
+		double batchSpheresHints;
+		double batchBoxes;
+		double orientedBoxes;
+		double treeBuild;
+		double treeQuery;
+	};
+	std::vector<CullingBenchmark> cullingBenchmarks;
+
+	// Job system scaling benchmark results (in ms)
+	struct ScalingBenchmark {
+		uint32_t threadCount;
+		double recordCommandBuffers;
+		double updateObjects;
+	};
+	std::vector<ScalingBenchmark> scalingBenchmarks;
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		zoom = -32.5f;
@@ -134,9 +188,7 @@ public:
 #else
 		std::cout << "numThreads = " << numThreads << std::endl;
 #endif
-		srand((unsigned int)time(NULL));
-
-		threadPool.setThreadCount(numThreads);
+		srand(getRandomSeed());
 
 		numObjectsPerThread = 512 / numThreads;
 	}
@@ -193,7 +245,7 @@ public:
 		uint32_t posX = 0;
 		uint32_t posZ = 0;
 
-		std::mt19937 rndGenerator((unsigned)time(NULL));
+		std::mt19937 rndGenerator(getRandomSeed());
 		std::uniform_real_distribution<float> uniformDist(0.0f, 1.0f);
 
 		for (uint32_t i = 0; i < numThreads; i++)
@@ -234,22 +286,60 @@ public:
 				thread->pushConstBlock[j].color = glm::vec3(rnd(1.0f), rnd(1.0f), rnd(1.0f));
 			}
 		}
+
+		const uint32_t objectCount = numThreads * numObjectsPerThread;
+		cullingSpheres.resize(objectCount);
+		commandBufferCache.resize(objectCount + 1);
+		visibilityMask.resize(vks::Frustum::getMaskSize(objectCount));
+		cullingPlaneHints.resize(vks::Frustum::getPlaneHintCount(objectCount), 0);
+
+		// Objects bob up and down, enlarging their tree bounds by the amplitude avoids reinserting them while they move
+		std::vector<vks::AABB> objectBounds(objectCount);
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			objectBounds[i] = getObjectBounds(i);
+		}
+		sceneTree.margin = 2.5f;
+		sceneTree.build(objectBounds, {}, sceneTreeProxies, getJobSystem());
 	
 	}
 
-	// Builds the secondary command buffer for each thread
-	void threadRenderCode(uint32_t threadIndex, uint32_t cmdBufferIndex, VkCommandBufferInheritanceInfo inheritanceInfo)
+	ObjectData &getObjectData(uint32_t index)
 	{
-		ThreadData *thread = &threadData[threadIndex];
-		ObjectData *objectData = &thread->objectData[cmdBufferIndex];
+		return threadData[index / numObjectsPerThread].objectData[index % numObjectsPerThread];
+	}
 
-		// Check visibility against view frustum
-		objectData->visible = frustum.checkSphere(objectData->pos, objectSphereDim * 0.5f); 
+	vks::AABB getObjectBounds(uint32_t index)
+	{
+		const glm::vec3 pos = getObjectData(index).pos;
+		const glm::vec3 extent = glm::vec3(objectSphereDim * 0.5f);
+		return vks::AABB(pos - extent, pos + extent);
+	}
 
-		if (!objectData->visible)
+	// Animates an object and updates its model matrix
+	static void updateObject(ObjectData &objectData, float timeStep)
+	{
+		objectData.rotation.y += 2.5f * objectData.rotationSpeed * timeStep;
+		if (objectData.rotation.y > 360.0f)
 		{
-			return;
+			objectData.rotation.y -= 360.0f;
 		}
+		objectData.deltaT += 0.15f * timeStep;
+		if (objectData.deltaT > 1.0f)
+			objectData.deltaT -= 1.0f;
+		objectData.pos.y = sin(glm::radians(objectData.deltaT * 360.0f)) * 2.5f;
+
+		objectData.model = glm::translate(glm::mat4(), objectData.pos);
+		objectData.model = glm::rotate(objectData.model, -sinf(glm::radians(objectData.deltaT * 360.0f)) * 0.25f, glm::vec3(objectData.rotationDir, 0.0f, 0.0f));
+		objectData.model = glm::rotate(objectData.model, glm::radians(objectData.rotation.y), glm::vec3(0.0f, objectData.rotationDir, 0.0f));
+		objectData.model = glm::rotate(objectData.model, glm::radians(objectData.deltaT * 360.0f), glm::vec3(0.0f, objectData.rotationDir, 0.0f));
+		objectData.model = glm::scale(objectData.model, glm::vec3(objectData.scale));
+	}
+
+	// Builds the secondary command buffer for each thread
+	void threadRenderCode(uint32_t threadIndex, uint32_t cmdBufferIndex, VkCommandBufferInheritanceInfo inheritanceInfo)
+	{
+		ThreadData *thread = &threadData[threadIndex];
 
 		VkCommandBufferBeginInfo commandBufferBeginInfo = vks::initializers::commandBufferBeginInfo();
 		commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
@@ -267,25 +357,6 @@ public:
 
 		vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.phong);
 
-		// Update
-		objectData->rotation.y += 2.5f * objectData->rotationSpeed * frameTimer;
-		if (objectData->rotation.y > 360.0f)
-		{
-			objectData->rotation.y -= 360.0f;
-		}
-		objectData->deltaT += 0.15f * frameTimer;
-		if (objectData->deltaT > 1.0f)
-			objectData->deltaT -= 1.0f;
-		objectData->pos.y = sin(glm::radians(objectData->deltaT * 360.0f)) * 2.5f;
-
-		objectData->model = glm::translate(glm::mat4(), objectData->pos);
-		objectData->model = glm::rotate(objectData->model, -sinf(glm::radians(objectData->deltaT * 360.0f)) * 0.25f, glm::vec3(objectData->rotationDir, 0.0f, 0.0f));
-		objectData->model = glm::rotate(objectData->model, glm::radians(objectData->rotation.y), glm::vec3(0.0f, objectData->rotationDir, 0.0f));
-		objectData->model = glm::rotate(objectData->model, glm::radians(objectData->deltaT * 360.0f), glm::vec3(0.0f, objectData->rotationDir, 0.0f));
-		objectData->model = glm::scale(objectData->model, glm::vec3(objectData->scale));
-
-		thread->pushConstBlock[cmdBufferIndex].mvp = matrices.projection * matrices.view * objectData->model;
-
 		// Update shader push constant block
 		// Contains model view matrix
 		vkCmdPushConstants(
@@ -304,8 +375,31 @@ public:
 		VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffer));
 	}
 
+	// Returns a hash of all state that goes into an object's secondary command buffer
+	uint64_t getObjectStateHash(const ThreadPushConstantBlock &pushConstBlock)
+	{
+		vks::StateHasher hasher;
+		hasher.add(pipelines.phong).add(renderPass).add(width).add(height).add(pushConstBlock.mvp).add(pushConstBlock.color);
+		return hasher.get();
+	}
+
 	void updateSecondaryCommandBuffer(VkCommandBufferInheritanceInfo inheritanceInfo)
 	{
+		glm::mat4 view = glm::mat4();
+		view = glm::rotate(view, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+		view = glm::rotate(view, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+		view = glm::rotate(view, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+
+		glm::mat4 mvp = matrices.projection * view;
+
+		// The sky sphere only changes with the camera rotation
+		vks::StateHasher hasher;
+		hasher.add(pipelines.starsphere).add(renderPass).add(width).add(height).add(mvp);
+		if (!commandBufferCache.checkDirty(numThreads * numObjectsPerThread, hasher.get()))
+		{
+			return;
+		}
+
 		// Secondary command buffer for the sky sphere
 		VkCommandBufferBeginInfo commandBufferBeginInfo = vks::initializers::commandBufferBeginInfo();
 		commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
@@ -321,13 +415,6 @@ public:
 
 		vkCmdBindPipeline(secondaryCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.starsphere);
 
-		glm::mat4 view = glm::mat4();
-		view = glm::rotate(view, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		view = glm::rotate(view, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		view = glm::rotate(view, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-
-		glm::mat4 mvp = matrices.projection * view;
-
 		vkCmdPushConstants(
 			secondaryCommandBuffer,
 			pipelineLayout,
@@ -344,10 +431,90 @@ public:
 		VK_CHECK_RESULT(vkEndCommandBuffer(secondaryCommandBuffer));
 	}
 
-	// Updates the secondary command buffers using a thread pool 
-	// and puts them into the primary command buffer that's 
-	// lat submitted to the queue for rendering
-	void updateCommandBuffers(VkFramebuffer frameBuffer)
+	// Animates all visible objects and records the secondary command buffers of those whose state changed using the job system
+	// Each thread data block (command pool) is recorded by a single job, as command pools must not be used concurrently
+	// Idle threads steal whole thread data blocks, so blocks with many visible objects don't stall the others
+	void recordObjectCommandBuffers(vks::JobSystem &jobSystem, VkCommandBufferInheritanceInfo inheritanceInfo, bool useCache = true)
+	{
+		jobSystem.parallelFor(numThreads, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t t = begin; t < end; t++)
+			{
+				for (uint32_t i = 0; i < numObjectsPerThread; i++)
+				{
+					ObjectData &objectData = threadData[t].objectData[i];
+					if (!objectData.visible)
+					{
+						continue;
+					}
+					if (!paused)
+					{
+						updateObject(objectData, frameTimer);
+					}
+					ThreadPushConstantBlock &pushConstBlock = threadData[t].pushConstBlock[i];
+					pushConstBlock.mvp = matrices.projection * matrices.view * objectData.model;
+					if (!useCache || commandBufferCache.checkDirty(t * numObjectsPerThread + i, getObjectStateHash(pushConstBlock)))
+					{
+						threadRenderCode(t, i, inheritanceInfo);
+					}
+				}
+			}
+		});
+	}
+
+	// Determines the visible objects using either the scene tree or the batch culling
+	void cullObjects()
+	{
+		if (useSceneTree)
+		{
+			// Only visit the parts of the scene that intersect the view frustum
+			visibleObjects.clear();
+			sceneTree.queryFrustum(frustum, visibleObjects);
+			visibleObjectCount = static_cast<uint32_t>(visibleObjects.size());
+			memset(visibilityMask.data(), 0, visibilityMask.size() * sizeof(uint32_t));
+			for (auto index : visibleObjects)
+			{
+				visibilityMask[index / 32] |= (1 << (index % 32));
+			}
+		}
+		else
+		{
+			// Check visibility of all objects against the view frustum in one batch
+			const float radius = objectSphereDim * 0.5f;
+			for (uint32_t t = 0; t < numThreads; t++)
+			{
+				for (uint32_t i = 0; i < numObjectsPerThread; i++)
+				{
+					cullingSpheres.set(t * numObjectsPerThread + i, threadData[t].objectData[i].pos, radius);
+				}
+			}
+			visibleObjectCount = frustum.checkSpheres(cullingSpheres, visibilityMask.data(), cullingPlaneHints.data());
+		}
+
+		for (uint32_t t = 0; t < numThreads; t++)
+		{
+			for (uint32_t i = 0; i < numObjectsPerThread; i++)
+			{
+				const uint32_t index = t * numObjectsPerThread + i;
+				threadData[t].objectData[i].visible = (visibilityMask[index / 32] & (1 << (index % 32))) != 0;
+			}
+		}
+	}
+
+	// Visible objects have been moved while recording their command buffers, update their bounds in the tree
+	void updateSceneTree()
+	{
+		for (uint32_t index = 0; index < numThreads * numObjectsPerThread; index++)
+		{
+			if (getObjectData(index).visible)
+			{
+				sceneTree.update(sceneTreeProxies[index], getObjectBounds(index));
+			}
+		}
+	}
+
+	// Puts the secondary command buffers into the primary command buffer that's
+	// later submitted to the queue for rendering
+	void recordPrimaryCommandBuffer()
 	{
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
@@ -364,9 +531,8 @@ public:
 		renderPassBeginInfo.renderArea.extent.height = height;
 		renderPassBeginInfo.clearValueCount = 2;
 		renderPassBeginInfo.pClearValues = clearValues;
-		renderPassBeginInfo.framebuffer = frameBuffer;
-
 		// Set target frame buffer
+		renderPassBeginInfo.framebuffer = currentFrameBuffer;
 
 		VK_CHECK_RESULT(vkBeginCommandBuffer(primaryCommandBuffer, &cmdBufInfo));
 
@@ -374,30 +540,12 @@ public:
 		// These are stored (and retrieved) from the secondary command buffers
 		vkCmdBeginRenderPass(primaryCommandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-		// Inheritance info for the secondary command buffers
-		VkCommandBufferInheritanceInfo inheritanceInfo = vks::initializers::commandBufferInheritanceInfo();
-		inheritanceInfo.renderPass = renderPass;
-		// Secondary command buffer also use the currently active framebuffer
-		inheritanceInfo.framebuffer = frameBuffer;
-
 		// Contains the list of secondary command buffers to be executed
 		std::vector<VkCommandBuffer> commandBuffers;
 
 		// Secondary command buffer with star background sphere
-		updateSecondaryCommandBuffer(inheritanceInfo);
 		commandBuffers.push_back(secondaryCommandBuffer);
 
-		// Add a job to the thread's queue for each object to be rendered
-		for (uint32_t t = 0; t < numThreads; t++)
-		{
-			for (uint32_t i = 0; i < numObjectsPerThread; i++)
-			{
-				threadPool.threads[t]->addJob([=] { threadRenderCode(t, i, inheritanceInfo); });
-			}
-		}
-			
-		threadPool.wait();
-
 		// Only submit if object is within the current view frustum
 		for (uint32_t t = 0; t < numThreads; t++)
 		{
@@ -418,6 +566,30 @@ public:
 		VK_CHECK_RESULT(vkEndCommandBuffer(primaryCommandBuffer));
 	}
 
+	// Sets up the stages of a frame and the resources they access
+	// The sky sphere is recorded while the objects are culled and recorded, the scene tree update runs alongside the primary command buffer
+	// Sky sphere and primary command buffer are both allocated from the example's command pool, so they also share it as a resource
+	void setupFrameGraph()
+	{
+		frameGraph.addTask("sky", [this] { updateSecondaryCommandBuffer(frameInheritanceInfo); }, { "camera" }, { "skyCommands", "cmdPool" });
+		frameGraph.addTask("culling", [this] { cullObjects(); }, { "camera", "objects", "sceneTree" }, { "visibility" });
+		frameGraph.addTask("record", [this] { recordObjectCommandBuffers(*getJobSystem(), frameInheritanceInfo); }, { "camera", "visibility" }, { "objects", "objectCommands" });
+		frameGraph.addTask("sceneTree", [this] { updateSceneTree(); }, { "objects", "visibility" }, { "sceneTree" });
+		frameGraph.addTask("primary", [this] { recordPrimaryCommandBuffer(); }, { "visibility", "skyCommands", "objectCommands" }, { "primaryCommands", "cmdPool" });
+	}
+
+	// Updates all command buffers for the current frame by running the frame graph on the job system
+	void updateCommandBuffers(VkFramebuffer frameBuffer)
+	{
+		// Inheritance info for the secondary command buffers
+		frameInheritanceInfo = vks::initializers::commandBufferInheritanceInfo();
+		frameInheritanceInfo.renderPass = renderPass;
+		currentFrameBuffer = frameBuffer;
+
+		frameGraph.execute(*getJobSystem());
+		commandBufferCache.nextFrame();
+	}
+
 	void loadMeshes()
 	{
 		models.ufo.loadFromFile(getAssetPath() + "models/retroufo_red_lowpoly.dae", vertexLayout, 0.12f, vulkanDevice, queue);
@@ -614,6 +786,7 @@ public:
 		setupPipelineLayout();
 		preparePipelines();
 		prepareMultiThreadedRenderer();
+		setupFrameGraph();
 		updateMatrices();
 		prepared = true;
 	}
@@ -630,9 +803,292 @@ public:
 		updateMatrices();
 	}
 
+	// Compares per object culling with the batch culling functions for large numbers of random objects
+	void runCullingBenchmark()
+	{
+		std::mt19937 rndGenerator(0);
+		std::uniform_real_distribution<float> posDist(-256.0f, 256.0f);
+		std::uniform_real_distribution<float> sizeDist(0.5f, 8.0f);
+
+		cullingBenchmarks.clear();
+		const uint32_t objectCounts[] = { 10000, 100000, 1000000 };
+		for (auto objectCount : objectCounts)
+		{
+			vks::Frustum::Spheres spheres;
+			vks::Frustum::Boxes boxes;
+			spheres.resize(objectCount);
+			boxes.resize(objectCount);
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				const glm::vec3 pos = glm::vec3(posDist(rndGenerator), posDist(rndGenerator), posDist(rndGenerator));
+				const glm::vec3 extent = glm::vec3(sizeDist(rndGenerator), sizeDist(rndGenerator), sizeDist(rndGenerator));
+				spheres.set(i, pos, glm::length(extent));
+				boxes.set(i, pos - extent, pos + extent);
+			}
+			std::vector<uint32_t> mask(vks::Frustum::getMaskSize(objectCount));
+			std::vector<uint8_t> hints(vks::Frustum::getPlaneHintCount(objectCount), 0);
+
+			CullingBenchmark result;
+			result.objectCount = objectCount;
+			uint32_t visibleScalar = 0;
+
+			auto tStart = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				visibleScalar += frustum.checkSphere(glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.radius[i]) ? 1 : 0;
+			}
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			result.scalar = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+
+			tStart = std::chrono::high_resolution_clock::now();
+			uint32_t visibleBatch = frustum.checkSpheres(spheres, mask.data());
+			tEnd = std::chrono::high_resolution_clock::now();
+			result.batchSpheres = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+
+			// First pass fills the plane hints, second pass benefits from them
+			frustum.checkSpheres(spheres, mask.data(), hints.data());
+			tStart = std::chrono::high_resolution_clock::now();
+			frustum.checkSpheres(spheres, mask.data(), hints.data());
+			tEnd = std::chrono::high_resolution_clock::now();
+			result.batchSpheresHints = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+
+			tStart = std::chrono::high_resolution_clock::now();
+			uint32_t visibleBoxes = frustum.checkBoxes(boxes, mask.data());
+			tEnd = std::chrono::high_resolution_clock::now();
+			result.batchBoxes = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+
+			// Same boxes with a random orientation, tested one at a time
+			std::uniform_real_distribution<float> angleDist(0.0f, glm::radians(360.0f));
+			std::vector<glm::mat3> axes(objectCount);
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				const glm::vec3 axis = glm::vec3(posDist(rndGenerator), posDist(rndGenerator), posDist(rndGenerator));
+				axes[i] = glm::mat3(glm::rotate(glm::mat4(1.0f), angleDist(rndGenerator), glm::length(axis) > 0.0f ? glm::normalize(axis) : glm::vec3(0.0f, 1.0f, 0.0f)));
+			}
+			uint32_t visibleOrientedBoxes = 0;
+			tStart = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				const glm::vec3 center = glm::vec3(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+				const glm::vec3 extent = glm::vec3(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+				visibleOrientedBoxes += frustum.checkOrientedBox(center, axes[i], extent) ? 1 : 0;
+			}
+			tEnd = std::chrono::high_resolution_clock::now();
+			result.orientedBoxes = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+
+			std::vector<vks::AABB> bounds(objectCount);
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				const glm::vec3 center = glm::vec3(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+				const glm::vec3 extent = glm::vec3(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+				bounds[i] = vks::AABB(center - extent, center + extent);
+			}
+			vks::AABBTree tree;
+			tree.margin = 0.0f;
+			std::vector<int32_t> proxies;
+			std::vector<uint32_t> visible;
+			visible.reserve(objectCount);
+			tStart = std::chrono::high_resolution_clock::now();
+			tree.build(bounds, {}, proxies, getJobSystem());
+			tEnd = std::chrono::high_resolution_clock::now();
+			result.treeBuild = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+
+			tStart = std::chrono::high_resolution_clock::now();
+			tree.queryFrustum(frustum, visible);
+			tEnd = std::chrono::high_resolution_clock::now();
+			result.treeQuery = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+
+			cullingBenchmarks.push_back(result);
+
+			std::cout << "Culling " << objectCount << " objects (" << visibleScalar << "/" << visibleBatch << " spheres, " << visibleBoxes << " boxes, " << visibleOrientedBoxes << " oriented boxes visible): "
+				<< "scalar " << result.scalar << " ms, batch spheres " << result.batchSpheres << " ms, batch spheres with plane hints " << result.batchSpheresHints << " ms, "
+				<< "batch boxes " << result.batchBoxes << " ms, oriented boxes " << result.orientedBoxes << " ms, tree build " << result.treeBuild << " ms, tree query " << result.treeQuery << " ms (" << visible.size() << " visible)" << std::endl;
+		}
+		updateTextOverlay();
+	}
+
+	// Measures how the job system scales from one thread up to all hardware threads
+	// Records the secondary command buffers of all objects and animates a large number of objects with job systems of increasing size
+	void runScalingBenchmark()
+	{
+		const uint32_t iterations = 10;
+		const uint32_t animatedObjectCount = 100000;
+
+		// Keep the current scene state, recording the command buffers also animates the objects
+		std::vector<std::vector<ObjectData>> objectDataBackup;
+		for (auto &thread : threadData)
+		{
+			objectDataBackup.push_back(thread.objectData);
+			for (auto &objectData : thread.objectData)
+			{
+				objectData.visible = true;
+			}
+		}
+
+		std::vector<ObjectData> animatedObjects(animatedObjectCount);
+		for (uint32_t i = 0; i < animatedObjectCount; i++)
+		{
+			animatedObjects[i] = threadData[i % numThreads].objectData[(i / numThreads) % numObjectsPerThread];
+		}
+
+		VkCommandBufferInheritanceInfo inheritanceInfo = vks::initializers::commandBufferInheritanceInfo();
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.framebuffer = frameBuffers[currentBuffer];
+
+		std::vector<uint32_t> threadCounts;
+		for (uint32_t count = 1; count < std::thread::hardware_concurrency(); count *= 2)
+		{
+			threadCounts.push_back(count);
+		}
+		threadCounts.push_back(std::max(std::thread::hardware_concurrency(), 1u));
+
+		scalingBenchmarks.clear();
+		for (auto threadCount : threadCounts)
+		{
+			vks::JobSystem benchmarkJobSystem(threadCount);
+			ScalingBenchmark result;
+			result.threadCount = threadCount;
+
+			auto tStart = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < iterations; i++)
+			{
+				recordObjectCommandBuffers(benchmarkJobSystem, inheritanceInfo, false);
+			}
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			result.recordCommandBuffers = std::chrono::duration<double, std::milli>(tEnd - tStart).count() / iterations;
+
+			tStart = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < iterations; i++)
+			{
+				benchmarkJobSystem.parallelFor(animatedObjectCount, [&](uint32_t begin, uint32_t end) {
+					for (uint32_t j = begin; j < end; j++)
+					{
+						updateObject(animatedObjects[j], 0.01f);
+					}
+				}, 256);
+			}
+			tEnd = std::chrono::high_resolution_clock::now();
+			result.updateObjects = std::chrono::duration<double, std::milli>(tEnd - tStart).count() / iterations;
+
+			scalingBenchmarks.push_back(result);
+
+			std::cout << "Job system with " << threadCount << " threads: recording " << numThreads * numObjectsPerThread << " command buffers " << result.recordCommandBuffers << " ms (speedup "
+				<< scalingBenchmarks[0].recordCommandBuffers / result.recordCommandBuffers << "x), animating " << animatedObjectCount << " objects " << result.updateObjects << " ms (speedup "
+				<< scalingBenchmarks[0].updateObjects / result.updateObjects << "x)" << std::endl;
+		}
+
+		for (uint32_t t = 0; t < numThreads; t++)
+		{
+			threadData[t].objectData = objectDataBackup[t];
+		}
+		// The object command buffers have been recorded with the benchmark's state
+		commandBufferCache.invalidate();
+		updateTextOverlay();
+	}
+
+	// Select the object under the mouse cursor using a ray cast against the scene tree
+	void pickObject()
+	{
+		if (pickedObject.index >= 0)
+		{
+			threadData[pickedObject.index / numObjectsPerThread].pushConstBlock[pickedObject.index % numObjectsPerThread].color = pickedObject.color;
+			pickedObject.index = -1;
+		}
+
+		// Unproject the cursor position on the near and far plane
+		const glm::vec2 ndc = glm::vec2(mousePos.x / (float)width, mousePos.y / (float)height) * 2.0f - 1.0f;
+		const glm::mat4 invViewProj = glm::inverse(matrices.projection * matrices.view);
+		glm::vec4 nearPos = invViewProj * glm::vec4(ndc, -1.0f, 1.0f);
+		glm::vec4 farPos = invViewProj * glm::vec4(ndc, 1.0f, 1.0f);
+		const glm::vec3 origin = glm::vec3(nearPos) / nearPos.w;
+		const glm::vec3 direction = glm::normalize(glm::vec3(farPos) / farPos.w - origin);
+
+		// Intersect the objects' bounding spheres for the exact hit distance
+		const float radius = objectSphereDim * 0.5f;
+		auto hitSphere = [&](uint32_t index, float &distance) {
+			const glm::vec3 oc = origin - getObjectData(index).pos;
+			const float b = glm::dot(oc, direction);
+			const float c = glm::dot(oc, oc) - radius * radius;
+			const float discriminant = b * b - c;
+			if (discriminant < 0.0f)
+			{
+				return false;
+			}
+			distance = -b - sqrt(discriminant);
+			return distance >= 0.0f;
+		};
+
+		uint32_t index;
+		float distance;
+		if (sceneTree.raycast(origin, direction, 256.0f, index, distance, hitSphere))
+		{
+			ThreadPushConstantBlock &pushConstBlock = threadData[index / numObjectsPerThread].pushConstBlock[index % numObjectsPerThread];
+			pickedObject.index = static_cast<int32_t>(index);
+			pickedObject.color = pushConstBlock.color;
+			pushConstBlock.color = glm::vec3(1.0f);
+		}
+		updateTextOverlay();
+	}
+
+	virtual void keyPressed(uint32_t keyCode)
+	{
+		switch (keyCode)
+		{
+		case KEY_B:
+		case GAMEPAD_BUTTON_A:
+			runCullingBenchmark();
+			break;
+		case KEY_T:
+		case GAMEPAD_BUTTON_X:
+			useSceneTree = !useSceneTree;
+			updateTextOverlay();
+			break;
+		case KEY_O:
+			pickObject();
+			break;
+		case KEY_M:
+		case GAMEPAD_BUTTON_Y:
+			runScalingBenchmark();
+			break;
+		}
+	}
+
 	virtual void getOverlayText(VulkanTextOverlay *textOverlay)
 	{
-		textOverlay->addText("Using " + std::to_string(numThreads) + " threads", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Using " + std::to_string(getJobSystem()->getThreadCount()) + " threads (" + std::to_string(numThreads) + " command pools)", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText(std::to_string(visibleObjectCount) + " of " + std::to_string(numThreads * numObjectsPerThread) + " objects visible (" + (useSceneTree ? "scene tree" : "batch") + " culling)", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+#if defined(__ANDROID__)
+		textOverlay->addText("Press \"Button A\" to run culling benchmark, \"Button Y\" to run job system benchmark, \"Button X\" to toggle culling method", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+#else
+		textOverlay->addText("Press \"b\" to run culling benchmark, \"m\" to run job system benchmark, \"t\" to toggle culling method, \"o\" to pick object under cursor", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+#endif
+		textOverlay->addText("Critical path: " + frameGraph.getCriticalPathString(), 5.0f, 130.0f, VulkanTextOverlay::alignLeft);
+		const vks::CommandBufferCache::Statistics cacheStatistics = commandBufferCache.getStatistics();
+		std::stringstream ss;
+		ss << "Command buffer cache: " << cacheStatistics.hits << " of " << cacheStatistics.hits + cacheStatistics.misses << " reused (" << std::fixed << std::setprecision(1) << cacheStatistics.hitRate() * 100.0f << "% hit rate)";
+		textOverlay->addText(ss.str(), 5.0f, 145.0f, VulkanTextOverlay::alignLeft);
+		float y = 160.0f;
+		if (pickedObject.index >= 0)
+		{
+			textOverlay->addText("Picked object " + std::to_string(pickedObject.index), 5.0f, y, VulkanTextOverlay::alignLeft);
+			y += 15.0f;
+		}
+		for (auto &result : cullingBenchmarks)
+		{
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2) << result.objectCount << " objects: scalar " << result.scalar << " ms, spheres " << result.batchSpheres
+				<< " ms (hints " << result.batchSpheresHints << " ms), boxes " << result.batchBoxes << " ms, OBBs " << result.orientedBoxes << " ms, tree " << result.treeQuery << " ms";
+			textOverlay->addText(ss.str(), 5.0f, y, VulkanTextOverlay::alignLeft);
+			y += 15.0f;
+		}
+		for (auto &result : scalingBenchmarks)
+		{
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2) << result.threadCount << " threads: record " << result.recordCommandBuffers << " ms (" << scalingBenchmarks[0].recordCommandBuffers / result.recordCommandBuffers
+				<< "x), animate " << result.updateObjects << " ms (" << scalingBenchmarks[0].updateObjects / result.updateObjects << "x)";
+			textOverlay->addText(ss.str(), 5.0f, y, VulkanTextOverlay::alignLeft);
+			y += 15.0f;
+		}
 	}
 };
 
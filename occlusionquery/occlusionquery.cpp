@@ -21,6 +21,7 @@
 #include "vulkanexamplebase.h"
 #include "VulkanBuffer.hpp"
 #include "VulkanModel.hpp"
+#include "VulkanOcclusionQueries.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -76,14 +77,11 @@ public:
 	VkDescriptorSet descriptorSet;
 	VkDescriptorSetLayout descriptorSetLayout;
 
-	// Stores occlusion query results
-	struct {
-		VkBuffer buffer;
-		VkDeviceMemory memory;
-	} queryResult;
+	// Occlusion queries with one query pool per command buffer
+	// Results are read without waiting when a command buffer is reused, so they lag behind by the number of command buffers
+	vks::OcclusionQueryManager *occlusionQueries = nullptr;
 
-	// Pool that stores all occlusion queries
-	VkQueryPool queryPool;
+	enum { QUERY_TEAPOT = 0, QUERY_SPHERE = 1, QUERY_COUNT = 2 };
 
 	// Passed query samples
 	uint64_t passedSamples[2] = { 1,1 };
@@ -109,10 +107,7 @@ public:
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
-		vkDestroyQueryPool(device, queryPool, nullptr);
-
-		vkDestroyBuffer(device, queryResult.buffer, nullptr);
-		vkFreeMemory(device, queryResult.memory, nullptr);
+		delete occlusionQueries;
 
 		uniformBuffers.occluder.destroy();
 		uniformBuffers.sphere.destroy();
@@ -123,53 +118,27 @@ public:
 		models.teapot.destroy();
 	}
 
-	// Create a buffer for storing the query result
-	// Setup a query pool
-	void setupQueryResultBuffer()
+	// Setup the occlusion query pools and result buffer (one set per command buffer)
+	void setupQueries()
 	{
-		uint32_t bufSize = 2 * sizeof(uint64_t);
-
-		VkMemoryRequirements memReqs;
-		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-		VkBufferCreateInfo bufferCreateInfo = 
-			vks::initializers::bufferCreateInfo(
-				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 
-				bufSize);
-
-		// Results are saved in a host visible buffer for easy access by the application
-		VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &queryResult.buffer));
-		vkGetBufferMemoryRequirements(device, queryResult.buffer, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &queryResult.memory));
-		VK_CHECK_RESULT(vkBindBufferMemory(device, queryResult.buffer, queryResult.memory, 0));
-
-		// Create query pool
-		VkQueryPoolCreateInfo queryPoolInfo = {};
-		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
-		// Query pool will be created for occlusion queries
-		queryPoolInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
-		queryPoolInfo.queryCount = 2;
-
-		VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, NULL, &queryPool));
+		occlusionQueries = new vks::OcclusionQueryManager(vulkanDevice, QUERY_COUNT, static_cast<uint32_t>(drawCmdBuffers.size()));
 	}
 
-	// Retrieves the results of the occlusion queries submitted to the command buffer
+	// Picks up the results of the occlusion queries submitted the last time the current command buffer was used
+	// This never waits on the GPU, objects without a result are considered visible
 	void getQueryResults()
 	{
-		// We use vkGetQueryResults to copy the results into a host visible buffer
-		vkGetQueryPoolResults(
-			device, 
-			queryPool,
-			0,
-			2,
-			sizeof(passedSamples),
-			passedSamples,
-			sizeof(uint64_t),
-			// Store results a 64 bit values and wait until the results have been finished
-			// If you don't want to wait, you can use VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
-			// which also returns the state of the result (ready) in the result
-			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		occlusionQueries->resolve(currentBuffer);
+		const bool teapotVisible = occlusionQueries->isVisible(QUERY_TEAPOT);
+		const bool sphereVisible = occlusionQueries->isVisible(QUERY_SPHERE);
+		const bool changed = (teapotVisible != (passedSamples[0] > 0)) || (sphereVisible != (passedSamples[1] > 0));
+		passedSamples[0] = occlusionQueries->hasResult(QUERY_TEAPOT) ? occlusionQueries->getPassedSamples(QUERY_TEAPOT) : 1;
+		passedSamples[1] = occlusionQueries->hasResult(QUERY_SPHERE) ? occlusionQueries->getPassedSamples(QUERY_SPHERE) : 1;
+		if (changed)
+		{
+			// Visibility is displayed by the object's color
+			updateUniformBuffers();
+		}
 	}
 
 	void buildCommandBuffers()
@@ -198,7 +167,7 @@ public:
 
 			// Reset query pool
 			// Must be done outside of render pass
-			vkCmdResetQueryPool(drawCmdBuffers[i], queryPool, 0, 2);
+			occlusionQueries->cmdReset(drawCmdBuffers[i], i);
 
 			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
@@ -230,24 +199,24 @@ public:
 			vkCmdDrawIndexed(drawCmdBuffers[i], models.plane.indexCount, 1, 0, 0, 0);
 
 			// Teapot
-			vkCmdBeginQuery(drawCmdBuffers[i], queryPool, 0, VK_FLAGS_NONE);
+			occlusionQueries->cmdBeginQuery(drawCmdBuffers[i], i, QUERY_TEAPOT);
 
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.teapot, 0, NULL);
 			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &models.teapot.vertices.buffer, offsets);
 			vkCmdBindIndexBuffer(drawCmdBuffers[i], models.teapot.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 			vkCmdDrawIndexed(drawCmdBuffers[i], models.teapot.indexCount, 1, 0, 0, 0);
 
-			vkCmdEndQuery(drawCmdBuffers[i], queryPool, 0);
+			occlusionQueries->cmdEndQuery(drawCmdBuffers[i], i, QUERY_TEAPOT);
 
 			// Sphere
-			vkCmdBeginQuery(drawCmdBuffers[i], queryPool, 1, VK_FLAGS_NONE);
+			occlusionQueries->cmdBeginQuery(drawCmdBuffers[i], i, QUERY_SPHERE);
 
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.sphere, 0, NULL);
 			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &models.sphere.vertices.buffer, offsets);
 			vkCmdBindIndexBuffer(drawCmdBuffers[i], models.sphere.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 			vkCmdDrawIndexed(drawCmdBuffers[i], models.sphere.indexCount, 1, 0, 0, 0);
 
-			vkCmdEndQuery(drawCmdBuffers[i], queryPool, 1);
+			occlusionQueries->cmdEndQuery(drawCmdBuffers[i], i, QUERY_SPHERE);
 
 			// Visible pass
 			// Clear color and depth attachments
@@ -295,6 +264,9 @@ public:
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
+			// Copy the query results of this command buffer into the host visible result buffer
+			occlusionQueries->cmdCopyResults(drawCmdBuffers[i], i);
+
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 		}
 	}
@@ -303,13 +275,13 @@ public:
 	{
 		VulkanExampleBase::prepareFrame();
 
+		// Read the query results of the previous submission of this command buffer before it's submitted again
+		getQueryResults();
+
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 
-		// Read query results for displaying in next frame
-		getQueryResults();
-
 		VulkanExampleBase::submitFrame();
 	}
 
@@ -602,7 +574,7 @@ public:
 	{
 		VulkanExampleBase::prepare();
 		loadAssets();
-		setupQueryResultBuffer();
+		setupQueries();
 		setupVertexDescriptions();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
@@ -11,6 +11,9 @@
 #include <string.h>
 #include <assert.h>
 #include <vector>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -23,6 +26,8 @@
 #include "VulkanBuffer.hpp"
 #include "VulkanTexture.hpp"
 #include "VulkanModel.hpp"
+#include "particlesystem.hpp"
+#include "depthsorter.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -31,20 +36,12 @@
 
 #define FLAME_RADIUS 8.0f
 
-#define PARTICLE_TYPE_FLAME 0
-#define PARTICLE_TYPE_SMOKE 1
-
-struct Particle {
-	glm::vec4 pos;
-	glm::vec4 color;
-	float alpha;
-	float size;
-	float rotation;
-	uint32_t type;
-	// Attributes not used in shader
-	glm::vec4 vel;
-	float rotationSpeed;
-};
+// Particle counts of the update benchmark (from 512 to 1M particles, multiplied by 4 per step)
+#define BENCHMARK_MIN_PARTICLE_COUNT 512
+#define BENCHMARK_MAX_PARTICLE_COUNT (1024 * 1024)
+#define BENCHMARK_ITERATIONS 32
+
+typedef vks::ParticleSystem::Vertex Particle;
 
 class VulkanExample : public VulkanExampleBase
 {
@@ -76,18 +73,32 @@ public:
 	} models;
 
 	glm::vec3 emitterPos = glm::vec3(0.0f, -FLAME_RADIUS + 2.0f, 0.0f);
-	glm::vec3 minVel = glm::vec3(-3.0f, 0.5f, -3.0f);
-	glm::vec3 maxVel = glm::vec3(3.0f, 7.0f, 3.0f);
+
+	// Structure of arrays particle simulation, writes its vertices straight into the mapped vertex buffer of the current frame
+	vks::ParticleSystem *particleSystem = nullptr;
+
+	// Smoke particles are alpha blended, so they need to be drawn back to front
+	bool depthSort = true;
+	vks::DepthSorter depthSorter;
+	std::vector<float> particleDepths;
 
 	struct {
-		VkBuffer buffer;
-		VkDeviceMemory memory;
-		// Store the mapped address of the particle data for reuse
-		void *mappedMemory;
-		// Size of the particle buffer in bytes
+		// One persistently mapped vertex buffer per command buffer, so the CPU never writes to a buffer that is in flight
+		std::vector<vks::Buffer> buffers;
+		// Size of a single particle buffer in bytes
 		size_t size;
 	} particles;
 
+	struct BenchmarkResult {
+		uint32_t particleCount;
+		double scalar;
+		double simd;
+		double simdJobs;
+		double sort;
+		double sortJobs;
+	};
+	std::vector<BenchmarkResult> benchmarkResults;
+
 	struct {
 		vks::Buffer fire;
 		vks::Buffer environment;
@@ -121,8 +132,6 @@ public:
 		VkDescriptorSet environment;
 	} descriptorSets;
 
-	std::vector<Particle> particleBuffer;
-
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		zoom = -75.0f;
@@ -131,7 +140,6 @@ public:
 		title = "Vulkan Example - Particle system";
 		zoomSpeed *= 1.5f;
 		timerSpeed *= 8.0f;
-		srand((unsigned int)time(NULL));
 	}
 
 	~VulkanExample()
@@ -150,9 +158,11 @@ public:
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
-		vkUnmapMemory(device, particles.memory);
-		vkDestroyBuffer(device, particles.buffer, nullptr);
-		vkFreeMemory(device, particles.memory, nullptr);
+		for (auto &buffer : particles.buffers)
+		{
+			buffer.destroy();
+		}
+		delete particleSystem;
 
 		uniformBuffers.environment.destroy();
 		uniformBuffers.fire.destroy();
@@ -207,8 +217,8 @@ public:
 			// Particle system (no index buffer)
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.particles, 0, NULL);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.particles);
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &particles.buffer, offsets);
-			vkCmdDraw(drawCmdBuffers[i], PARTICLE_COUNT, 1, 0, 0);
+			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &particles.buffers[i].buffer, offsets);
+			vkCmdDraw(drawCmdBuffers[i], particleSystem->getCount(), 1, 0, 0);
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
@@ -216,113 +226,122 @@ public:
 		}
 	}
 
-	float rnd(float range)
+	void prepareParticles()
 	{
-		return range * (rand() / float(RAND_MAX));
-	}
+		particleSystem = new vks::ParticleSystem(PARTICLE_COUNT, getJobSystem(), getRandomSeed());
+		particleSystem->settings.emitterPos = emitterPos;
+		particleSystem->settings.emitterRadius = FLAME_RADIUS;
+		particleSystem->reset();
 
-	void initParticle(Particle *particle, glm::vec3 emitterPos)
-	{
-		particle->vel = glm::vec4(0.0f, minVel.y + rnd(maxVel.y - minVel.y), 0.0f, 0.0f);
-		particle->alpha = rnd(0.75f);
-		particle->size = 1.0f + rnd(0.5f);
-		particle->color = glm::vec4(1.0f);
-		particle->type = PARTICLE_TYPE_FLAME;
-		particle->rotation = rnd(2.0f * float(M_PI));
-		particle->rotationSpeed = rnd(2.0f) - rnd(2.0f);
-
-		// Get random sphere point
-		float theta = rnd(2.0f * float(M_PI));
-		float phi = rnd(float(M_PI)) - float(M_PI) / 2.0f;
-		float r = rnd(FLAME_RADIUS);
-
-		particle->pos.x = r * cos(theta) * cos(phi);
-		particle->pos.y = r * sin(phi);
-		particle->pos.z = r * sin(theta) * cos(phi);
-
-		particle->pos += glm::vec4(emitterPos, 0.0f);
+		particles.size = particleSystem->getCount() * sizeof(Particle);
+
+		particles.buffers.resize(drawCmdBuffers.size());
+		for (auto &buffer : particles.buffers)
+		{
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&buffer,
+				particles.size));
+			// Map persistent
+			VK_CHECK_RESULT(buffer.map());
+			particleSystem->writeVertices(static_cast<Particle*>(buffer.mapped));
+		}
 	}
 
-	void transitionParticle(Particle *particle)
+	// Advance the simulation and write the particles into the vertex buffer used by the current command buffer
+	void updateParticles()
 	{
-		switch (particle->type)
+		Particle *vertices = static_cast<Particle*>(particles.buffers[currentBuffer].mapped);
+		if (!paused)
 		{
-		case PARTICLE_TYPE_FLAME:
-			// Flame particles have a chance of turning into smoke
-			if (rnd(1.0f) < 0.05f)
-			{
-				particle->alpha = 0.0f;
-				particle->color = glm::vec4(0.25f + rnd(0.25f));
-				particle->pos.x *= 0.5f;
-				particle->pos.z *= 0.5f;
-				particle->vel = glm::vec4(rnd(1.0f) - rnd(1.0f), (minVel.y * 2) + rnd(maxVel.y - minVel.y), rnd(1.0f) - rnd(1.0f), 0.0f);
-				particle->size = 1.0f + rnd(0.5f);
-				particle->rotationSpeed = rnd(1.0f) - rnd(1.0f);
-				particle->type = PARTICLE_TYPE_SMOKE;
-			}
-			else
-			{
-				initParticle(particle, emitterPos);
-			}
-			break;
-		case PARTICLE_TYPE_SMOKE:
-			// Respawn at end of life
-			initParticle(particle, emitterPos);
-			break;
+			// Sorted vertices are written after the sort, so the update only needs to write them if sorting is disabled
+			particleSystem->update(frameTimer, depthSort ? nullptr : vertices);
+		}
+		if (depthSort)
+		{
+			particleDepths.resize(particleSystem->getCount());
+			particleSystem->getDepths(uboVS.model, particleDepths.data());
+			const std::vector<uint32_t> &order = depthSorter.sort(particleDepths.data(), particleSystem->getCount(), getJobSystem());
+			particleSystem->writeVertices(vertices, order.data());
+		}
+		else if (paused)
+		{
+			// The buffers of the other frames may be older, so they still need to be refreshed when paused
+			particleSystem->writeVertices(vertices);
 		}
 	}
 
-	void prepareParticles()
+	// Measure the CPU time of a particle update for increasing particle counts with the scalar, vectorized and multi threaded paths
+	// and the time for sorting the particles by depth on a single thread and on the job system
+	void runBenchmark()
 	{
-		particleBuffer.resize(PARTICLE_COUNT);
-		for (auto& particle : particleBuffer)
+		benchmarkResults.clear();
+		std::vector<uint32_t> particleCounts;
+		for (uint32_t count = BENCHMARK_MIN_PARTICLE_COUNT; count < BENCHMARK_MAX_PARTICLE_COUNT; count *= 4)
 		{
-			initParticle(&particle, emitterPos);
-			particle.alpha = 1.0f - (abs(particle.pos.y) / (FLAME_RADIUS * 2.0f));
+			particleCounts.push_back(count);
 		}
+		particleCounts.push_back(BENCHMARK_MAX_PARTICLE_COUNT);
 
-		particles.size = particleBuffer.size() * sizeof(Particle);
+		std::vector<Particle> vertices(BENCHMARK_MAX_PARTICLE_COUNT);
+		std::vector<float> depths(BENCHMARK_MAX_PARTICLE_COUNT);
+		for (auto count : particleCounts)
+		{
+			auto measure = [&](bool simd, vks::JobSystem *jobSystem)
+			{
+				vks::ParticleSystem benchmarkSystem(count, jobSystem);
+				benchmarkSystem.settings = particleSystem->settings;
+				benchmarkSystem.settings.simd = simd;
+				benchmarkSystem.reset();
+				double time = 0.0;
+				for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++)
+				{
+					// Fixed time step, so all paths run the same simulation
+					benchmarkSystem.update(1.0f / 60.0f, vertices.data());
+					time += benchmarkSystem.lastUpdateTime;
+				}
+				return time / BENCHMARK_ITERATIONS;
+			};
+			BenchmarkResult result;
+			result.particleCount = count;
+			result.scalar = measure(false, nullptr);
+			result.simd = measure(true, nullptr);
+			result.simdJobs = measure(true, getJobSystem());
+
+			vks::ParticleSystem sortSystem(count);
+			sortSystem.settings = particleSystem->settings;
+			sortSystem.reset();
+			sortSystem.getDepths(uboVS.model, depths.data());
+			auto measureSort = [&](vks::JobSystem *jobSystem)
+			{
+				vks::DepthSorter sorter;
+				double time = 0.0;
+				for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++)
+				{
+					sorter.sort(depths.data(), count, jobSystem);
+					time += sorter.lastSortTime;
+				}
+				return time / BENCHMARK_ITERATIONS;
+			};
+			result.sort = measureSort(nullptr);
+			result.sortJobs = measureSort(getJobSystem());
 
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			particles.size,
-			&particles.buffer,
-			&particles.memory,
-			particleBuffer.data()));
+			benchmarkResults.push_back(result);
+		}
 
-		// Map the memory and store the pointer for reuse
-		VK_CHECK_RESULT(vkMapMemory(device, particles.memory, 0, particles.size, 0, &particles.mappedMemory));
+		std::cout << "Particle update and depth sort (ms per frame, " << getJobSystem()->getThreadCount() << " threads):" << std::endl;
+		for (auto &result : benchmarkResults)
+		{
+			std::cout << getBenchmarkResultText(result) << std::endl;
+		}
 	}
 
-	void updateParticles()
+	std::string getBenchmarkResultText(const BenchmarkResult &result)
 	{
-		float particleTimer = frameTimer * 0.45f;
-		for (auto& particle : particleBuffer)
-		{
-			switch (particle.type)
-			{
-			case PARTICLE_TYPE_FLAME:
-				particle.pos.y -= particle.vel.y * particleTimer * 3.5f;
-				particle.alpha += particleTimer * 2.5f;
-				particle.size -= particleTimer * 0.5f;
-				break;
-			case PARTICLE_TYPE_SMOKE:
-				particle.pos -= particle.vel * frameTimer * 1.0f;
-				particle.alpha += particleTimer * 1.25f;
-				particle.size += particleTimer * 0.125f;
-				particle.color -= particleTimer * 0.05f;
-				break;
-			}
-			particle.rotation += particleTimer * particle.rotationSpeed;
-			// Transition particle state
-			if (particle.alpha > 2.0f)
-			{
-				transitionParticle(&particle);
-			}
-		}
-		size_t size = particleBuffer.size() * sizeof(Particle);
-		memcpy(particles.mappedMemory, particleBuffer.data(), size);
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(3) << std::setw(8) << result.particleCount << " particles: scalar " << result.scalar << ", SIMD " << result.simd << ", SIMD + jobs " << result.simdJobs << ", sort " << result.sort << ", sort + jobs " << result.sortJobs;
+		return ss.str();
 	}
 
 	void loadAssets()
@@ -694,6 +713,9 @@ public:
 	{
 		VulkanExampleBase::prepareFrame();
 
+		// The vertex buffer of the acquired image is not in use anymore
+		updateParticles();
+
 		// Command buffer to be sumitted to the queue
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
@@ -726,7 +748,6 @@ public:
 		if (!paused)
 		{
 			updateUniformBufferLight();
-			updateParticles();
 		}
 	}
 
@@ -734,6 +755,47 @@ public:
 	{
 		updateUniformBuffers();
 	}
+
+	virtual void keyPressed(uint32_t keyCode)
+	{
+		switch (keyCode)
+		{
+		case KEY_B:
+		case GAMEPAD_BUTTON_A:
+			runBenchmark();
+			updateTextOverlay();
+			break;
+		case KEY_O:
+		case GAMEPAD_BUTTON_X:
+			depthSort = !depthSort;
+			updateTextOverlay();
+			break;
+		}
+	}
+
+	virtual void getOverlayText(VulkanTextOverlay *textOverlay)
+	{
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(3) << particleSystem->getCount() << " particles (" << particleSystem->getCount(vks::ParticleSystem::TYPE_SMOKE) << " smoke), update " << particleSystem->lastUpdateTime << " ms";
+		if (depthSort)
+		{
+			ss << ", depth sort " << depthSorter.lastSortTime << " ms";
+		}
+		textOverlay->addText(ss.str(), 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+#if defined(__ANDROID__)
+		textOverlay->addText("Press \"Button A\" to run the particle update benchmark", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Press \"Button X\" to toggle depth sorting", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+#else
+		textOverlay->addText("Press \"B\" to run the particle update benchmark", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Press \"O\" to toggle depth sorting", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+#endif
+		float y = 130.0f;
+		for (auto &result : benchmarkResults)
+		{
+			textOverlay->addText(getBenchmarkResultText(result), 5.0f, y, VulkanTextOverlay::alignLeft);
+			y += 15.0f;
+		}
+	}
 };
 
 VULKAN_EXAMPLE_MAIN()
\ No newline at end of file
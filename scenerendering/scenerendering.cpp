@@ -26,6 +26,9 @@
 #include <string.h>
 #include <assert.h>
 #include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -43,6 +46,8 @@
 #include "VulkanTexture.hpp"
 #include "VulkanDevice.hpp"
 #include "VulkanBuffer.hpp"
+#include "occlusionculler.hpp"
+#include "drawlist.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -87,9 +92,15 @@ struct ScenePart
 	// Index of first index in the scene buffer
 	uint32_t indexBase;
 	uint32_t indexCount;
+	// Index of the first vertex in the scene buffer, indices are relative to it
+	uint32_t vertexBase;
 
 	// Pointer to the material used by this mesh
 	SceneMaterial *material;
+
+	// World space bounds used for occlusion culling
+	vks::AABB bounds;
+	bool visible = true;
 };
 
 // Class for loading the scene and generating all Vulkan resources
@@ -119,6 +130,56 @@ private:
 
 	const aiScene* aScene;
 
+	// Meshes drawn by the last render call, ordered by view depth
+	std::vector<uint32_t> recordedDepthOrder;
+
+	std::vector<uint32_t> getDepthOrder()
+	{
+		std::vector<std::pair<float, uint32_t>> depths;
+		for (uint32_t i = 0; i < meshes.size(); i++)
+		{
+			if ((renderSingleScenePart) && (i != scenePartIndex))
+				continue;
+			if (!meshes[i].visible)
+				continue;
+			depths.push_back({ -(uniformData.view * glm::vec4(meshes[i].bounds.center(), 1.0f)).z, i });
+		}
+		std::sort(depths.begin(), depths.end());
+		std::vector<uint32_t> order(depths.size());
+		for (size_t i = 0; i < depths.size(); i++)
+		{
+			order[i] = depths[i].second;
+		}
+		return order;
+	}
+
+	struct OccluderCandidate {
+		uint32_t mesh;
+		uint32_t vertexBase;
+		uint32_t vertexCount;
+	};
+	std::vector<OccluderCandidate> occluderCandidates;
+
+	// Opaque meshes with the largest bounds (walls, floors, pillars) are used as occluders until the triangle budget is reached
+	void selectOccluders(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+	{
+		std::sort(occluderCandidates.begin(), occluderCandidates.end(), [this](const OccluderCandidate &a, const OccluderCandidate &b) {
+			return meshes[a.mesh].bounds.surfaceArea() > meshes[b.mesh].bounds.surfaceArea();
+		});
+		uint32_t triangleCount = 0;
+		for (auto &candidate : occluderCandidates)
+		{
+			ScenePart &mesh = meshes[candidate.mesh];
+			if ((mesh.material->pipeline != &pipelines.solid) || (triangleCount + mesh.indexCount / 3 > maxOccluderTriangles))
+			{
+				continue;
+			}
+			occlusionCuller.addOccluder(&vertices[candidate.vertexBase].pos.x, sizeof(Vertex), candidate.vertexCount, &indices[mesh.indexBase], mesh.indexCount);
+			triangleCount += mesh.indexCount / 3;
+		}
+		occluderCandidates.clear();
+	}
+
 	// Get materials from the assimp scene and map to our scene structures
 	void loadMaterials()
 	{
@@ -313,6 +374,8 @@ private:
 			bool hasColor = aMesh->HasVertexColors(0);
 			bool hasNormals = aMesh->HasNormals();
 
+			const uint32_t vertexBase = static_cast<uint32_t>(vertices.size());
+			meshes[i].vertexBase = vertexBase;
 			for (uint32_t v = 0; v < aMesh->mNumVertices; v++)
 			{
 				Vertex vertex;
@@ -323,6 +386,7 @@ private:
 				vertex.normal.y = -vertex.normal.y;
 				vertex.color = hasColor ? glm::make_vec3(&aMesh->mColors[0][v].r) : glm::vec3(1.0f);
 				vertices.push_back(vertex);
+				meshes[i].bounds.extend(vks::AABB(vertex.pos, vertex.pos));
 			}
 
 			// Indices
@@ -335,8 +399,11 @@ private:
 			}
 
 			indexBase += aMesh->mNumFaces * 3;
+			occluderCandidates.push_back({ i, vertexBase, aMesh->mNumVertices });
 		}
 
+		selectOccluders(vertices, indices);
+
 		// Create buffers
 		// For better performance we only create one index and vertex buffer to keep number of memory allocations down
 		size_t vertexDataSize = vertices.size() * sizeof(Vertex);
@@ -444,11 +511,22 @@ public:
 	bool renderSingleScenePart = false;
 	uint32_t scenePartIndex = 0;
 
+	// Meshes hidden behind the occluders are skipped when building the command buffers
+	vks::OcclusionCuller occlusionCuller;
+	uint32_t maxOccluderTriangles = 16384;
+	std::vector<vks::AABB> meshBounds;
+	std::vector<uint8_t> meshVisibility;
+
+	// Visible meshes are sorted by pipeline, material and depth before recording, redundant binds are skipped
+	vks::DrawList drawList;
+	vks::JobSystem *jobSystem = nullptr;
+
 	// Default constructor
-	Scene(vks::VulkanDevice *vulkanDevice, VkQueue queue)
+	Scene(vks::VulkanDevice *vulkanDevice, VkQueue queue, vks::JobSystem *jobSystem) : occlusionCuller(jobSystem)
 	{
 		this->vulkanDevice = vulkanDevice;
 		this->queue = queue;
+		this->jobSystem = jobSystem;
 
 		// Prepare uniform buffer for global matrices
 		VkMemoryRequirements memReqs;
@@ -520,50 +598,113 @@ public:
 
 	}
 
-	// Renders the scene into an active command buffer
-	// In a real world application we would do some visibility culling in here
-	void render(VkCommandBuffer cmdBuffer, bool wireframe)
+	/**
+	* Update the visibility of all meshes using the software occlusion culler
+	*
+	* @return True if the visibility of any mesh changed and the command buffers need to be rebuilt
+	*/
+	bool updateVisibility(const glm::mat4 &viewProjection, float zNear)
+	{
+		occlusionCuller.render(viewProjection, zNear);
+		meshBounds.resize(meshes.size());
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			meshBounds[i] = meshes[i].bounds;
+		}
+		occlusionCuller.testBoxes(meshBounds, meshVisibility);
+		bool changed = false;
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].visible != (meshVisibility[i] != 0))
+			{
+				meshes[i].visible = (meshVisibility[i] != 0);
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	/** @brief Mark all meshes as visible (occlusion culling disabled) */
+	bool resetVisibility()
 	{
-		VkDeviceSize offsets[1] = { 0 };
+		bool changed = false;
+		for (auto &mesh : meshes)
+		{
+			changed |= !mesh.visible;
+			mesh.visible = true;
+		}
+		return changed;
+	}
 
-		// Bind scene vertex and index buffers
-		vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &vertexBuffer.buffer, offsets);
-		vkCmdBindIndexBuffer(cmdBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+	/**
+	* Returns true if the depth order of the meshes drawn by the last render call has changed for the current view matrix
+	* The sort keys contain the view depth at the time of recording, so the command buffers need to be rebuilt if this changes
+	*/
+	bool depthOrderChanged()
+	{
+		return getDepthOrder() != recordedDepthOrder;
+	}
 
+	// Renders the scene into an active command buffer
+	// Meshes that have been culled by the last visibility update are skipped
+	void render(VkCommandBuffer cmdBuffer, bool wireframe)
+	{
+		drawList.clear();
+		recordedDepthOrder = getDepthOrder();
 		for (size_t i = 0; i < meshes.size(); i++)
 		{
 			if ((renderSingleScenePart) && (i != scenePartIndex))
 				continue;
 
-			// todo : per material pipelines
-			// vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, *mesh.material->pipeline);
+			if (!meshes[i].visible)
+				continue;
+
+			const SceneMaterial *material = meshes[i].material;
+			const bool blending = (material->pipeline == &pipelines.blending);
+
+			vks::DrawList::DrawPacket packet;
+			packet.pipeline = wireframe ? pipelines.wireframe : *material->pipeline;
+			packet.pipelineLayout = pipelineLayout;
 
 			// We will be using multiple descriptor sets for rendering
 			// In GLSL the selection is done via the set and binding keywords
 			// VS: layout (set = 0, binding = 0) uniform UBO;
 			// FS: layout (set = 1, binding = 0) uniform sampler2D samplerColorMap;
 
-			std::array<VkDescriptorSet, 2> descriptorSets;
 			// Set 0: Scene descriptor set containing global matrices
-			descriptorSets[0] = descriptorSetScene;
+			packet.descriptorSets[0] = descriptorSetScene;
 			// Set 1: Per-Material descriptor set containing bound images
-			descriptorSets[1] = meshes[i].material->descriptorSet;
+			packet.descriptorSets[1] = material->descriptorSet;
+			packet.descriptorSetCount = 2;
 
-			vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, wireframe ? pipelines.wireframe : *meshes[i].material->pipeline);
-			vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), 0, NULL);
+			// Render from the global scene vertex buffer using the mesh index and vertex offsets
+			packet.vertexBuffer = vertexBuffer.buffer;
+			packet.indexBuffer = indexBuffer.buffer;
+			packet.indexCount = meshes[i].indexCount;
+			packet.firstIndex = meshes[i].indexBase;
+			packet.vertexOffset = meshes[i].vertexBase;
 
 			// Pass material properies via push constants
-			vkCmdPushConstants(
-				cmdBuffer,
-				pipelineLayout,
-				VK_SHADER_STAGE_FRAGMENT_BIT,
-				0,
-				sizeof(SceneMaterialProperites),
-				&meshes[i].material->properties);
-
-			// Render from the global scene vertex buffer using the mesh index offset
-			vkCmdDrawIndexed(cmdBuffer, meshes[i].indexCount, 1, 0, meshes[i].indexBase, 0);
+			packet.pushConstants = &material->properties;
+			packet.pushConstantSize = sizeof(SceneMaterialProperites);
+			packet.pushConstantStages = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+			// Opaque meshes are grouped by state and drawn front to back, blended meshes are drawn back to front after them
+			const float depth = -(uniformData.view * glm::vec4(meshes[i].bounds.center(), 1.0f)).z;
+			const uint32_t pipelineId = wireframe ? 2 : (blending ? 1 : 0);
+			const uint32_t materialId = static_cast<uint32_t>(material - materials.data());
+			if (blending)
+			{
+				drawList.add(vks::DrawList::makeDepthFirstKey(1, pipelineId, materialId, depth), packet);
+			}
+			else
+			{
+				drawList.add(vks::DrawList::makeKey(0, pipelineId, materialId, depth), packet);
+			}
 		}
+
+		drawList.sort(jobSystem);
+		drawList.record(cmdBuffer);
 	}
 };
 
@@ -572,6 +713,7 @@ class VulkanExample : public VulkanExampleBase
 public:
 	bool wireframe = false;
 	bool attachLight = false;
+	bool occlusionCulling = true;
 
 	Scene *scene = nullptr;
 
@@ -830,7 +972,7 @@ public:
 	void loadScene()
 	{
 		VkCommandBuffer copyCmd = VulkanExampleBase::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, false);
-		scene = new Scene(vulkanDevice, queue);
+		scene = new Scene(vulkanDevice, queue, getJobSystem());
 
 #if defined(__ANDROID__)
 		scene->assetManager = androidApp->activity->assetManager;
@@ -851,16 +993,32 @@ public:
 		prepared = true;
 	}
 
+	// Cull meshes hidden behind the occluders before recording, command buffers are only rebuilt if the visible set changed
+	void updateVisibility()
+	{
+		const bool changed = occlusionCulling ? scene->updateVisibility(camera.matrices.perspective * camera.matrices.view, camera.getNearClip()) : scene->resetVisibility();
+		if (changed)
+		{
+			reBuildCommandBuffers();
+		}
+	}
+
 	virtual void render()
 	{
 		if (!prepared)
 			return;
+		updateVisibility();
 		draw();
 	}
 
 	virtual void viewChanged()
 	{
 		updateUniformBuffers();
+		// Draws are sorted by view depth when recording, so keep the front to back (opaque) and back to front (blended) order up to date
+		if (scene->depthOrderChanged())
+		{
+			reBuildCommandBuffers();
+		}
 	}
 
 	virtual void keyPressed(uint32_t keyCode)
@@ -893,6 +1051,11 @@ public:
 			attachLight = !attachLight;
 			updateUniformBuffers();
 			break;
+		case KEY_O:
+		case GAMEPAD_BUTTON_X:
+			occlusionCulling = !occlusionCulling;
+			updateTextOverlay();
+			break;
 		}
 	}
 
@@ -913,6 +1076,29 @@ public:
 			}
 #endif
 		}
+		if (!scene)
+		{
+			return;
+		}
+#if defined(__ANDROID__)
+		textOverlay->addText(std::string("Occlusion culling ") + (occlusionCulling ? "on" : "off") + " (\"Button X\" to toggle)", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+#else
+		textOverlay->addText(std::string("Occlusion culling ") + (occlusionCulling ? "on" : "off") + " (\"o\" to toggle)", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+#endif
+		if (occlusionCulling)
+		{
+			const vks::OcclusionCuller::Statistics &stats = scene->occlusionCuller.stats;
+			std::stringstream ss;
+			ss << stats.occludedObjects << " occluded, " << stats.outsideObjects << " outside of " << stats.testedObjects << " meshes (" << stats.rasterizedTriangles << "/" << stats.occluderTriangles << " occluder triangles)";
+			textOverlay->addText(ss.str(), 5.0f, 130.0f, VulkanTextOverlay::alignLeft);
+			ss.str("");
+			ss << std::fixed << std::setprecision(2) << "Raster " << stats.rasterTime << " ms, Hi-Z " << stats.hizTime << " ms, test " << stats.testTime << " ms";
+			textOverlay->addText(ss.str(), 5.0f, 145.0f, VulkanTextOverlay::alignLeft);
+		}
+		const vks::DrawList::Statistics &drawStats = scene->drawList.getStatistics();
+		std::stringstream ss;
+		ss << drawStats.draws << " draws, " << drawStats.pipelineBinds << " pipeline / " << drawStats.descriptorSetBinds << " descriptor binds, " << drawStats.pushConstantUpdates << " push constant updates (" << drawStats.redundantChanges << " redundant skipped)";
+		textOverlay->addText(ss.str(), 5.0f, 160.0f, VulkanTextOverlay::alignLeft);
 	}
 };
 
@@ -11,6 +11,9 @@
 #include <string.h>
 #include <assert.h>
 #include <vector>
+#include <array>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -20,6 +23,7 @@
 #include <vulkan/vulkan.h>
 #include "vulkanexamplebase.h"
 #include "VulkanModel.hpp"
+#include "VulkanFrameCapture.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -52,10 +56,21 @@ public:
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSet descriptorSet;
 
+	// Copies the swap chain images into readback buffers as part of the frame's submission and writes them to disk on a worker thread
+	vks::FrameCapture *frameCapture = nullptr;
+	bool captureSupported = false;
+	bool screenshotRequested = false;
+	// Capture every frame to an image sequence
+	bool recording = false;
+	uint32_t sequenceFrame = 0;
+	vks::FrameCapture::FileFormat sequenceFormat = vks::FrameCapture::FILE_FORMAT_PPM;
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		title = "Vulkan Example - Screenshot";
 		enableTextOverlay = true;
+		// The text overlay is drawn in the example's render pass, so it's part of the captured images
+		textOverlayInMainPass = true;
 
 		camera.type = Camera::CameraType::lookat;
 		camera.setPerspective(60.0f, (float)width / (float)height, 0.1f, 512.0f);
@@ -67,6 +82,9 @@ public:
 	{
 		// Clean up used Vulkan resources 
 		// Note : Inherited destructor cleans up resources stored in base class
+		// Writes all pending captures
+		delete frameCapture;
+
 		vkDestroyPipeline(device, pipeline, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
@@ -105,6 +123,8 @@ public:
 
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
+			textOverlay->cmdResetTimestamps(drawCmdBuffers[i], i);
+
 			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
@@ -122,6 +142,8 @@ public:
 
 			vkCmdDrawIndexed(drawCmdBuffers[i], models.object.indexCount, 1, 0, 0, 0);
 
+			textOverlay->cmdDraw(drawCmdBuffers[i], i);
+
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
@@ -299,229 +321,75 @@ public:
 		uniformBuffer.unmap();
 	}
 
-	// Take a screenshot for the curretn swapchain image
-	// This is done using a blit from the swapchain image to a linear image whose memory content is then saved as a ppm image
-	// Getting the image date directly from a swapchain image wouldn't work as they're usually stored in an implementation dependant optimal tiling format
-	// Note: This requires the swapchain images to be created with the VK_IMAGE_USAGE_TRANSFER_SRC_BIT flag (see VulkanSwapChain::create)
-	void saveScreenshot(const char *filename)
+	// Copying from the swap chain images requires them to be created with the transfer source usage flag
+	// Note: Must match the condition used in VulkanSwapChain::create
+	bool isCaptureSupported()
 	{
-		// Get format properties for the swapchain color format
 		VkFormatProperties formatProps;
-
-		bool supportsBlit = true;
-
-		// Check blit support for source and destination
-
-		// Check if the device supports blitting from optimal images (the swapchain images are in optimal format)
 		vkGetPhysicalDeviceFormatProperties(physicalDevice, swapChain.colorFormat, &formatProps);
-		if (!(formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT)) {
-			std::cerr << "Device does not support blitting from optimal tiled images, using copy instead of blit!" << std::endl;
-			supportsBlit = false;
-		}
-
-		// Check if the device supports blitting to linear images 
-		vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProps);
-		if (!(formatProps.linearTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
-			std::cerr << "Device does not support blitting to linear tiled images, using copy instead of blit!" << std::endl;
-			supportsBlit = false;
-		}
+		return vks::FrameCapture::isFormatSupported(swapChain.colorFormat) && (formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
+	}
 
-		// Source for the copy is the last rendered swapchain image
-		VkImage srcImage = swapChain.images[currentBuffer];
-	
-		// Create the linear tiled destination image to copy to and to read the memory from
-		VkImageCreateInfo imgCreateInfo(vks::initializers::imageCreateInfo());
-		imgCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-		// Note that vkCmdBlitImage (if supported) will also do format conversions if the swapchain color format would differ
-		imgCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-		imgCreateInfo.extent.width = width;
-		imgCreateInfo.extent.height = height;
-		imgCreateInfo.extent.depth = 1;
-		imgCreateInfo.arrayLayers = 1;
-		imgCreateInfo.mipLevels = 1;
-		imgCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imgCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-		imgCreateInfo.tiling = VK_IMAGE_TILING_LINEAR;
-		imgCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-		// Create the image
-		VkImage dstImage;
-		VK_CHECK_RESULT(vkCreateImage(device, &imgCreateInfo, nullptr, &dstImage));
-		// Create memory to back up the image
-		VkMemoryRequirements memRequirements;
-		VkMemoryAllocateInfo memAllocInfo(vks::initializers::memoryAllocateInfo());
-		VkDeviceMemory dstImageMemory;
-		vkGetImageMemoryRequirements(device, dstImage, &memRequirements);
-		memAllocInfo.allocationSize = memRequirements.size;
-		// Memory must be host visible to copy from
-		memAllocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device, &memAllocInfo, nullptr, &dstImageMemory));
-		VK_CHECK_RESULT(vkBindImageMemory(device, dstImage, dstImageMemory, 0));
-
-		// Do the actual blit from the swapchain image to our host visible destination image
-		VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-		VkImageMemoryBarrier imageMemoryBarrier = vks::initializers::imageMemoryBarrier();
-		
-		// Transition destination image to transfer destination layout
-		vks::tools::insertImageMemoryBarrier(
-			copyCmd,
-			dstImage,
-			0,
-			VK_ACCESS_TRANSFER_WRITE_BIT,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
-
-		// Transition swapchain image from present to transfer source layout
-		vks::tools::insertImageMemoryBarrier(
-			copyCmd,
-			srcImage,
-			VK_ACCESS_MEMORY_READ_BIT,
-			VK_ACCESS_TRANSFER_READ_BIT,
-			VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
-
-		// If source and destination support blit we'll blit as this also does automatic format conversion (e.g. from BGR to RGB)
-		if (supportsBlit)
+	void prepareFrameCapture()
+	{
+		delete frameCapture;
+		frameCapture = nullptr;
+		captureSupported = isCaptureSupported();
+		if (captureSupported)
 		{
-			// Define the region to blit (we will blit the whole swapchain image)
-			VkOffset3D blitSize;
-			blitSize.x = width;
-			blitSize.y = height;
-			blitSize.z = 1;
-			VkImageBlit imageBlitRegion{};
-			imageBlitRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageBlitRegion.srcSubresource.layerCount = 1;
-			imageBlitRegion.srcOffsets[1] = blitSize;
-			imageBlitRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageBlitRegion.dstSubresource.layerCount = 1;
-			imageBlitRegion.dstOffsets[1] = blitSize;
-
-			// Issue the blit command
-			vkCmdBlitImage(
-				copyCmd,
-				srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				1,
-				&imageBlitRegion,
-				VK_FILTER_NEAREST);
+			frameCapture = new vks::FrameCapture(vulkanDevice, swapChain.colorFormat, width, height);
 		}
 		else
 		{
-			// Otherwise use image copy (requires us to manually flip components)
-			VkImageCopy imageCopyRegion{};
-			imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageCopyRegion.srcSubresource.layerCount = 1;
-			imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageCopyRegion.dstSubresource.layerCount = 1;
-			imageCopyRegion.extent.width = width;
-			imageCopyRegion.extent.height = height;
-			imageCopyRegion.extent.depth = 1;
-
-			// Issue the copy command
-			vkCmdCopyImage(
-				copyCmd,
-				srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				1,
-				&imageCopyRegion);
+			std::cerr << "Swap chain images can't be captured (format " << swapChain.colorFormat << ")" << std::endl;
 		}
+	}
 
-		// Transition destination image to general layout, which is the required layout for mapping the image memory later on
-		vks::tools::insertImageMemoryBarrier(
-			copyCmd,
-			dstImage,
-			VK_ACCESS_TRANSFER_WRITE_BIT,
-			VK_ACCESS_MEMORY_READ_BIT,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_IMAGE_LAYOUT_GENERAL,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
-
-		// Transition back the swap chain image after the blit is done
-		vks::tools::insertImageMemoryBarrier(
-			copyCmd,
-			srcImage,
-			VK_ACCESS_TRANSFER_READ_BIT,
-			VK_ACCESS_MEMORY_READ_BIT,
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
-
-		vulkanDevice->flushCommandBuffer(copyCmd, queue);
-
-		// Get layout of the image (including row pitch)
-		VkImageSubresource subResource{};
-		subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		VkSubresourceLayout subResourceLayout;
-
-		vkGetImageSubresourceLayout(device, dstImage, &subResource, &subResourceLayout);
-
-		// Map image memory so we can start copying from it
-		const char* data;
-		vkMapMemory(device, dstImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-		data += subResourceLayout.offset;
-
-		std::ofstream file(filename, std::ios::out | std::ios::binary);
-
-		// ppm header
-		file << "P6\n" << width << "\n" << height << "\n" << 255 << "\n";
-
-		// If source is BGR (destination is always RGB) and we can't use blit (which does automatic conversion), we'll have to manually swizzle color components
-		bool colorSwizzle = false;
-		// Check if source is BGR 
-		// Note: Not complete, only contains most common and basic BGR surface formats for demonstation purposes
-		if (!supportsBlit)
-		{
-			std::vector<VkFormat> formatsBGR = { VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_B8G8R8A8_SNORM };
-			colorSwizzle = (std::find(formatsBGR.begin(), formatsBGR.end(), swapChain.colorFormat) != formatsBGR.end());
-		}
+	std::string getSequenceFilename(uint32_t frame)
+	{
+		const char* extensions[] = { ".ppm", ".png", ".raw" };
+		std::stringstream ss;
+		ss << "capture_" << std::setfill('0') << std::setw(6) << frame << extensions[sequenceFormat];
+		return ss.str();
+	}
+
+	void draw()
+	{
+		VulkanExampleBase::prepareFrame();
+
+		std::array<VkCommandBuffer, 2> commandBuffers = { drawCmdBuffers[currentBuffer], VK_NULL_HANDLE };
+		VkFence fence = VK_NULL_HANDLE;
+		submitInfo.commandBufferCount = 1;
 
-		// ppm binary pixel data
-		for (uint32_t y = 0; y < height; y++) 
+		if (frameCapture)
 		{
-			unsigned int *row = (unsigned int*)data;
-			for (uint32_t x = 0; x < width; x++) 
+			// Hand finished copies to the worker thread, never waits for the GPU
+			frameCapture->update();
+
+			// The copy is submitted in the same batch as the frame, so presentation waits for it
+			if (screenshotRequested)
 			{
-				if (colorSwizzle) 
-				{ 
-					file.write((char*)row+2, 1);
-					file.write((char*)row+1, 1);
-					file.write((char*)row, 1);
+				// Retried next frame if all slots are busy
+				if (frameCapture->record(swapChain.images[currentBuffer], "screenshot.ppm", vks::FrameCapture::FILE_FORMAT_PPM, &commandBuffers[1], &fence))
+				{
+					screenshotRequested = false;
+					submitInfo.commandBufferCount = 2;
+					std::cout << "Saving screenshot to screenshot.ppm" << std::endl;
 				}
-				else
+			}
+			else if (recording)
+			{
+				// Dropped frames are skipped in the sequence numbering
+				if (frameCapture->record(swapChain.images[currentBuffer], getSequenceFilename(sequenceFrame), sequenceFormat, &commandBuffers[1], &fence))
 				{
-					file.write((char*)row, 3);
+					submitInfo.commandBufferCount = 2;
 				}
-				row++;
+				sequenceFrame++;
 			}
-			data += subResourceLayout.rowPitch;
 		}
-		file.close();
-
-		std::cout << "Screenshot saved to disk" << std::endl;
 
-		// Clean up resources
-		vkUnmapMemory(device, dstImageMemory);
-		vkFreeMemory(device, dstImageMemory, nullptr);
-		vkDestroyImage(device, dstImage, nullptr);
-	}
-
-	void draw()
-	{
-		VulkanExampleBase::prepareFrame();
-
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		submitInfo.pCommandBuffers = commandBuffers.data();
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
 
 		VulkanExampleBase::submitFrame();
 	}
@@ -535,6 +403,8 @@ public:
 		preparePipelines();
 		setupDescriptorPool();
 		setupDescriptorSet();
+		prepareFrameCapture();
+		updateTextOverlay();
 		buildCommandBuffers();
 		prepared = true;
 	}
@@ -551,13 +421,56 @@ public:
 		updateUniformBuffers();
 	}
 
+	virtual void windowResized()
+	{
+		// Captures of the old size are written before the readback buffers are recreated
+		prepareFrameCapture();
+	}
+
+	void toggleRecording()
+	{
+		recording = !recording;
+		if (recording)
+		{
+			sequenceFrame = 0;
+			std::cout << "Recording " << width << "x" << height << " frames to " << getSequenceFilename(0) << "..." << std::endl;
+		}
+		else
+		{
+			frameCapture->flush();
+			std::cout << "Recording stopped, " << frameCapture->statistics.droppedFrames << " frames dropped in total" << std::endl;
+		}
+		updateTextOverlay();
+	}
+
+	void cycleSequenceFormat()
+	{
+		// Only changed between recordings so a sequence uses a single format
+		if (!recording)
+		{
+			sequenceFormat = (vks::FrameCapture::FileFormat)((sequenceFormat + 1) % 3);
+			updateTextOverlay();
+		}
+	}
+
 	virtual void keyPressed(uint32_t keyCode)
 	{
 		switch (keyCode)
 		{
 		case KEY_F2:
 		case GAMEPAD_BUTTON_A:
-			saveScreenshot("screenshot.ppm");
+			screenshotRequested = captureSupported;
+			break;
+		case KEY_F3:
+		case GAMEPAD_BUTTON_X:
+			if (captureSupported)
+			{
+				toggleRecording();
+			}
+			break;
+		case KEY_F4:
+		case GAMEPAD_BUTTON_Y:
+			cycleSequenceFormat();
 			break;
 		}
 	}
@@ -569,6 +482,25 @@ public:
 #else
 		textOverlay->addText("\"F2\" to save screenshot", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
 #endif
+		if (!captureSupported)
+		{
+			textOverlay->addText("Capturing the swap chain images is not supported", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+			return;
+		}
+		const char* formatNames[] = { "ppm", "png (stored)", "raw" };
+		std::stringstream ss;
+#if defined(__ANDROID__)
+		ss << (recording ? "Recording" : "Button X to record") << " sequence as " << formatNames[sequenceFormat] << (recording ? "" : " (Button Y to change)");
+#else
+		ss << (recording ? "Recording" : "\"F3\" to record") << " sequence as " << formatNames[sequenceFormat] << (recording ? "" : " (\"F4\" to change)");
+#endif
+		textOverlay->addText(ss.str(), 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+		ss.str("");
+		ss << std::fixed << std::setprecision(2) << "Written: " << frameCapture->statistics.writtenFrames << ", dropped: " << frameCapture->statistics.droppedFrames << ", pending: " << frameCapture->statistics.pendingFrames;
+		textOverlay->addText(ss.str(), 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+		ss.str("");
+		ss << std::fixed << std::setprecision(2) << "Worker: " << frameCapture->statistics.encodeTime << " ms, " << (frameCapture->statistics.fileSize / 1024) << " KB per frame";
+		textOverlay->addText(ss.str(), 5.0f, 130.0f, VulkanTextOverlay::alignLeft);
 	}
 };
 
@@ -12,6 +12,9 @@
 #include <assert.h>
 #include <vector>
 #include <random>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -22,11 +25,14 @@
 #include "vulkanexamplebase.h"
 #include "VulkanTexture.hpp"
 #include "VulkanModel.hpp"
+#include "VulkanClusteredLights.hpp"
+#include "VulkanTimestampQueries.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
 
-#define NUM_LIGHTS 64
+// Lights are culled into clusters, so the composition can handle thousands of them
+#define MAX_LIGHT_COUNT 10000
 
 class VulkanExample : public VulkanExampleBase
 {
@@ -60,20 +66,17 @@ public:
 		glm::mat4 view;
 	} uboGBuffer;
 
-	struct Light {
-		glm::vec4 position;
-		glm::vec3 color;
-		float radius;
-	};
+	vks::ClusteredLights *clusteredLights = nullptr;
+	vks::ClusteredLights::Builder lightBuilder = vks::ClusteredLights::BUILDER_CPU;
+	uint32_t lightCount = 64;
+	uint32_t lightSeed = 0;
+	vks::LightCountSweep lightCountSweep;
 
-	struct {
-		glm::vec4 viewPos;
-		Light lights[NUM_LIGHTS];
-	} uboLights;
+	// GPU time of the whole frame (cluster assignment, G-Buffer, composition and transparent pass)
+	vks::TimestampQueries *timestamps = nullptr;
 
 	struct {
 		vks::Buffer GBuffer;
-		vks::Buffer lights;
 	} uniformBuffers;
 
 	struct {
@@ -113,7 +116,7 @@ public:
 	
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
-		enableTextOverlay = false;
+		enableTextOverlay = true;
 		title = "Vulkan Example - Subpasses";
 		camera.type = Camera::CameraType::firstperson;
 		camera.movementSpeed = 5.0f;
@@ -158,7 +161,8 @@ public:
 		models.scene.destroy();
 		models.transparent.destroy();
 		uniformBuffers.GBuffer.destroy();
-		uniformBuffers.lights.destroy();
+		delete clusteredLights;
+		delete timestamps;
 	}
 
 	// Create a frame buffer attachment
@@ -412,6 +416,16 @@ public:
 		VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass));
 	}
 
+	void reBuildCommandBuffers()
+	{
+		if (!checkCommandBuffers())
+		{
+			destroyCommandBuffers();
+			createCommandBuffers();
+		}
+		buildCommandBuffers();
+	}
+
 	void buildCommandBuffers()
 	{
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
@@ -439,6 +453,15 @@ public:
 
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
+			timestamps->cmdReset(drawCmdBuffers[i], i);
+			timestamps->cmdWriteTimestamp(drawCmdBuffers[i], i, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+			// With the GPU builder the lights are assigned to the clusters before the render pass
+			if (lightBuilder == vks::ClusteredLights::BUILDER_GPU)
+			{
+				clusteredLights->cmdBuild(drawCmdBuffers[i]);
+			}
+
 			// First sub pass
 			// Renders the components of the scene to the G-Buffer atttachments
 
@@ -465,7 +488,9 @@ public:
 			vkCmdNextSubpass(drawCmdBuffers[i], VK_SUBPASS_CONTENTS_INLINE);
 
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.composition);
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.composition, 0, 1, &descriptorSets.composition, 0, NULL);
+			// Set 0: G-Buffer input attachments, set 1: Light clusters
+			std::array<VkDescriptorSet, 2> compositionSets = { descriptorSets.composition, clusteredLights->descriptorSet };
+			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.composition, 0, static_cast<uint32_t>(compositionSets.size()), compositionSets.data(), 0, NULL);
 			vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
 
 			// Third subpass
@@ -480,6 +505,8 @@ public:
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
+			timestamps->cmdWriteTimestamp(drawCmdBuffers[i], i, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 		}
 	}
@@ -713,11 +740,6 @@ public:
 				VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
 				VK_SHADER_STAGE_FRAGMENT_BIT,
 				2),
-			// Binding 3: Light positions
-			vks::initializers::descriptorSetLayoutBinding(
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				VK_SHADER_STAGE_FRAGMENT_BIT,
-				3),
 		};
 
 		VkDescriptorSetLayoutCreateInfo descriptorLayout =
@@ -727,9 +749,10 @@ public:
 
 		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &descriptorSetLayouts.composition));
 
-		// Pipeline layout
+		// Pipeline layout, the light clusters are read from set 1
+		std::array<VkDescriptorSetLayout, 2> setLayouts = { descriptorSetLayouts.composition, clusteredLights->descriptorSetLayout };
 		VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo = 
-			vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayouts.composition, 1);
+			vks::initializers::pipelineLayoutCreateInfo(setLayouts.data(), static_cast<uint32_t>(setLayouts.size()));
 
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayouts.composition));
 
@@ -777,12 +800,6 @@ public:
 				VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
 				2,
 				&texDescriptorAlbedo),
-			// Binding 4: Fragment shader lights
-			vks::initializers::writeDescriptorSet(
-				descriptorSets.composition,
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				3,
-				&uniformBuffers.lights.descriptor),
 		};
 
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
@@ -818,22 +835,6 @@ public:
 		shaderStages[0] = loadShader(getAssetPath() + "shaders/subpasses/composition.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
 		shaderStages[1] = loadShader(getAssetPath() + "shaders/subpasses/composition.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
 
-		// Use specialization constants to pass number of lights to the shader
-		VkSpecializationMapEntry specializationEntry{};
-		specializationEntry.constantID = 0;
-		specializationEntry.offset = 0;
-		specializationEntry.size = sizeof(uint32_t);
-
-		uint32_t specializationData = NUM_LIGHTS;
-
-		VkSpecializationInfo specializationInfo;
-		specializationInfo.mapEntryCount = 1;
-		specializationInfo.pMapEntries = &specializationEntry;
-		specializationInfo.dataSize = sizeof(specializationData);
-		specializationInfo.pData = &specializationData;
-
-		shaderStages[1].pSpecializationInfo = &specializationInfo;
-
 		VkGraphicsPipelineCreateInfo pipelineCreateInfo =
 			vks::initializers::pipelineCreateInfo(pipelineLayouts.composition, renderPass, 0);
 
@@ -916,13 +917,6 @@ public:
 			&uniformBuffers.GBuffer,
 			sizeof(uboGBuffer));
 
-		// Deferred fragment shader
-		vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&uniformBuffers.lights,
-			sizeof(uboLights));
-
 		// Update
 		updateUniformBufferDeferredMatrices();
 		updateUniformBufferDeferredLights();
@@ -939,38 +933,38 @@ public:
 		uniformBuffers.GBuffer.unmap();
 	}
 
-	void initLights()
+	void prepareClusteredLights()
 	{
-		std::vector<glm::vec3> colors =
-		{
-			glm::vec3(1.0f, 1.0f, 1.0f),
-			glm::vec3(1.0f, 0.0f, 0.0f),
-			glm::vec3(0.0f, 1.0f, 0.0f),
-			glm::vec3(0.0f, 0.0f, 1.0f),
-			glm::vec3(1.0f, 1.0f, 0.0f),
-		};
+		clusteredLights = new vks::ClusteredLights(vulkanDevice, MAX_LIGHT_COUNT, getJobSystem());
+		clusteredLights->prepareCompute(loadShader(getAssetPath() + "shaders/base/clusteredlights.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT), pipelineCache);
+		clusteredLights->ambient = 0.15f;
+		clusteredLights->specular = 0.0f;
+		timestamps = new vks::TimestampQueries(vulkanDevice, 2, static_cast<uint32_t>(drawCmdBuffers.size()), vulkanDevice->queueFamilyIndices.graphics);
+		lightCountSweep.gpuTimeName = "GPU frame";
+	}
 
-		std::mt19937 rndGen((unsigned)time(NULL));
-		std::uniform_real_distribution<float> rndDist(-1.0f, 1.0f);
-		std::uniform_int_distribution<uint32_t> rndCol(0, static_cast<uint32_t>(colors.size()-1));
+	void initLights()
+	{
+		lightSeed = getRandomSeed();
+		setLightCount(lightCount);
+	}
 
-		for (auto& light : uboLights.lights)
-		{
-			light.position = glm::vec4(rndDist(rndGen) * 6.0f, 0.25f + std::abs(rndDist(rndGen)) * 4.0f, rndDist(rndGen) * 6.0f, 1.0f);
-			light.color = colors[rndCol(rndGen)];
-			light.radius = 1.0f + std::abs(rndDist(rndGen));			
-		}
+	void setLightCount(uint32_t count)
+	{
+		lightCount = std::max(std::min(count, (uint32_t)MAX_LIGHT_COUNT), 1u);
+		clusteredLights->generateRandomLights(lightCount, glm::vec3(-6.0f, 0.25f, -6.0f), glm::vec3(6.0f, 4.25f, 6.0f), 1.5f, 3.0f, lightSeed);
 	}
 
-	// Update fragment shader light position uniform block
+	// Assign the lights to the clusters for the current view
 	void updateUniformBufferDeferredLights()
 	{
 		// Current view position
-		uboLights.viewPos = glm::vec4(camera.position, 0.0f) * glm::vec4(-1.0f, 1.0f, -1.0f, 1.0f);
+		glm::vec4 viewPos = glm::vec4(camera.position, 0.0f) * glm::vec4(-1.0f, 1.0f, -1.0f, 1.0f);
 
-		VK_CHECK_RESULT(uniformBuffers.lights.map());
-		memcpy(uniformBuffers.lights.mapped, &uboLights, sizeof(uboLights));
-		uniformBuffers.lights.unmap();
+		// Positions in the G-Buffer have a flipped y axis
+		glm::mat4 view = camera.matrices.view * glm::scale(glm::mat4(), glm::vec3(1.0f, -1.0f, 1.0f));
+
+		clusteredLights->update(view, camera.matrices.perspective, camera.getNearClip(), camera.getFarClip(), width, height, viewPos, lightBuilder);
 	}
 
 	void draw()
@@ -992,6 +986,7 @@ public:
 		VulkanExampleBase::prepare();
 		loadAssets();
 		setupVertexDescriptions();
+		prepareClusteredLights();
 		initLights();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
@@ -1008,12 +1003,17 @@ public:
 		if (!prepared)
 			return;
 		draw();
+		if (lightCountSweep.update(timestamps, currentBuffer, frameTimer * 1000.0, clusteredLights, lightBuilder))
+		{
+			setLightCount(lightCountSweep.getLightCount());
+			updateTextOverlay();
+		}
+		updateUniformBufferDeferredLights();
 	}
 
 	virtual void viewChanged()
 	{
 		updateUniformBufferDeferredMatrices();
-		updateUniformBufferDeferredLights();
 	}
 
 	virtual void keyPressed(uint32_t keyCode)
@@ -1023,10 +1023,43 @@ public:
 		case KEY_F1:
 		case GAMEPAD_BUTTON_A:
 			initLights();
-			updateUniformBufferDeferredLights();
+			break;
+		case KEY_KPADD:
+		case GAMEPAD_BUTTON_R1:
+			setLightCount(lightCount * 2);
+			updateTextOverlay();
+			break;
+		case KEY_KPSUB:
+		case GAMEPAD_BUTTON_L1:
+			setLightCount(lightCount / 2);
+			updateTextOverlay();
+			break;
+		case KEY_B:
+		case GAMEPAD_BUTTON_X:
+			lightBuilder = (lightBuilder == vks::ClusteredLights::BUILDER_CPU) ? vks::ClusteredLights::BUILDER_GPU : vks::ClusteredLights::BUILDER_CPU;
+			reBuildCommandBuffers();
+			updateTextOverlay();
+			break;
+		case KEY_T:
+		case GAMEPAD_BUTTON_Y:
+			lightCountSweep.start(lightCount);
+			setLightCount(lightCountSweep.getLightCount());
+			updateTextOverlay();
 			break;
 		}
 	}
+
+	virtual void getOverlayText(VulkanTextOverlay *textOverlay)
+	{
+#if defined(__ANDROID__)
+		textOverlay->addText("\"Button A\" to randomize lights, \"L1/R1\" to change light count", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("\"Button X\" to toggle cluster builder, \"Button Y\" to measure", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+#else
+		textOverlay->addText("\"F1\" to randomize lights, \"+/-\" to change light count", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("\"B\" to toggle cluster builder, \"T\" to measure", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+#endif
+		lightCountSweep.addOverlayText(textOverlay, 115.0f, lightCount, clusteredLights, lightBuilder);
+	}
 };
 
 VULKAN_EXAMPLE_MAIN()
@@ -0,0 +1,205 @@
+# Golden image regression runner
+#
+# Runs each example headless (offscreen, no window or swap chain) with a fixed size and time step, captures a single frame
+# and compares it against the golden image in tests/golden (see VulkanExampleBase::RegressionSettings)
+#
+# Usage:
+#	python run_golden.py [examples...]           Compare against the golden images
+#	python run_golden.py --record [examples...]  Capture (missing) golden images, use --force to overwrite existing ones
+#
+# Rendering differs slightly between drivers, so goldens should be recorded and compared with the same (software) ICD,
+# e.g. --icd /usr/share/vulkan/icd.d/lvp_icd.x86_64.json for lavapipe or the vk_swiftshader_icd.json of a SwiftShader build
+# Recording writes the ICD and the device the goldens were captured on to ICD.txt in the golden directory,
+# comparing warns if the examples run on a different device
+#
+# Examples need to be built first, binaries are looked up in the bin directory of the repository (or --bin)
+
+import sys
+import os
+import re
+import shutil
+import argparse
+import subprocess
+
+# Examples that render the same image for a given frame index, size and time step
+EXAMPLES = [
+	"triangle",
+	"pipelines",
+	"texture",
+	"texturearray",
+	"texturecubemap",
+	"mesh",
+	"instancing",
+	"indirectdraw",
+	"dynamicuniformbuffer",
+	"offscreen",
+	"deferred",
+	"deferredshadows",
+	"shadowmapping",
+	"ssao",
+	"hdr",
+	"bloom",
+	"pbrbasic",
+	"pbribl",
+	"particlefire",
+	"computenbody",
+	"multithreading",
+	"scenerendering",
+	"subpasses",
+	"distancefieldfonts",
+]
+
+# Examples whose output at a given frame also depends on timing outside of the frame loop
+EXCLUDED = {
+	"texture3d": "noise texture is generated asynchronously, the frame it gets uploaded at varies",
+	"texturesparseresidency": "pages are streamed in asynchronously based on GPU feedback",
+	"occlusionquery": "visibility depends on when query results become available",
+	"screenshot": "captures the swap chain itself",
+}
+
+rootdir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+parser = argparse.ArgumentParser(description="Run golden image regression tests for the Vulkan examples")
+parser.add_argument("examples", nargs="*", help="examples to run (default: all that are not excluded)")
+parser.add_argument("--bin", default=os.path.join(rootdir, "bin"), help="directory containing the example binaries")
+parser.add_argument("--golden", default=os.path.join(rootdir, "tests", "golden"), help="directory containing the golden images")
+parser.add_argument("--output", default=os.path.join(rootdir, "tests", "output"), help="directory for captured (and diff) images")
+parser.add_argument("--frame", type=int, default=60, help="index of the frame to capture")
+parser.add_argument("--width", type=int, default=640)
+parser.add_argument("--height", type=int, default=360)
+parser.add_argument("--timestep", type=float, default=1.0 / 60.0, help="fixed frame time in seconds")
+parser.add_argument("--threshold", type=float, help="per pixel difference threshold (0..1)")
+parser.add_argument("--maxdiff", type=float, help="fraction of pixels allowed to differ")
+parser.add_argument("--timeout", type=int, default=120, help="timeout per example in seconds")
+parser.add_argument("--record", action="store_true", help="store captures as golden images instead of comparing")
+parser.add_argument("--force", action="store_true", help="overwrite existing golden images when recording")
+parser.add_argument("--icd", help="Vulkan ICD manifest (json) to run the examples on, sets VK_ICD_FILENAMES")
+parser.add_argument("--windowed", action="store_true", help="render to a window and capture the swap chain instead of rendering headless")
+args = parser.parse_args()
+
+examples = args.examples if len(args.examples) > 0 else EXAMPLES
+for example in examples:
+	if example in EXCLUDED:
+		print("Warning: %s is excluded from golden image tests (%s)" % (example, EXCLUDED[example]))
+
+env = os.environ.copy()
+if args.icd:
+	if not os.path.exists(args.icd):
+		print("ERROR: ICD manifest %s not found" % args.icd)
+		sys.exit(1)
+	env["VK_ICD_FILENAMES"] = os.path.abspath(args.icd)
+icd = env.get("VK_ICD_FILENAMES", "system default")
+
+# ICD and device the golden images were recorded with
+icdfile = os.path.join(args.golden, "ICD.txt")
+icdpattern = re.compile(r"^ICD: (.*)$", re.MULTILINE)
+devicepattern = re.compile(r"^Capture device: (.*)$", re.MULTILINE)
+goldenicd = None
+goldendevice = None
+if os.path.exists(icdfile):
+	with open(icdfile) as f:
+		content = f.read()
+	match = icdpattern.search(content)
+	goldenicd = match.group(1) if match else None
+	match = devicepattern.search(content)
+	goldendevice = match.group(1) if match else None
+if not args.record:
+	if goldendevice is None:
+		print("Warning: %s doesn't name the device the golden images were recorded on" % icdfile)
+	elif goldenicd is not None and os.path.basename(goldenicd) != os.path.basename(icd):
+		print("Warning: Golden images were recorded with ICD %s, running with %s (use --icd)" % (goldenicd, icd))
+
+if not os.path.exists(args.output):
+	os.makedirs(args.output)
+if args.record and not os.path.exists(args.golden):
+	os.makedirs(args.golden)
+
+recordeddevice = None
+frametimepattern = re.compile(r"Frame time \(ms\): avg ([0-9.]+), median ([0-9.]+), min ([0-9.]+), max ([0-9.]+)")
+
+results = []
+for example in examples:
+	binary = os.path.join(args.bin, example + (".exe" if os.name == "nt" else ""))
+	if not os.path.exists(binary):
+		results.append((example, "MISSING", None))
+		continue
+
+	golden = os.path.join(args.golden, example + ".ppm")
+	capture = os.path.join(args.output, example + ".ppm")
+	if args.record and os.path.exists(golden) and not args.force:
+		results.append((example, "SKIPPED", None))
+		continue
+	if not args.record and not os.path.exists(golden):
+		results.append((example, "NO GOLDEN", None))
+		continue
+
+	cmd = [binary, "-width", str(args.width), "-height", str(args.height), "-capture", str(args.frame), "-capturefile", capture, "-timestep", str(args.timestep)]
+	if not args.windowed:
+		cmd += ["-headless"]
+	if not args.record:
+		cmd += ["-golden", golden]
+	if args.threshold is not None:
+		cmd += ["-threshold", str(args.threshold)]
+	if args.maxdiff is not None:
+		cmd += ["-maxdiff", str(args.maxdiff)]
+
+	print("\n-------- %s --------\n" % example)
+	# Assets are loaded relative to the working directory (./../data/)
+	try:
+		process = subprocess.Popen(cmd, cwd=args.bin, env=env, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+		output, _ = process.communicate(timeout=args.timeout)
+		exitcode = process.returncode
+	except subprocess.TimeoutExpired:
+		process.kill()
+		output, _ = process.communicate()
+		exitcode = None
+	print(output)
+
+	frametimes = None
+	match = frametimepattern.search(output)
+	if match:
+		frametimes = [float(value) for value in match.groups()]
+	device = None
+	match = devicepattern.search(output)
+	if match:
+		device = match.group(1)
+		if not args.record and goldendevice is not None and device != goldendevice:
+			print("Warning: Golden images were recorded on %s, captured on %s" % (goldendevice, device))
+
+	if exitcode is None:
+		status = "TIMEOUT"
+	elif exitcode != 0:
+		status = "FAILED (%d)" % exitcode
+	elif args.record:
+		if os.path.exists(capture):
+			shutil.copyfile(capture, golden)
+			status = "RECORDED"
+			recordeddevice = device
+		else:
+			status = "NO CAPTURE"
+	else:
+		status = "PASSED"
+	results.append((example, status, frametimes))
+
+if recordeddevice is not None:
+	with open(icdfile, "w") as f:
+		f.write("Golden images in this directory were recorded with (see run_golden.py)\n")
+		f.write("ICD: %s\n" % icd)
+		f.write("Capture device: %s\n" % recordeddevice)
+
+print("\n-------- Golden image test results --------\n")
+
+failed = 0
+for example, status, frametimes in results:
+	line = "%-24s %-12s" % (example, status)
+	if frametimes:
+		line += " frame time (ms): avg %.3f, median %.3f, min %.3f, max %.3f" % tuple(frametimes)
+	print(line)
+	if status not in ("PASSED", "RECORDED", "SKIPPED"):
+		failed += 1
+
+if failed == 0:
+	print("\nSUCCESS: All golden image tests passed")
+else:
+	print("\nERROR: %d example(s) failed or could not be run" % failed)
+sys.exit(1 if failed > 0 else 0)
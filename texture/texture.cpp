@@ -75,6 +75,13 @@ public:
 	VkDescriptorSet descriptorSet;
 	VkDescriptorSetLayout descriptorSetLayout;
 
+	// Last text overlay timings for the separate overlay submission (0) and the overlay recorded into the main render pass (1)
+	struct OverlayTimings {
+		double gpuTime = 0.0;
+		double submitTime = 0.0;
+		bool measured = false;
+	} overlayTimings[2];
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		zoom = -2.5f;
@@ -546,6 +553,11 @@ public:
 
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
+			if (textOverlayInMainPass)
+			{
+				textOverlay->cmdResetTimestamps(drawCmdBuffers[i], i);
+			}
+
 			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
@@ -563,6 +575,12 @@ public:
 
 			vkCmdDrawIndexed(drawCmdBuffers[i], indexCount, 1, 0, 0, 0);
 
+			// The default render pass is compatible with the text overlay's pipeline
+			if (textOverlayInMainPass)
+			{
+				textOverlay->cmdDraw(drawCmdBuffers[i], i);
+			}
+
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
@@ -892,10 +910,23 @@ public:
 		updateTextOverlay();
 	}
 
+	// Switch between submitting the text overlay separately and recording it into the example's render pass
+	void toggleTextOverlayMode()
+	{
+		vkDeviceWaitIdle(device);
+		textOverlayInMainPass = !textOverlayInMainPass;
+		buildCommandBuffers();
+		updateTextOverlay();
+	}
+
 	virtual void keyPressed(uint32_t keyCode)
 	{
 		switch (keyCode)
 		{
+		case KEY_O:
+		case GAMEPAD_BUTTON_A:
+			toggleTextOverlayMode();
+			break;
 		case KEY_KPADD:
 		case GAMEPAD_BUTTON_R1:
 			changeLodBias(0.1f);
@@ -916,6 +947,33 @@ public:
 #else
 		textOverlay->addText("LOD bias: " + ss.str() + " (numpad +/- to change)", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
 #endif
+
+		// Keep the timings of both modes for comparison
+		OverlayTimings &current = overlayTimings[textOverlayInMainPass ? 1 : 0];
+		current.gpuTime = textOverlay->statistics.gpuTime;
+		current.submitTime = textOverlay->statistics.submitTime;
+		current.measured = true;
+
+#if defined(__ANDROID__)
+		textOverlay->addText(std::string("Text overlay: ") + (textOverlayInMainPass ? "main render pass" : "separate submission") + " (Button A to toggle)", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+#else
+		textOverlay->addText(std::string("Text overlay: ") + (textOverlayInMainPass ? "main render pass" : "separate submission") + " (\"O\" to toggle)", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+#endif
+		const char* modeNames[2] = { "Separate submission", "Main render pass" };
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			ss.str("");
+			ss << std::setprecision(3) << modeNames[i] << ": ";
+			if (overlayTimings[i].measured)
+			{
+				ss << "GPU " << overlayTimings[i].gpuTime << " ms, submit + present CPU " << overlayTimings[i].submitTime << " ms";
+			}
+			else
+			{
+				ss << "not measured yet";
+			}
+			textOverlay->addText(ss.str(), 5.0f, 115.0f + i * 15.0f, VulkanTextOverlay::alignLeft);
+		}
 	}
 };
 
@@ -14,6 +14,8 @@
 #include <random>
 #include <numeric>
 #include <ctime>
+#include <sstream>
+#include <iomanip>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -25,6 +27,8 @@
 #include "VulkanDevice.hpp"
 #include "VulkanBuffer.hpp"
 #include "VulkanModel.hpp"
+#include "blockcompressor.hpp"
+#include "noisegenerator.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -36,113 +40,6 @@ struct Vertex {
 	float normal[3];
 };
 
-// Translation of Ken Perlin's JAVA implementation (http://mrl.nyu.edu/~perlin/noise/)
-template <typename T>
-class PerlinNoise
-{
-private:
-	uint32_t permutations[512];
-	T fade(T t) 
-	{ 
-		return t * t * t * (t * (t * (T)6 - (T)15) + (T)10); 
-	}
-	T lerp(T t, T a, T b) 
-	{ 
-		return a + t * (b - a); 
-	}
-	T grad(int hash, T x, T y, T z) 
-	{
-		// Convert LO 4 bits of hash code into 12 gradient directions
-		int h = hash & 15;                     
-		T u = h < 8 ? x : y;
-		T v = h < 4 ? y : h == 12 || h == 14 ? x : z;
-		return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
-	}
-public:
-	PerlinNoise()
-	{
-		// Generate random lookup for permutations containing all numbers from 0..255
-		std::vector<uint8_t> plookup;
-		plookup.resize(256);
-		std::iota(plookup.begin(), plookup.end(), 0);
-		std::default_random_engine rndEngine(std::random_device{}());
-		std::shuffle(plookup.begin(), plookup.end(), rndEngine);
-
-		for (uint32_t i = 0; i < 256; i++)
-		{
-			permutations[i] = permutations[256 + i] = plookup[i];
-		}		
-	}
-	T noise(T x, T y, T z)
-	{
-		// Find unit cube that contains point
-		int32_t X = (int32_t)floor(x) & 255;
-		int32_t Y = (int32_t)floor(y) & 255;
-		int32_t Z = (int32_t)floor(z) & 255;
-		// Find relative x,y,z of point in cube
-		x -= floor(x);
-		y -= floor(y);
-		z -= floor(z);
-
-		// Compute fade curves for each of x,y,z
-		T u = fade(x);
-		T v = fade(y);
-		T w = fade(z);
-
-		// Hash coordinates of the 8 cube corners
-		uint32_t A = permutations[X] + Y;
-		uint32_t AA = permutations[A] + Z;
-		uint32_t AB = permutations[A + 1] + Z;
-		uint32_t B = permutations[X + 1] + Y;
-		uint32_t BA = permutations[B] + Z;
-		uint32_t BB = permutations[B + 1] + Z;
-
-		// And add blended results for 8 corners of the cube;
-		T res = lerp(w, lerp(v, 
-			lerp(u, grad(permutations[AA], x, y, z), grad(permutations[BA], x - 1, y, z)), lerp(u, grad(permutations[AB], x, y - 1, z), grad(permutations[BB], x - 1, y - 1, z))),
-			lerp(v, lerp(u, grad(permutations[AA + 1], x, y, z - 1), grad(permutations[BA + 1], x - 1, y, z - 1)), lerp(u, grad(permutations[AB + 1], x, y - 1, z - 1), grad(permutations[BB + 1], x - 1, y - 1, z - 1))));
-		return res;
-	}
-};
-
-// Fractal noise generator based on perlin noise above
-template <typename T>
-class FractalNoise
-{
-private:
-	PerlinNoise<float> perlinNoise;
-	uint32_t octaves; 
-	T frequency;
-	T amplitude;
-	T persistence;
-public:
-
-	FractalNoise(const PerlinNoise<T> &perlinNoise) 
-	{
-		this->perlinNoise = perlinNoise;
-		octaves = 6;
-		persistence = (T)0.5;
-	}
-
-	T noise(T x, T y, T z)
-	{
-		T sum = 0;
-		T frequency = (T)1;
-		T amplitude = (T)1;
-		T max = (T)0;  
-		for (int32_t i = 0; i < (int32_t)octaves; i++)
-		{
-			sum += perlinNoise.noise(x * frequency, y * frequency, z * frequency) * amplitude;
-			max += amplitude;
-			amplitude *= persistence;
-			frequency *= (T)2;
-		}
-
-		sum = sum / max;
-		return (sum + (T)1.0) / (T)2.0;
-	}
-};
-
 class VulkanExample : public VulkanExampleBase
 {
 public:
@@ -161,6 +58,32 @@ public:
 
 	bool regenerateNoise = true;
 
+	// The generated noise can optionally be block compressed (BC4) on the host before uploading
+	vks::BlockCompressor blockCompressor;
+	bool compressionSupported = false;
+	bool compressNoise = false;
+	double noiseGenerationTime = 0.0;
+
+	// Noise is generated in bricks of slices on the job system's worker threads
+	// Finished slices are uploaded every frame, so generating a new volume doesn't stall rendering
+	vks::NoiseGenerator noiseGenerator;
+	const uint32_t noiseSlicesPerBrick = 4;
+	// Persistently mapped, uncompressed noise is written directly into this buffer by the worker threads
+	vks::Buffer noiseStaging;
+	// Generation target if the noise is compressed before uploading
+	std::vector<uint8_t> noiseData;
+	bool generatingNoise = false;
+	uint32_t generatedSlices = 0;
+
+	struct NoiseBenchmark {
+		uint32_t size;
+		double scalar;
+		double scalarThreaded;
+		double simd;
+		double simdThreaded;
+	};
+	std::vector<NoiseBenchmark> benchmarkResults;
+
 	struct {
 		vks::Model cube;
 	} models;
@@ -192,13 +115,22 @@ public:
 	VkDescriptorSet descriptorSet;
 	VkDescriptorSetLayout descriptorSetLayout;
 
-	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
+	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION), blockCompressor(getJobSystem()), noiseGenerator(getJobSystem())
 	{
 		zoom = -2.5f;
 		rotation = { 0.0f, 15.0f, 0.0f };
 		title = "Vulkan Example - 3D textures";
 		enableTextOverlay = true;
-		srand((unsigned int)time(NULL));
+		srand(getRandomSeed());
+	}
+
+	// Enable physical device features required for this example
+	virtual void getEnabledFeatures()
+	{
+		// Block compressed formats are optional
+		if (deviceFeatures.textureCompressionBC) {
+			enabledFeatures.textureCompressionBC = VK_TRUE;
+		}
 	}
 
 	~VulkanExample()
@@ -206,6 +138,10 @@ public:
 		// Clean up used Vulkan resources 
 		// Note : Inherited destructor cleans up resources stored in base class
 
+		// Worker threads may still be writing to the staging buffer
+		noiseGenerator.wait();
+		noiseStaging.destroy();
+
 		destroyTextureImage(texture);
 
 		vkDestroyPipeline(device, pipelines.solid, nullptr);
@@ -227,7 +163,7 @@ public:
 		texture.height = height;
 		texture.depth = depth;
 		texture.mipLevels = 1;
-		texture.format = VK_FORMAT_R8_UNORM;
+		texture.format = compressNoise ? VK_FORMAT_BC4_UNORM_BLOCK : VK_FORMAT_R8_UNORM;
 
 		// Format support check
 		// 3D texture support in Vulkan is mandatory (in contrast to OpenGL) so no need to check if it's supported
@@ -258,7 +194,7 @@ public:
 		imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
 		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 		imageCreateInfo.extent.width = texture.width;
-		imageCreateInfo.extent.height = texture.width;
+		imageCreateInfo.extent.height = texture.height;
 		imageCreateInfo.extent.depth = texture.depth;
 		// Set initial layout of the image to undefined
 		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -304,144 +240,183 @@ public:
 		view.subresourceRange.levelCount = 1;
 		VK_CHECK_RESULT(vkCreateImageView(device, &view, nullptr, &texture.view));
 
+		// Noise slices are uploaded progressively, so the image is transitioned to shader read right away
+		texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		VkCommandBuffer layoutCmd = VulkanExampleBase::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		vks::tools::setImageLayout(layoutCmd, texture.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, texture.imageLayout, subresourceRange);
+		VulkanExampleBase::flushCommandBuffer(layoutCmd, queue, true);
+
 		// Fill image descriptor image info to be used descriptor set setup
-		texture.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		texture.descriptor.imageLayout = texture.imageLayout;
 		texture.descriptor.imageView = texture.view;
 		texture.descriptor.sampler = texture.sampler;
 	}
 
-	// Generate randomized noise and upload it to the 3D texture using staging
-	void updateNoiseTexture()
+	// Start generating a new randomized noise volume on the noise generator's worker threads
+	void startNoiseGeneration()
 	{
-		const uint32_t texMemSize = texture.width * texture.height * texture.depth;
-
-		uint8_t *data = new uint8_t[texMemSize];
-		memset(data, 0, texMemSize);
-
-		// Generate perlin based noise
 		std::cout << "Generating " << texture.width << " x " << texture.height << " x " << texture.depth << " noise texture..." << std::endl;
 
-		auto tStart = std::chrono::high_resolution_clock::now();
+		noiseGenerator.seed(getRandomSeed());
+		noiseGenerator.settings.fractal = true;
+		noiseGenerator.settings.frequency = static_cast<float>(rand() % 10) + 4.0f;
 
-		PerlinNoise<float> perlinNoise;
-		FractalNoise<float> fractalNoise(perlinNoise);
+		// Uncompressed noise is written directly into the staging buffer
+		uint8_t *dst = static_cast<uint8_t*>(noiseStaging.mapped);
+		if (compressNoise)
+		{
+			noiseData.resize(texture.width * texture.height * texture.depth);
+			dst = noiseData.data();
+		}
+		generatedSlices = 0;
+		generatingNoise = true;
+		noiseGenerator.generateAsync(dst, texture.width, texture.height, texture.depth, noiseSlicesPerBrick);
+	}
 
-		std::default_random_engine rndEngine(std::random_device{}());
-		const int32_t noiseType = rand() % 2;
-		const float noiseScale = static_cast<float>(rand() % 10) + 4.0f;
+	// Upload all noise slices that have been finished since the last frame to the 3D texture
+	void updateNoiseTexture()
+	{
+		std::vector<vks::NoiseGenerator::Brick> bricks;
+		const bool finished = noiseGenerator.getFinishedBricks(bricks);
+		for (auto &brick : bricks)
+		{
+			generatedSlices += brick.sliceCount;
+		}
 
-#pragma omp parallel for
-		for (int32_t z = 0; z < (int32_t)texture.depth; z++)
+		VkDeviceSize sliceSize = texture.width * texture.height;
+		if (compressNoise)
 		{
-			for (uint32_t y = 0; y < texture.height; y++)
+			// Optionally compress the noise to BC4 on the host
+			// Blocks are 4x4x1 texels, so the volume is compressed as one 2D image with all slices stacked on top of each other
+			// The compressed volume is uploaded at once after all bricks have been generated
+			bricks.clear();
+			if (finished)
 			{
-				for (int32_t x = 0; x < (int32_t)texture.width; x++)
-				{
-					float nx = (float)x / (float)texture.width;
-					float ny = (float)y / (float)texture.height;
-					float nz = (float)z / (float)texture.depth;
-#define FRACTAL
-#ifdef FRACTAL
-					float n = fractalNoise.noise(nx * noiseScale, ny * noiseScale, nz * noiseScale);
-#else
-					float n = 20.0 * perlinNoise.noise(nx, ny, nz);
-#endif
-					n = n - floor(n);
-
-					data[x + y * texture.width + z * texture.width * texture.height] = static_cast<uint8_t>(floor(n * 255));
-				}
+				assert(texture.height % 4 == 0);
+				blockCompressor.settings.computePSNR = true;
+				blockCompressor.compress(noiseData.data(), texture.width, texture.height * texture.depth, VK_FORMAT_BC4_UNORM_BLOCK, noiseStaging.mapped);
+				const vks::BlockCompressor::Statistics &stats = blockCompressor.lastStatistics;
+				std::cout << "Compressed to BC4 in " << stats.time << "ms (" << stats.megaPixelsPerSecond << " MPix/s, " << blockCompressor.getThreadCount() << " threads), PSNR " << stats.psnr << " dB, " << stats.sourceSize / 1024 << " KB -> " << stats.compressedSize / 1024 << " KB" << std::endl;
+				sliceSize = vks::BlockCompressor::getCompressedSize(VK_FORMAT_BC4_UNORM_BLOCK, texture.width, texture.height);
+				bricks.push_back({ 0, texture.depth });
 			}
 		}
 
-		auto tEnd = std::chrono::high_resolution_clock::now();
-		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		if (!bricks.empty())
+		{
+			// Setup buffer copy regions, one per brick of slices
+			std::vector<VkBufferImageCopy> bufferCopyRegions;
+			for (auto &brick : bricks)
+			{
+				VkBufferImageCopy bufferCopyRegion{};
+				bufferCopyRegion.bufferOffset = brick.firstSlice * sliceSize;
+				bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				bufferCopyRegion.imageSubresource.mipLevel = 0;
+				bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
+				bufferCopyRegion.imageSubresource.layerCount = 1;
+				bufferCopyRegion.imageOffset.z = brick.firstSlice;
+				bufferCopyRegion.imageExtent.width = texture.width;
+				bufferCopyRegion.imageExtent.height = texture.height;
+				bufferCopyRegion.imageExtent.depth = brick.sliceCount;
+				bufferCopyRegions.push_back(bufferCopyRegion);
+			}
 
-		std::cout << "Done in " << tDiff << "ms" << std::endl;
+			VkCommandBuffer copyCmd = VulkanExampleBase::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+
+			// The sub resource range describes the regions of the image we will be transition
+			VkImageSubresourceRange subresourceRange = {};
+			subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			subresourceRange.baseMipLevel = 0;
+			subresourceRange.levelCount = 1;
+			subresourceRange.layerCount = 1;
+
+			// Slices that are not part of this upload keep their contents, so the texture is updated progressively
+			vks::tools::setImageLayout(
+				copyCmd,
+				texture.image,
+				VK_IMAGE_ASPECT_COLOR_BIT,
+				texture.imageLayout,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				subresourceRange);
+
+			vkCmdCopyBufferToImage(
+				copyCmd,
+				noiseStaging.buffer,
+				texture.image,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				static_cast<uint32_t>(bufferCopyRegions.size()),
+				bufferCopyRegions.data());
+
+			vks::tools::setImageLayout(
+				copyCmd,
+				texture.image,
+				VK_IMAGE_ASPECT_COLOR_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				texture.imageLayout,
+				subresourceRange);
+
+			VulkanExampleBase::flushCommandBuffer(copyCmd, queue, true);
+		}
 
-		// Create a host-visible staging buffer that contains the raw image data
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingMemory;
+		if (finished)
+		{
+			noiseGenerationTime = noiseGenerator.lastGenerationTime;
+			std::cout << "Done in " << noiseGenerationTime << "ms (" << noiseGenerator.getThreadCount() << " threads)" << std::endl;
+			generatingNoise = false;
+			regenerateNoise = false;
+		}
+		if (!bricks.empty() || finished)
+		{
+			updateTextOverlay();
+		}
+	}
 
-		// Buffer object
-		VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
-		bufferCreateInfo.size = texMemSize;
-		bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;			
-		VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &stagingBuffer));
+	// Compare scalar and vectorized noise generation, each on a single thread and on all worker threads, for different volume sizes
+	// Speedups are relative to the single threaded scalar generation
+	// Note: Blocks rendering while running
+	void runNoiseBenchmark()
+	{
+		// Separate generators, so the seed and settings of the one used for the texture stay untouched
+		vks::NoiseGenerator singleThreadGenerator;
+		vks::NoiseGenerator threadedGenerator(getJobSystem());
+		threadedGenerator.settings = singleThreadGenerator.settings = noiseGenerator.settings;
+		threadedGenerator.settings.frequency = singleThreadGenerator.settings.frequency = 8.0f;
+		threadedGenerator.seed(0);
+		singleThreadGenerator.seed(0);
+
+		std::cout << "Noise benchmark (fractal, " << threadedGenerator.settings.octaves << " octaves):" << std::endl;
+		benchmarkResults.clear();
+		for (uint32_t size : { 128, 256 })
+		{
+			std::vector<uint8_t> volume(size * size * size);
+			NoiseBenchmark result;
+			result.size = size;
+			// Scalar on a single thread (baseline for the speedups)
+			singleThreadGenerator.settings.simd = false;
+			singleThreadGenerator.generate(volume.data(), size, size, size);
+			result.scalar = singleThreadGenerator.lastGenerationTime;
+			// Scalar using all worker threads
+			threadedGenerator.settings.simd = false;
+			threadedGenerator.generate(volume.data(), size, size, size);
+			result.scalarThreaded = threadedGenerator.lastGenerationTime;
+			// Vectorized on a single thread
+			singleThreadGenerator.settings.simd = true;
+			singleThreadGenerator.generate(volume.data(), size, size, size);
+			result.simd = singleThreadGenerator.lastGenerationTime;
+			// Vectorized using all worker threads
+			threadedGenerator.settings.simd = true;
+			threadedGenerator.generate(volume.data(), size, size, size);
+			result.simdThreaded = threadedGenerator.lastGenerationTime;
+			benchmarkResults.push_back(result);
+			const uint32_t threadCount = threadedGenerator.getThreadCount();
+			std::cout << "\t" << size << "^3: scalar (1 thread) " << result.scalar << " ms"
+				<< ", scalar (" << threadCount << " threads) " << result.scalarThreaded << " ms (x" << result.scalar / result.scalarThreaded << ")"
+				<< ", SIMD (1 thread) " << result.simd << " ms (x" << result.scalar / result.simd << ")"
+				<< ", SIMD (" << threadCount << " threads) " << result.simdThreaded << " ms (x" << result.scalar / result.simdThreaded << ")" << std::endl;
+		}
 
-		// Allocate host visible memory for data upload
-		VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-		VkMemoryRequirements memReqs = {};
-		vkGetBufferMemoryRequirements(device, stagingBuffer, &memReqs);
-		memAllocInfo.allocationSize = memReqs.size;
-		memAllocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device, &memAllocInfo, nullptr, &stagingMemory));
-		VK_CHECK_RESULT(vkBindBufferMemory(device, stagingBuffer, stagingMemory, 0));
-
-		// Copy texture data into staging buffer
-		uint8_t *mapped;
-		VK_CHECK_RESULT(vkMapMemory(device, stagingMemory, 0, memReqs.size, 0, (void **)&mapped));
-		memcpy(mapped, data, texMemSize);
-		vkUnmapMemory(device, stagingMemory);
-
-		VkCommandBuffer copyCmd = VulkanExampleBase::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-		// Image barrier for optimal image
-
-		// The sub resource range describes the regions of the image we will be transition
-		VkImageSubresourceRange subresourceRange = {};
-		subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		subresourceRange.baseMipLevel = 0;
-		subresourceRange.levelCount = 1;
-		subresourceRange.layerCount = 1;
-
-		// Optimal image will be used as destination for the copy, so we must transfer from our
-		// initial undefined image layout to the transfer destination layout
-		vks::tools::setImageLayout(
-			copyCmd,
-			texture.image,
-			VK_IMAGE_ASPECT_COLOR_BIT,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			subresourceRange);
-
-		// Copy 3D noise data to texture
-
-		// Setup buffer copy regions
-		VkBufferImageCopy bufferCopyRegion{};
-		bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		bufferCopyRegion.imageSubresource.mipLevel = 0;
-		bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
-		bufferCopyRegion.imageSubresource.layerCount = 1;
-		bufferCopyRegion.imageExtent.width = texture.width;
-		bufferCopyRegion.imageExtent.height = texture.height;
-		bufferCopyRegion.imageExtent.depth = texture.depth;
-
-		vkCmdCopyBufferToImage(
-			copyCmd,
-			stagingBuffer,
-			texture.image,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1, 
-			&bufferCopyRegion);
-
-		// Change texture image layout to shader read after all mip levels have been copied
-		texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		vks::tools::setImageLayout(
-			copyCmd,
-			texture.image,
-			VK_IMAGE_ASPECT_COLOR_BIT,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			texture.imageLayout,
-			subresourceRange);
-
-		VulkanExampleBase::flushCommandBuffer(copyCmd, queue, true);
-
-		// Clean up staging resources
-		delete[] data;
-		vkFreeMemory(device, stagingMemory, nullptr);
-		vkDestroyBuffer(device, stagingBuffer, nullptr);
-		regenerateNoise = false;
+		updateTextOverlay();
 	}
 
 	// Free all Vulkan resources used a texture object
@@ -457,6 +432,22 @@ public:
 			vkFreeMemory(device, texture.deviceMemory, nullptr);
 	}
 
+	// Recreate the texture with the selected format and generate new noise
+	void toggleCompression()
+	{
+		if (!compressionSupported)
+		{
+			return;
+		}
+		vkDeviceWaitIdle(device);
+		compressNoise = !compressNoise;
+		destroyTextureImage(texture);
+		prepareNoiseTexture(texture.width, texture.height, texture.depth);
+		VkWriteDescriptorSet writeDescriptorSet = vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &texture.descriptor);
+		vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, NULL);
+		regenerateNoise = true;
+	}
+
 	void buildCommandBuffers()
 	{
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
@@ -791,7 +782,20 @@ public:
 		generateQuad();
 		setupVertexDescriptions();
 		prepareUniformBuffers();
+		// BC4 for 3D images is optional even if block compression is supported
+		if (deviceFeatures.textureCompressionBC)
+		{
+			VkImageFormatProperties imageFormatProperties;
+			compressionSupported = (vkGetPhysicalDeviceImageFormatProperties(physicalDevice, VK_FORMAT_BC4_UNORM_BLOCK, VK_IMAGE_TYPE_3D, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 0, &imageFormatProperties) == VK_SUCCESS);
+		}
 		prepareNoiseTexture(256, 256, 256);
+		// Staging buffer for the noise volume (sized for the uncompressed data)
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&noiseStaging,
+			texture.width * texture.height * texture.depth));
+		VK_CHECK_RESULT(noiseStaging.map());
 		setupDescriptorSetLayout();
 		preparePipelines();
 		setupDescriptorPool();
@@ -805,7 +809,11 @@ public:
 		if (!prepared)
 			return;
 		draw();
-		if (regenerateNoise)
+		if (regenerateNoise && !generatingNoise)
+		{
+			startNoiseGeneration();
+		}
+		if (generatingNoise)
 		{
 			updateNoiseTexture();
 		}
@@ -830,6 +838,21 @@ public:
 				updateTextOverlay();
 			}
 			break;
+		case KEY_B:
+		case GAMEPAD_BUTTON_X:
+			if (!regenerateNoise)
+			{
+				toggleCompression();
+				updateTextOverlay();
+			}
+			break;
+		case KEY_M:
+		case GAMEPAD_BUTTON_Y:
+			if (!regenerateNoise)
+			{
+				runNoiseBenchmark();
+			}
+			break;
 		}
 	}
 
@@ -837,7 +860,7 @@ public:
 	{
 		if (regenerateNoise)
 		{
-			textOverlay->addText("Generating new noise texture...", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+			textOverlay->addText("Generating new noise texture... (" + std::to_string(generatedSlices) + " / " + std::to_string(texture.depth) + " slices)", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
 		}
 		else
 		{
@@ -846,6 +869,37 @@ public:
 #else
 			textOverlay->addText("Press \"n\" to generate new noise", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
 #endif
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2) << "Noise generation: " << noiseGenerationTime << " ms (" << noiseGenerator.getThreadCount() << " threads)";
+			textOverlay->addText(ss.str(), 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+			if (compressionSupported)
+			{
+#ifdef __ANDROID__
+				textOverlay->addText(std::string("BC4 compression: ") + (compressNoise ? "on" : "off") + " (\"Button X\" to toggle)", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+#else
+				textOverlay->addText(std::string("BC4 compression: ") + (compressNoise ? "on" : "off") + " (\"b\" to toggle)", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+#endif
+				if (compressNoise)
+				{
+					const vks::BlockCompressor::Statistics &stats = blockCompressor.lastStatistics;
+					ss.str("");
+					ss << "Compression: " << stats.time << " ms, " << stats.megaPixelsPerSecond << " MPix/s, PSNR " << stats.psnr << " dB";
+					textOverlay->addText(ss.str(), 5.0f, 130.0f, VulkanTextOverlay::alignLeft);
+				}
+			}
+			float y = compressionSupported ? (compressNoise ? 145.0f : 130.0f) : 115.0f;
+#ifdef __ANDROID__
+			textOverlay->addText("Press \"Button Y\" to run noise benchmark", 5.0f, y, VulkanTextOverlay::alignLeft);
+#else
+			textOverlay->addText("Press \"m\" to run noise benchmark", 5.0f, y, VulkanTextOverlay::alignLeft);
+#endif
+			for (auto &result : benchmarkResults)
+			{
+				y += 15.0f;
+				ss.str("");
+				ss << result.size << "^3: scalar " << result.scalar << " ms, MT x" << result.scalar / result.scalarThreaded << ", SIMD x" << result.scalar / result.simd << ", SIMD MT x" << result.scalar / result.simdThreaded;
+				textOverlay->addText(ss.str(), 5.0f, y, VulkanTextOverlay::alignLeft);
+			}
 		}
 	}
 };
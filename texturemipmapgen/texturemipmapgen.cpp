@@ -26,6 +26,8 @@
 #include "VulkanDevice.hpp"
 #include "VulkanBuffer.hpp"
 #include "VulkanModel.hpp"
+#include "VulkanTexture.hpp"
+#include "mipmapgenerator.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -42,6 +44,18 @@ public:
 		uint32_t mipLevels;
 	} texture;
 
+	// Same texture with the mip chain generated on the host (vks::MipmapGenerator) for comparison
+	vks::Texture2D textureHostMips;
+	bool useHostMips = false;
+
+	// Mip chain generation timings (in ms)
+	struct {
+		double blit = 0.0;
+		double host = 0.0;
+		double hostScalar = 0.0;
+		uint32_t hostThreadCount = 0;
+	} mipGenTimings;
+
 	// To demonstrate mip mapping and filtering this example uses separate samplers
 	std::vector<std::string> samplerNames{ "No mip maps" , "With mip maps (bilinear)" , "With mip maps (anisotropic)" };
 	std::vector<VkSampler> samplers;
@@ -79,7 +93,10 @@ public:
 	} pipelines;
 
 	VkPipelineLayout pipelineLayout;
-	VkDescriptorSet descriptorSet;
+	struct {
+		VkDescriptorSet blitMips;
+		VkDescriptorSet hostMips;
+	} descriptorSets;
 	VkDescriptorSetLayout descriptorSetLayout;
 
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
@@ -99,6 +116,7 @@ public:
 	~VulkanExample()
 	{
 		destroyTextureImage(texture);
+		textureHostMips.destroy();
 		vkDestroyPipeline(device, pipelines.solid, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
@@ -235,6 +253,8 @@ public:
 		// ---------------------------------------------------------------
 		// We copy down the whole mip chain doing a blit from mip-1 to mip
 		// An alternative way would be to always blit from the first mip level and sample that one down
+		auto tStart = std::chrono::high_resolution_clock::now();
+
 		VkCommandBuffer blitCmd = VulkanExampleBase::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 
 		// Copy down mips from n-1 to n
@@ -309,6 +329,30 @@ public:
 			subresourceRange);
 
 		VulkanExampleBase::flushCommandBuffer(blitCmd, queue, true);
+
+		// Includes command buffer submission and waiting for the queue to become idle
+		auto tEnd = std::chrono::high_resolution_clock::now();
+		mipGenTimings.blit = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		// ---------------------------------------------------------------
+
+		// Generate the same mip chain on the host
+		// ---------------------------------------------------------------
+		// Benchmark the vectorized multi threaded generator against the scalar single threaded reference path
+		std::vector<vks::MipmapGenerator::Level> levels;
+		vks::MipmapGenerator mipmapGenerator(getJobSystem());
+		mipmapGenerator.generate(tex2D[0].data(), format, texture.width, texture.height, texture.mipLevels, levels);
+		mipGenTimings.host = mipmapGenerator.lastGenerationTime;
+		mipGenTimings.hostThreadCount = mipmapGenerator.getThreadCount();
+
+		vks::MipmapGenerator scalarMipmapGenerator;
+		scalarMipmapGenerator.settings.simd = false;
+		scalarMipmapGenerator.generate(tex2D[0].data(), format, texture.width, texture.height, texture.mipLevels, levels);
+		mipGenTimings.hostScalar = scalarMipmapGenerator.lastGenerationTime;
+
+		std::cout << "Mip chain generation: blit " << mipGenTimings.blit << " ms, host " << mipGenTimings.host << " ms (" << mipGenTimings.hostThreadCount << " threads), host scalar " << mipGenTimings.hostScalar << " ms" << std::endl;
+
+		// The texture class uses the host generator if a full mip chain is requested
+		textureHostMips.fromBuffer(tex2D[0].data(), tex2D[0].size(), format, texture.width, texture.height, vulkanDevice, queue, VK_FILTER_LINEAR, VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true, VK_FORMAT_UNDEFINED, getJobSystem());
 		// ---------------------------------------------------------------
 
 		// Create samplers
@@ -397,7 +441,7 @@ public:
 			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
 			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, useHostMips ? &descriptorSets.hostMips : &descriptorSets.blitMips, 0, NULL);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.solid);
 
 			VkDeviceSize offsets[1] = { 0 };
@@ -478,16 +522,17 @@ public:
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes =
 		{
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1),	// Vertex shader UBO
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1),		// Sampled image
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_SAMPLER, 3),			// 3 samplers (array)
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),	// Vertex shader UBO
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 2),		// Sampled image
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_SAMPLER, 6),			// 3 samplers (array)
 		};
 
+		// One set for the blit generated mip chain and one for the host generated one
 		VkDescriptorPoolCreateInfo descriptorPoolInfo = 
 			vks::initializers::descriptorPoolCreateInfo(
 				static_cast<uint32_t>(poolSizes.size()),
 				poolSizes.data(),
-				1);
+				2);
 
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
@@ -530,7 +575,7 @@ public:
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayout));
 	}
 
-	void setupDescriptorSet()
+	void setupDescriptorSet(VkDescriptorSet &descriptorSet, VkImageView imageView)
 	{
 		VkDescriptorSetAllocateInfo allocInfo = 
 			vks::initializers::descriptorSetAllocateInfo(
@@ -553,8 +598,8 @@ public:
 		VkDescriptorImageInfo textureDescriptor = 
 			vks::initializers::descriptorImageInfo(
 				VK_NULL_HANDLE,				 
-				texture.view, 
-				texture.imageLayout);
+				imageView, 
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(
 			descriptorSet,
 			VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
@@ -580,6 +625,12 @@ public:
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
 	}
 
+	void setupDescriptorSets()
+	{
+		setupDescriptorSet(descriptorSets.blitMips, texture.view);
+		setupDescriptorSet(descriptorSets.hostMips, textureHostMips.view);
+	}
+
 	void preparePipelines()
 	{
 		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
@@ -689,7 +740,7 @@ public:
 		setupDescriptorSetLayout();
 		preparePipelines();
 		setupDescriptorPool();
-		setupDescriptorSet();
+		setupDescriptorSets();
 		buildCommandBuffers();
 		prepared = true;
 	}
@@ -732,6 +783,23 @@ public:
 		updateTextOverlay();
 	}
 	
+	void toggleMipSource()
+	{
+		useHostMips = !useHostMips;
+		reBuildCommandBuffers();
+		updateTextOverlay();
+	}
+
+	void reBuildCommandBuffers()
+	{
+		if (!checkCommandBuffers())
+		{
+			destroyCommandBuffers();
+			createCommandBuffers();
+		}
+		buildCommandBuffers();
+	}
+
 	virtual void keyPressed(uint32_t keyCode)
 	{
 		switch (keyCode)
@@ -748,6 +816,10 @@ public:
 		case GAMEPAD_BUTTON_A:
 			toggleSampler();
 			break;
+		case KEY_M:
+		case GAMEPAD_BUTTON_X:
+			toggleMipSource();
+			break;
 		}
 	}
 
@@ -758,10 +830,15 @@ public:
 #if defined(__ANDROID__)
 		textOverlay->addText("LOD bias: " + ss.str() + " (Buttons L1/R1 to change)", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
 		textOverlay->addText("Sampler: " + samplerNames[uboVS.samplerIndex] + " (\"Button A\" to toggle)", 5.0f, 105.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Mip chain: " + std::string(useHostMips ? "host" : "blit") + " (\"Button X\" to toggle)", 5.0f, 125.0f, VulkanTextOverlay::alignLeft);
 #else
 		textOverlay->addText("LOD bias: " + ss.str() + " (numpad +/- to change)", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
 		textOverlay->addText("Sampler: " + samplerNames[uboVS.samplerIndex] + " (\"f\" to toggle)", 5.0f, 105.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Mip chain: " + std::string(useHostMips ? "host" : "blit") + " (\"m\" to toggle)", 5.0f, 125.0f, VulkanTextOverlay::alignLeft);
 #endif
+		ss.str("");
+		ss << "Blit: " << mipGenTimings.blit << " ms, host: " << mipGenTimings.host << " ms (" << mipGenTimings.hostThreadCount << " threads), host scalar: " << mipGenTimings.hostScalar << " ms";
+		textOverlay->addText(ss.str(), 5.0f, 145.0f, VulkanTextOverlay::alignLeft);
 	}
 };
 
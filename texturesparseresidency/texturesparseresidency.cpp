@@ -22,6 +22,7 @@ todos:
 #include <algorithm>
 #include <random>
 #include <chrono>
+#include <list>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -45,6 +46,41 @@ struct Vertex {
 	float uv[2];
 };
 
+// Fixed size device memory pool that backs all resident virtual texture pages
+// Memory is allocated once up front, so the residency budget can't be exceeded and no allocations are done at runtime
+struct VirtualTexturePagePool
+{
+	VkDevice device;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize pageSize;
+	uint32_t pageCount = 0;
+	std::vector<uint32_t> freeSlots;
+
+	void create(VkDevice device, uint32_t memoryTypeIndex, VkDeviceSize pageSize, uint32_t pageCount)
+	{
+		this->device = device;
+		this->pageSize = pageSize;
+		this->pageCount = pageCount;
+		VkMemoryAllocateInfo allocInfo = vks::initializers::memoryAllocateInfo();
+		allocInfo.allocationSize = pageSize * pageCount;
+		allocInfo.memoryTypeIndex = memoryTypeIndex;
+		VK_CHECK_RESULT(vkAllocateMemory(device, &allocInfo, nullptr, &memory));
+		freeSlots.resize(pageCount);
+		for (uint32_t i = 0; i < pageCount; i++)
+		{
+			freeSlots[i] = pageCount - 1 - i;
+		}
+	}
+
+	void destroy()
+	{
+		if (memory != VK_NULL_HANDLE)
+		{
+			vkFreeMemory(device, memory, nullptr);
+		}
+	}
+};
+
 // Virtual texture page as a part of the partially resident texture
 // Contains memory bindings, offsets and status information
 struct VirtualTexturePage
@@ -56,27 +92,34 @@ struct VirtualTexturePage
 	uint32_t mipLevel;													// Mip level that this page belongs to
 	uint32_t layer;														// Array layer that this page belongs to
 	uint32_t index;	
+	uint32_t poolSlot;													// Slot in the page memory pool (if resident)
+	uint64_t lastRequested = 0;											// Last feedback frame that requested this page
+	std::list<uint32_t>::iterator lruEntry;								// Position in the page cache's LRU list (if resident)
 
 	VirtualTexturePage()
 	{
 		imageMemoryBind.memory = VK_NULL_HANDLE;						// Page initially not backed up by memory
 	}
 
-	// Allocate Vulkan memory for the virtual page
-	void allocate(VkDevice device, uint32_t memoryTypeIndex)
+	bool resident()
 	{
-		if (imageMemoryBind.memory != VK_NULL_HANDLE)
-		{
-			//std::cout << "Page " << index << " already allocated" << std::endl;
-			return;
-		};
-
-		imageMemoryBind = {};
+		return (imageMemoryBind.memory != VK_NULL_HANDLE);
+	}
 
-		VkMemoryAllocateInfo allocInfo = vks::initializers::memoryAllocateInfo();
-		allocInfo.allocationSize = size;
-		allocInfo.memoryTypeIndex = memoryTypeIndex;
-		VK_CHECK_RESULT(vkAllocateMemory(device, &allocInfo, nullptr, &imageMemoryBind.memory));
+	// Back the virtual page with a slot from the memory pool
+	// Returns false if the pool has no free slots left
+	bool allocate(VirtualTexturePagePool &pool)
+	{
+		if (resident())
+		{
+			return true;
+		}
+		if (pool.freeSlots.empty())
+		{
+			return false;
+		}
+		poolSlot = pool.freeSlots.back();
+		pool.freeSlots.pop_back();
 
 		VkImageSubresource subResource{};
 		subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -84,19 +127,24 @@ struct VirtualTexturePage
 		subResource.arrayLayer = layer;
 
 		// Sparse image memory binding
+		imageMemoryBind = {};
 		imageMemoryBind.subresource = subResource;
 		imageMemoryBind.extent = extent;
 		imageMemoryBind.offset = offset;
+		imageMemoryBind.memory = pool.memory;
+		imageMemoryBind.memoryOffset = poolSlot * pool.pageSize;
+		return true;
 	}
 
-	// Release Vulkan memory allocated for this page
-	void release(VkDevice device)
+	// Return the memory of this page to the pool
+	// The page needs to be rebound (with no memory) to actually unbind it from the image
+	void release(VirtualTexturePagePool &pool)
 	{
-		if (imageMemoryBind.memory != VK_NULL_HANDLE)
+		if (resident())
 		{
-			vkFreeMemory(device, imageMemoryBind.memory, nullptr);
+			pool.freeSlots.push_back(poolSlot);
 			imageMemoryBind.memory = VK_NULL_HANDLE;
-			//std::cout << "Page " << index << " released" << std::endl;
+			imageMemoryBind.memoryOffset = 0;
 		}
 	}
 };
@@ -108,11 +156,15 @@ struct VirtualTexture
 	VkImage image;														// Texture image handle
 	VkBindSparseInfo bindSparseInfo;									// Sparse queue binding information
 	std::vector<VirtualTexturePage> pages;								// Contains all virtual pages of the texture
-	std::vector<VkSparseImageMemoryBind> sparseImageMemoryBinds;		// Sparse image memory bindings of all memory-backed virtual tables
-	std::vector<VkSparseMemoryBind>	opaqueMemoryBinds;					// Sparse paque memory bindings for the mip tail (if present)
+	std::vector<VkSparseImageMemoryBind> sparseImageMemoryBinds;		// Sparse image memory bindings of all pages changed since the last update
+	std::vector<VkSparseMemoryBind>	opaqueMemoryBinds;					// Sparse opaque memory bindings for the mip tail (if present)
 	VkSparseImageMemoryBindInfo imageMemoryBindInfo;					// Sparse image memory bind info 
 	VkSparseImageOpaqueMemoryBindInfo opaqueMemoryBindInfo;				// Sparse image opaque memory bind info (mip tail)
 	uint32_t mipTailStart;												// First mip level in mip tail
+	VkExtent3D pageGranularity;											// Extent of a single page in texels
+	std::vector<uint32_t> mipPageOffsets;								// Index of the first page of each mip level (first layer)
+	std::vector<glm::uvec2> mipPageCounts;								// Number of pages in x and y for each mip level
+	VirtualTexturePagePool pagePool;									// Memory backing the resident pages
 	
 	VirtualTexturePage* addPage(VkOffset3D offset, VkExtent3D extent, const VkDeviceSize size, const uint32_t mipLevel, uint32_t layer)
 	{
@@ -129,22 +181,25 @@ struct VirtualTexture
 		return &pages.back();
 	}
 
+	// Returns the index of the page covering the given page coordinates of a mip level (first layer)
+	uint32_t getPageIndex(uint32_t mipLevel, uint32_t x, uint32_t y)
+	{
+		return mipPageOffsets[mipLevel] + y * mipPageCounts[mipLevel].x + x;
+	}
+
 	// Call before sparse binding to update memory bind list etc.
-	void updateSparseBindInfo()
+	// Only the passed pages are (re)bound, pages that have been released are unbound
+	// The opaque mip tail bindings are only required for the initial binding
+	void updateSparseBindInfo(const std::vector<uint32_t> &changedPages, bool bindMipTail)
 	{
-		// Update list of memory-backed sparse image memory binds
-		sparseImageMemoryBinds.resize(pages.size());
-		uint32_t index = 0;
-		for (auto page : pages)
+		// Update list of changed sparse image memory binds
+		sparseImageMemoryBinds.resize(changedPages.size());
+		for (size_t i = 0; i < changedPages.size(); i++)
 		{
-			sparseImageMemoryBinds[index] = page.imageMemoryBind;
-			index++;
+			sparseImageMemoryBinds[i] = pages[changedPages[i]].imageMemoryBind;
 		}
 		// Update sparse bind info
 		bindSparseInfo = vks::initializers::bindSparseInfo();
-		// todo: Semaphore for queue submission
-		// bindSparseInfo.signalSemaphoreCount = 1;
-		// bindSparseInfo.pSignalSemaphores = &bindSparseSemaphore;
 
 		// Image memory binds
 		imageMemoryBindInfo.image = image;
@@ -157,17 +212,14 @@ struct VirtualTexture
 		opaqueMemoryBindInfo.image = image;
 		opaqueMemoryBindInfo.bindCount = static_cast<uint32_t>(opaqueMemoryBinds.size());
 		opaqueMemoryBindInfo.pBinds = opaqueMemoryBinds.data();
-		bindSparseInfo.imageOpaqueBindCount = (opaqueMemoryBindInfo.bindCount > 0) ? 1 : 0;
+		bindSparseInfo.imageOpaqueBindCount = (bindMipTail && (opaqueMemoryBindInfo.bindCount > 0)) ? 1 : 0;
 		bindSparseInfo.pImageOpaqueBinds = &opaqueMemoryBindInfo;
 	}
 
 	// Release all Vulkan resources
 	void destroy()
 	{
-		for (auto page : pages)
-		{
-			page.release(device);
-		}
+		pagePool.destroy();
 		for (auto bind : opaqueMemoryBinds)
 		{
 			vkFreeMemory(device, bind.memory, nullptr);
@@ -176,7 +228,6 @@ struct VirtualTexture
 };
 
 uint32_t memoryTypeIndex;
-int32_t lastFilledMip = 0;
 
 class VulkanExample : public VulkanExampleBase
 {
@@ -197,7 +248,11 @@ public:
 		vks::Texture2D source;
 	} textures;
 
-	vks::HeightMap *heightMap = nullptr;
+	// Terrain is split into chunks with distance based LOD that are streamed in on worker threads
+	// On desktop the heights are streamed from tile files, only loading the tiles needed by the chunks that are generated
+	vks::MemoryHeightSource heightSource;
+	vks::TiledHeightSource *tiledHeightSource = nullptr;
+	vks::ChunkedTerrain *terrain = nullptr;
 
 	struct {
 		VkPipelineVertexInputStateCreateInfo inputState;
@@ -224,9 +279,52 @@ public:
 	VkDescriptorSet descriptorSet;
 	VkDescriptorSetLayout descriptorSetLayout;
 
-	//todo: comment
+	// Signaled by sparse binding, page uploads wait on this before writing to newly bound pages
 	VkSemaphore bindSparseSemaphore = VK_NULL_HANDLE;
 
+	// Feedback pass that writes the requested pages into a color attachment at a reduced resolution
+	const uint32_t feedbackDivisor = 8;
+	struct FrameBufferAttachment {
+		VkImage image;
+		VkDeviceMemory memory;
+		VkImageView view;
+	};
+	struct {
+		uint32_t width, height;
+		FrameBufferAttachment color, depth;
+		VkFramebuffer frameBuffer;
+		VkRenderPass renderPass;
+		VkPipeline pipeline;
+	} feedback;
+
+	// The feedback is copied into a ring of host visible buffers and consumed a few frames later, so reading it back never stalls
+	struct FeedbackReadback {
+		vks::Buffer buffer;
+		VkCommandBuffer commandBuffer;
+		VkFence fence;
+		bool pending = false;
+		uint64_t frame = 0;
+	};
+	std::array<FeedbackReadback, 3> feedbackReadbacks;
+	uint64_t feedbackFrame = 0;
+
+	// Page cache
+	// Resident pages are kept in least recently used order (front = most recently requested)
+	std::list<uint32_t> pageLRU;
+	uint64_t residencyUpdate = 0;
+	// Max. number of resident pages (size of the page memory pool)
+	const uint32_t pageBudget = 512;
+	// Max. number of pages made resident per update to limit the per-frame cost
+	const uint32_t maxPageUploads = 64;
+	VkCommandBuffer residencyCmdBuffer;
+	VkFence residencyFence;
+	struct {
+		uint32_t requestedPages = 0;
+		uint32_t uploadedPages = 0;
+		uint32_t evictedPages = 0;
+		double updateTime = 0.0;
+	} residencyStats;
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		zoom = -1.3f; 
@@ -252,12 +350,24 @@ public:
 		// Clean up used Vulkan resources 
 		// Note : Inherited destructor cleans up resources stored in base class
 
-		if (heightMap)
-			delete heightMap;
+		if (terrain)
+			delete terrain;
+		if (tiledHeightSource)
+			delete tiledHeightSource;
 
 		destroyTextureImage(texture);
 
 		vkDestroySemaphore(device, bindSparseSemaphore, nullptr);
+		vkDestroyFence(device, residencyFence, nullptr);
+
+		// Feedback pass
+		vkDestroyPipeline(device, feedback.pipeline, nullptr);
+		vkDestroyRenderPass(device, feedback.renderPass, nullptr);
+		destroyFeedbackTargets();
+		for (auto& readback : feedbackReadbacks)
+		{
+			vkDestroyFence(device, readback.fence, nullptr);
+		}
 
 		vkDestroyPipeline(device, pipelines.solid, nullptr);
 
@@ -386,11 +496,10 @@ public:
 			//todo:multiple reqs
 			texture.mipTailStart = reqs.imageMipTailFirstLod;
 		}
-		
-		lastFilledMip = texture.mipTailStart - 1;
+
 
 		// Get sparse image requirements for the color aspect
-		VkSparseImageMemoryRequirements sparseMemoryReq;
+		VkSparseImageMemoryRequirements sparseMemoryReq{};
 		bool colorAspectFound = false;
 		for (auto reqs : sparseMemoryReqs)
 		{
@@ -406,12 +515,16 @@ public:
 			std::cout << "Error: Could not find sparse image memory requirements for color aspect bit!" << std::endl;
 			return;
 		}
+		texture.pageGranularity = sparseMemoryReq.formatProperties.imageGranularity;
 
 		// todo:
 		// Calculate number of required sparse memory bindings by alignment
 		assert((sparseImageMemoryReqs.size % sparseImageMemoryReqs.alignment) == 0);
 		memoryTypeIndex = vulkanDevice->getMemoryType(sparseImageMemoryReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
+		// All resident pages are backed by a single fixed size memory pool
+		texture.pagePool.create(device, memoryTypeIndex, sparseImageMemoryReqs.alignment, pageBudget);
+
 		// Get sparse bindings
 		uint32_t sparseBindsCount = static_cast<uint32_t>(sparseImageMemoryReqs.size / sparseImageMemoryReqs.alignment);		
 		std::vector<VkSparseMemoryBind>	sparseMemoryBinds(sparseBindsCount);
@@ -439,6 +552,12 @@ public:
 				// Aligned sizes by image granularity
 				VkExtent3D imageGranularity = sparseMemoryReq.formatProperties.imageGranularity;
 				glm::uvec3 sparseBindCounts = alignedDivision(extent, imageGranularity);
+				if (layer == 0)
+				{
+					// Used to look up the pages requested by the feedback pass
+					texture.mipPageOffsets.push_back(static_cast<uint32_t>(texture.pages.size()));
+					texture.mipPageCounts.push_back(glm::uvec2(sparseBindCounts.x, sparseBindCounts.y));
+				}
 				glm::uvec3 lastBlockExtent;
 				lastBlockExtent.x = (extent.width % imageGranularity.width) ? extent.width % imageGranularity.width : imageGranularity.width;
 				lastBlockExtent.y = (extent.height % imageGranularity.height) ? extent.height % imageGranularity.height : imageGranularity.height;
@@ -467,12 +586,6 @@ public:
 							VirtualTexturePage *newPage = texture.addPage(offset, extent, sparseImageMemoryReqs.alignment, mipLevel, layer);
 							newPage->imageMemoryBind.subresource = subResource;
 
-							if ((x % 2 == 1) || (y % 2 == 1))
-							{
-								// Allocate memory for this virtual page
-								//newPage->allocate(device, memoryTypeIndex);
-							}
-
 							index++;
 						}
 					}
@@ -503,6 +616,7 @@ public:
 		std::cout << "Texture info:" << std::endl;
 		std::cout << "\tDim: " << texture.width << " x " << texture.height << std::endl;
 		std::cout << "\tVirtual pages: " << texture.pages.size() << std::endl;
+		std::cout << "\tPage budget: " << pageBudget << " (" << (pageBudget * sparseImageMemoryReqs.alignment) / (1024 * 1024) << " MB)" << std::endl;
 
 		// Check if format has one mip tail for all layers
 		if ((sparseMemoryReq.formatProperties.flags & VK_SPARSE_IMAGE_FORMAT_SINGLE_MIPTAIL_BIT) && (sparseMemoryReq.imageMipTailFirstLod < texture.mipLevels))
@@ -528,13 +642,9 @@ public:
 		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
 		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &bindSparseSemaphore));
 
-		// Prepare bind sparse info for reuse in queue submission
-		texture.updateSparseBindInfo();
-
-		// Bind to queue
-		// todo: in draw?
+		// Initially only the mip tail is bound, all other pages are made resident on demand
+		texture.updateSparseBindInfo({}, true);
 		vkQueueBindSparse(queue, 1, &texture.bindSparseInfo, VK_NULL_HANDLE);
-		//todo: use sparse bind semaphore
 		vkQueueWaitIdle(queue);
 
 		// Create sampler
@@ -574,8 +684,7 @@ public:
 		texture.descriptor.imageView = texture.view;
 		texture.descriptor.sampler = texture.sampler;
 
-		// Fill smallest (non-tail) mip map leve
-		fillVirtualTexture(lastFilledMip);
+		fillMipTail();
 	}
 
 	// Free all Vulkan resources used a texture object
@@ -622,25 +731,125 @@ public:
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.solid);
 
-			VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &heightMap->vertexBuffer.buffer, offsets);
-			vkCmdBindIndexBuffer(drawCmdBuffers[i], heightMap->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(drawCmdBuffers[i], heightMap->indexCount, 1, 0, 0, 0);
+			terrain->draw(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID);
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 		}
+
+		buildFeedbackCommandBuffers();
+	}
+
+	// Render the terrain into the feedback attachment and copy the page requests to the host visible readback buffers
+	void buildFeedbackCommandBuffers()
+	{
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+
+		VkClearValue clearValues[2];
+		// Cleared to "no page requested"
+		clearValues[0].color.uint32[0] = 0xFFFFFFFF;
+		clearValues[1].depthStencil = { 1.0f, 0 };
+
+		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+		renderPassBeginInfo.renderPass = feedback.renderPass;
+		renderPassBeginInfo.framebuffer = feedback.frameBuffer;
+		renderPassBeginInfo.renderArea.extent.width = feedback.width;
+		renderPassBeginInfo.renderArea.extent.height = feedback.height;
+		renderPassBeginInfo.clearValueCount = 2;
+		renderPassBeginInfo.pClearValues = clearValues;
+
+		for (auto& readback : feedbackReadbacks)
+		{
+			VkCommandBuffer cmdBuffer = readback.commandBuffer;
+			VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo));
+
+			vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+			VkViewport viewport = vks::initializers::viewport((float)feedback.width, (float)feedback.height, 0.0f, 1.0f);
+			vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+
+			VkRect2D scissor = vks::initializers::rect2D(feedback.width, feedback.height, 0, 0);
+			vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+
+			vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+			vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, feedback.pipeline);
+
+			terrain->draw(cmdBuffer, VERTEX_BUFFER_BIND_ID);
+
+			vkCmdEndRenderPass(cmdBuffer);
+
+			// Copy page requests to the readback buffer (render pass transitions the attachment to transfer source)
+			VkBufferImageCopy copyRegion{};
+			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copyRegion.imageSubresource.layerCount = 1;
+			copyRegion.imageExtent = { feedback.width, feedback.height, 1 };
+			vkCmdCopyImageToBuffer(cmdBuffer, feedback.color.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer.buffer, 1, &copyRegion);
+
+			// Make the copied data visible to the host
+			VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+			bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.buffer = readback.buffer.buffer;
+			bufferBarrier.size = VK_WHOLE_SIZE;
+			vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+			VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffer));
+		}
+	}
+
+	// Consume all feedback readbacks that have finished on the GPU (oldest first)
+	// Only polls the fences, so this never waits for the GPU
+	void processFeedback()
+	{
+		for (;;)
+		{
+			FeedbackReadback *oldest = nullptr;
+			for (auto& readback : feedbackReadbacks)
+			{
+				if (readback.pending && ((oldest == nullptr) || (readback.frame < oldest->frame)))
+				{
+					oldest = &readback;
+				}
+			}
+			if ((oldest == nullptr) || (vkGetFenceStatus(device, oldest->fence) != VK_SUCCESS))
+			{
+				break;
+			}
+			oldest->pending = false;
+			updateResidency(static_cast<const uint32_t*>(oldest->buffer.mapped), feedback.width * feedback.height);
+		}
+	}
+
+	// Submit the feedback pass for the current frame into a free readback slot
+	// If all slots are still in flight, no feedback is generated for this frame
+	void submitFeedback()
+	{
+		for (auto& readback : feedbackReadbacks)
+		{
+			if (!readback.pending)
+			{
+				VK_CHECK_RESULT(vkResetFences(device, 1, &readback.fence));
+				VkSubmitInfo feedbackSubmitInfo = vks::initializers::submitInfo();
+				feedbackSubmitInfo.commandBufferCount = 1;
+				feedbackSubmitInfo.pCommandBuffers = &readback.commandBuffer;
+				VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &feedbackSubmitInfo, readback.fence));
+				readback.pending = true;
+				readback.frame = feedbackFrame++;
+				break;
+			}
+		}
 	}
 
 	void draw()
 	{
 		VulkanExampleBase::prepareFrame();
 
-		// Sparse bindings
-//		vkQueueBindSparse(queue, 1, &bindSparseInfo, VK_NULL_HANDLE);
-		//todo: use sparse bind semaphore
-//		vkQueueWaitIdle(queue);
+		// Update page residency with the feedback of earlier frames and request pages for the current frame
+		processFeedback();
+		submitFeedback();
 
 		// Command buffer to be sumitted to the queue
 		submitInfo.commandBufferCount = 1;
@@ -654,18 +863,216 @@ public:
 
 	void loadAssets()
 	{
-		textures.source.loadFromFile(getAssetPath() + "textures/ground_dry_bc3.ktx", VK_FORMAT_BC3_UNORM_BLOCK, vulkanDevice, queue, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+		// Source for the page contents, only used for blits
+		textures.source.loadFromFile(getAssetPath() + "textures/ground_dry_bc3.ktx", VK_FORMAT_BC3_UNORM_BLOCK, vulkanDevice, queue, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 	}
 
-	// Generate a terrain quad patch for feeding to the tessellation control shader
+	// Setup the chunked terrain, only the root chunk is generated up front
 	void generateTerrain()
 	{
-		heightMap = new vks::HeightMap(vulkanDevice, queue);
+		vks::HeightSource *source = &heightSource;
 #if defined(__ANDROID__)
-		heightMap->loadFromFile(getAssetPath() + "textures/terrain_heightmap_r16.ktx", 128, glm::vec3(2.0f, 48.0f, 2.0f), vks::HeightMap::topologyTriangles, androidApp->activity->assetManager);
+		heightSource.loadFromFile(getAssetPath() + "textures/terrain_heightmap_r16.ktx", androidApp->activity->assetManager);
 #else
-		heightMap->loadFromFile(getAssetPath() + "textures/terrain_heightmap_r16.ktx", 128, glm::vec3(2.0f, 48.0f, 2.0f), vks::HeightMap::topologyTriangles);
+		// The height map is split into tiles next to the KTX file on the first run, later runs stream from the tiles without loading the whole height map
+		// Falls back to keeping the height map in memory if the tiles can't be written (e.g. read-only asset directory)
+		const std::string tileBasePath = getAssetPath() + "textures/terrain_heightmap_r16";
+		const uint32_t tileSize = 128;
+		uint32_t dim, tileSetTileSize;
+		bool tilesAvailable = vks::TiledHeightSource::readInfo(tileBasePath, dim, tileSetTileSize);
+		if (!tilesAvailable)
+		{
+			heightSource.loadFromFile(getAssetPath() + "textures/terrain_heightmap_r16.ktx");
+			dim = heightSource.getDim();
+			tileSetTileSize = tileSize;
+			tilesAvailable = vks::TiledHeightSource::writeTiles(heightSource.data(), dim, tileSize, tileBasePath);
+			std::cout << (tilesAvailable ? "Wrote height map tiles to " : "Could not write height map tiles to ") << tileBasePath << std::endl;
+		}
+		if (tilesAvailable)
+		{
+			// Only a quarter of the tiles are kept in memory at once
+			const uint32_t tilesPerRow = (dim + tileSetTileSize - 1) / tileSetTileSize;
+			tiledHeightSource = new vks::TiledHeightSource(tileBasePath, dim, tileSetTileSize, std::max(tilesPerRow * tilesPerRow / 4, 4u));
+			source = tiledHeightSource;
+			heightSource = vks::MemoryHeightSource();
+		}
 #endif
+		terrain = new vks::ChunkedTerrain(vulkanDevice, queue, getJobSystem());
+		// Same extent and height as the single mesh terrain previously used by this example
+		const float sampleSize = 512.0f / static_cast<float>(source->getDim());
+		terrain->create(source, glm::vec3(sampleSize, 48.0f, sampleSize));
+		std::cout << "Terrain: " << terrain->getLevelCount() << " LOD levels, " << terrain->settings.chunkResolution << " x " << terrain->settings.chunkResolution << " quads per chunk, " << terrain->getThreadCount() << " worker threads" << std::endl;
+	}
+
+	// Select terrain chunks for the current camera position
+	void updateTerrain()
+	{
+		vks::Frustum frustum;
+		frustum.update(camera.matrices.perspective * camera.matrices.view);
+		// The first person camera's view matrix translates by the camera position, so the world space position is negated
+		const uint32_t uploadedChunks = terrain->stats.uploadedChunks;
+		if (terrain->update(-camera.position, &frustum))
+		{
+			buildCommandBuffers();
+			updateTextOverlay();
+		}
+		else if (terrain->stats.uploadedChunks != uploadedChunks)
+		{
+			updateTextOverlay();
+		}
+	}
+
+	void createFeedbackAttachment(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspectMask, FrameBufferAttachment *attachment)
+	{
+		VkImageCreateInfo image = vks::initializers::imageCreateInfo();
+		image.imageType = VK_IMAGE_TYPE_2D;
+		image.format = format;
+		image.extent = { feedback.width, feedback.height, 1 };
+		image.mipLevels = 1;
+		image.arrayLayers = 1;
+		image.samples = VK_SAMPLE_COUNT_1_BIT;
+		image.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image.usage = usage;
+		VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &attachment->image));
+
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device, attachment->image, &memReqs);
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &attachment->memory));
+		VK_CHECK_RESULT(vkBindImageMemory(device, attachment->image, attachment->memory, 0));
+
+		VkImageViewCreateInfo imageView = vks::initializers::imageViewCreateInfo();
+		imageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		imageView.format = format;
+		imageView.subresourceRange = { aspectMask, 0, 1, 0, 1 };
+		imageView.image = attachment->image;
+		VK_CHECK_RESULT(vkCreateImageView(device, &imageView, nullptr, &attachment->view));
+	}
+
+	// Create the window size dependent parts of the feedback pass (attachments, frame buffer and readback buffers)
+	void prepareFeedbackTargets()
+	{
+		feedback.width = std::max(width / feedbackDivisor, 1u);
+		feedback.height = std::max(height / feedbackDivisor, 1u);
+
+		createFeedbackAttachment(VK_FORMAT_R32_UINT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT, &feedback.color);
+		createFeedbackAttachment(depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, &feedback.depth);
+
+		std::array<VkImageView, 2> attachments = { feedback.color.view, feedback.depth.view };
+		VkFramebufferCreateInfo frameBufferInfo = vks::initializers::framebufferCreateInfo();
+		frameBufferInfo.renderPass = feedback.renderPass;
+		frameBufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		frameBufferInfo.pAttachments = attachments.data();
+		frameBufferInfo.width = feedback.width;
+		frameBufferInfo.height = feedback.height;
+		frameBufferInfo.layers = 1;
+		VK_CHECK_RESULT(vkCreateFramebuffer(device, &frameBufferInfo, nullptr, &feedback.frameBuffer));
+
+		for (auto& readback : feedbackReadbacks)
+		{
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(
+				VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&readback.buffer,
+				feedback.width * feedback.height * sizeof(uint32_t)));
+			VK_CHECK_RESULT(readback.buffer.map());
+		}
+	}
+
+	void destroyFeedbackTargets()
+	{
+		vkDestroyFramebuffer(device, feedback.frameBuffer, nullptr);
+		for (auto attachment : { feedback.color, feedback.depth })
+		{
+			vkDestroyImageView(device, attachment.view, nullptr);
+			vkDestroyImage(device, attachment.image, nullptr);
+			vkFreeMemory(device, attachment.memory, nullptr);
+		}
+		for (auto& readback : feedbackReadbacks)
+		{
+			readback.buffer.destroy();
+		}
+	}
+
+	// Prepare the offscreen feedback pass
+	// Renders the terrain at a fraction of the window resolution and writes the page each fragment would sample from
+	void prepareFeedback()
+	{
+		std::array<VkAttachmentDescription, 2> attachmentDescs = {};
+		// Page requests, transitioned for the copy to the readback buffer at the end of the render pass
+		attachmentDescs[0].format = VK_FORMAT_R32_UINT;
+		attachmentDescs[0].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachmentDescs[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachmentDescs[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachmentDescs[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachmentDescs[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachmentDescs[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachmentDescs[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		// Depth
+		attachmentDescs[1].format = depthFormat;
+		attachmentDescs[1].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachmentDescs[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachmentDescs[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachmentDescs[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachmentDescs[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachmentDescs[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachmentDescs[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 1;
+		subpass.pColorAttachments = &colorReference;
+		subpass.pDepthStencilAttachment = &depthReference;
+
+		// Subpass dependencies for layout transitions
+		std::array<VkSubpassDependency, 2> dependencies;
+		// Don't overwrite the attachment before the copy of the previous feedback pass has finished
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+		// Page requests are copied after the render pass
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+		VkRenderPassCreateInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachmentDescs.size());
+		renderPassInfo.pAttachments = attachmentDescs.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
+		VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &feedback.renderPass));
+
+		prepareFeedbackTargets();
+
+		// Readback ring
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo();
+		for (auto& readback : feedbackReadbacks)
+		{
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &readback.commandBuffer));
+			VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &readback.fence));
+		}
+
+		// Page uploads
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &residencyCmdBuffer));
+		fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &residencyFence));
 	}
 
 	void setupVertexDescriptions()
@@ -861,6 +1268,35 @@ public:
 		pipelineCreateInfo.pStages = shaderStages.data();
 
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.solid));
+
+		// Feedback pass
+		// Texture and page dimensions are passed as specialization constants
+		struct SpecializationData {
+			float textureWidth;
+			float textureHeight;
+			float pageWidth;
+			float pageHeight;
+			float mipTailStart;
+			float lodOffset;
+		} specializationData;
+		specializationData.textureWidth = (float)texture.width;
+		specializationData.textureHeight = (float)texture.height;
+		specializationData.pageWidth = (float)texture.pageGranularity.width;
+		specializationData.pageHeight = (float)texture.pageGranularity.height;
+		specializationData.mipTailStart = (float)texture.mipTailStart;
+		specializationData.lodOffset = log2f((float)feedbackDivisor);
+
+		std::array<VkSpecializationMapEntry, 6> specializationMapEntries;
+		for (uint32_t i = 0; i < specializationMapEntries.size(); i++)
+		{
+			specializationMapEntries[i] = vks::initializers::specializationMapEntry(i, i * sizeof(float), sizeof(float));
+		}
+		VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(static_cast<uint32_t>(specializationMapEntries.size()), specializationMapEntries.data(), sizeof(specializationData), &specializationData);
+
+		shaderStages[1] = loadShader(getAssetPath() + "shaders/texturesparseresidency/feedback.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+		shaderStages[1].pSpecializationInfo = &specializationInfo;
+		pipelineCreateInfo.renderPass = feedback.renderPass;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &feedback.pipeline));
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
@@ -911,6 +1347,7 @@ public:
 		generateTerrain();
 		setupVertexDescriptions();
 		prepareUniformBuffers();
+		prepareFeedback();
 		// Create a virtual texture with max. possible dimension (does not take up any VRAM yet)
 		prepareSparseTexture(8192, 8192, 1, VK_FORMAT_R8G8B8A8_UNORM);
 		setupDescriptorSetLayout();
@@ -925,6 +1362,7 @@ public:
 	{
 		if (!prepared)
 			return;
+		updateTerrain();
 		draw();
 	}
 
@@ -933,6 +1371,21 @@ public:
 		updateUniformBuffers();
 	}
 
+	// The feedback pass renders at a fraction of the window size, so its targets need to be recreated
+	virtual void windowResized()
+	{
+		// The device is idle, so all readbacks have finished, but their contents match the old size and are dropped
+		for (auto& readback : feedbackReadbacks)
+		{
+			readback.pending = false;
+		}
+		destroyFeedbackTargets();
+		prepareFeedbackTargets();
+		buildFeedbackCommandBuffers();
+		// Shows the feedback resolution
+		updateTextOverlay();
+	}
+
 	void changeLodBias(float delta)
 	{
 		uboVS.lodBias += delta;
@@ -948,104 +1401,222 @@ public:
 		updateTextOverlay();
 	}
 
-	// Clear all pages of the virtual texture
-	// todo: just for testing
-	void flushVirtualTexture()
+	// Add the blits that fill a page with the (tiled) source texture
+	// The source is repeated every page size texels at the first mip level, so each page of mip level n contains 2^n x 2^n tiles
+	void addPageBlits(const VirtualTexturePage &page, std::vector<VkImageBlit> &imageBlits)
 	{
-		vkDeviceWaitIdle(device);
-		for (auto& page : texture.pages)
+		const uint32_t scale = 1 << page.mipLevel;
+		const uint32_t tileWidth = std::max(page.extent.width / scale, 1u);
+		const uint32_t tileHeight = std::max(page.extent.height / scale, 1u);
+
+		// Use the source mip level closest to the tile size
+		uint32_t srcMipLevel = 0;
+		while ((srcMipLevel + 1 < textures.source.mipLevels) && ((textures.source.width >> (srcMipLevel + 1)) >= tileWidth))
 		{
-			page.release(device);
+			srcMipLevel++;
+		}
+
+		for (uint32_t x = 0; x < scale; x++)
+		{
+			for (uint32_t y = 0; y < scale; y++)
+			{
+				VkImageBlit blit{};
+				// Source
+				blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				blit.srcSubresource.baseArrayLayer = 0;
+				blit.srcSubresource.layerCount = 1;
+				blit.srcSubresource.mipLevel = srcMipLevel;
+				blit.srcOffsets[0] = { 0, 0, 0 };
+				blit.srcOffsets[1] = { static_cast<int32_t>(std::max(textures.source.width >> srcMipLevel, 1u)), static_cast<int32_t>(std::max(textures.source.height >> srcMipLevel, 1u)), 1 };
+				// Dest
+				blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				blit.dstSubresource.baseArrayLayer = 0;
+				blit.dstSubresource.layerCount = 1;
+				blit.dstSubresource.mipLevel = page.mipLevel;
+				blit.dstOffsets[0].x = static_cast<int32_t>(page.offset.x + x * tileWidth);
+				blit.dstOffsets[0].y = static_cast<int32_t>(page.offset.y + y * tileHeight);
+				blit.dstOffsets[0].z = 0;
+				blit.dstOffsets[1].x = static_cast<int32_t>(blit.dstOffsets[0].x + tileWidth);
+				blit.dstOffsets[1].y = static_cast<int32_t>(blit.dstOffsets[0].y + tileHeight);
+				blit.dstOffsets[1].z = 1;
+				imageBlits.push_back(blit);
+			}
 		}
-		texture.updateSparseBindInfo();
-		vkQueueBindSparse(queue, 1, &texture.bindSparseInfo, VK_NULL_HANDLE);
-		//todo: use sparse bind semaphore
-		vkQueueWaitIdle(queue);
-		lastFilledMip = texture.mipTailStart - 1;
 	}
 
-	// Fill a complete mip level
-	void fillVirtualTexture(int32_t &mipLevel)
+	// Fill the (always resident) mip tail
+	// Tiles are smaller than a texel at these levels, so the smallest source mip level (average color) is used
+	void fillMipTail()
 	{
-		vkDeviceWaitIdle(device);
-		std::default_random_engine rndEngine(std::random_device{}());
-		std::uniform_real_distribution<float> rndDist(0.0f, 1.0f);
+		VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+
+		VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.mipLevels, 0, 1 };
+		vks::tools::setImageLayout(copyCmd, texture.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+
 		std::vector<VkImageBlit> imageBlits;
-		for (auto& page : texture.pages)
+		for (uint32_t mipLevel = texture.mipTailStart; mipLevel < texture.mipLevels; mipLevel++)
+		{
+			VkImageBlit blit{};
+			blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, textures.source.mipLevels - 1, 0, 1 };
+			blit.srcOffsets[1] = { static_cast<int32_t>(std::max(textures.source.width >> (textures.source.mipLevels - 1), 1u)), static_cast<int32_t>(std::max(textures.source.height >> (textures.source.mipLevels - 1), 1u)), 1 };
+			blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mipLevel, 0, 1 };
+			blit.dstOffsets[1] = { static_cast<int32_t>(std::max(texture.width >> mipLevel, 1u)), static_cast<int32_t>(std::max(texture.height >> mipLevel, 1u)), 1 };
+			imageBlits.push_back(blit);
+		}
+		if (!imageBlits.empty())
+		{
+			vkCmdBlitImage(copyCmd, textures.source.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(imageBlits.size()), imageBlits.data(), VK_FILTER_LINEAR);
+		}
+
+		texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		vks::tools::setImageLayout(copyCmd, texture.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture.imageLayout, subresourceRange);
+
+		vulkanDevice->flushCommandBuffer(copyCmd, queue);
+	}
+
+	// Bind and unbind the changed pages and fill the newly resident ones
+	// Only the delta is passed to the sparse binding, the uploads wait for the binding via semaphore
+	void commitPageChanges(const std::vector<uint32_t> &changedPages, const std::vector<VkImageBlit> &imageBlits)
+	{
+		texture.updateSparseBindInfo(changedPages, false);
+		texture.bindSparseInfo.signalSemaphoreCount = 1;
+		texture.bindSparseInfo.pSignalSemaphores = &bindSparseSemaphore;
+		VK_CHECK_RESULT(vkQueueBindSparse(queue, 1, &texture.bindSparseInfo, VK_NULL_HANDLE));
+
+		// The previous upload is usually long done, as it has been submitted at least one frame ago
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &residencyFence, VK_TRUE, UINT64_MAX));
+		VK_CHECK_RESULT(vkResetFences(device, 1, &residencyFence));
+
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		VK_CHECK_RESULT(vkBeginCommandBuffer(residencyCmdBuffer, &cmdBufInfo));
+		VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.mipLevels, 0, 1 };
+		vks::tools::setImageLayout(residencyCmdBuffer, texture.image, VK_IMAGE_ASPECT_COLOR_BIT, texture.imageLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+		if (!imageBlits.empty())
+		{
+			vkCmdBlitImage(residencyCmdBuffer, textures.source.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(imageBlits.size()), imageBlits.data(), VK_FILTER_LINEAR);
+		}
+		vks::tools::setImageLayout(residencyCmdBuffer, texture.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture.imageLayout, subresourceRange);
+		VK_CHECK_RESULT(vkEndCommandBuffer(residencyCmdBuffer));
+
+		VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		VkSubmitInfo uploadSubmitInfo = vks::initializers::submitInfo();
+		uploadSubmitInfo.waitSemaphoreCount = 1;
+		uploadSubmitInfo.pWaitSemaphores = &bindSparseSemaphore;
+		uploadSubmitInfo.pWaitDstStageMask = &waitStageMask;
+		uploadSubmitInfo.commandBufferCount = 1;
+		uploadSubmitInfo.pCommandBuffers = &residencyCmdBuffer;
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &uploadSubmitInfo, residencyFence));
+	}
+
+	// Update the page cache with the pages requested by one feedback readback
+	// Missing pages are made resident (coarsest first), evicting the least recently used pages once the budget is exhausted
+	// Note: The base class waits for the queue to become idle at the end of each frame, so evicted pages are no longer in use by the GPU
+	void updateResidency(const uint32_t *requests, uint32_t requestCount)
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+
+		const uint64_t update = ++residencyUpdate;
+		std::vector<uint32_t> missingPages;
+		residencyStats.requestedPages = 0;
+		for (uint32_t i = 0; i < requestCount; i++)
 		{
-			if ((page.mipLevel == mipLevel) && /*(rndDist(rndEngine) < 0.5f) &&*/ (page.imageMemoryBind.memory == VK_NULL_HANDLE))
+			const uint32_t request = requests[i];
+			if (request == 0xFFFFFFFF)
+			{
+				continue;
+			}
+			uint32_t mipLevel = request >> 24;
+			uint32_t x = request & 0xFFF;
+			uint32_t y = (request >> 12) & 0xFFF;
+			// Also request all coarser pages covering the same area, so sampling can always fall back to the next resident mip level
+			for (; mipLevel < texture.mipTailStart; mipLevel++, x >>= 1, y >>= 1)
 			{
-				// Allocate page memory
-				page.allocate(device, memoryTypeIndex);
+				if ((x >= texture.mipPageCounts[mipLevel].x) || (y >= texture.mipPageCounts[mipLevel].y))
+				{
+					break;
+				}
+				VirtualTexturePage &page = texture.pages[texture.getPageIndex(mipLevel, x, y)];
+				if (page.lastRequested == update)
+				{
+					// Page and all of its parents have already been visited in this update
+					break;
+				}
+				page.lastRequested = update;
+				residencyStats.requestedPages++;
+				if (page.resident())
+				{
+					pageLRU.splice(pageLRU.begin(), pageLRU, page.lruEntry);
+				}
+				else
+				{
+					missingPages.push_back(page.index);
+				}
+			}
+		}
 
-				// Current mip level scaling
-				uint32_t scale = texture.width / (texture.width >> page.mipLevel);
+		// Coarser pages first, so there is a valid fallback as soon as possible
+		std::sort(missingPages.begin(), missingPages.end(), [this](uint32_t a, uint32_t b) { return texture.pages[a].mipLevel > texture.pages[b].mipLevel; });
+		if (missingPages.size() > maxPageUploads)
+		{
+			missingPages.resize(maxPageUploads);
+		}
 
-				for (uint32_t x = 0; x < scale; x++)
+		std::vector<uint32_t> changedPages;
+		std::vector<VkImageBlit> imageBlits;
+		residencyStats.uploadedPages = 0;
+		residencyStats.evictedPages = 0;
+		for (auto index : missingPages)
+		{
+			VirtualTexturePage &page = texture.pages[index];
+			if (texture.pagePool.freeSlots.empty())
+			{
+				// Evict the least recently used page, unless it's part of the current working set
+				if (pageLRU.empty() || (texture.pages[pageLRU.back()].lastRequested == update))
 				{
-					for (uint32_t y = 0; y < scale; y++)
-					{
-						// Image blit
-						VkImageBlit blit{};
-						// Source
-						blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-						blit.srcSubresource.baseArrayLayer = 0;
-						blit.srcSubresource.layerCount = 1;
-						blit.srcSubresource.mipLevel = 0;
-						blit.srcOffsets[0] = { 0, 0, 0 };
-						blit.srcOffsets[1] = { static_cast<int32_t>(textures.source.width), static_cast<int32_t>(textures.source.height), 1 };
-						// Dest
-						blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-						blit.dstSubresource.baseArrayLayer = 0;
-						blit.dstSubresource.layerCount = 1;
-						blit.dstSubresource.mipLevel = page.mipLevel;
-						blit.dstOffsets[0].x = static_cast<int32_t>(page.offset.x + x * 128 / scale);
-						blit.dstOffsets[0].y = static_cast<int32_t>(page.offset.y + y * 128 / scale);
-						blit.dstOffsets[0].z = 0;
-						blit.dstOffsets[1].x = static_cast<int32_t>(blit.dstOffsets[0].x + page.extent.width / scale);
-						blit.dstOffsets[1].y = static_cast<int32_t>(blit.dstOffsets[0].y + page.extent.height / scale);
-						blit.dstOffsets[1].z = 1;
-
-						imageBlits.push_back(blit);
-					}
+					break;
 				}
+				VirtualTexturePage &evictedPage = texture.pages[pageLRU.back()];
+				pageLRU.pop_back();
+				evictedPage.release(texture.pagePool);
+				changedPages.push_back(evictedPage.index);
+				residencyStats.evictedPages++;
 			}
+			page.allocate(texture.pagePool);
+			pageLRU.push_front(index);
+			page.lruEntry = pageLRU.begin();
+			changedPages.push_back(index);
+			addPageBlits(page, imageBlits);
+			residencyStats.uploadedPages++;
 		}
 
-		// Update sparse queue binding
-		texture.updateSparseBindInfo();
-		vkQueueBindSparse(queue, 1, &texture.bindSparseInfo, VK_NULL_HANDLE);
-		//todo: use sparse bind semaphore
-		vkQueueWaitIdle(queue);
+		if (!changedPages.empty())
+		{
+			commitPageChanges(changedPages, imageBlits);
+		}
 
-		// Issue blit commands
-		if (imageBlits.size() > 0)
+		auto tEnd = std::chrono::high_resolution_clock::now();
+		residencyStats.updateTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		if (residencyStats.uploadedPages + residencyStats.evictedPages > 0)
 		{
-			auto tStart = std::chrono::high_resolution_clock::now();
-
-			VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-			vkCmdBlitImage(
-				copyCmd,
-				textures.source.image,
-				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				texture.image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				static_cast<uint32_t>(imageBlits.size()),
-				imageBlits.data(),
-				VK_FILTER_LINEAR
-			);
-
-			vulkanDevice->flushCommandBuffer(copyCmd, queue);
-
-			auto tEnd = std::chrono::high_resolution_clock::now();
-			auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-			std::cout << "Image blits took " << tDiff << " ms" << std::endl;
+			updateTextOverlay();
 		}
+	}
 
+	// Evict all pages of the virtual texture (the mip tail stays resident)
+	void flushVirtualTexture()
+	{
+		vkDeviceWaitIdle(device);
+		std::vector<uint32_t> changedPages;
+		for (auto index : pageLRU)
+		{
+			texture.pages[index].release(texture.pagePool);
+			changedPages.push_back(index);
+		}
+		pageLRU.clear();
+		texture.updateSparseBindInfo(changedPages, false);
+		vkQueueBindSparse(queue, 1, &texture.bindSparseInfo, VK_NULL_HANDLE);
 		vkQueueWaitIdle(queue);
-
-		mipLevel--;
+		updateTextOverlay();
 	}
 
 	virtual void keyPressed(uint32_t keyCode)
@@ -1061,30 +1632,36 @@ public:
 			changeLodBias(-0.1f);
 			break;
 		case KEY_F:
+		case GAMEPAD_BUTTON_A:
 			flushVirtualTexture();
 			break;
-		case KEY_N:
-			if (lastFilledMip >= 0)
-			{
-				fillVirtualTexture(lastFilledMip);
-			}
-			break;
 		}
 	}
 
 	virtual void getOverlayText(VulkanTextOverlay *textOverlay)
 	{
-		uint32_t respages = 0;
-		std::for_each(texture.pages.begin(), texture.pages.end(), [&respages](VirtualTexturePage page) { respages += (page.imageMemoryBind.memory != VK_NULL_HANDLE) ? 1 :0; });
+		const uint32_t residentPages = texture.pagePool.pageCount - static_cast<uint32_t>(texture.pagePool.freeSlots.size());
 		std::stringstream ss;
 		ss << std::setprecision(2) << std::fixed << uboVS.lodBias;
 #if defined(__ANDROID__)
-//		textOverlay->addText("LOD bias: " + ss.str() + " (Buttons L1/R1 to change)", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("LOD bias: " + ss.str() + " (Buttons L1/R1 to change)", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("\"Button A\" to evict all pages", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
 #else
-		//textOverlay->addText("LOD bias: " + ss.str() + " (numpad +/- to change)", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
-		textOverlay->addText("Resident pages: " + std::to_string(respages) + " / " + std::to_string(texture.pages.size()), 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
-		textOverlay->addText("\"n\" to fill next mip level (" + std::to_string(lastFilledMip) + ")", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("LOD bias: " + ss.str() + " (numpad +/- to change)", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("\"f\" to evict all pages", 5.0f, 100.0f, VulkanTextOverlay::alignLeft);
 #endif
+		textOverlay->addText("Resident pages: " + std::to_string(residentPages) + " / " + std::to_string(pageBudget) + " (" + std::to_string(texture.pages.size()) + " virtual)", 5.0f, 115.0f, VulkanTextOverlay::alignLeft);
+		ss.str("");
+		ss << "Last update: " << residencyStats.requestedPages << " requested, " << residencyStats.uploadedPages << " uploaded, " << residencyStats.evictedPages << " evicted (" << residencyStats.updateTime << " ms)";
+		textOverlay->addText(ss.str(), 5.0f, 130.0f, VulkanTextOverlay::alignLeft);
+		textOverlay->addText("Feedback: " + std::to_string(feedback.width) + " x " + std::to_string(feedback.height), 5.0f, 145.0f, VulkanTextOverlay::alignLeft);
+		ss.str("");
+		ss << "Terrain: " << terrain->stats.drawnChunks << " chunks (" << terrain->stats.triangles / 1000 << "k tris), " << terrain->stats.residentChunks << " / " << terrain->settings.maxResidentChunks << " resident, " << terrain->stats.pendingChunks << " streaming";
+		textOverlay->addText(ss.str(), 5.0f, 160.0f, VulkanTextOverlay::alignLeft);
+		if (tiledHeightSource)
+		{
+			textOverlay->addText("Height tiles: " + std::to_string(tiledHeightSource->getCachedTileCount()) + " / " + std::to_string(tiledHeightSource->getMaxCachedTiles()) + " cached, " + std::to_string(tiledHeightSource->getLoadedTileCount()) + " loaded", 5.0f, 175.0f, VulkanTextOverlay::alignLeft);
+		}
 	}
 };
 
@@ -15,6 +15,8 @@
 #include <string.h>
 #include <assert.h>
 #include <vector>
+#include <algorithm>
+#include <sstream>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -26,6 +28,7 @@
 #include "vulkanexamplebase.h"
 #include "VulkanTexture.hpp"
 #include "VulkanModel.hpp"
+#include "drawlist.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -46,18 +49,23 @@ public:
 	{
 		vks::Model model;
 		VkPipeline *pipeline;
+		// Sort key of the model's draw, models sharing a pipeline are drawn next to each other
+		uint64_t sortKey;
 
-		void draw(VkCommandBuffer cmdBuffer)
+		vks::DrawList::DrawPacket getDrawPacket()
 		{
-			VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, *pipeline);
-			vkCmdBindVertexBuffers(cmdBuffer, VERTEX_BUFFER_BIND_ID, 1, &model.vertices.buffer, offsets);
-			vkCmdBindIndexBuffer(cmdBuffer, model.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(cmdBuffer, model.indexCount, 1, 0, 0, 0);
+			vks::DrawList::DrawPacket packet;
+			packet.pipeline = *pipeline;
+			packet.vertexBuffer = model.vertices.buffer;
+			packet.vertexBinding = VERTEX_BUFFER_BIND_ID;
+			packet.indexBuffer = model.indices.buffer;
+			packet.indexCount = model.indexCount;
+			return packet;
 		}
 	};
 
 	std::vector<DemoModel> demoModels;
+	vks::DrawList drawList;
 
 	struct {
 		vks::Buffer meshVS;
@@ -125,6 +133,10 @@ public:
 		for (auto i = 0; i < modelFiles.size(); i++) {
 			DemoModel model;
 			model.pipeline = modelPipelines[i];
+			// The skybox doesn't write depth and is drawn in a separate pass after all other models
+			const bool skybox = (model.pipeline == &pipelines.skybox);
+			const uint32_t pipelineId = static_cast<uint32_t>(std::find(modelPipelines.begin(), modelPipelines.end(), model.pipeline) - modelPipelines.begin());
+			model.sortKey = vks::DrawList::makeKey(skybox ? 1 : 0, pipelineId, 0, 0.0f);
 			vks::ModelCreateInfo modelCreateInfo(glm::vec3(1.0f), glm::vec3(1.0f), glm::vec3(0.0f));
 			if (modelFiles[i] != "cube.obj") {
 				modelCreateInfo.center.y += 1.15f;
@@ -153,6 +165,12 @@ public:
 		renderPassBeginInfo.clearValueCount = 2;
 		renderPassBeginInfo.pClearValues = clearValues;
 
+		drawList.clear();
+		for (auto &model : demoModels) {
+			drawList.add(model.sortKey, model.getDrawPacket());
+		}
+		drawList.sort();
+
 		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
 		{
 			renderPassBeginInfo.framebuffer = frameBuffers[i];
@@ -169,10 +187,8 @@ public:
 
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
 
-			VkDeviceSize offsets[1] = { 0 };
-			for (auto model : demoModels) {
-				model.draw(drawCmdBuffers[i]);
-			}
+			// The global descriptor set is bound once above, the draw list only binds the per-model state
+			drawList.record(drawCmdBuffers[i]);
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
@@ -444,6 +460,14 @@ public:
 		updateUniformBuffers();
 	}
 
+	virtual void getOverlayText(VulkanTextOverlay *textOverlay)
+	{
+		const vks::DrawList::Statistics &stats = drawList.getStatistics();
+		std::stringstream ss;
+		ss << stats.draws << " draws, " << stats.pipelineBinds << " pipeline binds, " << stats.vertexBufferBinds << " vertex buffer binds (" << stats.redundantChanges << " redundant skipped)";
+		textOverlay->addText(ss.str(), 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+	}
+
 };
 
 VULKAN_EXAMPLE_MAIN()
\ No newline at end of file